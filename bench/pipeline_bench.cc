@@ -0,0 +1,274 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+//
+// Benchmark of real pipeline stages. FILE is pushed in chunks through
+// pipelines built by create_pipeline() exactly as body_filter does it:
+// DumpHandler alone, EncodingHandler with both VCDIFF encoders, and with
+// CacheStoreHandler, DeflateHandler and all of them together. Output goes
+// to a body filter which only counts bytes. Prints MB/s of FILE and time
+// per chunk for every pipeline.
+//
+//   pipeline_bench DICTIONARY FILE [CHUNK [ROUNDS]]
+//
+// Stages need nginx, so it links with objects of nginx tree configured
+// and built with the module. main() of nginx is renamed away:
+//
+//   objcopy --redefine-sym main=ngx_main $NGX/objs/src/core/nginx.o nginx.o
+//   g++ -O2 -I. -I$NGX/objs -I$NGX/src/core -I$NGX/src/event
+//       -I$NGX/src/event/modules -I$NGX/src/os/unix -I$NGX/src/http
+//       -I$NGX/src/http/modules -o pipeline_bench bench/pipeline_bench.cc
+//       nginx.o $(find $NGX/objs -name '*.o' ! -name nginx.o)
+//       <libraries from link line of $NGX/objs/Makefile>
+
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+}
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "sdch_cache.h"
+#include "sdch_config.h"
+#include "sdch_dictionary.h"
+#include "sdch_handler.h"
+#include "sdch_main_config.h"
+#include "sdch_module.h"
+#include "sdch_pipeline.h"
+#include "sdch_pool_alloc.h"
+#include "sdch_request_context.h"
+
+namespace sdch {
+namespace {
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+bool read_file(const char* fn, std::string* res) {
+  std::ifstream in(fn, std::ios::binary);
+  if (!in)
+    return false;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  *res = ss.str();
+  return true;
+}
+
+uint64_t output_bytes;
+
+// Stands for the rest of nginx filters: takes everything at once.
+ngx_int_t count_body(ngx_http_request_t* r, ngx_chain_t* in) {
+  for (ngx_chain_t* cl = in; cl; cl = cl->next) {
+    output_bytes += ngx_buf_size(cl->buf);
+    cl->buf->pos = cl->buf->last;
+  }
+  return NGX_OK;
+}
+
+// What ngx_init_cycle does for sdch_cache_zone, in process memory.
+Cache* create_cache(ngx_cycle_t* cycle, size_t size) {
+  ngx_conf_t cf;
+  ngx_memzero(&cf, sizeof(cf));
+  cf.cycle = cycle;
+  cf.pool = cycle->pool;
+  cf.log = cycle->log;
+  ngx_str_t name = ngx_string("bench");
+  Cache* cache = Cache::create(&cf, &name, size);
+  if (cache == NULL)
+    return NULL;
+
+  ngx_shm_zone_t* zone =
+      static_cast<ngx_shm_zone_t*>(cycle->shared_memory.part.elts);
+  zone->shm.addr = static_cast<u_char*>(ngx_alloc(size, cycle->log));
+  if (zone->shm.addr == NULL)
+    return NULL;
+
+  ngx_slab_pool_t* sp = reinterpret_cast<ngx_slab_pool_t*>(zone->shm.addr);
+  sp->end = zone->shm.addr + size;
+  sp->min_shift = 3;
+  sp->addr = zone->shm.addr;
+  if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK)
+    return NULL;
+  ngx_slab_init(sp);
+
+  return zone->init(zone, NULL) == NGX_OK ? cache : NULL;
+}
+
+struct Bench {
+  const char* name;
+  ngx_uint_t encoder;
+  bool dump;
+  bool cache;
+  bool gzip;
+};
+
+const Bench benches[] = {
+  { "dump", ENCODER_VCDIFF, true, false, false },
+  { "vcdiff", ENCODER_VCDIFF, false, false, false },
+  { "simd", ENCODER_SIMD, false, false, false },
+  { "simd cache", ENCODER_SIMD, false, true, false },
+  { "simd gzip", ENCODER_SIMD, false, false, true },
+  { "dump simd cache gzip", ENCODER_SIMD, true, true, true },
+};
+
+// One response through pipeline. Pool of request is destroyed with it.
+bool run(ngx_http_request_t* r, ngx_log_t* log, const Bench& b,
+         Dictionary* dict, Cache* cache, unsigned round,
+         const std::string& body, size_t chunk) {
+  r->pool = ngx_create_pool(16384, log);
+  if (r->pool == NULL)
+    return false;
+
+  RequestContext* ctx = POOL_ALLOC(r, RequestContext, r);
+  if (ctx == NULL)
+    return false;
+
+  PipelineSpec spec;
+  spec.next_body = count_body;
+  spec.dump = b.dump;
+  if (b.name != std::string("dump")) {
+    spec.dict = dict;
+    spec.encoder = b.encoder;
+  }
+  if (b.cache) {
+    // Every round is a miss, as if ETag changed.
+    char etag[32];
+    ngx_str_t e = { size_t(snprintf(etag, sizeof(etag), "\"%u\"", round)),
+                    reinterpret_cast<u_char*>(etag) };
+    ngx_str_t host = ngx_string("example.com");
+    Cache::make_key(dict, b.encoder, host, r->unparsed_uri, e,
+                          &spec.cache_key);
+    spec.cache = cache;
+  }
+  if (b.gzip) {
+    spec.gzip = true;
+    spec.gzip_level = 1;
+    spec.gzip_wbits = 15;
+  }
+
+  Handler* h = create_pipeline(ctx, spec);
+  bool ok = h != NULL && h->init(ctx);
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(body.data());
+  for (size_t off = 0; ok && off < body.size(); off += chunk) {
+    size_t len = std::min(chunk, body.size() - off);
+    ok = h->on_data(p + off, len) != NGX_ERROR;
+  }
+  ok = ok && h->on_finish() != NGX_ERROR;
+
+  ngx_destroy_pool(r->pool);
+  return ok;
+}
+
+}  // namespace
+}  // namespace sdch
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "usage: pipeline_bench DICTIONARY FILE [CHUNK [ROUNDS]]\n");
+    return 2;
+  }
+  using namespace sdch;
+  size_t chunk = argc > 3 ? strtoul(argv[3], NULL, 10) : 8192;
+  unsigned rounds = argc > 4 ? strtoul(argv[4], NULL, 10) : 100;
+
+  // Bits of ngx_os_init() and ngx_init_cycle() stages rely on.
+  ngx_time_init();
+  ngx_pagesize = getpagesize();
+  for (ngx_uint_t n = ngx_pagesize; n >>= 1; ngx_pagesize_shift++) {}
+  ngx_slab_sizes_init();
+
+  static ngx_open_file_t log_file;
+  static ngx_log_t log;
+  log_file.fd = ngx_stderr;
+  log.file = &log_file;
+  log.log_level = NGX_LOG_WARN;
+
+  // DumpQueue arms timer to publish segments.
+  ngx_queue_init(&ngx_posted_events);
+  ngx_event_timer_init(&log);
+
+  ngx_pool_t* pool = ngx_create_pool(16384, &log);
+  ngx_cycle_t* cycle =
+      static_cast<ngx_cycle_t*>(ngx_pcalloc(pool, sizeof(ngx_cycle_t)));
+  if (pool == NULL || cycle == NULL ||
+      ngx_list_init(&cycle->shared_memory, pool, 1, sizeof(ngx_shm_zone_t))
+          != NGX_OK) {
+    return 1;
+  }
+  cycle->pool = pool;
+  cycle->log = &log;
+  ngx_cycle = cycle;
+
+  Dictionary dict;
+  std::string body;
+  if (!dict.load(argv[1]) || !read_file(argv[2], &body) || body.empty()) {
+    fprintf(stderr, "pipeline_bench: can't read %s or %s\n", argv[1],
+            argv[2]);
+    return 1;
+  }
+
+  // Module configuration as create_*_conf and merge_loc_conf leave it.
+  sdch_module.ctx_index = 0;
+  MainConfig* main = POOL_ALLOC(pool, MainConfig);
+  Config* conf = POOL_ALLOC(pool, Config, pool);
+  Cache* cache = create_cache(cycle, 64 * 1024 * 1024);
+  char dumpdir[] = "/tmp/pipeline_bench.XXXXXX";
+  if (main == NULL || conf == NULL || cache == NULL ||
+      mkdtemp(dumpdir) == NULL) {
+    fprintf(stderr, "pipeline_bench: setup failed\n");
+    return 1;
+  }
+  main->dump_queue.set_segment(64 * 1024 * 1024, 600, false);
+  conf->bufs.num = 4;
+  conf->bufs.size = 16384;
+  conf->sdch_dumpdir.data = reinterpret_cast<u_char*>(dumpdir);
+  conf->sdch_dumpdir.len = strlen(dumpdir);
+
+  void* main_conf[1] = { main };
+  void* loc_conf[1] = { conf };
+  void* ctx[1] = { NULL };
+  ngx_connection_t c;
+  ngx_memzero(&c, sizeof(c));
+  c.log = &log;
+  ngx_http_request_t r;
+  ngx_memzero(&r, sizeof(r));
+  r.main = &r;
+  r.connection = &c;
+  r.main_conf = main_conf;
+  r.loc_conf = loc_conf;
+  r.ctx = ctx;
+  ngx_str_set(&r.unparsed_uri, "/bench");
+
+  printf("%s: %zu bytes in %zu byte chunks, %u rounds, dumps in %s\n",
+         argv[2], body.size(), chunk, rounds, dumpdir);
+  for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); ++b) {
+    output_bytes = 0;
+    double start = now();
+    for (unsigned i = 0; i < rounds; ++i) {
+      if (!run(&r, &log, benches[b], &dict, cache, i, body, chunk)) {
+        fprintf(stderr, "pipeline_bench: %s failed\n", benches[b].name);
+        return 1;
+      }
+    }
+    double t = now() - start;
+    size_t chunks = (body.size() + chunk - 1) / chunk * rounds;
+    printf("%-22s %8.1f MB/s %8.0f ns/chunk %10llu bytes out\n",
+           benches[b].name, body.size() * double(rounds) / t / 1e6,
+           t * 1e9 / chunks,
+           static_cast<unsigned long long>(output_bytes / rounds));
+  }
+
+  return 0;
+}
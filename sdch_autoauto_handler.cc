@@ -9,54 +9,54 @@
 
 namespace sdch {
 
-AutoautoHandler::AutoautoHandler(RequestContext* ctx, Handler* next)
-    : Handler(next), ctx_(ctx) {
-  // TODO
-}
-
-AutoautoHandler::~AutoautoHandler() {}
+void store_quasidict(RequestContext* ctx, const std::vector<char>& blob,
+                     const ngx_str_t& version_key, size_t versions) {
+  if (blob.empty()) {
+    ngx_log_error(NGX_LOG_ERR,
+                  ctx->request->connection->log,
+                  0,
+                  "storing quasidict: no blob");
+    return;
+  }
 
-bool AutoautoHandler::init(RequestContext* ctx) {
-  return true;
-}
+  ScopedTimer timer(&ctx->phase_ns[PHASE_AUTOAUTO]);
 
-ngx_int_t AutoautoHandler::on_data(const uint8_t* buf, size_t len) {
-  blob_.insert(blob_.end(), buf, buf + len);
+  MainConfig* main = MainConfig::get(ctx->request);
+  size_t evictions = main->fastdict_factory.evictions();
+  Dictionary* dict =
+      main->fastdict_factory.create_dictionary(
+          blob.data(), blob.size(),
+          std::string(reinterpret_cast<const char*>(ctx->group.data),
+                      ctx->group.len));
 
-  if (next_)
-    return next_->on_data(buf, len);
-  return NGX_OK;
-}
+  if (main->stats != NULL && dict != NULL) {
+    main->stats->add(Stats::QUASI_STORES);
+    main->stats->add(Stats::QUASI_EVICTIONS,
+                     main->fastdict_factory.evictions() - evictions);
+  }
 
-ngx_int_t AutoautoHandler::on_finish() {
-  if (blob_.empty()) {
-    ngx_log_error(NGX_LOG_ERR,
-                  ctx_->request->connection->log,
+  if (dict) {
+    Dictionary::id_t client_id = dict->client_id();
+    ngx_log_error(NGX_LOG_DEBUG,
+                  ctx->request->connection->log,
                   0,
-                  "storing quasidict: no blob");
-  } else {
-    MainConfig* main = MainConfig::get(ctx_->request);
-    Dictionary* dict =
-        main->fastdict_factory.create_dictionary(blob_.data(), blob_.size());
-
-    if (dict) {
-      Dictionary::id_t client_id = dict->client_id();
-      ngx_log_error(NGX_LOG_DEBUG,
-                    ctx_->request->connection->log,
-                    0,
-                    "storing quasidict %*s (%d)",
-                    client_id.size(), client_id.data(),
-                    blob_.size());
-    } else {
-      ngx_log_error(NGX_LOG_ERR,
-                    ctx_->request->connection->log,
-                    0,
-                    "failed storing quasidict (%d)",
-                    blob_.size());
+                  "storing quasidict %*s (%d)",
+                  client_id.size(), client_id.data(),
+                  blob.size());
+
+    if (version_key.len) {
+      main->version_index.add(
+          std::string(reinterpret_cast<const char*>(version_key.data),
+                      version_key.len),
+          client_id, versions, &main->fastdict_factory);
     }
+  } else {
+    ngx_log_error(NGX_LOG_ERR,
+                  ctx->request->connection->log,
+                  0,
+                  "failed storing quasidict (%d)",
+                  blob.size());
   }
-
-  return next_->on_finish();
 }
 
 }  // namespace sdch
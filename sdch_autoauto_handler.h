@@ -7,26 +7,48 @@
 #include <vector>
 
 #include "sdch_handler.h"
+#include "sdch_probes.h"
+#include "sdch_request_context.h"
 
 namespace sdch {
 
-class RequestContext;
+// Create quasi-dictionary from the blob and store it in FastdictFactory.
+// Register it in VersionIndex if version_key is not empty.
+void store_quasidict(RequestContext* ctx, const std::vector<char>& blob,
+                     const ngx_str_t& version_key, size_t versions);
 
 // Create YaSDCH dictionary 
-class AutoautoHandler : public Handler {
+template <typename Next>
+class AutoautoHandler {
  public:
-  AutoautoHandler(RequestContext* ctx, Handler* next);
-  ~AutoautoHandler();
+  AutoautoHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : next_(ctx, spec), ctx_(ctx), version_key_(spec.version_key),
+        versions_(spec.versions) {}
 
-  virtual bool init(RequestContext* ctx);
+  bool init(RequestContext* ctx) { return next_.init(ctx); }
 
-  virtual ngx_int_t on_data(const uint8_t* buf, size_t len);
-  virtual ngx_int_t on_finish();
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    SDCH_PROBE3(autoauto_data, ctx_->request, buf, len);
+    blob_.insert(blob_.end(), buf, buf + len);
+    return next_.on_data(buf, len);
+  }
+
+  ngx_int_t on_finish() {
+    SDCH_PROBE1(autoauto_finish, ctx_->request);
+    store_quasidict(ctx_, blob_, version_key_, versions_);
+    return next_.on_finish();
+  }
 
  private:
+  Next next_;
+
   // Keep context. For logging purpose mostly.
   RequestContext* ctx_;
 
+  // "sdch_delta" URL. Allocated from request pool.
+  ngx_str_t version_key_;
+  size_t versions_;
+
   // FastdictFactory for data passing by. We'll create actual dictionary in on_finish
   std::vector<char> blob_;
 };
@@ -35,4 +57,3 @@ class AutoautoHandler : public Handler {
 }  // namespace sdch
 
 #endif  // SDCH_AUTOAUTO_HANDLER_H_
-
@@ -0,0 +1,238 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_cache.h"
+
+#include <openssl/sha.h>
+
+#include "sdch_dictionary.h"
+#include "sdch_module.h"
+#include "sdch_pool_alloc.h"
+
+namespace sdch {
+
+// Lives in shared memory.
+struct Cache::Shared {
+  ngx_rbtree_t rbtree;
+  ngx_rbtree_node_t sentinel;
+  // Most recently used first.
+  ngx_queue_t lru;
+  Stats stats;
+};
+
+struct Cache::Node {
+  // node.key is the beginning of key.
+  ngx_rbtree_node_t node;
+  ngx_queue_t queue;
+  CacheKey key;
+  size_t len;
+  u_char data[1];
+};
+
+Cache* Cache::create(ngx_conf_t* cf, ngx_str_t* name, size_t size) {
+  ngx_shm_zone_t* zone = ngx_shared_memory_add(cf, name, size, &sdch_module);
+  if (zone == NULL)
+    return NULL;
+
+  if (zone->data) {
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "duplicate sdch_cache_zone \"%V\"", name);
+    return NULL;
+  }
+
+  Cache* cache = POOL_ALLOC(cf, Cache);
+  if (cache == NULL)
+    return NULL;
+
+  cache->size_ = size;
+  zone->init = init_zone;
+  zone->data = cache;
+  return cache;
+}
+
+ngx_int_t Cache::init_zone(ngx_shm_zone_t* zone, void* data) {
+  Cache* cache = static_cast<Cache*>(zone->data);
+  Cache* old = static_cast<Cache*>(data);
+
+  // Reload. Keep cached entries.
+  if (old) {
+    cache->shpool_ = old->shpool_;
+    cache->sh_ = old->sh_;
+    return NGX_OK;
+  }
+
+  cache->shpool_ = reinterpret_cast<ngx_slab_pool_t*>(zone->shm.addr);
+
+  if (zone->shm.exists) {
+    cache->sh_ = static_cast<Shared*>(cache->shpool_->data);
+    return NGX_OK;
+  }
+
+  cache->sh_ = static_cast<Shared*>(
+      ngx_slab_calloc(cache->shpool_, sizeof(Shared)));
+  if (cache->sh_ == NULL)
+    return NGX_ERROR;
+
+  cache->shpool_->data = cache->sh_;
+
+  ngx_rbtree_init(&cache->sh_->rbtree, &cache->sh_->sentinel, insert_value);
+  ngx_queue_init(&cache->sh_->lru);
+
+  return NGX_OK;
+}
+
+void Cache::insert_value(ngx_rbtree_node_t* temp,
+                         ngx_rbtree_node_t* node,
+                         ngx_rbtree_node_t* sentinel) {
+  ngx_rbtree_node_t** p;
+
+  for (;;) {
+    if (node->key != temp->key) {
+      p = (node->key < temp->key) ? &temp->left : &temp->right;
+    } else {
+      Node* n = reinterpret_cast<Node*>(node);
+      Node* t = reinterpret_cast<Node*>(temp);
+      p = (ngx_memcmp(n->key.data, t->key.data, sizeof(n->key.data)) < 0)
+              ? &temp->left
+              : &temp->right;
+    }
+
+    if (*p == sentinel)
+      break;
+
+    temp = *p;
+  }
+
+  *p = node;
+  node->parent = temp;
+  node->left = sentinel;
+  node->right = sentinel;
+  ngx_rbt_red(node);
+}
+
+void Cache::make_key(const Dictionary* dict,
+                     ngx_uint_t encoder,
+                     const ngx_str_t& host,
+                     const ngx_str_t& uri,
+                     const ngx_str_t& etag,
+                     CacheKey* key) {
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, dict->server_id().data(), dict->server_id().size());
+  SHA256_Update(&ctx, &encoder, sizeof(encoder));
+  // Lengths keep host, uri and etag from running into each other.
+  SHA256_Update(&ctx, &host.len, sizeof(host.len));
+  SHA256_Update(&ctx, host.data, host.len);
+  SHA256_Update(&ctx, &uri.len, sizeof(uri.len));
+  SHA256_Update(&ctx, uri.data, uri.len);
+  SHA256_Update(&ctx, etag.data, etag.len);
+  SHA256_Final(key->data, &ctx);
+}
+
+Cache::Node* Cache::find(const CacheKey& key) {
+  ngx_rbtree_key_t hash;
+  ngx_memcpy(&hash, key.data, sizeof(hash));
+
+  ngx_rbtree_node_t* node = sh_->rbtree.root;
+  ngx_rbtree_node_t* sentinel = sh_->rbtree.sentinel;
+
+  while (node != sentinel) {
+    if (hash != node->key) {
+      node = (hash < node->key) ? node->left : node->right;
+      continue;
+    }
+
+    Node* n = reinterpret_cast<Node*>(node);
+    int rc = ngx_memcmp(key.data, n->key.data, sizeof(key.data));
+    if (rc == 0)
+      return n;
+
+    node = (rc < 0) ? node->left : node->right;
+  }
+
+  return NULL;
+}
+
+bool Cache::lookup(const CacheKey& key, ngx_pool_t* pool, ngx_str_t* out) {
+  ngx_shmtx_lock(&shpool_->mutex);
+
+  Node* n = find(key);
+  if (n == NULL) {
+    ++sh_->stats.misses;
+    ngx_shmtx_unlock(&shpool_->mutex);
+    return false;
+  }
+
+  ngx_queue_remove(&n->queue);
+  ngx_queue_insert_head(&sh_->lru, &n->queue);
+
+  // Entry can be evicted by other worker as soon as lock is released.
+  out->data = static_cast<u_char*>(ngx_pnalloc(pool, n->len));
+  if (out->data != NULL) {
+    out->len = n->len;
+    ngx_memcpy(out->data, n->data, n->len);
+    ++sh_->stats.hits;
+  } else {
+    ++sh_->stats.misses;
+  }
+
+  ngx_shmtx_unlock(&shpool_->mutex);
+  return out->data != NULL;
+}
+
+bool Cache::evict_one() {
+  if (ngx_queue_empty(&sh_->lru))
+    return false;
+
+  ngx_queue_t* q = ngx_queue_last(&sh_->lru);
+  Node* n = ngx_queue_data(q, Node, queue);
+
+  ngx_queue_remove(q);
+  ngx_rbtree_delete(&sh_->rbtree, &n->node);
+  ngx_slab_free_locked(shpool_, n);
+  ++sh_->stats.evictions;
+  return true;
+}
+
+void Cache::store(const CacheKey& key, const u_char* data, size_t len) {
+  if (len > max_entry_size())
+    return;
+
+  ngx_shmtx_lock(&shpool_->mutex);
+
+  // Other worker was faster.
+  if (find(key) != NULL) {
+    ngx_shmtx_unlock(&shpool_->mutex);
+    return;
+  }
+
+  size_t size = offsetof(Node, data) + len;
+  Node* n = static_cast<Node*>(ngx_slab_alloc_locked(shpool_, size));
+  while (n == NULL && evict_one())
+    n = static_cast<Node*>(ngx_slab_alloc_locked(shpool_, size));
+
+  if (n == NULL) {
+    ngx_shmtx_unlock(&shpool_->mutex);
+    return;
+  }
+
+  ngx_memcpy(&n->node.key, key.data, sizeof(n->node.key));
+  n->key = key;
+  n->len = len;
+  ngx_memcpy(n->data, data, len);
+
+  ngx_rbtree_insert(&sh_->rbtree, &n->node);
+  ngx_queue_insert_head(&sh_->lru, &n->queue);
+  ++sh_->stats.stores;
+
+  ngx_shmtx_unlock(&shpool_->mutex);
+}
+
+Cache::Stats Cache::stats() const {
+  ngx_shmtx_lock(&shpool_->mutex);
+  Stats res = sh_->stats;
+  ngx_shmtx_unlock(&shpool_->mutex);
+  return res;
+}
+
+}  // namespace sdch
@@ -0,0 +1,93 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_CACHE_H_
+#define SDCH_CACHE_H_
+
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+}
+
+namespace sdch {
+
+class Dictionary;
+
+// SHA-256 of everything encoded output depends on.
+struct CacheKey {
+  u_char data[32];
+};
+
+// Value of $sdch_cache_status.
+enum CacheStatus {
+  CACHE_NONE,    // sdch_cache off or nothing encoded
+  CACHE_BYPASS,  // Response can't be cached. E.g. no strong ETag
+  CACHE_MISS,
+  CACHE_HIT,
+};
+
+// Encoded responses in shared memory zone ("sdch_cache_zone"). Entries
+// are kept in rbtree by key and evicted in LRU order when slab is full.
+//
+// Object itself lives in configuration pool of every worker and is
+// attached to ngx_shm_zone_t as data.
+class Cache {
+ public:
+  struct Stats {
+    ngx_uint_t hits;
+    ngx_uint_t misses;
+    ngx_uint_t stores;
+    ngx_uint_t evictions;
+  };
+
+  // Add zone of size bytes. Called by "sdch_cache_zone".
+  static Cache* create(ngx_conf_t* cf, ngx_str_t* name, size_t size);
+
+  // Cache attached to zone. NULL if zone wasn't defined.
+  static Cache* get(ngx_shm_zone_t* zone) {
+    return static_cast<Cache*>(zone->data);
+  }
+
+  // Key of response with strong etag at uri of host encoded by encoder
+  // with dict. Virtual servers share zone.
+  static void make_key(const Dictionary* dict,
+                       ngx_uint_t encoder,
+                       const ngx_str_t& host,
+                       const ngx_str_t& uri,
+                       const ngx_str_t& etag,
+                       CacheKey* key);
+
+  // Copy cached output into pool. Returns false on miss.
+  bool lookup(const CacheKey& key, ngx_pool_t* pool, ngx_str_t* out);
+
+  // Store output. Evicts least recently used entries to make room.
+  void store(const CacheKey& key, const u_char* data, size_t len);
+
+  // Bigger outputs aren't cached. So a single response can't flush the
+  // whole zone.
+  size_t max_entry_size() const { return size_ / 8; }
+
+  Stats stats() const;
+
+ private:
+  struct Shared;
+  struct Node;
+
+  static ngx_int_t init_zone(ngx_shm_zone_t* zone, void* data);
+  static void insert_value(ngx_rbtree_node_t* temp,
+                           ngx_rbtree_node_t* node,
+                           ngx_rbtree_node_t* sentinel);
+
+  Node* find(const CacheKey& key);
+  bool evict_one();
+
+  size_t size_;
+  ngx_slab_pool_t* shpool_;
+  Shared* sh_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_CACHE_H_
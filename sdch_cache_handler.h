@@ -0,0 +1,92 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_CACHE_HANDLER_H_
+#define SDCH_CACHE_HANDLER_H_
+
+#include <string>
+
+#include "sdch_cache.h"
+#include "sdch_handler.h"
+#include "sdch_probes.h"
+#include "sdch_request_context.h"
+
+namespace sdch {
+
+// Collects encoded output and stores it into spec.cache when response is
+// complete. Placed after encoding stage.
+template <typename Next>
+class CacheStoreHandler {
+ public:
+  CacheStoreHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : next_(ctx, spec),
+        ctx_(ctx),
+        cache_(spec.cache),
+        key_(spec.cache_key),
+        overflow_(false) {}
+
+  bool init(RequestContext* ctx) { return next_.init(ctx); }
+
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    SDCH_PROBE3(cache_store_data, ctx_->request, buf, len);
+    if (!overflow_) {
+      if (output_.size() + len > cache_->max_entry_size()) {
+        overflow_ = true;
+        std::string().swap(output_);
+      } else {
+        output_.append(reinterpret_cast<const char*>(buf), len);
+      }
+    }
+
+    return next_.on_data(buf, len);
+  }
+
+  ngx_int_t on_finish() {
+    SDCH_PROBE1(cache_store_finish, ctx_->request);
+    if (!overflow_)
+      cache_->store(key_, reinterpret_cast<const u_char*>(output_.data()),
+                    output_.size());
+    return next_.on_finish();
+  }
+
+ private:
+  Next next_;
+  RequestContext* ctx_;
+  Cache* cache_;
+  CacheKey key_;
+  std::string output_;
+  bool overflow_;
+};
+
+// Sends spec.cached instead of encoding response. Replaces encoding stage
+// on cache hit. Response body is still read, but only to be dropped.
+template <typename Next>
+class CachedHandler {
+ public:
+  CachedHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : next_(ctx, spec), cached_(spec.cached) {}
+
+  bool init(RequestContext* ctx) {
+    if (!next_.init(ctx))
+      return false;
+    return next_.on_data(cached_.data, cached_.len) != NGX_ERROR;
+  }
+
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    // Keep flushes.
+    if (len == 0)
+      return next_.on_data(buf, len);
+    return NGX_OK;
+  }
+
+  ngx_int_t on_finish() { return next_.on_finish(); }
+
+ private:
+  Next next_;
+  ngx_str_t cached_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_CACHE_HANDLER_H_
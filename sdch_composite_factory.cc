@@ -0,0 +1,65 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_composite_factory.h"
+
+#include <vector>
+
+#include <boost/make_shared.hpp>
+
+namespace sdch {
+
+CompositeFactory::CompositeFactory()
+    : total_size_(0), max_size_(10000000), keep_payload_(false) {}
+
+CompositeFactory::ValuePtr CompositeFactory::get(const Dictionary* dict,
+                                                 const Dictionary* quasi) {
+  Key key(dict, quasi->client_id());
+  StoreType::iterator i = values_.find(key);
+  if (i != values_.end()) {
+    lru_.splice(lru_.begin(), lru_, i->second.lru);
+    return i->second.value;
+  }
+
+  if (!dict->has_payload() || !quasi->has_payload())
+    return ValuePtr();
+
+  // Quasi-dictionaries have no headers. So does composite one.
+  std::vector<char> blob;
+  blob.reserve(dict->payload_size() + quasi->payload_size());
+  blob.insert(blob.end(), dict->payload(),
+              dict->payload() + dict->payload_size());
+  blob.insert(blob.end(), quasi->payload(),
+              quasi->payload() + quasi->payload_size());
+
+  ValuePtr v = boost::make_shared<FastdictFactory::Value>(time(NULL));
+  const char* begin = blob.data();
+  if (!v->dict.init(begin, begin, begin + blob.size(), keep_payload_))
+    return ValuePtr();
+  v->charged = v->dict.memory_size();
+
+  lru_.push_front(key);
+  Entry e = { v, lru_.begin() };
+  values_.insert(std::make_pair(key, e));
+  total_size_ += v->charged;
+  trim();
+
+  return v;
+}
+
+void CompositeFactory::trim() {
+  LRUType::iterator i = lru_.end();
+  while (total_size_ > max_size_ && i != lru_.begin()) {
+    --i;
+    StoreType::iterator si = values_.find(*i);
+    // Still used by some request.
+    if (!si->second.value.unique())
+      continue;
+
+    total_size_ -= si->second.value->charged;
+    values_.erase(si);
+    i = lru_.erase(i);
+  }
+}
+
+}  // namespace sdch
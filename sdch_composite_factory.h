@@ -0,0 +1,59 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_COMPOSITE_FACTORY_H_
+#define SDCH_COMPOSITE_FACTORY_H_
+
+#include <list>
+#include <map>
+#include <utility>
+
+#include "sdch_dictionary.h"
+#include "sdch_fastdict_factory.h"
+
+namespace sdch {
+
+// Per-worker LRU of composite dictionaries: payload of configured
+// Dictionary followed by quasi-dictionary. Limited by total size like
+// FastdictFactory. Composites are per client, so they are handed out as
+// quasi-dictionaries and never pooled or cached.
+class CompositeFactory {
+ public:
+  typedef FastdictFactory::ValuePtr ValuePtr;
+
+  CompositeFactory();
+
+  // Find or build composite of dict and quasi. Empty ValuePtr on failure.
+  ValuePtr get(const Dictionary* dict, const Dictionary* quasi);
+
+  size_t total_size() const { return total_size_; }
+  void set_max_size(size_t max_size) { max_size_ = max_size; }
+  // Keep payload of composites for encoders other than open-vcdiff.
+  void set_keep_payload(bool keep) { keep_payload_ = keep; }
+
+ private:
+  // Configured dictionaries live as long as config. Quasi ones don't, so
+  // they are referenced by id.
+  typedef std::pair<const Dictionary*, Dictionary::id_t> Key;
+  typedef std::list<Key> LRUType;
+  struct Entry {
+    ValuePtr value;
+    LRUType::iterator lru;
+  };
+  typedef std::map<Key, Entry> StoreType;
+
+  // Remove least recently used entries not in use until we fit max_size_.
+  void trim();
+
+  StoreType values_;
+  // Most recently used in front.
+  LRUType lru_;
+  size_t total_size_;
+  size_t max_size_;
+  bool keep_payload_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_COMPOSITE_FACTORY_H_
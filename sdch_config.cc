@@ -11,8 +11,33 @@ namespace sdch {
 Config::Config(ngx_pool_t* pool)
     : enable(NGX_CONF_UNSET),
       min_length(NGX_CONF_UNSET_SIZE),
+      dump_sample(NGX_CONF_UNSET_UINT),
+      train(NGX_CONF_UNSET),
       enable_fastdict(NGX_CONF_UNSET),
       vary(NGX_CONF_UNSET),
+      slice_size(NGX_CONF_UNSET_SIZE),
+      encoder(NGX_CONF_UNSET_UINT),
+#if (NGX_THREADS)
+      thread_pool(static_cast<ngx_thread_pool_t*>(NGX_CONF_UNSET_PTR)),
+#endif
+      window_size(NGX_CONF_UNSET_SIZE),
+      cache_zone(static_cast<ngx_shm_zone_t*>(NGX_CONF_UNSET_PTR)),
+      static_files(NGX_CONF_UNSET),
+      lookahead(NGX_CONF_UNSET_SIZE),
+      lookahead_ratio(NGX_CONF_UNSET_UINT),
+      composite(NGX_CONF_UNSET),
+      delta(NGX_CONF_UNSET),
+      delta_versions(NGX_CONF_UNSET_UINT),
+      gzip(NGX_CONF_UNSET),
+      gzip_level(NGX_CONF_UNSET),
+      gzip_window(NGX_CONF_UNSET_SIZE),
+      gzip_wbits(0),
+      zstd(NGX_CONF_UNSET),
+      zstd_level(NGX_CONF_UNSET),
+      cdt(NGX_CONF_UNSET),
+      trial_dicts(NGX_CONF_UNSET),
+      status_format(NGX_CONF_UNSET_UINT),
+      stats_location(-1),
       dict_factory(POOL_ALLOC(pool, DictionaryFactory, pool)) {
 }
 
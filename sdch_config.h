@@ -19,6 +19,14 @@ namespace sdch {
 
 class DictionaryFactory;
 
+// Encoder engine used by EncodingHandler.
+enum EncoderType {
+  ENCODER_VCDIFF,   // open-vcdiff
+  ENCODER_SIMD,     // in-tree VcdiffEngine
+  ENCODER_OPTIMAL,  // in-tree OptimalEngine
+  ENCODER_ZSTD,     // zstd for "sdch-zstd" clients (ZstdEncodingHandler)
+};
+
 class Config {
  public:
   explicit Config(ngx_pool_t* pool);
@@ -52,11 +60,87 @@ class Config {
   ngx_uint_t sdch_proxied;
 
   ngx_str_t sdch_dumpdir;
+  // Share of responses to dump multiplied by 10000.
+  ngx_uint_t dump_sample;
+
+  // Sample responses for "sdch_train_zone".
+  ngx_flag_t train;
 
   ngx_flag_t enable_fastdict;
 
   ngx_flag_t vary;
 
+  // Max bytes to feed into Handler chain per body_filter invocation.
+  // 0 means unlimited.
+  size_t slice_size;
+
+  // EncoderType
+  ngx_uint_t encoder;
+
+#if (NGX_THREADS)
+  // Thread pool for parallel encoding. NULL if disabled. Set by
+  // "sdch_thread_pool".
+  ngx_thread_pool_t* thread_pool;
+#endif
+  // Size of window encoded by single thread.
+  size_t window_size;
+
+  // "sdch_cache" zone. NULL if disabled.
+  ngx_shm_zone_t* cache_zone;
+
+  // Serve precompressed FILE.<server_id>.sdch if it exists.
+  ngx_flag_t static_files;
+
+  // Bytes to buffer and trial-encode before committing to SDCH. 0 means
+  // decide in header_filter.
+  size_t lookahead;
+  // Minimal trial compression ratio multiplied by 100.
+  ngx_uint_t lookahead_ratio;
+
+  // Encode against configured dictionary followed by quasi-dictionary when
+  // client has both.
+  ngx_flag_t composite;
+
+  // Store versions of URLs and encode against the one client has.
+  ngx_flag_t delta;
+  // Versions per URL to keep.
+  ngx_uint_t delta_versions;
+  // URL of the version.
+  ngx_str_t delta_key;
+  ngx_http_complex_value_t delta_keycv;
+
+  // Gzip SDCH output for clients accepting gzip.
+  ngx_flag_t gzip;
+  ngx_int_t gzip_level;
+  size_t gzip_window;
+  // log2(gzip_window). Calculated in merge_conf.
+  int gzip_wbits;
+
+  // Use zstd with the same dictionaries for clients accepting sdch-zstd.
+  ngx_flag_t zstd;
+  ngx_int_t zstd_level;
+
+  // Compression Dictionary Transport. Encode with "dcz" against stored
+  // responses client has.
+  ngx_flag_t cdt;
+  // Store responses and mark them with Use-As-Dictionary for this URL
+  // pattern. Empty if disabled.
+  ngx_str_t cdt_match;
+  // Value of Use-As-Dictionary header. Made from cdt_match in merge_conf.
+  ngx_str_t cdt_use_as;
+
+  // Number of best announced dictionaries to trial-encode look-ahead
+  // buffer with. 1 means just use the best one.
+  ngx_int_t trial_dicts;
+  // Trial winners are memoized per location and value of this.
+  ngx_str_t trial_key;
+  ngx_http_complex_value_t trial_keycv;
+
+  // Stats::Format of "sdch_status" handler.
+  ngx_uint_t status_format;
+  // Index of location for Stats phase histograms. -1 if not timed.
+  ngx_int_t stats_location;
+
   DictionaryFactory* dict_factory;
 };
 
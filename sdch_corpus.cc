@@ -0,0 +1,389 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_corpus.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "sdch_fdholder.h"
+
+namespace sdch {
+
+namespace {
+
+const char kSegmentMagic[] = "SDCHCRP1";
+const char kIndexMagic[] = "SDCHIDX1";
+const char kRecordMagic[] = "SDRC";
+const size_t kMagicSize = 8;
+const size_t kHeaderSize = 32;
+const size_t kIndexEntrySize = 32;
+const uint8_t kFlagCompressed = 1;
+const size_t kMaxName = 255;
+
+void put_u32(std::string* out, uint32_t v) {
+  for (int i = 0; i < 4; ++i)
+    out->push_back(static_cast<char>(v >> (8 * i)));
+}
+
+void put_u64(std::string* out, uint64_t v) {
+  for (int i = 0; i < 8; ++i)
+    out->push_back(static_cast<char>(v >> (8 * i)));
+}
+
+uint32_t get_u32(const char* p) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+  return uint32_t(b[0]) | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 |
+         uint32_t(b[3]) << 24;
+}
+
+uint64_t get_u64(const char* p) {
+  return uint64_t(get_u32(p)) | uint64_t(get_u32(p + 4)) << 32;
+}
+
+bool ends_with(const std::string& s, const char* suffix) {
+  size_t len = strlen(suffix);
+  return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+bool write_all(int fd, const std::string& data) {
+  const char* p = data.data();
+  size_t left = data.size();
+  while (left > 0) {
+    ssize_t n = ::write(fd, p, left);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    left -= n;
+  }
+  return true;
+}
+
+// Returns false if compressed data isn't smaller.
+bool compress_body(const std::string& body, std::string* out) {
+  uLongf len = compressBound(body.size());
+  out->resize(len);
+  if (compress2(reinterpret_cast<Bytef*>(&(*out)[0]), &len,
+                reinterpret_cast<const Bytef*>(body.data()), body.size(),
+                Z_DEFAULT_COMPRESSION) != Z_OK ||
+      len >= body.size())
+    return false;
+  out->resize(len);
+  return true;
+}
+
+}  // namespace
+
+uint64_t corpus_uri_hash(const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+CorpusWriter::CorpusWriter(const std::string& dir, size_t segment_size,
+                           time_t segment_age, bool compress)
+    : dir_(dir),
+      segment_size_(segment_size),
+      segment_age_(segment_age),
+      compress_(compress),
+      fd_(-1),
+      opened_(0),
+      offset_(0),
+      seq_(0) {}
+
+CorpusWriter::~CorpusWriter() {
+  close();
+}
+
+bool CorpusWriter::append(const CorpusRecord& rec) {
+  time_t now = time(NULL);
+  if (fd_ != -1 && (offset_ >= segment_size_ || now - opened_ >= segment_age_))
+    close();
+  if (fd_ == -1 && !open_segment(now))
+    return false;
+
+  std::string compressed;
+  bool is_compressed = compress_ && compress_body(rec.body, &compressed);
+  const std::string& body = is_compressed ? compressed : rec.body;
+  size_t group_len = std::min(rec.group.size(), kMaxName);
+  size_t type_len = std::min(rec.content_type.size(), kMaxName);
+
+  std::string out;
+  out.reserve(kHeaderSize + group_len + type_len + body.size());
+  out.append(kRecordMagic, 4);
+  out.push_back(is_compressed ? kFlagCompressed : 0);
+  out.push_back(static_cast<char>(group_len));
+  out.push_back(static_cast<char>(type_len));
+  out.push_back(0);
+  put_u64(&out, rec.timestamp);
+  put_u64(&out, rec.uri_hash);
+  put_u32(&out, body.size());
+  put_u32(&out, rec.body.size());
+  out.append(rec.group, 0, group_len);
+  out.append(rec.content_type, 0, type_len);
+  out.append(body);
+
+  // Single write per record. Reader never sees records of .tmp segment
+  // anyway.
+  if (!write_all(fd_, out)) {
+    fail("write", name_ + ".seg.tmp");
+    // Publish records written so far, but never a torn one.
+    if (ftruncate(fd_, offset_) == 0) {
+      std::string error = error_;
+      close();
+      error_ = error;
+    } else {
+      discard();
+    }
+    return false;
+  }
+
+  CorpusIndexEntry e;
+  e.offset = offset_;
+  e.size = out.size();
+  e.body_size = rec.body.size();
+  e.timestamp = rec.timestamp;
+  e.uri_hash = rec.uri_hash;
+  index_.push_back(e);
+  offset_ += out.size();
+  return true;
+}
+
+bool CorpusWriter::expire(time_t now) {
+  if (fd_ != -1 && now - opened_ >= segment_age_)
+    return close();
+  return true;
+}
+
+bool CorpusWriter::open_segment(time_t now) {
+  char name[64];
+  snprintf(name, sizeof(name), "/%08lx-%08lx-%04x",
+           static_cast<unsigned long>(now),
+           static_cast<unsigned long>(getpid()), ++seq_);
+  name_ = dir_ + name;
+
+  std::string fn = name_ + ".seg.tmp";
+  fd_ = open(fn.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+  if (fd_ == -1)
+    return fail("open", fn);
+
+  if (!write_all(fd_, std::string(kSegmentMagic, kMagicSize))) {
+    fail("write", fn);
+    ::close(fd_);
+    fd_ = -1;
+    unlink(fn.c_str());
+    return false;
+  }
+
+  opened_ = now;
+  offset_ = kMagicSize;
+  index_.clear();
+  return true;
+}
+
+bool CorpusWriter::close() {
+  if (fd_ == -1)
+    return true;
+
+  bool ok = true;
+  std::string seg = name_ + ".seg";
+  std::string idx = name_ + ".idx";
+
+  if (::close(fd_) != 0)
+    ok = fail("close", seg + ".tmp");
+  fd_ = -1;
+
+  std::string out(kIndexMagic, kMagicSize);
+  out.reserve(kMagicSize + index_.size() * kIndexEntrySize);
+  for (size_t i = 0; i < index_.size(); ++i) {
+    put_u64(&out, index_[i].offset);
+    put_u32(&out, index_[i].size);
+    put_u32(&out, index_[i].body_size);
+    put_u64(&out, index_[i].timestamp);
+    put_u64(&out, index_[i].uri_hash);
+  }
+  index_.clear();
+
+  // Index first: segment without index is still readable, but index
+  // without segment is garbage.
+  FDHolder fd(open((idx + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                   0666));
+  if (fd == -1 || !write_all(fd, out) ||
+      rename((idx + ".tmp").c_str(), idx.c_str()) != 0) {
+    ok = fail("write", idx);
+    unlink((idx + ".tmp").c_str());
+  }
+
+  if (rename((seg + ".tmp").c_str(), seg.c_str()) != 0)
+    ok = fail("rename", seg);
+
+  return ok;
+}
+
+void CorpusWriter::discard() {
+  ::close(fd_);
+  fd_ = -1;
+  unlink((name_ + ".seg.tmp").c_str());
+  index_.clear();
+}
+
+bool CorpusWriter::fail(const std::string& what, const std::string& fn) {
+  error_ = what + " " + fn + ": " + strerror(errno);
+  return false;
+}
+
+CorpusReader::CorpusReader() : current_(0), file_(NULL) {}
+
+CorpusReader::~CorpusReader() {
+  if (file_ != NULL)
+    fclose(file_);
+}
+
+bool CorpusReader::add(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return fail("stat " + path + ": " + strerror(errno));
+
+  if (!S_ISDIR(st.st_mode)) {
+    segments_.push_back(path);
+    return true;
+  }
+
+  DIR* dir = opendir(path.c_str());
+  if (dir == NULL)
+    return fail("opendir " + path + ": " + strerror(errno));
+
+  std::vector<std::string> names;
+  while (struct dirent* de = readdir(dir)) {
+    std::string name(de->d_name);
+    if (ends_with(name, ".seg"))
+      names.push_back(path + "/" + name);
+  }
+  closedir(dir);
+
+  std::sort(names.begin(), names.end());
+  segments_.insert(segments_.end(), names.begin(), names.end());
+  return true;
+}
+
+bool CorpusReader::next(CorpusRecord* rec) {
+  for (;;) {
+    if (file_ == NULL && !open_segment())
+      return false;
+
+    char hdr[kHeaderSize];
+    size_t n = fread(hdr, 1, kHeaderSize, file_);
+    if (n == 0 && feof(file_)) {
+      fclose(file_);
+      file_ = NULL;
+      ++current_;
+      continue;
+    }
+    if (n != kHeaderSize || memcmp(hdr, kRecordMagic, 4) != 0)
+      return fail("broken record in " + segment());
+
+    size_t group_len = static_cast<uint8_t>(hdr[5]);
+    size_t type_len = static_cast<uint8_t>(hdr[6]);
+    size_t stored = get_u32(hdr + 24);
+    size_t body_len = get_u32(hdr + 28);
+
+    buf_.resize(group_len + type_len + stored);
+    if (!buf_.empty() && fread(&buf_[0], 1, buf_.size(), file_) != buf_.size())
+      return fail("truncated record in " + segment());
+
+    rec->timestamp = get_u64(hdr + 8);
+    rec->uri_hash = get_u64(hdr + 16);
+    rec->group.assign(buf_, 0, group_len);
+    rec->content_type.assign(buf_, group_len, type_len);
+
+    if (!(hdr[4] & kFlagCompressed)) {
+      rec->body.assign(buf_, group_len + type_len, stored);
+      return true;
+    }
+
+    rec->body.resize(body_len);
+    uLongf len = body_len;
+    if (uncompress(reinterpret_cast<Bytef*>(body_len ? &rec->body[0] : NULL),
+                   &len,
+                   reinterpret_cast<const Bytef*>(buf_.data()) + group_len +
+                       type_len,
+                   stored) != Z_OK ||
+        len != body_len)
+      return fail("broken compressed body in " + segment());
+    return true;
+  }
+}
+
+const std::string& CorpusReader::segment() const {
+  return segments_[std::min(current_, segments_.size() - 1)];
+}
+
+bool CorpusReader::open_segment() {
+  if (current_ >= segments_.size())
+    return false;
+
+  file_ = fopen(segment().c_str(), "rb");
+  if (file_ == NULL)
+    return fail("open " + segment() + ": " + strerror(errno));
+
+  char magic[kMagicSize];
+  if (fread(magic, 1, kMagicSize, file_) != kMagicSize ||
+      memcmp(magic, kSegmentMagic, kMagicSize) != 0)
+    return fail(segment() + " is not a corpus segment");
+  return true;
+}
+
+bool CorpusReader::fail(const std::string& what) {
+  error_ = what;
+  return false;
+}
+
+bool read_corpus_index(const std::string& segment,
+                       std::vector<CorpusIndexEntry>* entries) {
+  std::string fn = segment;
+  if (ends_with(fn, ".seg"))
+    fn.resize(fn.size() - 4);
+  fn += ".idx";
+
+  FILE* f = fopen(fn.c_str(), "rb");
+  if (f == NULL)
+    return false;
+
+  char buf[kIndexEntrySize];
+  bool ok = fread(buf, 1, kMagicSize, f) == kMagicSize &&
+            memcmp(buf, kIndexMagic, kMagicSize) == 0;
+  while (ok) {
+    size_t n = fread(buf, 1, kIndexEntrySize, f);
+    if (n == 0)
+      break;
+    if (n != kIndexEntrySize) {
+      ok = false;
+      break;
+    }
+    CorpusIndexEntry e;
+    e.offset = get_u64(buf);
+    e.size = get_u32(buf + 8);
+    e.body_size = get_u32(buf + 12);
+    e.timestamp = get_u64(buf + 16);
+    e.uri_hash = get_u64(buf + 24);
+    entries->push_back(e);
+  }
+  fclose(f);
+  return ok;
+}
+
+}  // namespace sdch
@@ -0,0 +1,160 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_CORPUS_H_
+#define SDCH_CORPUS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+// Corpus of responses saved by "sdch_dumpdir". Doesn't depend on nginx, so
+// tools can link with it.
+//
+// Corpus is a directory of append-only segments written by workers.
+// Segment is written as NAME.seg.tmp and renamed into NAME.seg when it's
+// complete, after its index NAME.idx. NAME is <time>-<pid>-<seq> in hex,
+// so segments sort by time of creation.
+//
+// Segment starts with "SDCHCRP1" followed by records. All numbers are
+// little-endian.
+//
+//    0  4  "SDRC"
+//    4  1  flags, 1 means body is zlib compressed
+//    5  1  group length
+//    6  1  content type length
+//    7  1  reserved
+//    8  8  timestamp, milliseconds since epoch
+//   16  8  corpus_uri_hash of request URI with arguments
+//   24  4  stored body length
+//   28  4  body length
+//   32     group, content type, stored body
+//
+// Index starts with "SDCHIDX1" followed by CorpusIndexEntry for every
+// record of segment, 32 bytes each: offset (8), size (4), body_size (4),
+// timestamp (8), uri_hash (8).
+
+namespace sdch {
+
+struct CorpusRecord {
+  CorpusRecord() : timestamp(0), uri_hash(0) {}
+
+  uint64_t timestamp;
+  uint64_t uri_hash;
+  // Truncated to 255 bytes when stored.
+  std::string group;
+  std::string content_type;
+  std::string body;
+};
+
+struct CorpusIndexEntry {
+  // Of record in segment.
+  uint64_t offset;
+  // Whole record with header.
+  uint32_t size;
+  // Uncompressed.
+  uint32_t body_size;
+  uint64_t timestamp;
+  uint64_t uri_hash;
+};
+
+// FNV-1a. Tools use it to find responses of URI.
+uint64_t corpus_uri_hash(const void* data, size_t len);
+
+// Appends records into segments of directory. Not thread safe.
+class CorpusWriter {
+ public:
+  // Segment is published when it gets bigger than segment_size or older
+  // than segment_age seconds. Bodies are compressed if it makes them
+  // smaller and compress is set.
+  CorpusWriter(const std::string& dir, size_t segment_size,
+               time_t segment_age, bool compress);
+  ~CorpusWriter();
+
+  bool append(const CorpusRecord& rec);
+
+  // Publish current segment if it's older than segment_age. append() checks
+  // it too, this is for writers without new records.
+  bool expire(time_t now);
+
+  // Publish current segment, if any.
+  bool close();
+
+  // Segment is being written.
+  bool is_open() const { return fd_ != -1; }
+
+  // Description of the last failure.
+  const std::string& error() const { return error_; }
+
+ private:
+  bool open_segment(time_t now);
+  // Remove current segment without publishing.
+  void discard();
+  bool fail(const std::string& what, const std::string& fn);
+
+  std::string dir_;
+  size_t segment_size_;
+  time_t segment_age_;
+  bool compress_;
+
+  // Segment being written. Path without suffix.
+  int fd_;
+  std::string name_;
+  time_t opened_;
+  uint64_t offset_;
+  std::vector<CorpusIndexEntry> index_;
+  unsigned seq_;
+
+  std::string error_;
+
+  CorpusWriter(const CorpusWriter&);
+  CorpusWriter& operator=(const CorpusWriter&);
+};
+
+// Iterates over records of segments.
+class CorpusReader {
+ public:
+  CorpusReader();
+  ~CorpusReader();
+
+  // Segment file or corpus directory. Can be called several times, paths
+  // are read in order. Segments of directory are read in name order.
+  bool add(const std::string& path);
+
+  // Returns false at the end or on error().
+  bool next(CorpusRecord* rec);
+
+  // Segment of the record returned by next().
+  const std::string& segment() const;
+
+  // All segments added so far.
+  const std::vector<std::string>& segments() const { return segments_; }
+
+  // Empty if there was no error.
+  const std::string& error() const { return error_; }
+
+ private:
+  bool open_segment();
+  bool fail(const std::string& what);
+
+  std::vector<std::string> segments_;
+  size_t current_;
+  FILE* file_;
+  std::string buf_;
+  std::string error_;
+
+  CorpusReader(const CorpusReader&);
+  CorpusReader& operator=(const CorpusReader&);
+};
+
+// Read index of segment. Returns false if it's missing or broken.
+bool read_corpus_index(const std::string& segment,
+                       std::vector<CorpusIndexEntry>* entries);
+
+
+}  // namespace sdch
+
+#endif  // SDCH_CORPUS_H_
@@ -0,0 +1,110 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_DEFLATE_HANDLER_H_
+#define SDCH_DEFLATE_HANDLER_H_
+
+#include <zlib.h>
+
+#include "sdch_deflate_pool.h"
+#include "sdch_handler.h"
+#include "sdch_main_config.h"
+#include "sdch_probes.h"
+#include "sdch_request_context.h"
+
+namespace sdch {
+
+// Gzips output of encoding stage for "Content-Encoding: sdch, gzip".
+// Placed right before OutputHandler. z_stream is borrowed from per-worker
+// DeflatePool.
+template <typename Next>
+class DeflateHandler {
+ public:
+  DeflateHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : next_(ctx, spec),
+        ctx_(ctx),
+        level_(spec.gzip_level),
+        wbits_(spec.gzip_wbits),
+        pool_(NULL),
+        zs_(NULL) {}
+
+  ~DeflateHandler() {
+    // Request was aborted in the middle. Stream state is unknown.
+    if (zs_)
+      DeflatePool::destroy(zs_);
+  }
+
+  bool init(RequestContext* ctx) {
+    if (!next_.init(ctx))
+      return false;
+
+    pool_ = &MainConfig::get(ctx->request)->deflate_pool;
+    zs_ = pool_->borrow(level_, wbits_);
+    return zs_ != NULL;
+  }
+
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    SDCH_PROBE3(deflate_data, ctx_->request, buf, len);
+    if (len)
+      return deflate(buf, len, Z_NO_FLUSH);
+
+    // Flush requested. Push out everything deflate holds.
+    if (ctx_->need_flush)
+      return deflate(buf, 0, Z_SYNC_FLUSH);
+
+    return next_.on_data(buf, len);
+  }
+
+  ngx_int_t on_finish() {
+    SDCH_PROBE1(deflate_finish, ctx_->request);
+    if (deflate(NULL, 0, Z_FINISH) == NGX_ERROR)
+      return NGX_ERROR;
+
+    pool_->release(zs_);
+    zs_ = NULL;
+    return next_.on_finish();
+  }
+
+ private:
+  // Feed buf into deflate and pass its output to next_ chunk by chunk.
+  ngx_int_t deflate(const uint8_t* buf, size_t len, int flush) {
+    uint8_t out[4096];
+    ngx_int_t rc = NGX_OK;
+
+    zs_->next_in = const_cast<Bytef*>(buf);
+    zs_->avail_in = len;
+
+    do {
+      zs_->next_out = out;
+      zs_->avail_out = sizeof(out);
+
+      int z = ::deflate(zs_, flush);
+      if (z != Z_OK && z != Z_STREAM_END && z != Z_BUF_ERROR)
+        return NGX_ERROR;
+
+      size_t n = sizeof(out) - zs_->avail_out;
+      if (n) {
+        rc = next_.on_data(out, n);
+        if (rc == NGX_ERROR)
+          return rc;
+      }
+    } while (zs_->avail_out == 0);
+
+    return rc;
+  }
+
+  Next next_;
+  RequestContext* ctx_;
+
+  int level_;
+  int wbits_;
+
+  DeflatePool* pool_;
+  // Borrowed in init(). NULL after successful on_finish().
+  z_stream* zs_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_DEFLATE_HANDLER_H_
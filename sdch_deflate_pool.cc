@@ -0,0 +1,66 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_deflate_pool.h"
+
+#include <string.h>
+
+namespace sdch {
+
+namespace {
+
+// Same as nginx gzip filter uses for default window.
+const int kMemLevel = 8;
+
+}  // namespace
+
+DeflatePool::DeflatePool() : max_size_(8) {}
+
+DeflatePool::~DeflatePool() {
+  for (StoreType::iterator i = free_.begin(); i != free_.end(); ++i) {
+    for (FreeList::iterator s = i->second.begin(); s != i->second.end(); ++s)
+      destroy(&(*s)->zs);
+  }
+}
+
+z_stream* DeflatePool::borrow(int level, int wbits) {
+  int key = level << 8 | wbits;
+
+  StoreType::iterator i = free_.find(key);
+  if (i != free_.end() && !i->second.empty()) {
+    Stream* s = i->second.back();
+    i->second.pop_back();
+    if (deflateReset(&s->zs) == Z_OK)
+      return &s->zs;
+    destroy(&s->zs);
+  }
+
+  Stream* s = new Stream;
+  memset(&s->zs, 0, sizeof(s->zs));
+  s->key = key;
+  // +16 for gzip header and trailer instead of zlib ones.
+  if (deflateInit2(&s->zs, level, Z_DEFLATED, wbits + 16, kMemLevel,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    delete s;
+    return NULL;
+  }
+  return &s->zs;
+}
+
+void DeflatePool::release(z_stream* zs) {
+  // zs is the first member of Stream.
+  Stream* s = reinterpret_cast<Stream*>(zs);
+  FreeList& l = free_[s->key];
+  if (l.size() >= max_size_) {
+    destroy(zs);
+  } else {
+    l.push_back(s);
+  }
+}
+
+void DeflatePool::destroy(z_stream* zs) {
+  deflateEnd(zs);
+  delete reinterpret_cast<Stream*>(zs);
+}
+
+}  // namespace sdch
@@ -0,0 +1,51 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_DEFLATE_POOL_H_
+#define SDCH_DEFLATE_POOL_H_
+
+#include <map>
+#include <vector>
+
+#include <zlib.h>
+
+namespace sdch {
+
+// Per-worker cache of idle gzip z_streams. deflateInit2 allocates about
+// 256K of window and hash tables, deflateReset just clears them. Streams
+// are keyed by compression level and window bits.
+class DeflatePool {
+ public:
+  DeflatePool();
+  ~DeflatePool();
+
+  // Get stream ready to produce gzip member. Caller owns it until
+  // release(). Returns NULL on failure.
+  z_stream* borrow(int level, int wbits);
+
+  // Return stream to the pool. Should be called only after Z_STREAM_END.
+  // Otherwise just destroy() it.
+  void release(z_stream* zs);
+
+  // Free stream without pooling.
+  static void destroy(z_stream* zs);
+
+  // Maximum number of idle streams per key. 0 disables pooling.
+  void set_max_size(size_t max_size) { max_size_ = max_size; }
+
+ private:
+  struct Stream {
+    z_stream zs;
+    int key;
+  };
+  typedef std::vector<Stream*> FreeList;
+  typedef std::map<int, FreeList> StoreType;
+
+  StoreType free_;
+  size_t max_size_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_DEFLATE_POOL_H_
@@ -0,0 +1,348 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_dict_builder.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace sdch {
+
+namespace {
+
+const int kHashBits = 22;
+const size_t kHashSize = size_t(1) << kHashBits;
+
+// That many k-mers of taken segments in a row split segment. Shorter runs
+// are markup repeated between texts, copied cheaper along with them.
+const size_t kMaxGap = 64;
+
+// Hash of k bytes at p. k is up to 8.
+inline uint32_t kmer_hash(const char* p, uint64_t mask) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return static_cast<uint32_t>(((v & mask) * 0xCF1BBCDCB7A56463ULL) >>
+                               (64 - kHashBits));
+}
+
+template <typename T>
+struct ThreadCall {
+  T* arg;
+  void (*fn)(T*, size_t);
+  size_t thread;
+
+  static void* run(void* data) {
+    ThreadCall* c = static_cast<ThreadCall*>(data);
+    c->fn(c->arg, c->thread);
+    return NULL;
+  }
+};
+
+// Runs fn(arg, thread) for n threads. Shares of threads which can't be
+// created run in the calling one.
+template <typename T>
+void parallel(size_t n, T* arg, void (*fn)(T*, size_t)) {
+  if (n == 1) {
+    fn(arg, 0);
+    return;
+  }
+
+  std::vector<ThreadCall<T> > calls(n);
+  std::vector<pthread_t> tids(n);
+  std::vector<bool> started(n);
+  for (size_t i = 0; i < n; ++i) {
+    calls[i].arg = arg;
+    calls[i].fn = fn;
+    calls[i].thread = i;
+    started[i] =
+        pthread_create(&tids[i], NULL, ThreadCall<T>::run, &calls[i]) == 0;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (started[i])
+      pthread_join(tids[i], NULL);
+    else
+      fn(arg, i);
+  }
+}
+
+struct Candidate {
+  Candidate() : score(0), sample(0), begin(0), end(0) {}
+  uint64_t score;
+  size_t sample;
+  size_t begin;
+  size_t end;
+};
+
+}  // namespace
+
+// First pass. Every thread counts its share of samples into its own table,
+// tables are summed at the end.
+struct DictBuilder::Counter {
+  Counter(const DictBuilderParams& p, uint64_t m)
+      : params(p),
+        mask(m),
+        freq(p.threads, std::vector<uint32_t>(kHashSize)),
+        last(p.threads, std::vector<uint32_t>(kHashSize)),
+        batch(NULL),
+        first_id(0) {}
+
+  static void run(Counter* self, size_t thread) {
+    std::vector<uint32_t>& freq = self->freq[thread];
+    std::vector<uint32_t>& last = self->last[thread];
+    // k-mers are read as 8 bytes.
+    size_t k = std::max(self->params.k, sizeof(uint64_t));
+
+    for (size_t i = thread; i < self->batch->size();
+         i += self->params.threads) {
+      const std::string& s = (*self->batch)[i];
+      uint32_t id = self->first_id + i + 1;
+      for (size_t p = 0; p + k <= s.size(); ++p) {
+        uint32_t h = kmer_hash(s.data() + p, self->mask);
+        if (last[h] != id) {
+          last[h] = id;
+          ++freq[h];
+        }
+      }
+    }
+  }
+
+  const DictBuilderParams& params;
+  uint64_t mask;
+  std::vector<std::vector<uint32_t> > freq;
+  std::vector<std::vector<uint32_t> > last;
+
+  const DictSamples* batch;
+  uint32_t first_id;
+};
+
+// Second pass. Every thread finds the best segment among its share of
+// samples of epoch.
+struct DictBuilder::Selector {
+  Selector(const DictBuilderParams& p, uint64_t m, std::vector<uint32_t>* f)
+      : params(p),
+        mask(m),
+        freq(f),
+        seen(p.threads, std::vector<uint32_t>(kHashSize)),
+        best(p.threads),
+        epoch(NULL) {}
+
+  uint32_t weight(uint32_t h) const {
+    uint32_t f = (*freq)[h];
+    return f >= params.min_freq ? f : 0;
+  }
+
+  static void run(Selector* self, size_t thread) {
+    std::vector<uint32_t>& seen = self->seen[thread];
+    Candidate& best = self->best[thread];
+    best = Candidate();
+    size_t k = std::max(self->params.k, sizeof(uint64_t));
+
+    for (size_t i = thread; i < self->epoch->size();
+         i += self->params.threads) {
+      const std::string& s = (*self->epoch)[i];
+      const char* data = s.data();
+      if (s.size() < k)
+        continue;
+
+      // Window of bytes [start, p + k) not longer than params.length.
+      // Score is sum of weights of distinct k-mers in it.
+      size_t start = 0;
+      uint64_t score = 0;
+      for (size_t p = 0; p + k <= s.size(); ++p) {
+        uint32_t h = kmer_hash(data + p, self->mask);
+        if (seen[h]++ == 0)
+          score += self->weight(h);
+
+        if (p + k - start > self->params.length) {
+          uint32_t h0 = kmer_hash(data + start, self->mask);
+          if (--seen[h0] == 0)
+            score -= self->weight(h0);
+          ++start;
+        }
+
+        if (score > best.score) {
+          best.score = score;
+          best.sample = i;
+          best.begin = start;
+          best.end = p + k;
+        }
+      }
+
+      // Leave table clean for the next sample.
+      for (size_t p = start; p + k <= s.size(); ++p)
+        seen[kmer_hash(data + p, self->mask)] = 0;
+    }
+  }
+
+  // Take the best candidate of epoch. Returns false if there is none.
+  bool take(std::string* segment) {
+    Candidate c;
+    for (size_t i = 0; i < best.size(); ++i) {
+      if (best[i].score > c.score)
+        c = best[i];
+    }
+    if (c.score == 0)
+      return false;
+
+    const std::string& s = (*epoch)[c.sample];
+    size_t k = std::max(params.k, sizeof(uint64_t));
+
+    // Every k-mer of sample was counted, so zero frequency means it was
+    // taken already. Window may have runs of them between k-mers found in
+    // colliding counters: take the best part without such runs, and
+    // without worthless k-mers at the ends. The rest stays for later
+    // epochs.
+    size_t begin = c.begin;
+    size_t end = c.begin;
+    uint64_t score = 0;
+    size_t run_begin = c.begin;
+    uint64_t run_score = 0;
+    size_t gap = kMaxGap;
+    for (size_t p = c.begin; p + k <= c.end; ++p) {
+      uint32_t h = kmer_hash(s.data() + p, mask);
+      uint32_t w = weight(h);
+      if (w == 0) {
+        if ((*freq)[h] == 0)
+          ++gap;
+        continue;
+      }
+      if (gap >= kMaxGap) {
+        run_begin = p;
+        run_score = 0;
+      }
+      gap = 0;
+      run_score += w;
+      if (run_score > score) {
+        score = run_score;
+        begin = run_begin;
+        end = p + k;
+      }
+    }
+    if (score == 0)
+      return false;
+
+    for (size_t p = begin; p + k <= end; ++p)
+      (*freq)[kmer_hash(s.data() + p, mask)] = 0;
+
+    segment->assign(s, begin, end - begin);
+    return true;
+  }
+
+  const DictBuilderParams& params;
+  uint64_t mask;
+  std::vector<uint32_t>* freq;
+  std::vector<std::vector<uint32_t> > seen;
+  std::vector<Candidate> best;
+
+  const DictSamples* epoch;
+};
+
+DictBuilder::DictBuilder(const DictBuilderParams& params)
+    : params_(params),
+      mask_(params.k >= 8 ? ~uint64_t(0)
+                          : (uint64_t(1) << (8 * params.k)) - 1),
+      counter_(NULL),
+      selector_(NULL),
+      samples_(0),
+      bytes_(0),
+      payload_size_(0) {
+  if (params_.threads == 0)
+    params_.threads = 1;
+}
+
+DictBuilder::~DictBuilder() {
+  delete counter_;
+  delete selector_;
+}
+
+void DictBuilder::count(const DictSamples& batch) {
+  if (counter_ == NULL)
+    counter_ = new Counter(params_, mask_);
+
+  counter_->batch = &batch;
+  counter_->first_id = samples_;
+  parallel(params_.threads, counter_, Counter::run);
+  counter_->batch = NULL;
+
+  samples_ += batch.size();
+  for (size_t i = 0; i < batch.size(); ++i)
+    bytes_ += batch[i].size();
+}
+
+void DictBuilder::merge_counts() {
+  if (counter_ == NULL) {
+    freq_.assign(kHashSize, 0);
+    return;
+  }
+
+  freq_.swap(counter_->freq[0]);
+  for (size_t t = 1; t < params_.threads; ++t) {
+    const std::vector<uint32_t>& f = counter_->freq[t];
+    for (size_t h = 0; h < kHashSize; ++h)
+      freq_[h] += f[h];
+  }
+  delete counter_;
+  counter_ = NULL;
+}
+
+uint64_t DictBuilder::epoch_bytes() const {
+  size_t epochs = std::max<size_t>(params_.size / params_.length, 1);
+  return std::max<uint64_t>(bytes_ / epochs, params_.length);
+}
+
+bool DictBuilder::select(const DictSamples& epoch) {
+  if (selector_ == NULL) {
+    merge_counts();
+    selector_ = new Selector(params_, mask_, &freq_);
+  }
+  if (full())
+    return false;
+
+  selector_->epoch = &epoch;
+  parallel(params_.threads, selector_, Selector::run);
+
+  std::string segment;
+  bool taken = selector_->take(&segment);
+  selector_->epoch = NULL;
+  if (!taken)
+    return false;
+
+  if (segment.size() > params_.size - payload_size_)
+    segment.resize(params_.size - payload_size_);
+  payload_size_ += segment.size();
+  segments_.push_back(std::string());
+  segments_.back().swap(segment);
+  return true;
+}
+
+std::string DictBuilder::payload() const {
+  std::string res;
+  res.reserve(payload_size_);
+  for (size_t i = segments_.size(); i-- > 0;)
+    res += segments_[i];
+  return res;
+}
+
+std::string build_dict_payload(const DictSamples& samples,
+                               const DictBuilderParams& params) {
+  DictBuilder builder(params);
+  builder.count(samples);
+
+  uint64_t epoch_bytes = builder.epoch_bytes();
+  DictSamples epoch;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < samples.size() && !builder.full(); ++i) {
+    epoch.push_back(samples[i]);
+    bytes += samples[i].size();
+    if (bytes >= epoch_bytes || i + 1 == samples.size()) {
+      builder.select(epoch);
+      epoch.clear();
+      bytes = 0;
+    }
+  }
+  return builder.payload();
+}
+
+}  // namespace sdch
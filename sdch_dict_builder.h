@@ -0,0 +1,103 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_DICT_BUILDER_H_
+#define SDCH_DICT_BUILDER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// Builds dictionary payload from sample responses. Used by sdch_dictgen and
+// by "sdch_train_zone". Doesn't depend on nginx.
+//
+// Frequency based, the same idea as zstd "fastcover". First pass counts in
+// how many responses every k bytes long substring (k-mer) occurs. Samples
+// are then split into size / length epochs, and from every epoch the length
+// bytes long segment with the highest sum of frequencies of its distinct
+// k-mers is taken. K-mers of taken segment don't count anymore, so
+// dictionary has no long duplicates. K-mers found in less than min_freq
+// responses are worthless. Long runs of taken k-mers split segments.
+//
+// Frequencies are kept in a table of 2^22 counters per thread, colliding
+// k-mers share one. The best segments go to the end of payload: encoders
+// prefer near copies.
+
+namespace sdch {
+
+typedef std::vector<std::string> DictSamples;
+
+struct DictBuilderParams {
+  DictBuilderParams()
+      : size(128 * 1024), k(8), length(1024), min_freq(2), threads(1) {}
+
+  // Of payload.
+  size_t size;
+  // 4..8
+  size_t k;
+  // Of segment.
+  size_t length;
+  uint32_t min_freq;
+  // Both passes run on that many threads. 1 means the calling one.
+  size_t threads;
+};
+
+class DictBuilder {
+ public:
+  explicit DictBuilder(const DictBuilderParams& params);
+  ~DictBuilder();
+
+  // First pass. Can be called for several batches of samples, every sample
+  // is counted once.
+  void count(const DictSamples& batch);
+
+  // Samples and bytes counted so far.
+  size_t samples() const { return samples_; }
+  uint64_t bytes() const { return bytes_; }
+
+  // Bytes of samples to pass to select() at once. Valid after the first
+  // pass.
+  uint64_t epoch_bytes() const;
+
+  // Second pass. Takes the best segment of epoch. Returns false if there
+  // is nothing worth taking in it.
+  bool select(const DictSamples& epoch);
+
+  bool full() const { return payload_size_ >= params_.size; }
+
+  // Segments taken so far, the best last.
+  std::string payload() const;
+  size_t segments() const { return segments_.size(); }
+
+ private:
+  struct Counter;
+  struct Selector;
+
+  void merge_counts();
+
+  DictBuilderParams params_;
+  uint64_t mask_;
+  Counter* counter_;
+  Selector* selector_;
+  // Summed over threads after the first pass.
+  std::vector<uint32_t> freq_;
+
+  size_t samples_;
+  uint64_t bytes_;
+
+  std::vector<std::string> segments_;
+  size_t payload_size_;
+
+  DictBuilder(const DictBuilder&);
+  DictBuilder& operator=(const DictBuilder&);
+};
+
+// Both passes over samples in memory.
+std::string build_dict_payload(const DictSamples& samples,
+                               const DictBuilderParams& params);
+
+
+}  // namespace sdch
+
+#endif  // SDCH_DICT_BUILDER_H_
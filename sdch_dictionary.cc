@@ -8,52 +8,78 @@
 #include <vector>
 #include <openssl/sha.h>
 
+#include "sdch_fdholder.h"
+
 namespace sdch {
 
 namespace {
 
-#if nginx_version < 1006000
-static void
-ngx_encode_base64url(ngx_str_t *dst, ngx_str_t *src)
-{
-	ngx_encode_base64(dst, src);
-	unsigned i;
-
-	for (i = 0; i < dst->len; i++) {
-		if (dst->data[i] == '+')
-			dst->data[i] = '-';
-		if (dst->data[i] == '/')
-			dst->data[i] = '_';
-	}
-}
-#endif
-
-void encode_id(u_char* sha, Dictionary::id_t& id) {
-	ngx_str_t src = {6, sha};
-	ngx_str_t dst = {8, id.data()};
-	ngx_encode_base64url(&dst, &src);
+// Base64url of 6 bytes is exactly 8 chars. Done by hand so the sdch_encode
+// tool doesn't have to link nginx.
+void encode_id(const u_char* sha, Dictionary::id_t& id) {
+  static const char alphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  uint8_t* dst = id.data();
+  for (int i = 0; i < 6; i += 3) {
+    uint32_t v = (sha[i] << 16) | (sha[i + 1] << 8) | sha[i + 2];
+    *dst++ = alphabet[(v >> 18) & 0x3f];
+    *dst++ = alphabet[(v >> 12) & 0x3f];
+    *dst++ = alphabet[(v >> 6) & 0x3f];
+    *dst++ = alphabet[v & 0x3f];
+  }
 }
 
 void get_dict_ids(const char* buf,
                   size_t buflen,
+                  uint8_t* sha,
                   Dictionary::id_t& client_id,
                   Dictionary::id_t& server_id) {
   SHA256_CTX ctx;
   SHA256_Init(&ctx);
   SHA256_Update(&ctx, buf, buflen);
-  unsigned char sha[32];
   SHA256_Final(sha, &ctx);
 
   encode_id(sha, client_id);
   encode_id(sha + 6, server_id);
 }
 
+// Skip dictionary headers in case of on-disk dictionary
+const char *get_dict_payload(const char *dictbegin, const char *dictend)
+{
+  const char *nl = dictbegin;
+  while (nl < dictend) {
+    if (*nl == '\n')
+      return nl+1;
+    nl = (const char*)memchr(nl, '\n', dictend-nl);
+    if (nl == NULL)
+      return NULL;
+    if (nl == dictend)
+      return nl;
+    ++nl;
+  }
+  return dictend;
+}
+
+bool read_file(const char* fn, std::vector<char>& blob) {
+  blob.clear();
+  FDHolder fd(open(fn, O_RDONLY));
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+    return false;
+  blob.resize(st.st_size);
+  if (read(fd, &blob[0], blob.size()) != (ssize_t)blob.size())
+    return false;
+  return true;
+}
 
 }  // namespace
 
 bool Dictionary::init(const char* begin,
                       const char* payload,
-                      const char* end) {
+                      const char* end,
+                      bool keep_payload) {
   if (begin == NULL || payload == NULL || end == NULL)
     return false;
 
@@ -61,9 +87,71 @@ bool Dictionary::init(const char* begin,
   if (!hashed_dict_->Init())
     return false;
 
-  get_dict_ids(begin, end - begin, client_id_, server_id_);
+  if (keep_payload)
+    payload_.assign(payload, end);
+  get_dict_ids(begin, end - begin, sha256_, client_id_, server_id_);
   size_ = end - begin;
+  hashed_size_ = end - payload;
   return true;
 }
 
+bool Dictionary::load(const char* filename) {
+  std::vector<char> blob;
+  if (!read_file(filename, blob))
+    return false;
+
+  if (!init(blob.data(),
+            get_dict_payload(blob.data(), blob.data() + blob.size()),
+            blob.data() + blob.size(), false))
+    return false;
+  filename_ = filename;
+  return true;
+}
+
+bool Dictionary::has_payload() const {
+  if (!payload_.empty() || hashed_size_ == 0)
+    return true;
+  if (filename_.empty())
+    return false;
+
+  // Blocks, but once per process.
+  std::vector<char> blob;
+  uint8_t sha[32];
+  id_t client_id, server_id;
+  if (read_file(filename_.c_str(), blob)) {
+    get_dict_ids(blob.data(), blob.size(), sha, client_id, server_id);
+    const char* end = blob.data() + blob.size();
+    if (memcmp(sha, sha256_, sizeof(sha)) == 0)
+      payload_.assign(get_dict_payload(blob.data(), end), end);
+  }
+  filename_.clear();
+  return !payload_.empty();
+}
+
+Dictionary::id_t Dictionary::client_id_for(const uint8_t* sha256) {
+  id_t res;
+  encode_id(sha256, res);
+  return res;
+}
+
+size_t Dictionary::index_size() const {
+  // BlockHash: power of two table of heads and two arrays of int per
+  // 16-byte block.
+  size_t blocks = hashed_size_ / 16;
+  size_t table = 1;
+  while (table < blocks)
+    table <<= 1;
+  size_t res = (table + 2 * blocks) * sizeof(int);
+
+  if (vcdiff_index_.get() != NULL)
+    res += vcdiff_index_->table_size();
+  return res;
+}
+
+const VcdiffIndex* Dictionary::vcdiff_index() {
+  if (vcdiff_index_.get() == NULL && has_payload())
+    vcdiff_index_.reset(new VcdiffIndex(payload_.data(), payload_.size()));
+  return vcdiff_index_.get();
+}
+
 }  // namespace sdch
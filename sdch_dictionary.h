@@ -13,9 +13,13 @@ extern "C" {
 
 #include <stdint.h>  // uint8_t
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <google/vcencoder.h>
 
+#include "sdch_vcdiff_engine.h"
+
 namespace sdch {
 
 // In-memory Dictionary representation
@@ -50,23 +54,69 @@ class Dictionary {
     return server_id_;
   }
 
+  // SHA-256 of the whole dictionary. Compression Dictionary Transport
+  // identifies dictionaries by it.
+  const uint8_t* sha256() const { return sha256_; }
+
+  // client_id of dictionary with this SHA-256.
+  static id_t client_id_for(const uint8_t* sha256);
+
   const open_vcdiff::HashedDictionary* hashed_dict() const {
     return hashed_dict_.get();
   }
 
+  // Dictionary content without headers. open-vcdiff has its own copy, so
+  // it's only kept for other encoders: loaded dictionaries read it from
+  // file again on first use, the rest keep it if created so. False if it's
+  // unavailable, e.g. file has changed since.
+  bool has_payload() const;
+  // Valid after has_payload().
+  const char* payload() const { return payload_.data(); }
+  size_t payload_size() const { return payload_.size(); }
+
+  // Index for VcdiffEngine. Built on first use. NULL without payload.
+  const VcdiffIndex* vcdiff_index();
+
+  // Memory used by hash tables of encoders. open-vcdiff doesn't tell it,
+  // so its part is estimated from BlockHash layout.
+  size_t index_size() const;
+
+  // Memory held: copy in hashed_dict(), payload and indexes.
+  size_t memory_size() const {
+    return hashed_size_ + payload_.size() + index_size();
+  }
+
+  Dictionary() {}
+
+  // Load dictionary in sdch_dict format (headers, empty line, payload).
+  bool load(const char* filename);
+
  private:
+  friend class CompositeFactory;
   friend class DictionaryFactory;
   friend class FastdictFactory;
+  friend class Trainer;
 
   bool init(const char* begin,
             const char* payload,
-            const char* end);
+            const char* end,
+            bool keep_payload);
 
   std::auto_ptr<open_vcdiff::HashedDictionary> hashed_dict_;
+  mutable std::vector<char> payload_;
+  // File to read payload_ from. Cleared once tried.
+  mutable std::string filename_;
+  std::auto_ptr<VcdiffIndex> vcdiff_index_;
 
   size_t size_;
+  size_t hashed_size_;
+  uint8_t sha256_[32];
   id_t client_id_;
   id_t server_id_;
+
+  // VcdiffIndex points into payload_. So no copying.
+  Dictionary(const Dictionary&);
+  Dictionary& operator=(const Dictionary&);
 };
 
 
@@ -3,58 +3,65 @@
 
 #include "sdch_dump_handler.h"
 
-#include <cassert>
 #include "sdch_config.h"
+#include "sdch_corpus.h"
+#include "sdch_main_config.h"
 #include "sdch_request_context.h"
 
 namespace sdch {
 
-DumpHandler::DumpHandler(Handler* next) : Handler(next), fd_(-1) {
-  assert(next_);
+size_t max_dump_size(RequestContext* ctx) {
+  return MainConfig::get(ctx->request)->dump_queue.max_response();
 }
 
-DumpHandler::~DumpHandler() {}
-
-bool DumpHandler::init(RequestContext* ctx) {
-  Config* conf = Config::get(ctx->request);
-  char fn[conf->sdch_dumpdir.len + 30];
-
-  sprintf(fn,
-          "%s/%08lx-%08lx-%08lx",
-          conf->sdch_dumpdir.data,
-          random(),
-          random(),
-          random());
-
-  fd_.reset(open(fn, O_WRONLY | O_CREAT | O_EXCL, 0666));
-  if (fd_ == -1) {
-    ngx_log_error(NGX_LOG_ERR,
-                  ctx->request->connection->log,
-                  0,
-                  "dump open error %s",
-                  fn);
-    return false;
+void push_dump(RequestContext* ctx, std::string* data) {
+  ngx_http_request_t* r = ctx->request;
+  MainConfig* main = MainConfig::get(r);
+
+  CorpusRecord rec;
+  ngx_time_t* tp = ngx_timeofday();
+  rec.timestamp = uint64_t(tp->sec) * 1000 + tp->msec;
+  rec.uri_hash = corpus_uri_hash(r->unparsed_uri.data, r->unparsed_uri.len);
+  rec.group.assign(reinterpret_cast<const char*>(ctx->group.data),
+                   ctx->group.len);
+  // Without "; charset=..."
+  size_t type_len = r->headers_out.content_type_len;
+  if (type_len == 0)
+    type_len = r->headers_out.content_type.len;
+  rec.content_type.assign(
+      reinterpret_cast<const char*>(r->headers_out.content_type.data),
+      type_len);
+  rec.body.swap(*data);
+
+  if (!main->dump_queue.push(Config::get(r)->sdch_dumpdir, &rec,
+                             r->connection->log)) {
+    drop_dump(ctx);
+    return;
   }
 
-  ngx_log_error(NGX_LOG_DEBUG,
-                ctx->request->connection->log,
-                0,
-                "dump open file %s",
-                fn);
-  return true;
+  if (main->stats != NULL)
+    main->stats->add(Stats::DUMPS);
 }
 
-ngx_int_t DumpHandler::on_data(const uint8_t* buf, size_t len) {
-  ssize_t res = 0;
+void drop_dump(RequestContext* ctx) {
+  ngx_http_request_t* r = ctx->request;
+  ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "sdch dump dropped");
 
-  if ((res = write(fd_, buf, len)) != static_cast<ssize_t>(len)) {
-    // XXX
-    return NGX_ERROR;
-  }
+  Stats* stats = MainConfig::get(r)->stats;
+  if (stats != NULL)
+    stats->add(Stats::DUMPS_DROPPED);
+}
+
+size_t max_sample_size(RequestContext* ctx) {
+  return MainConfig::get(ctx->request)->trainer.sample_size();
+}
 
-  if (next_)
-    return next_->on_data(buf, len);
-  return NGX_OK;
+void push_sample(RequestContext* ctx, ngx_int_t slot,
+                 const std::string& data) {
+  ngx_log_error(NGX_LOG_DEBUG, ctx->request->connection->log, 0,
+                "train sample %uz bytes into slot %i", data.size(), slot);
+  MainConfig::get(ctx->request)->trainer.fill(slot, data);
 }
 
 }  // namespace sdch
@@ -4,29 +4,100 @@
 #ifndef SDCH_DUMP_HANDLER_H_
 #define SDCH_DUMP_HANDLER_H_
 
-#include "sdch_fdholder.h"
+#include <algorithm>
+#include <string>
+
 #include "sdch_handler.h"
+#include "sdch_probes.h"
+#include "sdch_request_context.h"
 
 namespace sdch {
 
-class RequestContext;
+// Longest response DumpHandler can queue.
+size_t max_dump_size(RequestContext* ctx);
+
+// Queue collected response as corpus record for sdch_dumpdir. Takes data
+// away.
+void push_dump(RequestContext* ctx, std::string* data);
+
+// Count response which didn't fit into the dump queue.
+void drop_dump(RequestContext* ctx);
 
-// Dumps data into temporary directory
-class DumpHandler : public Handler {
+// Longest prefix of response kept for sdch_train.
+size_t max_sample_size(RequestContext* ctx);
+
+// Put collected prefix of response into reservoir slot of Trainer.
+void push_sample(RequestContext* ctx, ngx_int_t slot, const std::string& data);
+
+// Collects response in memory. Queues it for appending to corpus in
+// sdch_dumpdir (see DumpQueue) and puts it into reservoir of sdch_train
+// (see Trainer). Never blocks on disk.
+template <typename Next>
+class DumpHandler {
  public:
-  explicit DumpHandler(Handler* next);
-  ~DumpHandler();
+  DumpHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : next_(ctx, spec),
+        ctx_(ctx),
+        dump_(spec.dump),
+        train_slot_(spec.train_slot),
+        max_size_(0),
+        truncated_(false) {}
+
+  bool init(RequestContext* ctx) {
+    if (dump_)
+      max_size_ = max_dump_size(ctx);
+    if (train_slot_ >= 0)
+      max_size_ = std::max(max_size_, max_sample_size(ctx));
+    return next_.init(ctx);
+  }
 
-  virtual bool init(RequestContext* ctx);
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    SDCH_PROBE3(dump_data, ctx_->request, buf, len);
 
-  virtual ngx_int_t on_data(const uint8_t* buf, size_t len);
+    if (!truncated_) {
+      size_t room = max_size_ - data_.size();
+      if (len <= room) {
+        data_.append(reinterpret_cast<const char*>(buf), len);
+      } else if (train_slot_ >= 0) {
+        // Prefix is still a good sample.
+        truncated_ = true;
+        data_.append(reinterpret_cast<const char*>(buf), room);
+      } else {
+        truncated_ = true;
+        std::string().swap(data_);
+      }
+    }
+
+    return next_.on_data(buf, len);
+  }
+
+  ngx_int_t on_finish() {
+    SDCH_PROBE1(dump_finish, ctx_->request);
+
+    if (train_slot_ >= 0)
+      push_sample(ctx_, train_slot_, data_);
+
+    if (dump_) {
+      if (truncated_)
+        drop_dump(ctx_);
+      else
+        push_dump(ctx_, &data_);
+    }
+
+    return next_.on_finish();
+  }
 
  private:
-  FDHolder fd_;
+  Next next_;
+  RequestContext* ctx_;
+  bool dump_;
+  ngx_int_t train_slot_;
+  size_t max_size_;
+  bool truncated_;
+  std::string data_;
 };
 
 
 }  // namespace sdch
 
 #endif  // SDCH_DUMP_HANDLER_H_
-
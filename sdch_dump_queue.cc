@@ -0,0 +1,190 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_dump_queue.h"
+
+#include <algorithm>
+
+namespace sdch {
+
+DumpQueue::DumpQueue()
+    :
+#if (NGX_THREADS)
+      thread_pool_(NULL),
+      task_(NULL),
+#endif
+      in_flight_(false),
+      queued_(0),
+      writing_size_(0),
+      max_size_(16 * 1024 * 1024),
+      rate_(1024 * 1024),
+      second_(0),
+      spent_(0),
+      segment_size_(64 * 1024 * 1024),
+      segment_age_(600),
+      compress_(false),
+      expire_(false),
+      open_(0) {
+  ngx_memzero(&timer_, sizeof(timer_));
+}
+
+DumpQueue::~DumpQueue() {
+  if (timer_.timer_set)
+    ngx_del_timer(&timer_);
+
+  // Worker is exiting, thread pools are already stopped. Don't lose what
+  // was sampled and publish segments.
+  if (!in_flight_ && !pending_.empty())
+    write_items(&pending_, ngx_cycle->log);
+
+  for (WriterMap::iterator i = writers_.begin(); i != writers_.end(); ++i) {
+    if (!i->second->close()) {
+      ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, 0, "dump %s",
+                    i->second->error().c_str());
+    }
+    delete i->second;
+  }
+}
+
+bool DumpQueue::accepting() {
+  refill();
+  return queued_ < max_size_ && (rate_ == 0 || spent_ < rate_);
+}
+
+size_t DumpQueue::max_response() const {
+  return rate_ != 0 ? std::min(max_size_, rate_) : max_size_;
+}
+
+bool DumpQueue::push(const ngx_str_t& dir, CorpusRecord* rec,
+                     ngx_log_t* log) {
+  size_t len = rec->body.size();
+
+  refill();
+  if (queued_ + len > max_size_ || (rate_ != 0 && spent_ + len > rate_))
+    return false;
+  spent_ += len;
+
+  pending_.push_back(Item());
+  Item& item = pending_.back();
+  item.dir.assign(reinterpret_cast<const char*>(dir.data), dir.len);
+  item.rec.timestamp = rec->timestamp;
+  item.rec.uri_hash = rec->uri_hash;
+  item.rec.group.swap(rec->group);
+  item.rec.content_type.swap(rec->content_type);
+  item.rec.body.swap(rec->body);
+  queued_ += len;
+
+  ngx_log_error(NGX_LOG_DEBUG, log, 0, "dump queued %uz bytes into %s", len,
+                item.dir.c_str());
+
+  post();
+  return true;
+}
+
+void DumpQueue::refill() {
+  time_t now = ngx_time();
+  if (now != second_) {
+    second_ = now;
+    spent_ = 0;
+  }
+}
+
+void DumpQueue::post() {
+  if (in_flight_ || (pending_.empty() && !expire_))
+    return;
+
+#if (NGX_THREADS)
+  if (thread_pool_ != NULL) {
+    if (task_ == NULL) {
+      task_ = ngx_thread_task_alloc(ngx_cycle->pool, 0);
+      if (task_ == NULL)
+        return;
+      task_->ctx = this;
+      task_->handler = thread_handler;
+      task_->event.handler = event_handler;
+      task_->event.data = this;
+    }
+
+    // On failure items stay pending and are retried with the next push.
+    writing_.swap(pending_);
+    if (ngx_thread_task_post(thread_pool_, task_) != NGX_OK) {
+      pending_.swap(writing_);
+      return;
+    }
+    in_flight_ = true;
+    writing_size_ = queued_;
+    return;
+  }
+#endif
+
+  write_items(&pending_, ngx_cycle->log);
+  queued_ = 0;
+  written();
+}
+
+void DumpQueue::written() {
+  expire_ = false;
+  if (open_ == 0 || timer_.timer_set)
+    return;
+
+  if (timer_.handler == NULL) {
+    timer_.handler = timer_handler;
+    timer_.data = this;
+    timer_.log = ngx_cycle->log;
+    timer_.cancelable = 1;
+  }
+  // Segment is published at most a minute late.
+  ngx_add_timer(&timer_, std::min<time_t>(segment_age_, 60) * 1000);
+}
+
+void DumpQueue::timer_handler(ngx_event_t* ev) {
+  DumpQueue* self = static_cast<DumpQueue*>(ev->data);
+  // Task owns writers. Try again soon.
+  if (self->in_flight_) {
+    ngx_add_timer(ev, 1000);
+    return;
+  }
+  self->expire_ = true;
+  self->post();
+}
+
+void DumpQueue::write_items(ItemList* items, ngx_log_t* log) {
+  for (ItemList::iterator i = items->begin(); i != items->end(); ++i) {
+    CorpusWriter*& w = writers_[i->dir];
+    if (w == NULL)
+      w = new CorpusWriter(i->dir, segment_size_, segment_age_, compress_);
+    if (!w->append(i->rec))
+      ngx_log_error(NGX_LOG_ERR, log, 0, "dump %s", w->error().c_str());
+  }
+  items->clear();
+
+  time_t now = time(NULL);
+  open_ = 0;
+  for (WriterMap::iterator i = writers_.begin(); i != writers_.end(); ++i) {
+    if (expire_ && !i->second->expire(now))
+      ngx_log_error(NGX_LOG_ERR, log, 0, "dump %s",
+                    i->second->error().c_str());
+    if (i->second->is_open())
+      ++open_;
+  }
+}
+
+#if (NGX_THREADS)
+
+void DumpQueue::thread_handler(void* data, ngx_log_t* log) {
+  DumpQueue* self = static_cast<DumpQueue*>(data);
+  self->write_items(&self->writing_, log);
+}
+
+void DumpQueue::event_handler(ngx_event_t* ev) {
+  DumpQueue* self = static_cast<DumpQueue*>(ev->data);
+  self->in_flight_ = false;
+  self->queued_ -= self->writing_size_;
+  self->writing_size_ = 0;
+  self->written();
+  self->post();
+}
+
+#endif  // NGX_THREADS
+
+}  // namespace sdch
@@ -0,0 +1,115 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_DUMP_QUEUE_H_
+#define SDCH_DUMP_QUEUE_H_
+
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+}
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "sdch_corpus.h"
+
+namespace sdch {
+
+// Per-worker queue of responses sampled by "sdch_dumpdir". Responses are
+// appended to corpus segments (see CorpusWriter) by a thread pool task, so
+// event loop never waits for disk. Responses are dropped when queue is full
+// or the byte budget of current second is spent. Without thread pool they
+// are written right in push(). While segments are open, a timer publishes
+// the ones older than segment age even if nothing more is sampled.
+class DumpQueue {
+ public:
+  DumpQueue();
+  ~DumpQueue();
+
+  // Bytes waiting to be written.
+  void set_max_size(size_t max_size) { max_size_ = max_size; }
+  // Bytes accepted per second. 0 means unlimited.
+  void set_rate(size_t rate) { rate_ = rate; }
+  // See CorpusWriter.
+  void set_segment(size_t size, time_t age, bool compress) {
+    segment_size_ = size;
+    segment_age_ = age;
+    compress_ = compress;
+  }
+#if (NGX_THREADS)
+  // NULL means write synchronously.
+  void set_thread_pool(ngx_thread_pool_t* pool) { thread_pool_ = pool; }
+#endif
+
+  // Cheap check before collecting response.
+  bool accepting();
+  // Longest response push() can ever accept.
+  size_t max_response() const;
+
+  // Queue record to be appended to corpus in dir. Takes body away.
+  // Returns false if it was dropped.
+  bool push(const ngx_str_t& dir, CorpusRecord* rec, ngx_log_t* log);
+
+ private:
+  struct Item {
+    std::string dir;
+    CorpusRecord rec;
+  };
+  typedef std::deque<Item> ItemList;
+  typedef std::map<std::string, CorpusWriter*> WriterMap;
+
+  // Start new second of rate_ budget if it's time.
+  void refill();
+  void post();
+  // After items are written. Arms timer while segments are open.
+  void written();
+
+  static void timer_handler(ngx_event_t* ev);
+
+  // Can run in thread pool.
+  void write_items(ItemList* items, ngx_log_t* log);
+
+#if (NGX_THREADS)
+  static void thread_handler(void* data, ngx_log_t* log);
+  static void event_handler(ngx_event_t* ev);
+
+  ngx_thread_pool_t* thread_pool_;
+  ngx_thread_task_t* task_;
+#endif
+
+  // Waiting for task.
+  ItemList pending_;
+  // Owned by task while in_flight_.
+  ItemList writing_;
+  bool in_flight_;
+
+  // In pending_ and writing_.
+  size_t queued_;
+  // In writing_. Only thread touches writing_ itself while in_flight_.
+  size_t writing_size_;
+  size_t max_size_;
+
+  size_t rate_;
+  time_t second_;
+  size_t spent_;
+
+  size_t segment_size_;
+  time_t segment_age_;
+  bool compress_;
+  // By directory. Used only by write_items.
+  WriterMap writers_;
+
+  ngx_event_t timer_;
+  // Set by timer, write_items publishes old segments.
+  bool expire_;
+  // Writers with open segment, counted by write_items.
+  size_t open_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_DUMP_QUEUE_H_
@@ -0,0 +1,93 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_encoder_pool.h"
+
+#include <algorithm>
+
+namespace sdch {
+
+EncoderPool::EncoderPool()
+    : max_size_(8), idle_timeout_(60) {
+  ngx_memzero(&timer_, sizeof(timer_));
+}
+
+EncoderPool::~EncoderPool() {
+  if (timer_.timer_set)
+    ngx_del_timer(&timer_);
+
+  for (StoreType::iterator i = free_.begin(); i != free_.end(); ++i) {
+    for (FreeList::iterator e = i->second.begin(); e != i->second.end(); ++e)
+      delete e->enc;
+  }
+}
+
+EncoderPool::Encoder* EncoderPool::borrow(const Dictionary* dict) {
+  StoreType::iterator i = free_.find(dict);
+  if (i == free_.end() || i->second.empty())
+    return create(dict);
+
+  // Most recently used one. It's more likely to be in cache.
+  Encoder* res = i->second.back().enc;
+  i->second.pop_back();
+  return res;
+}
+
+void EncoderPool::release(const Dictionary* dict, Encoder* enc) {
+  time_t now = ngx_time();
+
+  FreeList& l = free_[dict];
+  if (l.size() >= max_size_) {
+    delete enc;
+  } else {
+    Entry e = { enc, now };
+    l.push_back(e);
+  }
+
+  if (!timer_.timer_set)
+    schedule(now);
+}
+
+void EncoderPool::trim(time_t now) {
+  for (StoreType::iterator i = free_.begin(); i != free_.end(); ++i) {
+    FreeList& l = i->second;
+    // Entries are ordered by ts. Oldest ones are in front.
+    FreeList::iterator e = l.begin();
+    for (; e != l.end() && now - e->ts > idle_timeout_; ++e)
+      delete e->enc;
+    l.erase(l.begin(), e);
+  }
+}
+
+void EncoderPool::schedule(time_t now) {
+  time_t oldest = now;
+  bool idle = false;
+  for (StoreType::iterator i = free_.begin(); i != free_.end(); ++i) {
+    if (!i->second.empty()) {
+      oldest = std::min(oldest, i->second.front().ts);
+      idle = true;
+    }
+  }
+  if (!idle)
+    return;
+
+  if (timer_.handler == NULL) {
+    timer_.handler = timer_handler;
+    timer_.data = this;
+    timer_.log = ngx_cycle->log;
+    // Don't keep exiting worker alive.
+    timer_.cancelable = 1;
+  }
+  // trim() destroys encoders idle strictly longer than idle_timeout_.
+  time_t delay = std::max<time_t>(oldest + idle_timeout_ + 1 - now, 1);
+  ngx_add_timer(&timer_, delay * 1000);
+}
+
+void EncoderPool::timer_handler(ngx_event_t* ev) {
+  EncoderPool* self = static_cast<EncoderPool*>(ev->data);
+  time_t now = ngx_time();
+  self->trim(now);
+  self->schedule(now);
+}
+
+}  // namespace sdch
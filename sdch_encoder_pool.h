@@ -0,0 +1,81 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_ENCODER_POOL_H_
+#define SDCH_ENCODER_POOL_H_
+
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+}
+
+#include <time.h>
+#include <map>
+#include <vector>
+
+#include <google/vcencoder.h>
+
+#include "sdch_dictionary.h"
+
+namespace sdch {
+
+// Per-worker cache of idle VCDiffStreamingEncoders. Constructing encoder
+// allocates internal buffers and hash state, so we reuse them between
+// requests. Only Dictionaries living as long as config (not quasi ones)
+// should be used as keys. While encoders are idle, a timer destroys those
+// idle longer than idle_timeout.
+class EncoderPool {
+ public:
+  typedef open_vcdiff::VCDiffStreamingEncoder Encoder;
+
+  EncoderPool();
+  ~EncoderPool();
+
+  // Get encoder for Dictionary. Caller owns it until release().
+  Encoder* borrow(const Dictionary* dict);
+
+  // Return encoder to the pool. Should be called only after successful
+  // FinishEncoding. Otherwise just delete encoder.
+  void release(const Dictionary* dict, Encoder* enc);
+
+  // Create new encoder without pooling. Inline, so tools don't have to
+  // link nginx for it.
+  static Encoder* create(const Dictionary* dict) {
+    return new Encoder(dict->hashed_dict(),
+                       open_vcdiff::VCD_FORMAT_INTERLEAVED |
+                           open_vcdiff::VCD_FORMAT_CHECKSUM,
+                       false);
+  }
+
+  // Maximum number of idle encoders per Dictionary. 0 disables pooling.
+  void set_max_size(size_t max_size) { max_size_ = max_size; }
+  // Idle encoders older than this will be destroyed.
+  void set_idle_timeout(time_t idle_timeout) { idle_timeout_ = idle_timeout; }
+
+ private:
+  struct Entry {
+    Encoder* enc;
+    time_t ts;
+  };
+  typedef std::vector<Entry> FreeList;
+  typedef std::map<const Dictionary*, FreeList> StoreType;
+
+  // Destroy encoders idle longer than idle_timeout_
+  void trim(time_t now);
+
+  // Arm timer for the oldest idle encoder, if any.
+  void schedule(time_t now);
+
+  static void timer_handler(ngx_event_t* ev);
+
+  StoreType free_;
+  size_t max_size_;
+  time_t idle_timeout_;
+  ngx_event_t timer_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_ENCODER_POOL_H_
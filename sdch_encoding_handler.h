@@ -8,43 +8,157 @@
 
 #include <google/vcencoder.h>
 
+#include "sdch_dictionary.h"
+#include "sdch_encoder_pool.h"
 #include "sdch_fastdict_factory.h"
+#include "sdch_probes.h"
+#include "sdch_request_context.h"
+#include "sdch_vcdiff_engine.h"
 
 namespace sdch {
 
-class Dictionary;
-class RequestContext;
+// Encoder engines for EncodingHandler. All of them produce VCDIFF with
+// interleaved and checksum extensions and have the same interface:
+//   bool start(RequestContext* ctx, Dictionary* dict,
+//              const FastdictFactory::ValuePtr& quasidict,
+//              open_vcdiff::OutputStringInterface* out);
+//   bool encode(const char* buf, size_t len, OutputStringInterface* out);
+//   bool finish(open_vcdiff::OutputStringInterface* out);
 
-// Actual VCDiff encoding handler
-class EncodingHandler : public Handler,
-                        public open_vcdiff::OutputStringInterface {
+// open-vcdiff VCDiffStreamingEncoder borrowed from EncoderPool.
+class OpenVcdiffEncoder {
  public:
-  EncodingHandler(Handler* next,
-                  Dictionary* dict,
-                  FastdictFactory::ValuePtr quasidict);
-  ~EncodingHandler();
+  OpenVcdiffEncoder();
+  ~OpenVcdiffEncoder();
+
+  bool start(RequestContext* ctx,
+             Dictionary* dict,
+             const FastdictFactory::ValuePtr& quasidict,
+             open_vcdiff::OutputStringInterface* out);
+
+  bool encode(const char* buf,
+              size_t len,
+              open_vcdiff::OutputStringInterface* out) {
+    return enc_->EncodeChunkToInterface(buf, len, out);
+  }
+
+  bool finish(open_vcdiff::OutputStringInterface* out);
+
+ private:
+  Dictionary* dict_;
 
-  // sdch::Handler implementation
-  virtual bool init(RequestContext* ctx);
-  virtual ngx_int_t on_data(const uint8_t* buf, size_t len);
-  virtual ngx_int_t on_finish();
+  // Pool to return encoder to. NULL for quasi-dictionaries.
+  EncoderPool* pool_;
+
+  // Actual encoder. Borrowed in start()
+  EncoderPool::Encoder* enc_;
+};
+
+// In-tree VcdiffEngine.
+class SimdEncoder {
+ public:
+  bool start(RequestContext* ctx,
+             Dictionary* dict,
+             const FastdictFactory::ValuePtr& quasidict,
+             open_vcdiff::OutputStringInterface* out) {
+    const VcdiffIndex* index = dict->vcdiff_index();
+    return index != NULL && engine_.start(index, out);
+  }
+
+  bool encode(const char* buf,
+              size_t len,
+              open_vcdiff::OutputStringInterface* out) {
+    return engine_.encode_chunk(buf, len, out);
+  }
+
+  bool finish(open_vcdiff::OutputStringInterface* out) {
+    return engine_.finish(out);
+  }
+
+ private:
+  VcdiffEngine engine_;
+};
+
+// Actual VCDiff encoding handler
+template <typename Next, typename Encoder>
+class EncodingHandler : public open_vcdiff::OutputStringInterface {
+ public:
+  EncodingHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : next_(ctx, spec),
+        ctx_(ctx),
+        dict_(spec.dict),
+        quasidict_(spec.quasidict),
+        cursize_(0),
+        next_status_(NGX_OK) {}
+
+  bool init(RequestContext* ctx) {
+    if (!next_.init(ctx))
+      return false;
+
+    // Output Dictionary server_id first
+    next_.on_data(dict_->server_id().data(), 8);
+
+    static const uint8_t terminator[1] = { 0x0 };
+    next_.on_data(terminator, 1);
+
+    if (!enc_.start(ctx, dict_, quasidict_, this))
+      return false;
+
+    return true;
+  }
+
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    SDCH_PROBE3(vcdiff_data, ctx_->request, buf, len);
+    // It will call ".append" which will pass it to the next_
+    if (len) {
+      ScopedTimer timer(&ctx_->phase_ns[PHASE_ENCODE]);
+      if (!enc_.encode(reinterpret_cast<const char*>(buf), len, this))
+        return NGX_ERROR;
+      return next_status_;
+    }
+
+    // No data was supplied. Just pass it through.
+    return next_.on_data(buf, len);
+  }
+
+  ngx_int_t on_finish() {
+    SDCH_PROBE1(vcdiff_finish, ctx_->request);
+    {
+      ScopedTimer timer(&ctx_->phase_ns[PHASE_ENCODE]);
+      if (!enc_.finish(this))
+        return NGX_ERROR;
+    }
+
+    return next_.on_finish();
+  }
 
   // open_vcdiff::OutputStringInterface implementation
-  virtual open_vcdiff::OutputStringInterface& append(const char* s, size_t n);
-  virtual void clear();
-  virtual void push_back(char c);
-  virtual void ReserveAdditionalBytes(size_t res_arg);
-  virtual size_t size() const;
+  virtual open_vcdiff::OutputStringInterface& append(const char* s,
+                                                     size_t n) {
+    next_status_ = next_.on_data(reinterpret_cast<const uint8_t*>(s), n);
+    cursize_ += n;
+    return *this;
+  }
+
+  virtual void clear() { cursize_ = 0; }
+
+  virtual void push_back(char c) { append(&c, 1); }
+
+  virtual void ReserveAdditionalBytes(size_t res_arg) {
+    // NOOP
+  }
+
+  virtual size_t size() const { return cursize_; }
 
  private:
-  class OutHelper;
+  Next next_;
 
   RequestContext*   ctx_;
   Dictionary*       dict_;
   FastdictFactory::ValuePtr quasidict_;
 
   // Actual encoder.
-  open_vcdiff::VCDiffStreamingEncoder enc_;
+  Encoder enc_;
 
   // For OutputStringInterface implementation
   size_t cursize_;
@@ -56,4 +170,3 @@ class EncodingHandler : public Handler,
 }  // namespace sdch
 
 #endif  // SDCH_ENCODING_HANDLER_H_
-
@@ -1,6 +1,8 @@
 #include <cassert>
+#include <cstring>
 
 #include "sdch_fastdict_factory.h"
+#include "sdch_probes.h"
 
 #include <boost/make_shared.hpp>
 
@@ -8,16 +10,25 @@ namespace sdch {
 
 FastdictFactory::Value::~Value() {}
 
-FastdictFactory::FastdictFactory() : max_size_(10000000) {}
+FastdictFactory::FastdictFactory()
+    : total_size_(0),
+      max_size_(10000000),
+      keep_payload_(false),
+      evictions_(0),
+      blocked_evictions_(0) {}
 
-Dictionary* FastdictFactory::create_dictionary(const char* buf, size_t len) {
+Dictionary* FastdictFactory::create_dictionary(const char* buf, size_t len,
+                                               const std::string& group) {
   ValuePtr v = boost::make_shared<Value>(time(NULL));
-  if (!v->dict.init(buf, buf, buf + len)) {
+  if (!v->dict.init(buf, buf, buf + len, keep_payload_)) {
     return NULL;
   }
+  v->group = group;
 
   if (!store(v->dict.client_id(), v)) {
-    return NULL;
+    // Same content is stored already.
+    ValuePtr old = find(v->dict.client_id());
+    return old != NULL ? &old->dict : NULL;
   }
 
   return &v->dict;
@@ -35,7 +46,9 @@ bool FastdictFactory::store(Dictionary::id_t key, ValuePtr value) {
   }
 
   lru_.insert(LRUType::value_type(r.first->second->ts, key));
-  total_size_ += r.first->second->dict.size();
+  value->charged = value->dict.memory_size();
+  total_size_ += value->charged;
+  SDCH_PROBE2(fastdict_store, key.data(), value->dict.size());
 
   // Remove oldest entries if we exceeded max_size_
   for (LRUType::iterator i = lru_.begin();
@@ -47,13 +60,16 @@ bool FastdictFactory::store(Dictionary::id_t key, ValuePtr value) {
     }
 
     if (!si->second.unique()) {  // XXX
+      ++blocked_evictions_;
       ++i;
       continue;
     }
 
-    total_size_ -= si->second->dict.size();
+    total_size_ -= si->second->charged;
+    SDCH_PROBE2(fastdict_evict, si->first.data(), si->second->dict.size());
     values_.erase(si);
     lru_.erase(i++);
+    ++evictions_;
   }
 
   return true;
@@ -61,11 +77,40 @@ bool FastdictFactory::store(Dictionary::id_t key, ValuePtr value) {
 
 FastdictFactory::ValuePtr FastdictFactory::find(const Dictionary::id_t& key) {
   StoreType::iterator i = values_.find(key);
+  SDCH_PROBE2(fastdict_find, key.data(), i != values_.end());
   if (i == values_.end())
     return ValuePtr();
 
+  ++i->second->hits;
+
   // TODO Update LRU?
   return i->second;
 }
 
+FastdictFactory::ValuePtr FastdictFactory::find_sha256(const uint8_t* sha256) {
+  ValuePtr res = find(Dictionary::client_id_for(sha256));
+  // client_id is just 48 bits of it.
+  if (res != NULL && memcmp(res->dict.sha256(), sha256, 32) != 0)
+    return ValuePtr();
+  return res;
+}
+
+void FastdictFactory::erase(const Dictionary::id_t& key) {
+  StoreType::iterator i = values_.find(key);
+  if (i == values_.end())
+    return;
+
+  std::pair<LRUType::iterator, LRUType::iterator> range =
+      lru_.equal_range(i->second->ts);
+  for (LRUType::iterator l = range.first; l != range.second; ++l) {
+    if (!(l->second < key) && !(key < l->second)) {
+      lru_.erase(l);
+      break;
+    }
+  }
+
+  total_size_ -= i->second->charged;
+  values_.erase(i);
+}
+
 }  // namespace sdch
@@ -18,33 +18,56 @@ class FastdictFactory {
  public:
   // Stored Value
   struct Value {
-    Value(time_t t) : ts(t) {}
-    Value(time_t t, Dictionary d) : ts(t), dict(d) {}
+    Value(time_t t) : ts(t), charged(0), hits(0) {}
     ~Value();
 
     time_t ts;
     Dictionary dict;
+    // Memory counted in total_size for it. Indexes built later aren't.
+    size_t charged;
+    // Times found by id.
+    size_t hits;
+    // sdch_group of response it was made from.
+    std::string group;
   };
 
   // We are using shared_ptr for refcounting Values to avoid discarding
   // currently in use Dictionaries.
   typedef boost::shared_ptr<Value> ValuePtr;
 
+  typedef std::map<Dictionary::id_t, ValuePtr> StoreType;
+
   FastdictFactory();
 
-  Dictionary* create_dictionary(const char* buf, size_t len);
+  Dictionary* create_dictionary(const char* buf, size_t len,
+                                const std::string& group = std::string());
 
   // Get Value and "lock" it.
   ValuePtr find(const Dictionary::id_t& key);
 
+  // Find Value by full SHA-256 of its content.
+  ValuePtr find_sha256(const uint8_t* sha256);
+
+  // Forget Value. Requests using it keep it alive till they finish.
+  void erase(const Dictionary::id_t& key);
+
   size_t total_size() const { return total_size_; }
   size_t max_size() const { return max_size_; }
   void set_max_size(size_t max_size) { max_size_ = max_size; }
+  // Keep payload of dictionaries for encoders other than open-vcdiff.
+  void set_keep_payload(bool keep) { keep_payload_ = keep; }
+  bool keep_payload() const { return keep_payload_; }
+  // Number of Values dropped to fit into max_size.
+  size_t evictions() const { return evictions_; }
+  // Times Value wasn't dropped because requests still use it.
+  size_t blocked_evictions() const { return blocked_evictions_; }
+
+  // For introspection. Values aren't "locked" by iterating.
+  const StoreType& values() const { return values_; }
 
  private:
   friend class Unlocker;
 
-  typedef std::map<Dictionary::id_t, ValuePtr> StoreType;
   typedef std::multimap<time_t, Dictionary::id_t>  LRUType;
 
   bool store(Dictionary::id_t key, ValuePtr value);
@@ -57,6 +80,9 @@ class FastdictFactory {
   size_t total_size_;
   // Maximum total size
   size_t max_size_;
+  bool keep_payload_;
+  size_t evictions_;
+  size_t blocked_evictions_;
 };
 
 }  // namespace sdch
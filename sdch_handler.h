@@ -11,18 +11,87 @@ extern "C" {
 #include <ngx_http.h>
 }
 
+#include "sdch_cache.h"
+#include "sdch_fastdict_factory.h"
 #include "sdch_status.h"
 
 namespace sdch {
 
+class Dictionary;
 class RequestContext;
 
-// SDCH Handler chain.
+// What header_filter decided to do with the response. Every stage of
+// the pipeline is constructed from it.
+struct PipelineSpec {
+  PipelineSpec() : store_as_quasi(false), dump(false), train_slot(-1),
+                   dict(NULL),
+                   encoder(0), zstd_level(0), dcz(false),
+#if (NGX_THREADS)
+                   thread_pool(NULL),
+#endif
+                   window_size(0), cache(NULL), versions(0),
+                   gzip(false), gzip_level(0), gzip_wbits(0),
+                   next_body(NULL) {
+    ngx_str_null(&cached);
+    ngx_str_null(&version_key);
+  }
+
+  // Store response as quasi-dictionary (AutoautoHandler).
+  bool store_as_quasi;
+  // Dump response into sdch_dumpdir (DumpHandler).
+  bool dump;
+  // Reservoir slot of Trainer to put response into (DumpHandler). -1 if
+  // response isn't sampled.
+  ngx_int_t train_slot;
+  // Encode response with this Dictionary (EncodingHandler). Can be NULL.
+  Dictionary* dict;
+  FastdictFactory::ValuePtr quasidict;
+  // EncoderType to encode with.
+  ngx_uint_t encoder;
+  // Level for ENCODER_ZSTD (ZstdEncodingHandler).
+  int zstd_level;
+  // Frame ENCODER_ZSTD output as Compression Dictionary Transport "dcz"
+  // instead of "sdch-zstd".
+  bool dcz;
+#if (NGX_THREADS)
+  // Encode windows of window_size bytes on this pool
+  // (ParallelEncodingHandler). Can be NULL.
+  ngx_thread_pool_t* thread_pool;
+#endif
+  size_t window_size;
+  // Store encoded output under cache_key (CacheStoreHandler). Can be NULL.
+  Cache* cache;
+  CacheKey cache_key;
+  // Cached output to send instead of encoding (CachedHandler).
+  ngx_str_t cached;
+  // Register quasi-dictionary as the latest version of this URL keeping
+  // that many versions (AutoautoHandler). Empty if not "sdch_delta".
+  ngx_str_t version_key;
+  size_t versions;
+  // Gzip encoded output (DeflateHandler).
+  bool gzip;
+  int gzip_level;
+  int gzip_wbits;
+  // Next nginx body filter (OutputHandler).
+  ngx_http_output_body_filter_pt next_body;
+};
+
+// SDCH Handler chain as seen by body_filter.
+//
+// Actual stages (AutoautoHandler, DumpHandler, EncodingHandler, ...,
+// DeflateHandler, OutputHandler) are plain classes templated on the next
+// stage and embedded into each other by value. Pipeline (see
+// sdch_pipeline.h) wraps the whole chain into a single Handler, so there is
+// only one virtual call per chunk and the compiler can inline across
+// stages.
+//
+// Every stage has the same (non-virtual) interface:
+//   Stage(RequestContext* ctx, const PipelineSpec& spec);
+//   bool init(RequestContext* ctx);
+//   ngx_int_t on_data(const uint8_t* buf, size_t len);
+//   ngx_int_t on_finish();
 class Handler {
  public:
-  // Construct Handler with pointer to the next Handler.
-  // We don't own this pointer. It's owned by nginx pool.
-  explicit Handler(Handler* next);
   virtual ~Handler();
 
   // Called after constructor to avoid exceptions
@@ -30,21 +99,14 @@ class Handler {
   virtual bool init(RequestContext* ctx) = 0;
 
   // Handle chunk of data. For example encode it with VCDIFF.
-  // Almost every Handler should call next_->on_data() to keep chain.
+  // Almost every stage should call next_.on_data() to keep chain.
   virtual ngx_int_t on_data(const uint8_t* buf, size_t len) = 0;
 
   // Called when request processing finished.
-  // Default implementation just invokes next_->on_finish();
-  virtual ngx_int_t on_finish();
-
-  Handler* next() const { return next_; }
-
- protected:
-  Handler* next_;
+  virtual ngx_int_t on_finish() = 0;
 };
 
 
 }  // namespace sdch
 
 #endif  // SDCH_HANDLER_H_
-
@@ -7,7 +7,26 @@
 
 namespace sdch {
 
-MainConfig::MainConfig() : stor_size(NGX_CONF_UNSET_SIZE) {}
+MainConfig::MainConfig()
+    : stor_size(NGX_CONF_UNSET_SIZE),
+      encoder_pool_size(NGX_CONF_UNSET_UINT),
+      encoder_pool_idle(NGX_CONF_UNSET),
+      composite_stor_size(NGX_CONF_UNSET_SIZE),
+      trial_valid(NGX_CONF_UNSET),
+      stats(NULL),
+      dump_queue_size(NGX_CONF_UNSET_SIZE),
+      dump_rate(NGX_CONF_UNSET_SIZE),
+      dump_segment_size(NGX_CONF_UNSET_SIZE),
+      dump_segment_age(NGX_CONF_UNSET),
+      dump_compress(NGX_CONF_UNSET),
+#if (NGX_THREADS)
+      dump_thread_pool(static_cast<ngx_thread_pool_t*>(NGX_CONF_UNSET_PTR)),
+#endif
+      dump(false) {
+#if (NGX_THREADS)
+  train_thread_pool = static_cast<ngx_thread_pool_t*>(NGX_CONF_UNSET_PTR);
+#endif
+}
 
 MainConfig::~MainConfig() {}
 
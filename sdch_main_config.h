@@ -10,7 +10,16 @@ extern "C" {
 #include <ngx_config.h>
 }
 
+#include "sdch_composite_factory.h"
+#include "sdch_deflate_pool.h"
+#include "sdch_dump_queue.h"
+#include "sdch_encoder_pool.h"
 #include "sdch_fastdict_factory.h"
+#include "sdch_stats.h"
+#include "sdch_trainer.h"
+#include "sdch_trial_memo.h"
+#include "sdch_version_index.h"
+#include "sdch_zstd_pool.h"
 
 namespace sdch {
 
@@ -24,6 +33,46 @@ class MainConfig {
   FastdictFactory fastdict_factory;
   // TODO Change config handling to pass it to FastdictFactory directly
   ngx_uint_t stor_size;
+
+  EncoderPool encoder_pool;
+  ngx_uint_t encoder_pool_size;
+  time_t encoder_pool_idle;
+
+  // Limited by "sdch_encoder_pool_size" too.
+  DeflatePool deflate_pool;
+#if (NGX_HAVE_ZSTD)
+  ZstdPool zstd_pool;
+#endif
+
+  VersionIndex version_index;
+
+  CompositeFactory composite_factory;
+  size_t composite_stor_size;
+
+  TrialMemo trial_memo;
+  time_t trial_valid;
+
+  // Created by "sdch_status". NULL if there is none.
+  Stats* stats;
+
+  // Responses sampled by "sdch_dumpdir". Set by "sdch_dump_queue".
+  DumpQueue dump_queue;
+  size_t dump_queue_size;
+  size_t dump_rate;
+  size_t dump_segment_size;
+  time_t dump_segment_age;
+  ngx_flag_t dump_compress;
+#if (NGX_THREADS)
+  ngx_thread_pool_t* dump_thread_pool;
+#endif
+  // "sdch_dumpdir" is used somewhere.
+  bool dump;
+
+  // Online training. Enabled by "sdch_train_zone".
+  Trainer trainer;
+#if (NGX_THREADS)
+  ngx_thread_pool_t* train_thread_pool;
+#endif
 };
 
 
@@ -7,17 +7,24 @@
 
 #include <assert.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "sdch_module.h"
 
-#include "sdch_autoauto_handler.h"
+#include "sdch_cache.h"
 #include "sdch_config.h"
 #include "sdch_dictionary_factory.h"
-#include "sdch_dump_handler.h"
 #include "sdch_encoding_handler.h"
+#include "sdch_handler.h"
 #include "sdch_main_config.h"
-#include "sdch_output_handler.h"
+#include "sdch_pipeline.h"
+#include "sdch_probes.h"
 #include "sdch_pool_alloc.h"
 #include "sdch_request_context.h"
+#include "sdch_stats.h"
+#include "sdch_zstd_pool.h"
 
 extern "C" {
 ngx_flag_t sdch_need_vary(ngx_http_request_t *r) {
@@ -32,14 +39,42 @@ static ngx_int_t add_variables(ngx_conf_t* cf);
 static ngx_int_t ratio_variable(ngx_http_request_t* r,
                                    ngx_http_variable_value_t* v,
                                    uintptr_t data);
-
+static ngx_int_t cache_status_variable(ngx_http_request_t* r,
+                                       ngx_http_variable_value_t* v,
+                                       uintptr_t data);
+static ngx_int_t cache_stats_variable(ngx_http_request_t* r,
+                                      ngx_http_variable_value_t* v,
+                                      uintptr_t data);
+static ngx_int_t phase_variable(ngx_http_request_t* r,
+                                ngx_http_variable_value_t* v,
+                                uintptr_t data);
+static ngx_int_t train_dict_variable(ngx_http_request_t* r,
+                                     ngx_http_variable_value_t* v,
+                                     uintptr_t data);
+static ngx_int_t context_variable(ngx_http_request_t* r,
+                                  ngx_http_variable_value_t* v,
+                                  uintptr_t data);
+
+static ngx_int_t body_filter(ngx_http_request_t* r, ngx_chain_t* in);
 static ngx_int_t filter_init(ngx_conf_t* cf);
 static void* create_conf(ngx_conf_t* cf);
 static char* merge_conf(ngx_conf_t* cf, void* parent, void* child);
 static void* create_main_conf(ngx_conf_t* cf);
 static char* init_main_conf(ngx_conf_t* cf, void* conf);
+static ngx_int_t init_process(ngx_cycle_t* cycle);
 
 static char* set_sdch_dict(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_thread_pool(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_dumpdir(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_dump_queue(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_train_zone(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_cache_zone(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_cache(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_lookahead_ratio(ngx_conf_t* cf, ngx_command_t* cmd,
+                                 void* conf);
+static char* set_status(ngx_conf_t* cf, ngx_command_t* cmd, void* conf);
+static char* set_fastdict_status(ngx_conf_t* cf, ngx_command_t* cmd,
+                                 void* conf);
 
 static ngx_conf_bitmask_t  ngx_http_sdch_proxied_mask[] = {
     { ngx_string("off"), NGX_HTTP_GZIP_PROXIED_OFF },
@@ -57,10 +92,25 @@ static ngx_str_t  ngx_http_gzip_no_cache = ngx_string("no-cache");
 static ngx_str_t  ngx_http_gzip_no_store = ngx_string("no-store");
 static ngx_str_t  ngx_http_gzip_private = ngx_string("private");
 
+static ngx_conf_enum_t sdch_encoders[] = {
+    { ngx_string("vcdiff"), ENCODER_VCDIFF },
+    { ngx_string("simd"), ENCODER_SIMD },
+    { ngx_string("optimal"), ENCODER_OPTIMAL },
+    { ngx_null_string, 0 }
+};
+
 static ngx_conf_num_bounds_t stor_size_bounds = {
     ngx_conf_check_num_bounds, 1, 0xffffffffU
 };
 
+static ngx_conf_num_bounds_t gzip_level_bounds = {
+    ngx_conf_check_num_bounds, 1, 9
+};
+
+static ngx_conf_num_bounds_t zstd_level_bounds = {
+    ngx_conf_check_num_bounds, 1, 22
+};
+
 static ngx_str_t sdch_default_types[] = {
     ngx_string("text/html"),
     ngx_string("text/css"),
@@ -128,13 +178,22 @@ static ngx_command_t  filter_commands[] = {
       offsetof(Config, sdch_url),
       NULL },
 
-   { ngx_string("sdch_dumpdir"),
+    { ngx_string("sdch_dumpdir"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
                         |NGX_HTTP_LIF_CONF
-                        |NGX_CONF_TAKE1,
-      ngx_conf_set_str_slot,
+                        |NGX_CONF_TAKE12,
+      set_dumpdir,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_train"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_HTTP_LIF_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
-      offsetof(Config, sdch_dumpdir),
+      offsetof(Config, train),
       NULL },
 
     { ngx_string("sdch_proxied"),
@@ -191,6 +250,181 @@ static ngx_command_t  filter_commands[] = {
       offsetof(Config, vary),
       NULL },
 
+    { ngx_string("sdch_slice_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, slice_size),
+      NULL },
+
+    { ngx_string("sdch_encoder"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, encoder),
+      &sdch_encoders },
+
+    { ngx_string("sdch_thread_pool"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      set_thread_pool,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE2,
+      set_cache_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      set_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_window_size"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, window_size),
+      NULL },
+
+    { ngx_string("sdch_static"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, static_files),
+      NULL },
+
+    { ngx_string("sdch_lookahead"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, lookahead),
+      NULL },
+
+    { ngx_string("sdch_lookahead_ratio"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      set_lookahead_ratio,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_delta"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, delta),
+      NULL },
+
+    { ngx_string("sdch_delta_versions"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, delta_versions),
+      NULL },
+
+    { ngx_string("sdch_delta_key"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, delta_key),
+      NULL },
+
+    { ngx_string("sdch_composite"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, composite),
+      NULL },
+
+    { ngx_string("sdch_trial_dicts"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, trial_dicts),
+      NULL },
+
+    { ngx_string("sdch_trial_key"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, trial_key),
+      NULL },
+
+    { ngx_string("sdch_gzip"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, gzip),
+      NULL },
+
+    { ngx_string("sdch_gzip_comp_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, gzip_level),
+      &gzip_level_bounds },
+
+    { ngx_string("sdch_gzip_window"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, gzip_window),
+      NULL },
+
+    { ngx_string("sdch_zstd"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, zstd),
+      NULL },
+
+    { ngx_string("sdch_zstd_level"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, zstd_level),
+      &zstd_level_bounds },
+
+    { ngx_string("sdch_cdt"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, cdt),
+      NULL },
+
+    { ngx_string("sdch_cdt_match"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF
+                        |NGX_CONF_TAKE1,
+      ngx_conf_set_str_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(Config, cdt_match),
+      NULL },
+
     { ngx_string("sdch_stor_size"),
       NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -198,6 +432,62 @@ static ngx_command_t  filter_commands[] = {
       offsetof(MainConfig, stor_size),
       &stor_size_bounds },
 
+    { ngx_string("sdch_encoder_pool_size"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(MainConfig, encoder_pool_size),
+      NULL },
+
+    { ngx_string("sdch_encoder_pool_idle"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(MainConfig, encoder_pool_idle),
+      NULL },
+
+    { ngx_string("sdch_composite_stor_size"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(MainConfig, composite_stor_size),
+      NULL },
+
+    { ngx_string("sdch_trial_valid"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_sec_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(MainConfig, trial_valid),
+      NULL },
+
+    { ngx_string("sdch_dump_queue"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      set_dump_queue,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_train_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      set_train_zone,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_status"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      set_status,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("sdch_fastdict_status"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      set_fastdict_status,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -236,6 +526,113 @@ backtrace_log(ngx_log_t *log)
 }
 #endif
 
+// Count in "sdch_status" zone if there is one.
+static void count_stat(ngx_http_request_t* r, Stats::Counter counter,
+                       ngx_atomic_int_t n = 1) {
+  Stats* stats = MainConfig::get(r)->stats;
+  if (stats != NULL) {
+    stats->add(counter, n);
+  }
+}
+
+static void count_skip(ngx_http_request_t* r, SkipReason reason) {
+  SDCH_PROBE2(skip, r, reason);
+  Stats* stats = MainConfig::get(r)->stats;
+  if (stats != NULL) {
+    stats->skipped(reason);
+  }
+}
+
+// Should response be dumped according to "sdch_dumpdir ... sample=". Don't
+// bother collecting it if dump queue is full anyway.
+static bool sample_dump(ngx_http_request_t* r, Config* conf) {
+  if (conf->dump_sample < 10000 &&
+      ngx_uint_t(ngx_random() % 10000) >= conf->dump_sample) {
+    return false;
+  }
+
+  if (!MainConfig::get(r)->dump_queue.accepting()) {
+    count_stat(r, Stats::DUMPS_DROPPED);
+    return false;
+  }
+  return true;
+}
+
+// Count skipped response and keep reason for $sdch_skip_reason. Creates
+// finished context if there is none yet.
+static RequestContext* skip_request(ngx_http_request_t* r,
+                                    SkipReason reason) {
+  count_skip(r, reason);
+
+  RequestContext* ctx = RequestContext::get(r);
+  if (ctx == NULL) {
+    ctx = POOL_ALLOC(r, RequestContext, r);
+    if (ctx == NULL) {
+      return NULL;
+    }
+    ctx->done = true;
+  }
+
+  ctx->skip_reason = reason;
+  return ctx;
+}
+
+static void set_dictionary(RequestContext* ctx, Dictionary* dict) {
+  ctx->has_dict = (dict != NULL);
+  if (dict != NULL) {
+    ctx->dict_id = dict->client_id();
+  }
+}
+
+// Dictionary response is encoded with, once it's final. Counted in status by
+// client id, or by label for per client ones.
+static void record_selection(ngx_http_request_t* r, RequestContext* ctx,
+                             Dictionary* dict, const char* label) {
+  set_dictionary(ctx, dict);
+
+  Stats* stats = MainConfig::get(r)->stats;
+  if (stats == NULL || dict == NULL) {
+    return;
+  }
+
+  ngx_str_t id;
+  if (label != NULL) {
+    id.data = reinterpret_cast<u_char*>(const_cast<char*>(label));
+    id.len = ngx_strlen(label);
+  } else {
+    id.data = const_cast<u_char*>(dict->client_id().data());
+    id.len = dict->client_id().size();
+  }
+  stats->selected(id, ctx->group);
+}
+
+// Phase histograms are filled when request is freed, after access log.
+static void record_phases(void* data) {
+  RequestContext* ctx = static_cast<RequestContext*>(data);
+  Stats* stats = MainConfig::get(ctx->request)->stats;
+  ngx_int_t location = Config::get(ctx->request)->stats_location;
+  for (int i = 0; i < PHASES; ++i) {
+    if (ctx->phase_ns[i]) {
+      stats->observe(location, Phase(i), ctx->phase_ns[i]);
+    }
+  }
+}
+
+static ngx_int_t time_phases(ngx_http_request_t* r, RequestContext* ctx) {
+  if (MainConfig::get(r)->stats == NULL ||
+      Config::get(r)->stats_location < 0) {
+    return NGX_OK;
+  }
+
+  ngx_pool_cleanup_t* cln = ngx_pool_cleanup_add(r->pool, 0);
+  if (cln == NULL) {
+    return NGX_ERROR;
+  }
+  cln->handler = record_phases;
+  cln->data = ctx;
+  return NGX_OK;
+}
+
 static ngx_table_elt_t* header_find(ngx_list_t* headers,
                                     const char* key,
                                     ngx_str_t* value) {
@@ -362,7 +759,38 @@ static FastdictFactory::ValuePtr find_quasidict(ngx_http_request_t* r,
   Dictionary::id_t id;
   std::copy(h, h + 8, id.data());
   MainConfig* main = MainConfig::get(r);
-  return main->fastdict_factory.find(id);
+  FastdictFactory::ValuePtr res = main->fastdict_factory.find(id);
+  count_stat(r, res != NULL ? Stats::QUASI_HITS : Stats::QUASI_MISSES);
+  return res;
+}
+
+// Find announced version of the URL stored by "sdch_delta".
+static FastdictFactory::ValuePtr find_version(ngx_http_request_t* r,
+                                              const ngx_str_t& version_key,
+                                              ngx_str_t val) {
+  MainConfig* main = MainConfig::get(r);
+  std::string url(reinterpret_cast<const char*>(version_key.data),
+                  version_key.len);
+
+  while (val.len >= 8) {
+    Dictionary::id_t id;
+    std::copy(val.data, val.data + 8, id.data());
+    if (main->version_index.has(url, id)) {
+      FastdictFactory::ValuePtr v = main->fastdict_factory.find(id);
+      if (v != NULL) {
+        ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                      "http sdch delta against %*s", id.size(), id.data());
+        return v;
+      }
+    }
+    val.data += 8;
+    val.len -= 8;
+    size_t l = std::min(strspn((char*)val.data, " \t,"), val.len);
+    val.data += l;
+    val.len -= l;
+  }
+
+  return FastdictFactory::ValuePtr();
 }
 
 static ngx_int_t
@@ -391,6 +819,7 @@ get_dictionary_header(ngx_http_request_t *r, Config *conf)
     h->hash = 1;
     ngx_str_set(&h->key, "Get-Dictionary");
     h->value = val;
+    count_stat(r, Stats::GET_DICTIONARY);
     return NGX_OK;
 }
 
@@ -442,14 +871,14 @@ expand_disable(ngx_http_request_t *r, Config *conf)
     return 0;
 }
 
-// Check should we process request at all
-static bool should_process(ngx_http_request_t* r, Config* conf,
-                                bool* sdch_encoded) {
+// Check should we process request at all. Returns SKIP_NONE if so.
+static SkipReason should_process(ngx_http_request_t* r, Config* conf,
+                                 bool* sdch_encoded) {
   if (!conf->enable) {
     ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "sdch header: not enabled");
 
-    return false;
+    return SKIP_DISABLED;
   }
 
   if (r->headers_out.status != NGX_HTTP_OK
@@ -458,7 +887,7 @@ static bool should_process(ngx_http_request_t* r, Config* conf,
     ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "sdch header: unsupported status");
 
-    return false;
+    return SKIP_STATUS;
   }
 
   if (r->headers_out.content_encoding
@@ -468,46 +897,83 @@ static bool should_process(ngx_http_request_t* r, Config* conf,
     const ngx_str_t &val = r->headers_out.content_encoding->value;
     if (ngx_strstrn(val.data, const_cast<char*>("sdch"), val.len) != 0) // XXX
       *sdch_encoded = true;
-    return false;
+    return SKIP_ENCODED;
   }
 
   if (r->headers_out.content_length_n != -1
     && r->headers_out.content_length_n < conf->min_length) {
     ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "sdch header: content is too small");
-    return false;
+    return SKIP_TOO_SMALL;
   }
 
   if (ngx_http_test_content_type(r, &conf->types) == NULL) {
     ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "sdch header: unsupported content type");
-    return false;
+    return SKIP_CONTENT_TYPE;
   }
 
   if (expand_disable(r, conf)) {
     ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "sdch header: CV disabled");
-    return false;
+    return SKIP_DISABLE_CV;
   }
 
-  return true;
+  return SKIP_NONE;
 }
 
+// Orders DictConfigs from the best one as choose_best_dictionary does.
+class BetterDictionary {
+ public:
+  BetterDictionary(DictionaryFactory* factory, const ngx_str_t& group)
+      : factory_(factory), group_(group) {}
+
+  bool operator()(DictConfig* a, DictConfig* b) const {
+    return a != b && factory_->choose_best_dictionary(b, a, group_) == a;
+  }
+
+ private:
+  DictionaryFactory* factory_;
+  const ngx_str_t& group_;
+};
+
 // Select Dictionary based on available dictionaries, group, support for quasis
-// and phase of the moon.
+// and phase of the moon. If candidates is not NULL all announced configured
+// dictionaries are stored there, the best first. Dictionaries trained for
+// group by "sdch_train_zone" beat configured ones and are returned in
+// trained as well as in quasidict, because they can be retired any time.
 ngx_int_t select_dictionary(ngx_http_request_t* r,
                             DictionaryFactory* dict_factory,
+                            Trainer* trainer,
                             ngx_str_t val,
                             const ngx_str_t group,
                             bool sdch_expected,
                             Dictionary*& dict,
                             bool& is_best,
-                            FastdictFactory::ValuePtr& quasidict) {
+                            FastdictFactory::ValuePtr& quasidict,
+                            FastdictFactory::ValuePtr& trained,
+                            std::vector<DictConfig*>* candidates = NULL) {
   DictConfig* bestdict = NULL;
+  ngx_uint_t trained_age = 0;
   while (val.len >= 8) {
     DictConfig* d = dict_factory->find_dictionary(val.data);
     bestdict = dict_factory->choose_best_dictionary(bestdict, d, group);
-    if (quasidict == NULL && d == NULL) {
+    if (candidates != NULL && d != NULL &&
+        std::find(candidates->begin(), candidates->end(), d) ==
+            candidates->end()) {
+      candidates->push_back(d);
+    }
+    FastdictFactory::ValuePtr t;
+    if (trainer != NULL && d == NULL) {
+      ngx_uint_t age;
+      t = trainer->find(group, val.data, &age);
+      // The newest one client has.
+      if (t != NULL && (trained == NULL || age < trained_age)) {
+        trained = t;
+        trained_age = age;
+      }
+    }
+    if (quasidict == NULL && d == NULL && t == NULL) {
       quasidict = find_quasidict(r, val.data);
       ngx_log_error(NGX_LOG_INFO,
                     r->connection->log,
@@ -522,6 +988,11 @@ ngx_int_t select_dictionary(ngx_http_request_t* r,
     val.data += l;
     val.len -= l;
   }
+  if (candidates != NULL) {
+    std::stable_sort(candidates->begin(), candidates->end(),
+                     BetterDictionary(dict_factory, group));
+  }
+
   if (bestdict != NULL) {
     ngx_log_error(NGX_LOG_INFO,
                   r->connection->log,
@@ -551,18 +1022,492 @@ ngx_int_t select_dictionary(ngx_http_request_t* r,
     dict = bestdict->dict;
   }
 
+  if (trained != NULL) {
+    dict = &trained->dict;
+    quasidict = trained;
+    is_best = (trained_age == 0);
+  } else if (trainer != NULL && trainer->current(group) != NULL) {
+    // Client should fetch the new one.
+    is_best = false;
+  }
+
   return NGX_OK;
 }
 
 
-static ngx_int_t
-header_filter(ngx_http_request_t *r)
+// Replace dict with composite of it and quasidict. Keep dict if composite
+// can't be built.
+static void
+use_composite(ngx_http_request_t *r, RequestContext* ctx, Dictionary*& dict,
+              FastdictFactory::ValuePtr& quasidict)
+{
+  FastdictFactory::ValuePtr c =
+      MainConfig::get(r)->composite_factory.get(dict, &quasidict->dict);
+  if (c == NULL) {
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "sdch: failed to build composite dictionary");
+    return;
+  }
+
+  // "<configured client_id> <quasi client_id>" for X-Sdch-Composite.
+  u_char* p = static_cast<u_char*>(ngx_pnalloc(r->pool, 8 + 1 + 8));
+  if (p == NULL) {
+    return;
+  }
+  ctx->composite_ids.data = p;
+  p = ngx_cpymem(p, dict->client_id().data(), 8);
+  *p++ = ' ';
+  p = ngx_cpymem(p, quasidict->dict.client_id().data(), 8);
+  ctx->composite_ids.len = p - ctx->composite_ids.data;
+
+  ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                "http sdch composite: %V", &ctx->composite_ids);
+
+  dict = &c->dict;
+  quasidict = c;
+}
+
+
+// Choose among sdch_trial_dicts best candidates. Either use memoized winner
+// for this location and sdch_trial_key or return NGX_AGAIN to make
+// lookahead() try them.
+static ngx_int_t
+prepare_trial(ngx_http_request_t *r, Config* conf, RequestContext* ctx,
+              const std::vector<DictConfig*>& candidates, Dictionary*& dict)
+{
+  ngx_str_t pattern;
+  if (ngx_http_complex_value(r, &conf->trial_keycv, &pattern) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  size_t n = std::min(candidates.size(), size_t(conf->trial_dicts));
+
+  std::string key(reinterpret_cast<const char*>(&conf), sizeof(conf));
+  key.append(reinterpret_cast<const char*>(pattern.data), pattern.len);
+  key.push_back('\0');
+  for (size_t i = 0; i < n; ++i) {
+    const Dictionary::id_t& id = candidates[i]->dict->server_id();
+    key.append(reinterpret_cast<const char*>(id.data()), id.size());
+  }
+
+  TrialMemo& memo = MainConfig::get(r)->trial_memo;
+  Dictionary* winner = memo.find(key, ngx_time());
+  if (winner != NULL) {
+    ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                  "http sdch trial memoized: %*s", size_t(8),
+                  winner->server_id().data());
+    dict = winner;
+    return NGX_OK;
+  }
+
+  ctx->trial_dicts = ngx_array_create(r->pool, n, sizeof(Dictionary*));
+  if (ctx->trial_dicts == NULL) {
+    return NGX_ERROR;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    Dictionary** d = static_cast<Dictionary**>(
+        ngx_array_push(ctx->trial_dicts));
+    *d = candidates[i]->dict;
+  }
+
+  ctx->trial_key.len = key.size();
+  ctx->trial_key.data = static_cast<u_char*>(ngx_pnalloc(r->pool, key.size()));
+  if (ctx->trial_key.data == NULL) {
+    return NGX_ERROR;
+  }
+  ngx_memcpy(ctx->trial_key.data, key.data(), key.size());
+
+  return NGX_AGAIN;
+}
+
+
+// Look up encoded response in sdch_cache. On miss make pipeline store it.
+static void
+prepare_cache(ngx_http_request_t *r, Config* conf, RequestContext* ctx,
+              PipelineSpec* spec)
+{
+  Cache* cache = Cache::get(conf->cache_zone);
+
+  // Only strong ETag identifies content. Quasi-dictionaries are per client
+  // so nobody will hit their entries.
+  ngx_table_elt_t* etag = r->headers_out.etag;
+  if (etag == NULL || etag->value.len == 0 ||
+      (etag->value.len > 2 && ngx_strncmp(etag->value.data, "W/", 2) == 0) ||
+      (spec->quasidict != NULL && spec->dict == &spec->quasidict->dict)) {
+    ctx->cache_status = CACHE_BYPASS;
+    return;
+  }
+
+  Cache::make_key(spec->dict, spec->encoder, r->headers_in.server,
+                  r->unparsed_uri, etag->value, &spec->cache_key);
+
+  if (cache->lookup(spec->cache_key, r->pool, &spec->cached)) {
+    ngx_log_debug(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                  "http sdch cache hit");
+    ctx->cache_status = CACHE_HIT;
+    return;
+  }
+
+  ctx->cache_status = CACHE_MISS;
+  spec->cache = cache;
+}
+
+
+// Mark response as encoded with selected Dictionary.
+static ngx_int_t
+add_encoding_headers(ngx_http_request_t *r, Config* conf,
+                     RequestContext* ctx)
+{
+  ngx_int_t rc = ctx->zstd
+      ? create_output_header(r, "Content-Encoding", "sdch-zstd")
+      : ctx->gzip
+      ? create_output_header(r, "Content-Encoding", "sdch, gzip")
+      : create_output_header(r, "Content-Encoding", "sdch");
+  if (rc != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  if (x_sdch_encode_0_header(r, false) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  SDCH_PROBE2(encode, r, ctx->dict_id.data());
+  count_stat(r, Stats::ENCODED);
+
+  if (conf->vary == 1) {
+    if (create_output_header(r, "Vary", "Accept-Encoding, Avail-Dictionary") != NGX_OK) {
+      return NGX_ERROR;
+    }
+  }
+
+  if (ctx->composite_ids.len > 0) {
+    ngx_table_elt_t* h = static_cast<ngx_table_elt_t*>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == NULL) {
+      return NGX_ERROR;
+    }
+    h->hash = 1;
+    ngx_str_set(&h->key, "X-Sdch-Composite");
+    h->value = ctx->composite_ids;
+  }
+
+  return NGX_OK;
+}
+
+
+// Accept-Encoding list has coding as a separate token. Parameters other
+// than zero q are ignored.
+static bool
+accepts_coding(const ngx_str_t& ae, const char* coding)
+{
+  size_t len = strlen(coding);
+  u_char* p = ae.data;
+  u_char* last = ae.data + ae.len;
+
+  while (p < last) {
+    while (p < last && (*p == ' ' || *p == ',')) {
+      ++p;
+    }
+    u_char* start = p;
+    while (p < last && *p != ',' && *p != ';' && *p != ' ') {
+      ++p;
+    }
+    bool match = size_t(p - start) == len &&
+                 ngx_strncasecmp(start, (u_char*)coding, len) == 0;
+
+    // "q=0", "q=0.0", ... but not "q=0.5".
+    bool zero_q = false;
+    for (; p < last && *p != ','; ++p) {
+      if (*p == 'q' && last - p > 2 && p[1] == '=' && p[2] == '0') {
+        zero_q = true;
+        p += 2;
+      } else if (zero_q && *p >= '1' && *p <= '9') {
+        zero_q = false;
+      }
+    }
+
+    if (match) {
+      return !zero_q;
+    }
+  }
+  return false;
+}
+
+
+// Client accepts gzip on top of sdch. Same checks as nginx gzip filter
+// does, so gzip_disable, gzip_proxied and gzip_http_version apply.
+static bool
+gzip_accepted(ngx_http_request_t *r)
+{
+#if (NGX_HTTP_GZIP)
+  return ngx_http_gzip_ok(r) == NGX_OK;
+#else
+  return false;
+#endif
+}
+
+
+// Stored response client announces in Available-Dictionary header. It's
+// structured field byte sequence: base64 of SHA-256 between colons.
+static FastdictFactory::ValuePtr
+find_cdt_dictionary(ngx_http_request_t *r)
+{
+  ngx_str_t val;
+  if (header_find(&r->headers_in.headers, "available-dictionary", &val) == 0
+      || val.len < 2 || val.data[0] != ':' || val.data[val.len - 1] != ':') {
+    return FastdictFactory::ValuePtr();
+  }
+
+  ngx_str_t src;
+  src.len = val.len - 2;
+  src.data = val.data + 1;
+
+  u_char sha[48];
+  ngx_str_t dst;
+  dst.len = 0;
+  dst.data = sha;
+  if (ngx_base64_decoded_length(src.len) > sizeof(sha)
+      || ngx_decode_base64(&dst, &src) != NGX_OK || dst.len != 32) {
+    return FastdictFactory::ValuePtr();
+  }
+
+  return MainConfig::get(r)->fastdict_factory.find_sha256(sha);
+}
+
+
+// Send headers of response which body will be replaced by pipeline output.
+static ngx_int_t
+send_pipeline_header(ngx_http_request_t *r)
+{
+  ngx_http_clear_content_length(r);
+  ngx_http_clear_accept_ranges(r);
+
+#if nginx_version > 1005000
+  ngx_http_clear_etag(r);
+#else
+//   TODO(wawa): adverse impact should be verified if any
+#endif
+
+  return ngx_http_next_header_filter(r);
+}
+
+
+// Replace headers of original response with precompressed file ones. Body
+// will be swapped in body_filter. Original file is never read because we
+// don't ask for main_filter_need_in_memory.
+static ngx_int_t
+send_static_header(ngx_http_request_t *r, RequestContext* ctx)
+{
+  ctx->total_in = r->headers_out.content_length_n > 0
+                      ? r->headers_out.content_length_n : 0;
+  ctx->total_out = ngx_buf_size(ctx->static_file);
+
+  ngx_http_clear_content_length(r);
+  r->headers_out.content_length_n = ctx->total_out;
+  ngx_http_clear_accept_ranges(r);
+
+#if nginx_version > 1005000
+  ngx_http_clear_etag(r);
+#endif
+
+  return ngx_http_next_header_filter(r);
+}
+
+
+// Open FILE.<server_id>.sdch produced by sdch_encode. Same way as
+// gzip_static does. Returns NGX_DECLINED if there is no such file.
+static ngx_int_t
+open_static_file(ngx_http_request_t *r, Dictionary* dict, RequestContext* ctx)
+{
+  static const char suffix[] = ".sdch";
+
+  ngx_str_t path;
+  size_t root;
+  u_char* last = ngx_http_map_uri_to_path(
+      r, &path, &root, 1 + dict->server_id().size() + sizeof(suffix) - 1);
+  if (last == NULL) {
+    return NGX_ERROR;
+  }
+
+  *last++ = '.';
+  last = ngx_cpymem(last, dict->server_id().data(), dict->server_id().size());
+  last = ngx_cpymem(last, suffix, sizeof(suffix) - 1);
+  *last = '\0';
+  path.len = last - path.data;
+
+  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "http sdch static filename: \"%V\"", &path);
+
+  ngx_http_core_loc_conf_t* clcf = static_cast<ngx_http_core_loc_conf_t*>(
+      ngx_http_get_module_loc_conf(r, ngx_http_core_module));
+
+  ngx_open_file_info_t of;
+  ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+  of.read_ahead = clcf->read_ahead;
+  of.directio = clcf->directio;
+  of.valid = clcf->open_file_cache_valid;
+  of.min_uses = clcf->open_file_cache_min_uses;
+  of.errors = clcf->open_file_cache_errors;
+  of.events = clcf->open_file_cache_events;
+
+  if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
+      != NGX_OK) {
+    if (of.err != NGX_ENOENT && of.err != NGX_ENOTDIR
+        && of.err != NGX_ENAMETOOLONG) {
+      ngx_log_error(NGX_LOG_CRIT, r->connection->log, of.err,
+                    "%s \"%s\" failed", of.failed, path.data);
+    }
+    return NGX_DECLINED;
+  }
+
+  if (!of.is_file) {
+    return NGX_DECLINED;
+  }
+
+  ngx_buf_t* b = ngx_calloc_buf(r->pool);
+  if (b == NULL) {
+    return NGX_ERROR;
+  }
+
+  b->file = static_cast<ngx_file_t*>(ngx_pcalloc(r->pool, sizeof(ngx_file_t)));
+  if (b->file == NULL) {
+    return NGX_ERROR;
+  }
+
+  b->file_pos = 0;
+  b->file_last = of.size;
+  b->in_file = b->file_last ? 1 : 0;
+  b->last_buf = (r == r->main) ? 1 : 0;
+  b->last_in_chain = 1;
+
+  b->file->fd = of.fd;
+  b->file->name = path;
+  b->file->log = r->connection->log;
+  b->file->directio = of.is_directio;
+
+  ctx->static_file = b;
+  return NGX_OK;
+}
+
+
+// Compression Dictionary Transport. Responses matching sdch_cdt_match are
+// stored as quasi-dictionaries and marked with Use-As-Dictionary. Clients
+// having one of them in Available-Dictionary get "dcz". Returns
+// NGX_DECLINED if neither applies, so SDCH can have a go.
+static ngx_int_t
+cdt_header_filter(ngx_http_request_t *r, Config* conf)
+{
+  bool sdch_encoded = false;
+  if (should_process(r, conf, &sdch_encoded) != SKIP_NONE || r->header_only
+      || ngx_http_sdch_ok(r) != NGX_OK) {
+    return NGX_DECLINED;
+  }
+
+  // Storing costs SHA-256 and index of the body, so do it only for
+  // clients that will announce it back.
+  ngx_str_t val;
+  bool dcz = false;
+  bool dcb = false;
+  if (header_find(&r->headers_in.headers, "accept-encoding", &val) != 0) {
+    dcz = accepts_coding(val, "dcz");
+    dcb = accepts_coding(val, "dcb");
+  }
+  bool mark = conf->cdt_match.len > 0
+              && r->headers_out.status == NGX_HTTP_OK
+              && (dcz || dcb);
+
+  FastdictFactory::ValuePtr dict;
+  if (conf->cdt && dcz) {
+    dict = find_cdt_dictionary(r);
+  }
+
+  if (!mark && dict == NULL) {
+    return NGX_DECLINED;
+  }
+
+  count_stat(r, Stats::REQUESTS);
+
+  RequestContext* ctx = POOL_ALLOC(r, RequestContext, r);
+  if (ctx == NULL || time_phases(r, ctx) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  set_dictionary(ctx, dict != NULL ? &dict->dict : NULL);
+  if (dict == NULL) {
+    count_skip(r, SKIP_NO_DICTIONARY);
+    ctx->skip_reason = SKIP_NO_DICTIONARY;
+  }
+
+  PipelineSpec spec;
+  spec.next_body = ngx_http_next_body_filter;
+  spec.store_as_quasi = mark;
+
+  if (mark) {
+    ngx_table_elt_t* h = static_cast<ngx_table_elt_t*>(
+        ngx_list_push(&r->headers_out.headers));
+    if (h == NULL) {
+      return NGX_ERROR;
+    }
+    h->hash = 1;
+    ngx_str_set(&h->key, "Use-As-Dictionary");
+    h->value = conf->cdt_use_as;
+  }
+
+  if (conf->cdt && conf->vary == 1) {
+    if (create_output_header(r, "Vary", "Accept-Encoding, Available-Dictionary") != NGX_OK) {
+      return NGX_ERROR;
+    }
+  }
+
+  if (dict != NULL) {
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http sdch cdt: dcz with %*s", size_t(8),
+                   dict->dict.client_id().data());
+    spec.dict = &dict->dict;
+    spec.quasidict = dict;
+    spec.encoder = ENCODER_ZSTD;
+    spec.zstd_level = conf->zstd_level;
+    spec.dcz = true;
+    if (create_output_header(r, "Content-Encoding", "dcz") != NGX_OK) {
+      return NGX_ERROR;
+    }
+    SDCH_PROBE2(encode, r, ctx->dict_id.data());
+    count_stat(r, Stats::ENCODED);
+  }
+
+  ctx->handler = create_pipeline(ctx, spec);
+  if (ctx->handler == NULL) {
+    return NGX_ERROR;
+  }
+
+  r->main_filter_need_in_memory = 1;
+
+  // Stored only. Body goes out as is, Content-Length and ETag still hold.
+  if (dict == NULL) {
+    return ngx_http_next_header_filter(r);
+  }
+
+  return send_pipeline_header(r);
+}
+
+
+static ngx_int_t
+header_filter(ngx_http_request_t *r)
 {
   ngx_log_debug(
       NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http sdch filter header 000");
 
   Config* conf = Config::get(r);
 
+  if (conf->cdt || conf->cdt_match.len) {
+    ngx_int_t rc = cdt_header_filter(r, conf);
+    if (rc != NGX_DECLINED) {
+      return rc;
+    }
+  }
+
   ngx_str_t val;
   // Workaround for nginx's strstrn which is not decrementing "n" while doing
   // outmost loop on strings. So third parameter is length(sdch) - 1.
@@ -575,16 +1520,43 @@ header_filter(ngx_http_request_t *r)
                   "http sdch filter header: no sdch in accept-encoding");
     return ngx_http_next_header_filter(r);
   }
+  SDCH_PROBE1(request, r);
+  count_stat(r, Stats::REQUESTS);
+
+  // Same dictionaries, zstd instead of VCDIFF.
+  bool zstd = conf->zstd && accepts_coding(val, "sdch-zstd");
 
   // Check that Browser announces FastDict support.
   bool store_as_quasi = false;
-  if (header_find(&r->headers_in.headers, "sdch-features", &val) != 0 &&
-      ngx_strstrn(val.data, const_cast<char*>("fastdict"), val.len) != 0) {
-    ngx_log_debug(NGX_LOG_DEBUG_HTTP,
-                  r->connection->log,
-                  0,
-                  "http sdch filter header: enable FastDict");
-    store_as_quasi = true;
+  bool composite = false;
+  bool delta = false;
+  if (header_find(&r->headers_in.headers, "sdch-features", &val) != 0) {
+    if (conf->delta &&
+        ngx_strstrn(val.data, const_cast<char*>("delta"),
+                    size_t(5 - 1)) != 0) {
+      ngx_log_debug(NGX_LOG_DEBUG_HTTP,
+                    r->connection->log,
+                    0,
+                    "http sdch filter header: enable delta");
+      delta = true;
+      store_as_quasi = true;
+    }
+    if (ngx_strstrn(val.data, const_cast<char*>("fastdict"), val.len) != 0) {
+      ngx_log_debug(NGX_LOG_DEBUG_HTTP,
+                    r->connection->log,
+                    0,
+                    "http sdch filter header: enable FastDict");
+      store_as_quasi = true;
+    }
+    if (conf->composite &&
+        ngx_strstrn(val.data, const_cast<char*>("composite"),
+                    size_t(9 - 1)) != 0) {
+      ngx_log_debug(NGX_LOG_DEBUG_HTTP,
+                    r->connection->log,
+                    0,
+                    "http sdch filter header: enable composite");
+      composite = true;
+    }
   }
 
   if (header_find(&r->headers_in.headers, "avail-dictionary", &val) == 0) {
@@ -593,11 +1565,15 @@ header_filter(ngx_http_request_t *r)
   bool sdch_expected = (val.len > 0);
 
   bool sdch_encoded = false;
-  if (!should_process(r, conf, &sdch_encoded)) {
+  SkipReason skip = should_process(r, conf, &sdch_encoded);
+  if (skip != SKIP_NONE) {
     ngx_log_debug(NGX_LOG_DEBUG_HTTP,
                   r->connection->log,
                   0,
                   "http sdch filter header: skipping request");
+    if (skip_request(r, skip) == NULL) {
+      return NGX_ERROR;
+    }
     ngx_int_t e = x_sdch_encode_0_header(r, sdch_expected && !sdch_encoded);
     if (e)
       return e;
@@ -605,10 +1581,16 @@ header_filter(ngx_http_request_t *r)
   }
 
   if (r->header_only) {
+    if (skip_request(r, SKIP_HEADER_ONLY) == NULL) {
+      return NGX_ERROR;
+    }
     return ngx_http_next_header_filter(r);
   }
 
   if (ngx_http_sdch_ok(r) != NGX_OK) {
+    if (skip_request(r, SKIP_PROXIED) == NULL) {
+      return NGX_ERROR;
+    }
     return ngx_http_next_header_filter(r);
   }
 
@@ -619,16 +1601,50 @@ header_filter(ngx_http_request_t *r)
 
   Dictionary* dict = NULL;
   FastdictFactory::ValuePtr quasidict;
+  FastdictFactory::ValuePtr trained;
   bool is_best;
+  std::vector<DictConfig*> candidates;
+
+  Trainer* trainer = NULL;
+  if (MainConfig::get(r)->trainer.enabled()) {
+    trainer = &MainConfig::get(r)->trainer;
+    trainer->refresh(r->connection->log);
+  }
+
+  ngx_str_t version_key = ngx_null_string;
+  if (delta) {
+    if (ngx_http_complex_value(r, &conf->delta_keycv, &version_key)
+        != NGX_OK) {
+      return NGX_ERROR;
+    }
+  }
 
-  select_dictionary(r,
-                    conf->dict_factory,
-                    val,
-                    group,
-                    sdch_expected,
-                    dict,
-                    is_best,
-                    quasidict);
+  uint64_t select_ns = 0;
+  {
+    ScopedTimer timer(&select_ns);
+    select_dictionary(r,
+                      conf->dict_factory,
+                      trainer,
+                      val,
+                      group,
+                      sdch_expected,
+                      dict,
+                      is_best,
+                      quasidict,
+                      trained,
+                      conf->trial_dicts > 1 ? &candidates : NULL);
+  }
+  SDCH_PROBE4(select, r, dict != NULL ? dict->client_id().data() : NULL,
+              is_best, quasidict != NULL);
+
+  // Client's copy of this URL beats any generic dictionary.
+  if (delta) {
+    FastdictFactory::ValuePtr version = find_version(r, version_key, val);
+    if (version != NULL) {
+      dict = &version->dict;
+      quasidict = version;
+    }
+  }
 
   // No the best Dictionary selected.
   if (!is_best) {
@@ -637,6 +1653,12 @@ header_filter(ngx_http_request_t *r)
       return e;
   }
 
+  // Sampled responses go through pipeline even without dictionary.
+  ngx_int_t train_slot = -1;
+  if (conf->train && trainer != NULL) {
+    train_slot = trainer->reserve(group);
+  }
+
   // Actually it wasn't selected at all.
   if (dict == NULL) {
     ngx_int_t e = x_sdch_encode_0_header(r, sdch_expected);
@@ -646,252 +1668,1525 @@ header_filter(ngx_http_request_t *r)
     if (store_as_quasi) {
       if (create_output_header(r, "X-Sdch-Use-As-Dictionary", "1") != NGX_OK)
         return NGX_ERROR;
-    } else {
+    } else if (train_slot < 0) {
+      RequestContext* ctx = skip_request(r, SKIP_NO_DICTIONARY);
+      if (ctx == NULL || time_phases(r, ctx) != NGX_OK) {
+        return NGX_ERROR;
+      }
+      ctx->phase_ns[PHASE_SELECT] = select_ns;
+      ctx->selected = true;
+      ctx->is_best = is_best;
+      ctx->group = group;
       return ngx_http_next_header_filter(r);
     }
+  } else if (delta) {
+    // Encoded reply is stored as the next version too.
+    if (create_output_header(r, "X-Sdch-Use-As-Dictionary", "1") != NGX_OK)
+      return NGX_ERROR;
+  }
+
+
+  RequestContext* ctx = POOL_ALLOC(r, RequestContext, r);
+  if (ctx == NULL || time_phases(r, ctx) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  ctx->phase_ns[PHASE_SELECT] = select_ns;
+  ctx->selected = true;
+  ctx->is_best = is_best;
+  ctx->quasi_hit = (quasidict != NULL && quasidict != trained);
+  ctx->group = group;
+  if (dict == NULL) {
+    count_skip(r, SKIP_NO_DICTIONARY);
+    ctx->skip_reason = SKIP_NO_DICTIONARY;
+  }
+
+  // Client has both configured and quasi-dictionary. Use them together.
+  if (composite && dict != NULL && quasidict != NULL &&
+      dict != &quasidict->dict) {
+    use_composite(r, ctx, dict, quasidict);
   }
 
+  // Look-ahead below is always enabled with sdch_trial_dicts.
+  bool trial = false;
+  if (candidates.size() > 1 && !store_as_quasi && r == r->main &&
+      (quasidict == NULL || dict != &quasidict->dict)) {
+    ngx_int_t rc = prepare_trial(r, conf, ctx, candidates, dict);
+    if (rc == NGX_ERROR) {
+      return NGX_ERROR;
+    }
+    trial = (rc == NGX_AGAIN);
+  }
+
+  // Winner of fresh trial is recorded by lookahead().
+  if (!trial) {
+    const char* label = NULL;
+    if (ctx->composite_ids.len > 0) {
+      label = "composite";
+    } else if (quasidict != NULL && dict == &quasidict->dict &&
+               quasidict != trained) {
+      label = "quasi";
+    }
+    record_selection(r, ctx, dict, label);
+  }
+
+  PipelineSpec spec;
+  spec.next_body = ngx_http_next_body_filter;
+
+  // If we have actual Dictionary - do encode response
+  if (dict != NULL) {
+    spec.dict = dict;
+    spec.quasidict = quasidict;
+    spec.encoder = conf->encoder;
+#if (NGX_THREADS)
+    spec.thread_pool = conf->thread_pool;
+#endif
+    if (zstd) {
+      ctx->zstd = true;
+      spec.encoder = ENCODER_ZSTD;
+      spec.zstd_level = conf->zstd_level;
+    }
+    spec.window_size = conf->window_size;
+
+    // Quasi-dictionaries are per client and FastDict needs original body.
+    // Unknown trial winner may have neither static file nor cache entry.
+    // Precompressed files are VCDIFF.
+    if (conf->static_files && !store_as_quasi && !trial && !zstd &&
+        (quasidict == NULL || dict != &quasidict->dict)) {
+      ngx_int_t rc = open_static_file(r, dict, ctx);
+      if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+      }
+      if (rc == NGX_OK) {
+        if (add_encoding_headers(r, conf, ctx) != NGX_OK) {
+          return NGX_ERROR;
+        }
+        return send_static_header(r, ctx);
+      }
+    }
+
+    if (conf->cache_zone != NULL && !trial) {
+      prepare_cache(r, conf, ctx, &spec);
+    }
+
+    if (conf->gzip && !zstd && gzip_accepted(r)) {
+      ctx->gzip = true;
+      spec.gzip = true;
+      spec.gzip_level = conf->gzip_level;
+      spec.gzip_wbits = conf->gzip_wbits;
+    }
+  }
+
+  spec.dump = conf->sdch_dumpdir.len > 0 && sample_dump(r, conf);
+  spec.train_slot = train_slot;
+
+  // If we have to create new quasi-dictionary
+  spec.store_as_quasi = store_as_quasi;
+  spec.version_key = version_key;
+  spec.versions = conf->delta_versions;
+
+  // Cached and quasi-storing responses are cheap or need encoding anyway.
+  // Subrequests have no last_buf to wait for.
+  bool look = conf->lookahead && dict != NULL && !store_as_quasi &&
+              r == r->main && ctx->cache_status != CACHE_HIT;
+
+  if (look) {
+    // Pipeline will be created for the winner, if encoding pays off.
+    ctx->spec = POOL_ALLOC(r, PipelineSpec, spec);
+    if (ctx->spec == NULL) {
+      return NGX_ERROR;
+    }
+  } else {
+    ctx->handler = create_pipeline(ctx, spec);
+    if (ctx->handler == NULL) {
+      return NGX_ERROR;
+    }
+  }
+
+  r->main_filter_need_in_memory = 1;
+
+  if (look) {
+    ctx->lookahead = ngx_create_temp_buf(r->pool, conf->lookahead);
+    if (ctx->lookahead == NULL) {
+      return NGX_ERROR;
+    }
+    ctx->lookahead_dict = dict;
+    // Headers will be sent by body_filter.
+    return NGX_OK;
+  }
+
+  // Sampled or stored only. Body goes out as is, Content-Length and ETag
+  // still hold.
+  if (dict == NULL) {
+    return ngx_http_next_header_filter(r);
+  }
+
+  if (add_encoding_headers(r, conf, ctx) != NGX_OK) {
+    return NGX_ERROR;
+  }
+
+  return send_pipeline_header(r);
+}
+
+
+// Keep the rest of input until RequestContext::resume() brings us back with
+// empty chain.
+static ngx_int_t
+keep_input(ngx_http_request_t *r, RequestContext* ctx, ngx_chain_t* in)
+{
+  if (ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+    ctx->done = true;
+    return NGX_ERROR;
+  }
+  r->buffered |= SDCH_BUFFERED;
+  return NGX_AGAIN;
+}
+
+
+// Keep the rest of input and let other connections run.
+static ngx_int_t
+yield_slice(ngx_http_request_t *r, RequestContext* ctx, ngx_chain_t* in)
+{
+  ngx_log_debug(NGX_LOG_DEBUG_HTTP,
+      r->connection->log, 0, "sdch slice exhausted, yielding");
+
+  ngx_int_t rc = keep_input(r, ctx, in);
+  if (rc == NGX_AGAIN) {
+    ctx->resume();
+  }
+  return rc;
+}
+
+
+// Encode data with Encoder as EncodingHandler does.
+template <typename Encoder>
+static bool
+trial_encode(RequestContext* ctx, const PipelineSpec& spec, Dictionary* dict,
+             const u_char* data, size_t len, std::string* res)
+{
+  open_vcdiff::OutputString<std::string> out(res);
+  Encoder enc;
+  return enc.start(ctx, dict, spec.quasidict, &out) &&
+         enc.encode(reinterpret_cast<const char*>(data), len, &out) &&
+         enc.finish(&out);
+}
+
+
+#if (NGX_HAVE_ZSTD)
+// Compress data into single frame as ZstdEncodingHandler does.
+static bool
+trial_zstd(RequestContext* ctx, const PipelineSpec& spec, Dictionary* dict,
+           const u_char* data, size_t len, std::string* res)
+{
+  ZstdPool* pool = &MainConfig::get(ctx->request)->zstd_pool;
+  ZSTD_CCtx* cctx = pool->borrow();
+  if (cctx == NULL) {
+    return false;
+  }
+
+  bool ok;
+  if (spec.quasidict != NULL && dict == &spec.quasidict->dict) {
+    ok = dict->has_payload() &&
+         !ZSTD_isError(ZSTD_CCtx_setParameter(
+             cctx, ZSTD_c_compressionLevel, spec.zstd_level)) &&
+         !ZSTD_isError(ZSTD_CCtx_refPrefix(
+             cctx, dict->payload(), dict->payload_size()));
+  } else {
+    const ZSTD_CDict* cdict = pool->cdict(dict, spec.zstd_level);
+    ok = cdict != NULL && !ZSTD_isError(ZSTD_CCtx_refCDict(cctx, cdict));
+  }
+
+  if (ok) {
+    res->resize(ZSTD_compressBound(len));
+    size_t n = ZSTD_compress2(cctx, &(*res)[0], res->size(), data, len);
+    ok = !ZSTD_isError(n);
+    res->resize(ok ? n : 0);
+  }
+
+  if (ok) {
+    pool->release(cctx);
+  } else {
+    ZSTD_freeCCtx(cctx);
+  }
+  return ok;
+}
+#endif
+
+
+// Size of data encoded against dict with encoder of spec. -1 on error.
+// "sdch_encoder optimal" runs on thread pool, so it is estimated with
+// VcdiffEngine here. Its output is never bigger.
+static ssize_t
+trial_size(RequestContext* ctx, const PipelineSpec& spec, Dictionary* dict,
+           const u_char* data, size_t len)
+{
+  std::string trial;
+  bool ok;
+  switch (spec.encoder) {
+#if (NGX_HAVE_ZSTD)
+    case ENCODER_ZSTD:
+      ok = trial_zstd(ctx, spec, dict, data, len, &trial);
+      break;
+#endif
+    case ENCODER_VCDIFF:
+      ok = trial_encode<OpenVcdiffEncoder>(ctx, spec, dict, data, len,
+                                           &trial);
+      break;
+    default:
+      ok = trial_encode<SimdEncoder>(ctx, spec, dict, data, len, &trial);
+      break;
+  }
+  if (!ok) {
+    return -1;
+  }
+
+  ngx_log_debug4(NGX_LOG_DEBUG_HTTP, ctx->request->connection->log, 0,
+                 "sdch trial %*s: %uz -> %uz", size_t(8),
+                 dict->server_id().data(), len, trial.size());
+
+  return trial.size();
+}
+
+
+// Encode start of response and check does it pay off.
+static bool
+lookahead_pays_off(ngx_http_request_t *r, RequestContext* ctx, Config* conf)
+{
+  ngx_buf_t* b = ctx->lookahead;
+  size_t len = b->last - b->pos;
+
+  // sdch_min_length for responses without Content-Length.
+  if (b->last_buf && ssize_t(len) < conf->min_length) {
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "sdch lookahead: %uz bytes is too small", len);
+    return false;
+  }
+
+  ssize_t size;
+  if (ctx->trial_dicts == NULL) {
+    size = trial_size(ctx, *ctx->spec, ctx->lookahead_dict, b->pos, len);
+  } else {
+    // Choose the smallest one among sdch_trial_dicts.
+    size = -1;
+    Dictionary** d = static_cast<Dictionary**>(ctx->trial_dicts->elts);
+    for (ngx_uint_t i = 0; i < ctx->trial_dicts->nelts; ++i) {
+      ssize_t s = trial_size(ctx, *ctx->spec, d[i], b->pos, len);
+      if (s >= 0 && (size < 0 || s < size)) {
+        size = s;
+        ctx->lookahead_dict = d[i];
+      }
+    }
+    if (size >= 0) {
+      std::string key(reinterpret_cast<const char*>(ctx->trial_key.data),
+                      ctx->trial_key.len);
+      MainConfig::get(r)->trial_memo.store(key, ctx->lookahead_dict,
+                                           ngx_time());
+    }
+  }
+
+  return size >= 0 && len * 100 >= size_t(size) * conf->lookahead_ratio;
+}
+
+
+// Buffer start of response until sdch_lookahead bytes or end of it. Then
+// send either SDCH-encoded or original response. Flushes are ignored while
+// buffering.
+static ngx_int_t
+lookahead(ngx_http_request_t *r, RequestContext* ctx, ngx_chain_t* in)
+{
+  ngx_buf_t* b = ctx->lookahead;
+
+  for (; in; in = in->next) {
+    size_t n = std::min(size_t(in->buf->last - in->buf->pos),
+                        size_t(b->end - b->last));
+    b->last = ngx_cpymem(b->last, in->buf->pos, n);
+    in->buf->pos += n;
+
+    if (in->buf->pos != in->buf->last) {
+      break;
+    }
+
+    if (in->buf->last_buf) {
+      b->last_buf = 1;
+      in = NULL;
+      break;
+    }
+  }
+
+  if (!b->last_buf && b->last != b->end) {
+    return NGX_OK;
+  }
+
+  Config* conf = Config::get(r);
+  bool encode = lookahead_pays_off(r, ctx, conf);
+  ctx->lookahead = NULL;
+
+  // Winner of sdch_trial_dicts is known only now.
+  if (ctx->trial_dicts != NULL) {
+    record_selection(r, ctx, ctx->lookahead_dict, NULL);
+  }
+
+  // Empty last buffer should be special one.
+  if (b->pos == b->last) {
+    b->temporary = 0;
+  }
+
+  ngx_chain_t* out = ngx_alloc_chain_link(r->pool);
+  if (out == NULL) {
+    return NGX_ERROR;
+  }
+  out->buf = b;
+  out->next = in;
+
+  ngx_int_t rc;
+  if (!encode) {
+    ctx->done = true;
+    count_skip(r, SKIP_LOOKAHEAD);
+    ctx->skip_reason = SKIP_LOOKAHEAD;
+    set_dictionary(ctx, NULL);
+    if (x_sdch_encode_0_header(r, true) != NGX_OK) {
+      return NGX_ERROR;
+    }
+    rc = ngx_http_next_header_filter(r);
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+      return rc;
+    }
+    return ngx_http_next_body_filter(r, out);
+  }
+
+  if (ctx->spec != NULL) {
+    ctx->spec->dict = ctx->lookahead_dict;
+    ctx->handler = create_pipeline(ctx, *ctx->spec);
+    if (ctx->handler == NULL) {
+      return NGX_ERROR;
+    }
+  }
+
+  if (add_encoding_headers(r, conf, ctx) != NGX_OK) {
+    return NGX_ERROR;
+  }
+  rc = send_pipeline_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+  return body_filter(r, out);
+}
+
+
+// Drop original body and send precompressed file instead of the last buffer.
+static ngx_int_t
+send_static_body(ngx_http_request_t *r, RequestContext* ctx, ngx_chain_t* in)
+{
+  bool last = false;
+  for (; in; in = in->next) {
+    in->buf->pos = in->buf->last;
+    in->buf->file_pos = in->buf->file_last;
+    last = last || in->buf->last_buf || in->buf->last_in_chain;
+  }
+
+  if (!last) {
+    return NGX_OK;
+  }
+
+  ctx->done = true;
+  count_stat(r, Stats::BYTES_IN, ctx->total_in);
+  count_stat(r, Stats::BYTES_OUT, ctx->total_out);
+
+  ngx_chain_t out;
+  out.buf = ctx->static_file;
+  out.next = NULL;
+  return ngx_http_next_body_filter(r, &out);
+}
+
+
+static ngx_int_t
+body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+{
+  RequestContext* ctx = RequestContext::get(r);
+
+  ngx_log_debug0(
+      NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http sdch filter body 000");
+
+  if (ctx == NULL || ctx->done || r->header_only) {
+    return ngx_http_next_body_filter(r, in);
+  }
+
+  if (ctx->static_file) {
+    return send_static_body(r, ctx, in);
+  }
+
+  if (ctx->lookahead) {
+    return lookahead(r, ctx, in);
+  }
+
+  if (!ctx->started) {
+    ctx->started = true;
+    ScopedTimer timer(&ctx->phase_ns[PHASE_INIT]);
+    if (!ctx->handler->init(ctx)) {
+      ctx->done = true;
+      return NGX_ERROR;
+    }
+  }
+
+  ngx_log_debug0(
+      NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http sdch filter started");
+
+  // Resume from where previous slice stopped. New data goes after it.
+  if (ctx->in) {
+    if (in && ngx_chain_add_copy(r->pool, &ctx->in, in) != NGX_OK) {
+      ctx->done = true;
+      return NGX_ERROR;
+    }
+    in = ctx->in;
+    ctx->in = NULL;
+    r->buffered &= ~SDCH_BUFFERED;
+  }
+
+  Config* conf = Config::get(r);
+  size_t budget = conf->slice_size;
+
+  // cycle while there is data to handle
+  for (; in; in = in->next) {
+    // Parallel windows have no room for more. They will resume us.
+    if (ctx->input_blocked && ngx_buf_size(in->buf) > 0) {
+      ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                     "sdch input blocked");
+      return keep_input(r, ctx, in);
+    }
+
+    if (in->buf->flush) {
+      ctx->need_flush = true;
+    }
+
+    off_t buf_size = ngx_buf_size(in->buf);
+    if (conf->slice_size && buf_size > off_t(budget)) {
+      buf_size = budget;
+    }
+
+    if (buf_size > 0 || in->buf->pos == in->buf->last) {
+      ngx_int_t status = ctx->handler->on_data(in->buf->pos, buf_size);
+      in->buf->pos += buf_size;
+      ctx->total_in += buf_size;
+      budget -= buf_size;
+
+      if (status == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0, "sdch failed");
+        ctx->done = true;
+        return NGX_ERROR;
+      }
+    }
+
+    // Slice exhausted in the middle of buffer.
+    if (in->buf->pos != in->buf->last) {
+      return yield_slice(r, ctx, in);
+    }
+
+    if (in->buf->last_buf) {
+      ngx_log_debug(NGX_LOG_DEBUG_HTTP,
+          ctx->request->connection->log, 0, "closing ctx");
+      ctx->done = true;
+      ngx_int_t rc = ctx->handler->on_finish();
+      count_stat(r, Stats::BYTES_IN, ctx->total_in);
+      count_stat(r, Stats::BYTES_OUT, ctx->total_out);
+      return rc;
+    }
+  }
+
+  return NGX_OK;
+}
+
+
+static ngx_str_t ratio = ngx_string("sdch_ratio");
+static ngx_str_t cache_status = ngx_string("sdch_cache_status");
+static ngx_str_t cache_hits = ngx_string("sdch_cache_hits");
+static ngx_str_t cache_misses = ngx_string("sdch_cache_misses");
+static ngx_str_t train_dict = ngx_string("sdch_train_dict");
+// RequestContext fields exposed by context_variable.
+enum ContextVariable {
+  VAR_DICT_ID,
+  VAR_DICT_GROUP,
+  VAR_IS_BEST,
+  VAR_QUASI_HIT,
+  VAR_BYTES_IN,
+  VAR_BYTES_OUT,
+  VAR_SKIP_REASON,
+  CONTEXT_VARS
+};
+
+// Indexed by ContextVariable.
+static ngx_str_t context_vars[] = {
+    ngx_string("sdch_dict_id"),
+    ngx_string("sdch_dict_group"),
+    ngx_string("sdch_is_best"),
+    ngx_string("sdch_quasi_hit"),
+    ngx_string("sdch_bytes_in"),
+    ngx_string("sdch_bytes_out"),
+    ngx_string("sdch_skip_reason"),
+};
+
+// Indexed by Phase.
+static ngx_str_t phase_vars[] = {
+    ngx_string("sdch_select_usec"),
+    ngx_string("sdch_init_usec"),
+    ngx_string("sdch_encode_usec"),
+    ngx_string("sdch_autoauto_usec"),
+    ngx_string("sdch_output_usec"),
+};
+
+static ngx_int_t
+add_variables(ngx_conf_t *cf)
+{
+    ngx_http_variable_t  *var;
+
+    var = ngx_http_add_variable(cf, &ratio, NGX_HTTP_VAR_NOHASH);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = ratio_variable;
+
+    var = ngx_http_add_variable(cf, &cache_status, NGX_HTTP_VAR_NOHASH);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = cache_status_variable;
+
+    var = ngx_http_add_variable(cf, &cache_hits, NGX_HTTP_VAR_NOCACHEABLE);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = cache_stats_variable;
+    var->data = offsetof(Cache::Stats, hits);
+
+    var = ngx_http_add_variable(cf, &cache_misses, NGX_HTTP_VAR_NOCACHEABLE);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = cache_stats_variable;
+    var->data = offsetof(Cache::Stats, misses);
+
+    var = ngx_http_add_variable(cf, &train_dict, NGX_HTTP_VAR_NOCACHEABLE);
+    if (var == NULL) {
+        return NGX_ERROR;
+    }
+
+    var->get_handler = train_dict_variable;
+
+    for (int i = 0; i < PHASES; ++i) {
+        var = ngx_http_add_variable(cf, &phase_vars[i],
+                                    NGX_HTTP_VAR_NOCACHEABLE);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = phase_variable;
+        var->data = i;
+    }
+
+    for (int i = 0; i < CONTEXT_VARS; ++i) {
+        var = ngx_http_add_variable(cf, &context_vars[i],
+                                    NGX_HTTP_VAR_NOCACHEABLE);
+        if (var == NULL) {
+            return NGX_ERROR;
+        }
+
+        var->get_handler = context_variable;
+        var->data = i;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ratio_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_uint_t            zint, zfrac;
+    RequestContext  *ctx = RequestContext::get(r);
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+
+    if (ctx == NULL || ctx->total_out == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = static_cast<u_char*>(ngx_pnalloc(r->pool, NGX_INT32_LEN + 3));
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    zint = (ngx_uint_t) (ctx->total_in / ctx->total_out);
+    zfrac = (ngx_uint_t) ((ctx->total_in * 100 / ctx->total_out) % 100);
+
+    if ((ctx->total_in * 1000 / ctx->total_out) % 10 > 4) {
+
+        /* the rounding, e.g., 2.125 to 2.13 */
+
+        zfrac++;
+
+        if (zfrac > 99) {
+            zint++;
+            zfrac = 0;
+        }
+    }
+
+    v->len = ngx_sprintf(v->data, "%ui.%02ui", zint, zfrac) - v->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+cache_status_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    static ngx_str_t  names[] = {
+        ngx_null_string,
+        ngx_string("BYPASS"),
+        ngx_string("MISS"),
+        ngx_string("HIT"),
+    };
+
+    RequestContext  *ctx = RequestContext::get(r);
+
+    if (ctx == NULL || ctx->cache_status == CACHE_NONE) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = names[ctx->cache_status].len;
+    v->data = names[ctx->cache_status].data;
+
+    return NGX_OK;
+}
+
+
+// File name of the newest dictionary trained for sdch_group of request.
+static ngx_int_t
+train_dict_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    static const char  suffix[] = ".dict";
+
+    Trainer  &trainer = MainConfig::get(r)->trainer;
+    ngx_str_t  group;
+
+    if (!trainer.enabled()
+        || ngx_http_complex_value(r, &Config::get(r)->sdch_groupcv, &group)
+           != NGX_OK)
+    {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    trainer.refresh(r->connection->log);
+    FastdictFactory::ValuePtr d = trainer.current(group);
+    if (d == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    const Dictionary::id_t& id = d->dict.client_id();
+    u_char* p = static_cast<u_char*>(
+        ngx_pnalloc(r->pool, id.size() + sizeof(suffix) - 1));
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->data = p;
+    p = ngx_cpymem(p, id.data(), id.size());
+    p = ngx_cpymem(p, suffix, sizeof(suffix) - 1);
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->len = p - v->data;
+
+    return NGX_OK;
+}
+
+
+// Zone-wide counter at offset data of Cache::Stats.
+static ngx_int_t
+cache_stats_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    Config  *conf = Config::get(r);
+
+    if (conf->cache_zone == NULL || Cache::get(conf->cache_zone) == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    Cache::Stats stats = Cache::get(conf->cache_zone)->stats();
+    ngx_uint_t value = *reinterpret_cast<ngx_uint_t*>(
+        reinterpret_cast<char*>(&stats) + data);
+
+    v->data = static_cast<u_char*>(ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN));
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+    v->len = ngx_sprintf(v->data, "%ui", value) - v->data;
+
+    return NGX_OK;
+}
+
+
+// Microseconds spent in Phase data. Not found if it didn't happen.
+static ngx_int_t
+phase_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    RequestContext  *ctx = RequestContext::get(r);
+
+    if (ctx == NULL || ctx->phase_ns[data] == 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->data = static_cast<u_char*>(ngx_pnalloc(r->pool, NGX_INT64_LEN));
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+    v->len = ngx_sprintf(v->data, "%uL", ctx->phase_ns[data] / 1000)
+             - v->data;
+
+    return NGX_OK;
+}
+
+
+// Decision about response. Flags are "1" or "0" and not found if there
+// was no dictionary selection, sizes are not found unless it's encoded.
+static ngx_int_t
+context_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    RequestContext  *ctx = RequestContext::get(r);
+
+    v->not_found = 1;
+    if (ctx == NULL) {
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 1;
+    v->not_found = 0;
+
+    size_t size = 0;
+    bool flag = false;
+    switch (data) {
+    case VAR_DICT_ID:
+        if (!ctx->has_dict) {
+            v->not_found = 1;
+            return NGX_OK;
+        }
+        v->data = ctx->dict_id.data();
+        v->len = ctx->dict_id.size();
+        return NGX_OK;
+
+    case VAR_DICT_GROUP:
+        v->data = ctx->group.data;
+        v->len = ctx->group.len;
+        v->not_found = !ctx->selected;
+        return NGX_OK;
+
+    case VAR_IS_BEST:
+    case VAR_QUASI_HIT:
+        if (!ctx->selected) {
+            v->not_found = 1;
+            return NGX_OK;
+        }
+        flag = (data == VAR_IS_BEST) ? ctx->is_best : ctx->quasi_hit;
+        v->data = const_cast<u_char*>(
+            reinterpret_cast<const u_char*>(flag ? "1" : "0"));
+        v->len = 1;
+        return NGX_OK;
+
+    case VAR_BYTES_IN:
+    case VAR_BYTES_OUT:
+        if (ctx->total_out == 0) {
+            v->not_found = 1;
+            return NGX_OK;
+        }
+        size = (data == VAR_BYTES_IN) ? ctx->total_in : ctx->total_out;
+        v->data = static_cast<u_char*>(ngx_pnalloc(r->pool, NGX_SIZE_T_LEN));
+        if (v->data == NULL) {
+            return NGX_ERROR;
+        }
+        v->len = ngx_sprintf(v->data, "%uz", size) - v->data;
+        return NGX_OK;
+
+    case VAR_SKIP_REASON:
+        if (ctx->skip_reason == SKIP_NONE) {
+            v->not_found = 1;
+            return NGX_OK;
+        }
+        v->data = skip_reason_name(ctx->skip_reason).data;
+        v->len = skip_reason_name(ctx->skip_reason).len;
+        return NGX_OK;
+    }
+
+    v->not_found = 1;
+    return NGX_OK;
+}
+
+static void *
+create_main_conf(ngx_conf_t *cf)
+{
+    return POOL_ALLOC(cf, MainConfig);
+}
+
+static char *
+init_main_conf(ngx_conf_t *cf, void *cnf)
+{
+    MainConfig *conf = static_cast<MainConfig*>(cnf);
+    if (conf->stor_size != NGX_CONF_UNSET_SIZE)
+        conf->fastdict_factory.set_max_size(conf->stor_size);
+    if (conf->encoder_pool_size != NGX_CONF_UNSET_UINT) {
+        conf->encoder_pool.set_max_size(conf->encoder_pool_size);
+        conf->deflate_pool.set_max_size(conf->encoder_pool_size);
+#if (NGX_HAVE_ZSTD)
+        conf->zstd_pool.set_max_size(conf->encoder_pool_size);
+#endif
+    }
+    if (conf->encoder_pool_idle != NGX_CONF_UNSET)
+        conf->encoder_pool.set_idle_timeout(conf->encoder_pool_idle);
+    if (conf->composite_stor_size != NGX_CONF_UNSET_SIZE)
+        conf->composite_factory.set_max_size(conf->composite_stor_size);
+    if (conf->trial_valid != NGX_CONF_UNSET)
+        conf->trial_memo.set_valid(conf->trial_valid);
+
+    if (conf->dump_queue_size != NGX_CONF_UNSET_SIZE)
+        conf->dump_queue.set_max_size(conf->dump_queue_size);
+    if (conf->dump_rate != NGX_CONF_UNSET_SIZE)
+        conf->dump_queue.set_rate(conf->dump_rate);
+    ngx_conf_init_size_value(conf->dump_segment_size, 64 * 1024 * 1024);
+    ngx_conf_init_value(conf->dump_segment_age, 600);
+    ngx_conf_init_value(conf->dump_compress, 0);
+    conf->dump_queue.set_segment(conf->dump_segment_size,
+                                 conf->dump_segment_age,
+                                 conf->dump_compress);
+#if (NGX_THREADS)
+    // Dumps are written on nginx "default" pool unless told otherwise.
+    if (conf->dump_thread_pool == NGX_CONF_UNSET_PTR) {
+        conf->dump_thread_pool = NULL;
+        if (conf->dump) {
+            ngx_str_t name = ngx_string("default");
+            conf->dump_thread_pool = ngx_thread_pool_add(cf, &name);
+            if (conf->dump_thread_pool == NULL) {
+                return static_cast<char*>(NGX_CONF_ERROR);
+            }
+        }
+    }
+    conf->dump_queue.set_thread_pool(conf->dump_thread_pool);
+
+    // The same for training.
+    if (conf->train_thread_pool == NGX_CONF_UNSET_PTR) {
+        conf->train_thread_pool = NULL;
+        if (conf->trainer.enabled()) {
+            ngx_str_t name = ngx_string("default");
+            conf->train_thread_pool = ngx_thread_pool_add(cf, &name);
+            if (conf->train_thread_pool == NULL) {
+                return static_cast<char*>(NGX_CONF_ERROR);
+            }
+        }
+    }
+    conf->trainer.set_thread_pool(conf->train_thread_pool);
+#endif
+    return NGX_CONF_OK;
+}
+
+static ngx_int_t
+init_process(ngx_cycle_t *cycle)
+{
+    MainConfig *conf = static_cast<MainConfig*>(
+        ngx_http_cycle_get_module_main_conf(cycle, sdch_module));
+    if (conf == NULL) {
+        return NGX_OK;
+    }
+    return conf->trainer.init_process(cycle);
+}
+
+static void *
+create_conf(ngx_conf_t *cf)
+{
+  return POOL_ALLOC(cf, Config, cf->pool);
+}
+
+static char *
+set_sdch_dict(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
+{
+    Config *conf = static_cast<Config*>(cnf);
+
+    if (cf->args->nelts < 2 || cf->args->nelts > 4) {
+        return const_cast<char*>("Wrong number of arguments");
+    }
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
+    ngx_str_t groupname;
+    ngx_str_set(&groupname, "default");
+    if (cf->args->nelts >= 3) {
+        groupname = value[2];
+    }
+
+    ngx_int_t prio = -1;
+    if (cf->args->nelts >= 4) {
+        prio = ngx_atoi(value[3].data, value[3].len);
+        if (prio == NGX_ERROR) {
+            return const_cast<char*>("Can't convert to number");
+        }
+    }
+
+    Dictionary* dict = conf->dict_factory->load_dictionary((const char*)value[1].data);
+    if (!dict) {
+      ngx_conf_log_error(
+          NGX_LOG_EMERG, cf, 0, "get_hashed_dict %s failed", value[1].data);
+      return const_cast<char*>("Can't load dictionary");
+    }
+    ngx_conf_log_error(NGX_LOG_NOTICE,
+                       cf,
+                       0,
+                       "dictionary ids: user %*s server %*s",
+                       dict->client_id().size(), dict->client_id().data(),
+                       dict->server_id().size(), dict->server_id().data());
+
+    conf->dict_factory->store_config(
+        dict,
+        groupname,
+        prio);
+
+    MainConfig* main = static_cast<MainConfig*>(
+        ngx_http_conf_get_module_main_conf(cf, sdch_module));
+    main->trainer.add_baseline(groupname, dict, prio);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+set_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
+{
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
+
+#if (NGX_THREADS)
+    Config *conf = static_cast<Config*>(cnf);
+
+    if (conf->thread_pool != NGX_CONF_UNSET_PTR) {
+        return const_cast<char*>("is duplicate");
+    }
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        conf->thread_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+    conf->thread_pool = ngx_thread_pool_add(cf, &value[1]);
+    if (conf->thread_pool == NULL) {
+        return static_cast<char*>(NGX_CONF_ERROR);
+    }
+
+    return NGX_CONF_OK;
+#else
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    return const_cast<char*>("requires nginx built with --with-threads");
+#endif
+}
+
+
+static char *
+set_dumpdir(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
+{
+    Config *conf = static_cast<Config*>(cnf);
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
+
+    if (conf->sdch_dumpdir.data != NULL) {
+        return const_cast<char*>("is duplicate");
+    }
+
+    conf->sdch_dumpdir = value[1];
+    conf->dump_sample = 10000;
+
+    if (cf->args->nelts > 2) {
+        if (ngx_strncmp(value[2].data, "sample=", 7) != 0) {
+            return const_cast<char*>("expects sample=");
+        }
+        ngx_int_t sample = ngx_atofp(value[2].data + 7, value[2].len - 7, 4);
+        if (sample == NGX_ERROR || sample > 10000) {
+            return const_cast<char*>("invalid sample rate");
+        }
+        conf->dump_sample = sample;
+    }
+
+    MainConfig* main = static_cast<MainConfig*>(
+        ngx_http_conf_get_module_main_conf(cf, sdch_module));
+    main->dump = true;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+set_dump_queue(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
+{
+    MainConfig *conf = static_cast<MainConfig*>(cnf);
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
+
+    if (conf->dump_queue_size != NGX_CONF_UNSET_SIZE) {
+        return const_cast<char*>("is duplicate");
+    }
+
+    ssize_t size = ngx_parse_size(&value[1]);
+    if (size == NGX_ERROR) {
+        return const_cast<char*>("invalid queue size");
+    }
+    conf->dump_queue_size = size;
+
+    for (ngx_uint_t i = 2; i < cf->args->nelts; ++i) {
+        if (ngx_strncmp(value[i].data, "rate=", 5) == 0) {
+            ngx_str_t s = {value[i].len - 5, value[i].data + 5};
+            size = ngx_parse_size(&s);
+            if (size == NGX_ERROR) {
+                return const_cast<char*>("invalid rate");
+            }
+            conf->dump_rate = size;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "segment=", 8) == 0) {
+            ngx_str_t s = {value[i].len - 8, value[i].data + 8};
+            size = ngx_parse_size(&s);
+            if (size == NGX_ERROR || size == 0) {
+                return const_cast<char*>("invalid segment size");
+            }
+            conf->dump_segment_size = size;
+            continue;
+        }
 
-  RequestContext* ctx = POOL_ALLOC(r, RequestContext, r);
-  if (ctx == NULL) {
-    return NGX_ERROR;
-  }
+        if (ngx_strncmp(value[i].data, "segment_time=", 13) == 0) {
+            ngx_str_t s = {value[i].len - 13, value[i].data + 13};
+            ngx_int_t age = ngx_parse_time(&s, 1);
+            if (age == NGX_ERROR) {
+                return const_cast<char*>("invalid segment_time");
+            }
+            conf->dump_segment_age = age;
+            continue;
+        }
 
-  // Allocate Handlers chain in reverse order
-  // Last will be OutputHandler.
-  ctx->handler = POOL_ALLOC(r, OutputHandler, ctx, ngx_http_next_body_filter);
-  if (ctx->handler == NULL)
-    return NGX_ERROR;
+        if (ngx_strcmp(value[i].data, "compress") == 0) {
+            conf->dump_compress = 1;
+            continue;
+        }
 
-  // If we have actual Dictionary - do encode response
-  if (dict != NULL) {
-    if (create_output_header(r, "Content-Encoding", "sdch") != NGX_OK) {
-      return NGX_ERROR;
-    }
+        if (ngx_strncmp(value[i].data, "thread_pool=", 12) == 0) {
+            ngx_str_t name = {value[i].len - 12, value[i].data + 12};
+#if (NGX_THREADS)
+            if (ngx_strcmp(name.data, "off") == 0) {
+                conf->dump_thread_pool = NULL;
+                continue;
+            }
+            conf->dump_thread_pool = ngx_thread_pool_add(cf, &name);
+            if (conf->dump_thread_pool == NULL) {
+                return static_cast<char*>(NGX_CONF_ERROR);
+            }
+            continue;
+#else
+            if (ngx_strcmp(name.data, "off") == 0) {
+                continue;
+            }
+            return const_cast<char*>(
+                "thread_pool= requires nginx built with --with-threads");
+#endif
+        }
 
-    if (x_sdch_encode_0_header(r, false) != NGX_OK) {
-      return NGX_ERROR;
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return static_cast<char*>(NGX_CONF_ERROR);
     }
 
-    if (conf->vary == 1) {
-      if (create_output_header(r, "Vary", "Accept-Encoding, Avail-Dictionary") != NGX_OK) {
-        return NGX_ERROR;
-      }
-    }
+    return NGX_CONF_OK;
+}
 
-    ctx->handler = POOL_ALLOC(r,
-        EncodingHandler, ctx->handler, dict, quasidict);
 
-    if (ctx->handler == NULL) {
-      return NGX_ERROR;
-    }
-  }
+static char *
+set_train_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
+{
+    MainConfig *conf = static_cast<MainConfig*>(cnf);
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
+    Trainer& trainer = conf->trainer;
 
-  if (conf->sdch_dumpdir.len > 0) {
-    ctx->handler = POOL_ALLOC(r, DumpHandler, ctx->handler);
-    if (ctx->handler == NULL) {
-      return NGX_ERROR;
+    if (trainer.enabled()) {
+        return const_cast<char*>("is duplicate");
     }
-  }
 
-  // If we have to create new quasi-dictionary
-  if (store_as_quasi) {
-    ctx->handler = POOL_ALLOC(r, AutoautoHandler, ctx, ctx->handler);
-    if (ctx->handler == NULL) {
-      return NGX_ERROR;
-    }
-  }
+    trainer.set_dir(value[1]);
 
-  r->main_filter_need_in_memory = 1;
+    for (ngx_uint_t i = 2; i < cf->args->nelts; ++i) {
+        if (ngx_strncmp(value[i].data, "groups=", 7) == 0) {
+            ngx_int_t n = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (n == NGX_ERROR || n == 0 || size_t(n) > Trainer::kMaxGroups) {
+                return const_cast<char*>("invalid groups");
+            }
+            trainer.set_groups(n);
+            continue;
+        }
 
-  ngx_http_clear_content_length(r);
-  ngx_http_clear_accept_ranges(r);
+        if (ngx_strncmp(value[i].data, "samples=", 8) == 0) {
+            ngx_int_t n = ngx_atoi(value[i].data + 8, value[i].len - 8);
+            if (n == NGX_ERROR || n < 20) {
+                return const_cast<char*>("invalid samples");
+            }
+            trainer.set_samples(n);
+            continue;
+        }
 
-#if nginx_version > 1005000
-  ngx_http_clear_etag(r);
+        if (ngx_strncmp(value[i].data, "sample=", 7) == 0) {
+            ngx_str_t s = {value[i].len - 7, value[i].data + 7};
+            ssize_t size = ngx_parse_size(&s);
+            if (size == NGX_ERROR || size < 64) {
+                return const_cast<char*>("invalid sample size");
+            }
+            trainer.set_sample_size(size);
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "size=", 5) == 0) {
+            ngx_str_t s = {value[i].len - 5, value[i].data + 5};
+            ssize_t size = ngx_parse_size(&s);
+            if (size == NGX_ERROR || size < 1024) {
+                return const_cast<char*>("invalid dictionary size");
+            }
+            trainer.set_dict_size(size);
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+            ngx_str_t s = {value[i].len - 9, value[i].data + 9};
+            ngx_int_t interval = ngx_parse_time(&s, 0);
+            if (interval == NGX_ERROR || interval == 0) {
+                return const_cast<char*>("invalid interval");
+            }
+            trainer.set_interval(interval);
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "keep=", 5) == 0) {
+            ngx_int_t n = ngx_atoi(value[i].data + 5, value[i].len - 5);
+            if (n == NGX_ERROR || n == 0 || size_t(n) > Trainer::kMaxKeep) {
+                return const_cast<char*>("invalid keep");
+            }
+            trainer.set_keep(n);
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "domain=", 7) == 0) {
+            ngx_str_t domain = {value[i].len - 7, value[i].data + 7};
+            trainer.set_domain(domain);
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "thread_pool=", 12) == 0) {
+            ngx_str_t name = {value[i].len - 12, value[i].data + 12};
+#if (NGX_THREADS)
+            if (ngx_strcmp(name.data, "off") == 0) {
+                conf->train_thread_pool = NULL;
+                continue;
+            }
+            conf->train_thread_pool = ngx_thread_pool_add(cf, &name);
+            if (conf->train_thread_pool == NULL) {
+                return static_cast<char*>(NGX_CONF_ERROR);
+            }
+            continue;
 #else
-//   TODO(wawa): adverse impact should be verified if any
+            if (ngx_strcmp(name.data, "off") == 0) {
+                continue;
+            }
+            return const_cast<char*>(
+                "thread_pool= requires nginx built with --with-threads");
 #endif
+        }
 
-  return ngx_http_next_header_filter(r);
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return static_cast<char*>(NGX_CONF_ERROR);
+    }
+
+    if (!trainer.create_zone(cf)) {
+        return static_cast<char*>(NGX_CONF_ERROR);
+    }
+
+    return NGX_CONF_OK;
 }
 
 
-static ngx_int_t
-body_filter(ngx_http_request_t *r, ngx_chain_t *in)
+static char *
+set_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
 {
-  RequestContext* ctx = RequestContext::get(r);
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
 
-  ngx_log_debug0(
-      NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http sdch filter body 000");
+    ssize_t size = ngx_parse_size(&value[2]);
+    if (size == NGX_ERROR) {
+        return const_cast<char*>("invalid zone size");
+    }
 
-  if (ctx == NULL || ctx->done || r->header_only) {
-    return ngx_http_next_body_filter(r, in);
-  }
+    if (size < ssize_t(8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return static_cast<char*>(NGX_CONF_ERROR);
+    }
 
-  if (!ctx->started) {
-    ctx->started = true;
-    for (Handler* h = ctx->handler; h; h = h->next()) {
-      if (!h->init(ctx)) {
-        ctx->done = true;
-        return NGX_ERROR;
-      }
+    if (Cache::create(cf, &value[1], size) == NULL) {
+        return static_cast<char*>(NGX_CONF_ERROR);
     }
-  }
 
-  ngx_log_debug0(
-      NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http sdch filter started");
+    return NGX_CONF_OK;
+}
 
-  // cycle while there is data to handle
-  for (; in; in = in->next) {
-    if (in->buf->flush) {
-      ctx->need_flush = true;
+
+static char *
+set_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
+{
+    Config *conf = static_cast<Config*>(cnf);
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
+
+    if (conf->cache_zone != NGX_CONF_UNSET_PTR) {
+        return const_cast<char*>("is duplicate");
     }
 
-    off_t buf_size = ngx_buf_size(in->buf);
-    ngx_int_t status = ctx->handler->on_data(in->buf->pos, buf_size);
-    in->buf->pos = in->buf->last;
-    ctx->total_in += buf_size;
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        conf->cache_zone = NULL;
+        return NGX_CONF_OK;
+    }
 
-    if (status == NGX_ERROR) {
-      ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0, "sdch failed");
-      ctx->done = true;
-      return NGX_ERROR;
+    if (ngx_strncmp(value[1].data, "zone=", 5) != 0) {
+        return const_cast<char*>("expects zone=<name> or off");
     }
 
-    if (in->buf->last_buf) {
-      ngx_log_debug(NGX_LOG_DEBUG_HTTP,
-          ctx->request->connection->log, 0, "closing ctx");
-      ctx->done = true;
-      return ctx->handler->on_finish();
+    ngx_str_t name;
+    name.data = value[1].data + 5;
+    name.len = value[1].len - 5;
+
+    // Zone can be defined later. Its size is filled in by sdch_cache_zone.
+    conf->cache_zone = ngx_shared_memory_add(cf, &name, 0, &sdch_module);
+    if (conf->cache_zone == NULL) {
+        return static_cast<char*>(NGX_CONF_ERROR);
     }
-  }
 
-  return NGX_OK;
+    return NGX_CONF_OK;
 }
 
 
-static ngx_str_t ratio = ngx_string("sdch_ratio");
-
-static ngx_int_t
-add_variables(ngx_conf_t *cf)
+// "sdch_lookahead_ratio 1.5". Stored multiplied by 100.
+static char *
+set_lookahead_ratio(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
 {
-    ngx_http_variable_t  *var;
+    Config *conf = static_cast<Config*>(cnf);
+    ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
 
-    var = ngx_http_add_variable(cf, &ratio, NGX_HTTP_VAR_NOHASH);
-    if (var == NULL) {
-        return NGX_ERROR;
+    if (conf->lookahead_ratio != NGX_CONF_UNSET_UINT) {
+        return const_cast<char*>("is duplicate");
     }
 
-    var->get_handler = ratio_variable;
+    ngx_int_t ratio = ngx_atofp(value[1].data, value[1].len, 2);
+    if (ratio == NGX_ERROR) {
+        return const_cast<char*>("invalid ratio");
+    }
 
-    return NGX_OK;
+    conf->lookahead_ratio = ratio;
+    return NGX_CONF_OK;
 }
 
 
 static ngx_int_t
-ratio_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
+status_handler(ngx_http_request_t *r)
 {
-    ngx_uint_t            zint, zfrac;
-    RequestContext  *ctx = RequestContext::get(r);
+  if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+  ngx_int_t rc = ngx_http_discard_request_body(r);
+  if (rc != NGX_OK) {
+    return rc;
+  }
 
+  Stats* stats = MainConfig::get(r)->stats;
+  Stats::Format format = Stats::Format(Config::get(r)->status_format);
 
-    if (ctx == NULL || ctx->total_out == 0) {
-        v->not_found = 1;
-        return NGX_OK;
-    }
+  ngx_buf_t* b = stats->render(r->pool, format);
+  if (b == NULL) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
 
-    v->data = static_cast<u_char*>(ngx_pnalloc(r->pool, NGX_INT32_LEN + 3));
-    if (v->data == NULL) {
-        return NGX_ERROR;
-    }
+  if (format == Stats::FORMAT_PROMETHEUS) {
+    ngx_str_set(&r->headers_out.content_type, "text/plain; version=0.0.4");
+  } else {
+    ngx_str_set(&r->headers_out.content_type, "application/json");
+  }
+  r->headers_out.content_type_len = r->headers_out.content_type.len;
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_length_n = b->last - b->pos;
 
-    zint = (ngx_uint_t) (ctx->total_in / ctx->total_out);
-    zfrac = (ngx_uint_t) ((ctx->total_in * 100 / ctx->total_out) % 100);
+  rc = ngx_http_send_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
 
-    if ((ctx->total_in * 1000 / ctx->total_out) % 10 > 4) {
+  b->last_buf = (r == r->main) ? 1 : 0;
+  b->last_in_chain = 1;
 
-        /* the rounding, e.g., 2.125 to 2.13 */
+  ngx_chain_t out;
+  out.buf = b;
+  out.next = NULL;
+  return ngx_http_output_filter(r, &out);
+}
 
-        zfrac++;
 
-        if (zfrac > 99) {
-            zint++;
-            zfrac = 0;
-        }
-    }
+// JSON dump of quasi-dictionaries stored by the worker serving request.
+static ngx_buf_t*
+render_fastdict(ngx_pool_t* pool, const FastdictFactory& factory)
+{
+  typedef FastdictFactory::StoreType StoreType;
+  const StoreType& values = factory.values();
+
+  size_t len = sizeof("{\"pid\":,\"total_size\":,\"max_size\":,"
+                      "\"evictions\":,\"blocked_evictions\":,"
+                      "\"dictionaries\":[]}\n") + 5 * NGX_SIZE_T_LEN;
+  for (StoreType::const_iterator i = values.begin(); i != values.end(); ++i) {
+    const std::string& group = i->second->group;
+    len += sizeof("{\"id\":\"\",\"size\":,\"index_size\":,\"age\":,"
+                  "\"hits\":,\"in_use\":,\"group\":\"\"},")
+           + 8 + 6 * NGX_SIZE_T_LEN + group.size() +
+           ngx_escape_json(NULL, (u_char*) group.data(), group.size());
+  }
 
-    v->len = ngx_sprintf(v->data, "%ui.%02ui", zint, zfrac) - v->data;
+  ngx_buf_t* b = ngx_create_temp_buf(pool, len);
+  if (b == NULL) {
+    return NULL;
+  }
 
-    return NGX_OK;
+  u_char* p = ngx_sprintf(b->last, "{\"pid\":%P,\"total_size\":%uz,"
+                          "\"max_size\":%uz,\"evictions\":%uz,"
+                          "\"blocked_evictions\":%uz,\"dictionaries\":[",
+                          ngx_pid, factory.total_size(), factory.max_size(),
+                          factory.evictions(), factory.blocked_evictions());
+
+  time_t now = ngx_time();
+  for (StoreType::const_iterator i = values.begin(); i != values.end(); ++i) {
+    const FastdictFactory::Value& v = *i->second;
+    // Store keeps one reference. The rest are requests using it.
+    p = ngx_sprintf(p, "%s{\"id\":\"%*s\",\"size\":%uz,"
+                       "\"index_size\":%uz,\"age\":%T,\"hits\":%uz,"
+                       "\"in_use\":%l,\"group\":\"",
+                    i == values.begin() ? "" : ",", i->first.size(),
+                    i->first.data(), v.dict.size(), v.dict.index_size(),
+                    now - v.ts, v.hits, long(i->second.use_count() - 1));
+    p = (u_char*) ngx_escape_json(p, (u_char*) v.group.data(),
+                                  v.group.size());
+    p = ngx_sprintf(p, "\"}");
+  }
+
+  p = ngx_sprintf(p, "]}\n");
+  b->last = p;
+  return b;
 }
 
-static void *
-create_main_conf(ngx_conf_t *cf)
+
+static ngx_int_t
+fastdict_status_handler(ngx_http_request_t *r)
 {
-    return POOL_ALLOC(cf, MainConfig);
+  if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+    return NGX_HTTP_NOT_ALLOWED;
+  }
+
+  ngx_int_t rc = ngx_http_discard_request_body(r);
+  if (rc != NGX_OK) {
+    return rc;
+  }
+
+  ngx_buf_t* b = render_fastdict(r->pool, MainConfig::get(r)->fastdict_factory);
+  if (b == NULL) {
+    return NGX_HTTP_INTERNAL_SERVER_ERROR;
+  }
+
+  ngx_str_set(&r->headers_out.content_type, "application/json");
+  r->headers_out.content_type_len = r->headers_out.content_type.len;
+  r->headers_out.status = NGX_HTTP_OK;
+  r->headers_out.content_length_n = b->last - b->pos;
+
+  rc = ngx_http_send_header(r);
+  if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+    return rc;
+  }
+
+  b->last_buf = (r == r->main) ? 1 : 0;
+  b->last_in_chain = 1;
+
+  ngx_chain_t out;
+  out.buf = b;
+  out.next = NULL;
+  return ngx_http_output_filter(r, &out);
 }
 
+
 static char *
-init_main_conf(ngx_conf_t *cf, void *cnf)
+set_fastdict_status(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
 {
-    MainConfig *conf = static_cast<MainConfig*>(cnf);
-    if (conf->stor_size != NGX_CONF_UNSET_SIZE)
-        conf->fastdict_factory.set_max_size(conf->stor_size);
+    ngx_http_core_loc_conf_t* clcf = static_cast<ngx_http_core_loc_conf_t*>(
+        ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+    clcf->handler = fastdict_status_handler;
     return NGX_CONF_OK;
 }
 
-static void *
-create_conf(ngx_conf_t *cf)
-{
-  return POOL_ALLOC(cf, Config, cf->pool);
-}
 
+// "sdch_status [json|prometheus]". Counters are shared by all locations.
 static char *
-set_sdch_dict(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
+set_status(ngx_conf_t *cf, ngx_command_t *cmd, void *cnf)
 {
     Config *conf = static_cast<Config*>(cnf);
-
-    if (cf->args->nelts < 2 || cf->args->nelts > 4) {
-        return const_cast<char*>("Wrong number of arguments");
-    }
     ngx_str_t *value = static_cast<ngx_str_t*>(cf->args->elts);
-    ngx_str_t groupname;
-    ngx_str_set(&groupname, "default");
-    if (cf->args->nelts >= 3) {
-        groupname = value[2];
+
+    if (conf->status_format != NGX_CONF_UNSET_UINT) {
+        return const_cast<char*>("is duplicate");
     }
 
-    ngx_int_t prio = -1;
-    if (cf->args->nelts >= 4) {
-        prio = ngx_atoi(value[3].data, value[3].len);
-        if (prio == NGX_ERROR) {
-            return const_cast<char*>("Can't convert to number");
+    conf->status_format = Stats::FORMAT_JSON;
+    if (cf->args->nelts > 1) {
+        if (ngx_strcmp(value[1].data, "prometheus") == 0) {
+            conf->status_format = Stats::FORMAT_PROMETHEUS;
+        } else if (ngx_strcmp(value[1].data, "json") != 0) {
+            return const_cast<char*>("expects json or prometheus");
         }
     }
 
-    Dictionary* dict = conf->dict_factory->load_dictionary((const char*)value[1].data);
-    if (!dict) {
-      ngx_conf_log_error(
-          NGX_LOG_EMERG, cf, 0, "get_hashed_dict %s failed", value[1].data);
-      return const_cast<char*>("Can't load dictionary");
+    MainConfig* main = static_cast<MainConfig*>(
+        ngx_http_conf_get_module_main_conf(cf, sdch_module));
+    main->stats = Stats::create(cf);
+    if (main->stats == NULL) {
+        return static_cast<char*>(NGX_CONF_ERROR);
     }
-    ngx_conf_log_error(NGX_LOG_NOTICE,
-                       cf,
-                       0,
-                       "dictionary ids: user %*s server %*s",
-                       dict->client_id().size(), dict->client_id().data(),
-                       dict->server_id().size(), dict->server_id().data());
 
-    conf->dict_factory->store_config(
-        dict,
-        groupname,
-        prio);
+    ngx_http_core_loc_conf_t* clcf = static_cast<ngx_http_core_loc_conf_t*>(
+        ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+    clcf->handler = status_handler;
 
     return NGX_CONF_OK;
 }
@@ -950,12 +3245,147 @@ merge_conf(ngx_conf_t *cf, void *parent, void *child)
         return const_cast<char*>("ngx_http_compile_complex_value sdch_url failed");
     }
 
+    if (conf->sdch_dumpdir.data == NULL) {
+        conf->sdch_dumpdir = prev->sdch_dumpdir;
+        conf->dump_sample = prev->dump_sample;
+    }
     ngx_conf_merge_str_value(conf->sdch_dumpdir, prev->sdch_dumpdir, "");
+    ngx_conf_merge_uint_value(conf->dump_sample, prev->dump_sample, 10000);
+    ngx_conf_merge_value(conf->train, prev->train, 0);
 
     ngx_conf_merge_value(conf->enable_fastdict, prev->enable_fastdict, 1);
 
     ngx_conf_merge_value(conf->vary, prev->vary, 1);
 
+    ngx_conf_merge_size_value(conf->slice_size, prev->slice_size, 0);
+
+    ngx_conf_merge_uint_value(conf->encoder, prev->encoder, ENCODER_VCDIFF);
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif
+    // It would block event loop for the whole response.
+    if (conf->encoder == ENCODER_OPTIMAL
+#if (NGX_THREADS)
+        && conf->thread_pool == NULL
+#endif
+        ) {
+        return const_cast<char*>("sdch_encoder optimal requires sdch_thread_pool");
+    }
+    ngx_conf_merge_ptr_value(conf->cache_zone, prev->cache_zone, NULL);
+
+    ngx_conf_merge_value(conf->static_files, prev->static_files, 0);
+
+    ngx_conf_merge_size_value(conf->lookahead, prev->lookahead, 0);
+    ngx_conf_merge_uint_value(conf->lookahead_ratio, prev->lookahead_ratio,
+                              110);
+
+    ngx_conf_merge_value(conf->delta, prev->delta, 0);
+    ngx_conf_merge_uint_value(conf->delta_versions, prev->delta_versions, 4);
+    if (conf->delta_versions == 0) {
+        return const_cast<char*>("sdch_delta_versions can't be 0");
+    }
+    ngx_conf_merge_str_value(conf->delta_key, prev->delta_key,
+                             "$host$request_uri");
+    ccv.value = &conf->delta_key;
+    ccv.complex_value = &conf->delta_keycv;
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return const_cast<char*>("ngx_http_compile_complex_value sdch_delta_key failed");
+    }
+
+    ngx_conf_merge_value(conf->composite, prev->composite, 0);
+
+    ngx_conf_merge_value(conf->gzip, prev->gzip, 0);
+    ngx_conf_merge_value(conf->gzip_level, prev->gzip_level, 1);
+    ngx_conf_merge_size_value(conf->gzip_window, prev->gzip_window,
+                              32 * 1024);
+    // Same values as zlib and nginx gzip_window accept.
+    for (conf->gzip_wbits = 9; conf->gzip_wbits <= 15; ++conf->gzip_wbits) {
+        if (conf->gzip_window == size_t(1) << conf->gzip_wbits)
+            break;
+    }
+    if (conf->gzip_wbits > 15) {
+        return const_cast<char*>("sdch_gzip_window must be 512, 1k, 2k, 4k, 8k, 16k, or 32k");
+    }
+
+    ngx_conf_merge_value(conf->zstd, prev->zstd, 0);
+    ngx_conf_merge_value(conf->zstd_level, prev->zstd_level, 3);
+#if !(NGX_HAVE_ZSTD)
+    if (conf->zstd) {
+        return const_cast<char*>("sdch_zstd requires zstd library");
+    }
+#endif
+
+    ngx_conf_merge_value(conf->cdt, prev->cdt, 0);
+#if !(NGX_HAVE_ZSTD)
+    if (conf->cdt) {
+        return const_cast<char*>("sdch_cdt requires zstd library");
+    }
+#endif
+    ngx_conf_merge_str_value(conf->cdt_match, prev->cdt_match, "");
+    if (conf->cdt_match.len) {
+        // It goes into sf-string as is.
+        for (size_t i = 0; i < conf->cdt_match.len; ++i) {
+            u_char c = conf->cdt_match.data[i];
+            if (c == '"' || c == '\\' || c < 0x20 || c > 0x7e) {
+                return const_cast<char*>("invalid sdch_cdt_match");
+            }
+        }
+        conf->cdt_use_as.data = static_cast<u_char*>(
+            ngx_pnalloc(cf->pool, sizeof("match=\"\"") - 1
+                                  + conf->cdt_match.len));
+        if (conf->cdt_use_as.data == NULL) {
+            return static_cast<char*>(NGX_CONF_ERROR);
+        }
+        conf->cdt_use_as.len =
+            ngx_sprintf(conf->cdt_use_as.data, "match=\"%V\"",
+                        &conf->cdt_match) - conf->cdt_use_as.data;
+    }
+
+    ngx_conf_merge_uint_value(conf->status_format, prev->status_format,
+                              Stats::FORMAT_JSON);
+
+    // Phase histograms are kept for every location with sdch enabled.
+    MainConfig* main = static_cast<MainConfig*>(
+        ngx_http_conf_get_module_main_conf(cf, sdch_module));
+    ngx_http_core_loc_conf_t* clcf = static_cast<ngx_http_core_loc_conf_t*>(
+        ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module));
+    if (main->stats != NULL && conf->enable && clcf->name.len) {
+        conf->stats_location = main->stats->location(cf, clcf->name);
+    }
+
+    ngx_conf_merge_value(conf->trial_dicts, prev->trial_dicts, 1);
+    if (conf->trial_dicts < 1) {
+        return const_cast<char*>("sdch_trial_dicts should be at least 1");
+    }
+    if (conf->trial_dicts > 1 && conf->lookahead == 0) {
+        return const_cast<char*>("sdch_trial_dicts requires sdch_lookahead");
+    }
+
+    ngx_conf_merge_str_value(conf->trial_key, prev->trial_key, "");
+    ccv.value = &conf->trial_key;
+    ccv.complex_value = &conf->trial_keycv;
+    if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+        return const_cast<char*>("ngx_http_compile_complex_value sdch_trial_key failed");
+    }
+
+    ngx_conf_merge_size_value(conf->window_size, prev->window_size,
+                              1024 * 1024);
+    if (conf->window_size == 0) {
+        return const_cast<char*>("sdch_window_size can't be 0");
+    }
+
+    // open-vcdiff has its own copy of dictionary. Keep one more only for
+    // encoders which need it.
+    bool payload = conf->encoder != ENCODER_VCDIFF || conf->zstd
+                   || conf->cdt;
+    if (payload || conf->composite) {
+        main->fastdict_factory.set_keep_payload(true);
+    }
+    if (payload) {
+        main->composite_factory.set_keep_payload(true);
+    }
+
     return NGX_CONF_OK;
 }
 
@@ -983,7 +3413,7 @@ ngx_module_t  sdch_module = {
     NGX_HTTP_MODULE,                  /* module type */
     NULL,                          /* init master */
     NULL,                          /* init module */
-    NULL,                          /* init process */
+    sdch::init_process,            /* init process */
     NULL,                          /* init thread */
     NULL,                          /* exit thread */
     NULL,                          /* exit process */
@@ -0,0 +1,60 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_offline.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "sdch_dictionary.h"
+#include "sdch_encoder_pool.h"
+#include "sdch_optimal_engine.h"
+#include "sdch_vcdiff_engine.h"
+
+namespace sdch {
+
+bool encode_buffer(EncoderType encoder, Dictionary* dict, const char* data,
+                   size_t len, open_vcdiff::OutputStringInterface* out) {
+  switch (encoder) {
+    case ENCODER_SIMD: {
+      const VcdiffIndex* index = dict->vcdiff_index();
+      VcdiffEngine engine;
+      return index != NULL && engine.start(index, out) &&
+             engine.encode_chunk(data, len, out) && engine.finish(out);
+    }
+
+    case ENCODER_OPTIMAL: {
+      OptimalEngine engine;
+      return dict->has_payload() &&
+             engine.start(dict->payload(), dict->payload_size(), out) &&
+             engine.encode_chunk(data, len, out) && engine.finish(out);
+    }
+
+    default: {
+      std::auto_ptr<EncoderPool::Encoder> enc(EncoderPool::create(dict));
+      return enc->StartEncodingToInterface(out) &&
+             enc->EncodeChunkToInterface(data, len, out) &&
+             enc->FinishEncodingToInterface(out);
+    }
+  }
+}
+
+bool write_file(const std::string& fn, const std::string& data) {
+  std::string tmp = fn + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == NULL)
+    return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  ok = (fclose(f) == 0) && ok;
+  if (ok && rename(tmp.c_str(), fn.c_str()) == 0)
+    return true;
+  int err = errno;
+  unlink(tmp.c_str());
+  errno = err;
+  return false;
+}
+
+}  // namespace sdch
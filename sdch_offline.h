@@ -0,0 +1,32 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_OFFLINE_H_
+#define SDCH_OFFLINE_H_
+
+#include <string>
+
+#include <google/vcencoder.h>
+
+#include "sdch_config.h"
+
+namespace sdch {
+
+class Dictionary;
+
+// Helpers for code outside of request pipeline: trainer and tools. They
+// don't need nginx linked.
+
+// Encode whole buffer as EncodingHandler does, without server_id. Payload
+// and index of dict are built on first use, so do it before sharing dict
+// between threads.
+bool encode_buffer(EncoderType encoder, Dictionary* dict, const char* data,
+                   size_t len, open_vcdiff::OutputStringInterface* out);
+
+// Write into temporary file and rename, so readers never see partial one.
+// errno tells what failed.
+bool write_file(const std::string& fn, const std::string& data);
+
+}  // namespace sdch
+
+#endif  // SDCH_OFFLINE_H_
@@ -0,0 +1,346 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_optimal_engine.h"
+
+#include <algorithm>
+
+namespace sdch {
+
+const size_t OptimalEngine::kWindowSize;
+
+namespace {
+
+// Symbols of text_ are bytes plus two separators.
+const uint32_t kSeparator = 256;
+const uint32_t kTerminator = 257;
+const size_t kAlphabet = 258;
+
+// Shortest COPY in default code table.
+const uint32_t kMinCopy = 4;
+// Longest COPY with size embedded into opcode.
+const uint32_t kMaxShortCopy = 18;
+// Suffix array neighbours checked in each direction.
+const size_t kMaxCandidates = 32;
+
+const uint32_t kRun = 0xffffffff;
+const uint32_t kInfinity = 0xffffffff;
+
+struct LongerFirst {
+  bool operator()(const OptimalEngine::Match& a,
+                  const OptimalEngine::Match& b) const {
+    return a.len > b.len;
+  }
+};
+
+}  // namespace
+
+// Use COPY step s of len bytes if it's cheaper than current one.
+void OptimalEngine::relax(std::vector<Step>* steps,
+                          size_t to,
+                          Step s,
+                          uint32_t len) {
+  if (len > kMaxShortCopy)
+    s.cost += VcdiffWriter::varint_length(len);
+  if (s.cost < (*steps)[to].cost)
+    (*steps)[to] = s;
+}
+
+OptimalEngine::OptimalEngine() : dict_(NULL), dict_size_(0) {}
+
+bool OptimalEngine::start(const char* dict,
+                          size_t len,
+                          open_vcdiff::OutputStringInterface* out) {
+  dict_ = reinterpret_cast<const uint8_t*>(dict);
+  dict_size_ = len;
+  window_.clear();
+  VcdiffWriter::write_header(out);
+  return true;
+}
+
+bool OptimalEngine::encode_chunk(const char* data,
+                                 size_t len,
+                                 open_vcdiff::OutputStringInterface* out) {
+  while (len > 0) {
+    size_t n = std::min(len, kWindowSize - window_.size());
+    window_.append(data, n);
+    data += n;
+    len -= n;
+
+    if (window_.size() == kWindowSize)
+      encode_window(out);
+  }
+  return true;
+}
+
+bool OptimalEngine::finish(open_vcdiff::OutputStringInterface* out) {
+  encode_window(out);
+  return true;
+}
+
+void OptimalEngine::encode_window(open_vcdiff::OutputStringInterface* out) {
+  // Same as open-vcdiff: no window for empty chunk.
+  if (window_.empty())
+    return;
+
+  text_.resize(dict_size_ + window_.size() + 2);
+  std::copy(dict_, dict_ + dict_size_, text_.begin());
+  text_[dict_size_] = kSeparator;
+  const uint8_t* w = reinterpret_cast<const uint8_t*>(window_.data());
+  std::copy(w, w + window_.size(), text_.begin() + dict_size_ + 1);
+  text_.back() = kTerminator;
+
+  build_suffix_array();
+  parse();
+
+  writer_.start_window(dict_size_);
+  emit();
+  writer_.finish_window(w, window_.size(), out);
+
+  window_.clear();
+}
+
+// Prefix doubling with radix sort. O(n log n).
+void OptimalEngine::build_suffix_array() {
+  const size_t n = text_.size();
+  std::vector<uint32_t> tmp(n);
+  std::vector<uint32_t> cnt(std::max(n, kAlphabet));
+  sa_.resize(n);
+  rank_.resize(n);
+
+  // Sort by first symbol.
+  for (size_t i = 0; i < n; ++i)
+    ++cnt[text_[i]];
+  for (size_t i = 1; i < kAlphabet; ++i)
+    cnt[i] += cnt[i - 1];
+  for (size_t i = n; i-- > 0;)
+    sa_[--cnt[text_[i]]] = i;
+
+  size_t classes = 1;
+  rank_[sa_[0]] = 0;
+  for (size_t i = 1; i < n; ++i) {
+    if (text_[sa_[i]] != text_[sa_[i - 1]])
+      ++classes;
+    rank_[sa_[i]] = classes - 1;
+  }
+
+  for (size_t k = 1; classes < n; k <<= 1) {
+    // Order by second half. Suffixes shorter than k have empty one.
+    size_t p = 0;
+    for (size_t i = n - std::min(k, n); i < n; ++i)
+      tmp[p++] = i;
+    for (size_t i = 0; i < n; ++i)
+      if (sa_[i] >= k)
+        tmp[p++] = sa_[i] - k;
+
+    // Stable sort by first half.
+    std::fill(cnt.begin(), cnt.begin() + classes, 0);
+    for (size_t i = 0; i < n; ++i)
+      ++cnt[rank_[i]];
+    for (size_t i = 1; i < classes; ++i)
+      cnt[i] += cnt[i - 1];
+    for (size_t i = n; i-- > 0;)
+      sa_[--cnt[rank_[tmp[i]]]] = tmp[i];
+
+    // Ranks of doubled prefixes.
+    tmp[sa_[0]] = 0;
+    classes = 1;
+    for (size_t i = 1; i < n; ++i) {
+      size_t a = sa_[i - 1];
+      size_t b = sa_[i];
+      uint32_t sa = a + k < n ? rank_[a + k] + 1 : 0;
+      uint32_t sb = b + k < n ? rank_[b + k] + 1 : 0;
+      if (rank_[a] != rank_[b] || sa != sb)
+        ++classes;
+      tmp[b] = classes - 1;
+    }
+    rank_.swap(tmp);
+  }
+
+  // Kasai. lcp_[r] is common prefix of sa_[r - 1] and sa_[r].
+  lcp_.assign(n, 0);
+  size_t h = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (rank_[i] == 0) {
+      h = 0;
+      continue;
+    }
+    size_t j = sa_[rank_[i] - 1];
+    while (i + h < n && j + h < n && text_[i + h] == text_[j + h])
+      ++h;
+    lcp_[rank_[i]] = h;
+    if (h > 0)
+      --h;
+  }
+}
+
+// Longest earlier strings matching window at pos. Sorted by decreasing
+// length, each one is closer (cheaper to address) than longer ones.
+void OptimalEngine::find_matches(size_t pos,
+                                 std::vector<Match>* matches) const {
+  matches->clear();
+
+  const size_t n = text_.size();
+  const size_t q = dict_size_ + 1 + pos;
+  const size_t r = rank_[q];
+  const size_t here = dict_size_ + pos;
+
+  Match found[2 * kMaxCandidates];
+  size_t nfound = 0;
+
+  // Neighbours above and below in suffix array. Common prefix of q and
+  // neighbour is the minimum of lcp_ between them.
+  uint32_t l = kInfinity;
+  for (size_t i = r, k = 0; i > 0 && k < kMaxCandidates; --i, ++k) {
+    l = std::min(l, lcp_[i]);
+    if (l < kMinCopy)
+      break;
+    // Strings of window after pos aren't decoded yet.
+    size_t p = sa_[i - 1];
+    if (p < q) {
+      Match m = { l, static_cast<uint32_t>(p < dict_size_ ? p : p - 1) };
+      found[nfound++] = m;
+    }
+  }
+
+  l = kInfinity;
+  for (size_t i = r + 1, k = 0; i < n && k < kMaxCandidates; ++i, ++k) {
+    l = std::min(l, lcp_[i]);
+    if (l < kMinCopy)
+      break;
+    size_t p = sa_[i];
+    if (p < q) {
+      Match m = { l, static_cast<uint32_t>(p < dict_size_ ? p : p - 1) };
+      found[nfound++] = m;
+    }
+  }
+
+  // Keep only matches cheaper than all longer ones.
+  std::sort(found, found + nfound, LongerFirst());
+  size_t last_cost = kInfinity;
+  for (size_t i = 0; i < nfound; ++i) {
+    size_t cost = address_cost(found[i].addr, here, kInfinity);
+    if (cost >= last_cost)
+      continue;
+    if (!matches->empty() && matches->back().len == found[i].len)
+      matches->back() = found[i];
+    else
+      matches->push_back(found[i]);
+    last_cost = cost;
+  }
+}
+
+size_t OptimalEngine::address_cost(size_t addr,
+                                   size_t here,
+                                   uint32_t last_addr) const {
+  // Near and same caches depend on whole path. Only the last COPY is
+  // accounted for.
+  if (addr == last_addr)
+    return 1;
+
+  size_t res = std::min(VcdiffWriter::varint_length(addr),
+                        VcdiffWriter::varint_length(here - addr));
+  if (addr > last_addr)
+    res = std::min(res, VcdiffWriter::varint_length(addr - last_addr));
+  return res;
+}
+
+// Shortest path over estimated sizes. ADD costs its bytes plus opcode.
+// COPY costs opcode, size when it isn't embedded into opcode and address.
+void OptimalEngine::parse() {
+  const size_t len = window_.size();
+  const uint8_t* w = reinterpret_cast<const uint8_t*>(window_.data());
+
+  Step inf = { kInfinity, 0, 0, 0, false };
+  copy_.assign(len + 1, inf);
+  add_.assign(len + 1, inf);
+  copy_[0].cost = 0;
+
+  std::vector<Match> matches;
+  size_t run_end = 0;
+
+  for (size_t i = 0; i < len; ++i) {
+    const Step& c = copy_[i];
+    const Step& a = add_[i];
+
+    // Literal either extends ADD or starts new one.
+    if (a.cost != kInfinity && a.cost + 1 < add_[i + 1].cost) {
+      Step s = { a.cost + 1, static_cast<uint32_t>(i), 0, a.last_addr, true };
+      add_[i + 1] = s;
+    }
+    if (c.cost != kInfinity && c.cost + 2 < add_[i + 1].cost) {
+      Step s = { c.cost + 2, static_cast<uint32_t>(i), 0, c.last_addr, false };
+      add_[i + 1] = s;
+    }
+
+    bool from_add = a.cost < c.cost;
+    const Step& base = from_add ? a : c;
+
+    // RUN of the same byte.
+    if (run_end <= i) {
+      run_end = i + 1;
+      while (run_end < len && w[run_end] == w[i])
+        ++run_end;
+    }
+    size_t run = run_end - i;
+    if (run >= kMinCopy) {
+      uint32_t cost = base.cost + 2 + VcdiffWriter::varint_length(run);
+      if (cost < copy_[i + run].cost) {
+        Step s = { cost, static_cast<uint32_t>(i), kRun, base.last_addr,
+                   from_add };
+        copy_[i + run] = s;
+      }
+    }
+
+    find_matches(i, &matches);
+    const size_t here = dict_size_ + i;
+    for (size_t m = 0; m < matches.size(); ++m) {
+      uint32_t addr = matches[m].addr;
+      uint32_t cost = base.cost + 1 +
+                      address_cost(addr, here, base.last_addr);
+      // Lengths not covered by next (cheaper) match.
+      uint32_t shortest = m + 1 < matches.size() ? matches[m + 1].len + 1
+                                                 : kMinCopy;
+      uint32_t longest = matches[m].len;
+
+      // Longest match and every length with size embedded into opcode.
+      Step s = { cost, static_cast<uint32_t>(i), addr, addr, from_add };
+      relax(&copy_, i + longest, s, longest);
+      for (uint32_t l = std::min(longest - 1, kMaxShortCopy); l >= shortest;
+           --l)
+        relax(&copy_, i + l, s, l);
+    }
+  }
+}
+
+void OptimalEngine::emit() {
+  const size_t len = window_.size();
+  const uint8_t* w = reinterpret_cast<const uint8_t*>(window_.data());
+
+  // Walk shortest path back. Instructions are collected as ends of
+  // COPY/RUN steps, literals are everything in between.
+  std::vector<size_t> ends;
+  bool in_add = add_[len].cost < copy_[len].cost;
+  for (size_t i = len; i > 0;) {
+    const Step& s = in_add ? add_[i] : copy_[i];
+    if (!in_add)
+      ends.push_back(i);
+    in_add = s.from_add;
+    i = s.from;
+  }
+
+  size_t lit = 0;
+  for (size_t k = ends.size(); k-- > 0;) {
+    size_t end = ends[k];
+    const Step& s = copy_[end];
+    writer_.add(w + lit, s.from - lit);
+    if (s.addr == kRun)
+      writer_.run(w[s.from], end - s.from);
+    else
+      writer_.copy(s.addr, end - s.from);
+    lit = end;
+  }
+  writer_.add(w + lit, len - lit);
+}
+
+}  // namespace sdch
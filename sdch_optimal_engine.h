@@ -0,0 +1,101 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_OPTIMAL_ENGINE_H_
+#define SDCH_OPTIMAL_ENGINE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <google/vcencoder.h>
+
+#include "sdch_vcdiff_writer.h"
+
+namespace sdch {
+
+// Maximum-ratio VCDIFF encoder. Much slower than VcdiffEngine and meant for
+// content encoded once and served many times.
+//
+// Input is buffered into windows of up to kWindowSize bytes. For every
+// window suffix array is built over dictionary and window. So COPY can
+// reference any earlier string of dictionary or window itself, including
+// overlapping ones. Instructions are chosen by shortest path over estimated
+// encoded sizes of ADD, RUN and COPY with every useful length. Address modes
+// and double opcodes are chosen by VcdiffWriter.
+class OptimalEngine {
+ public:
+  // Biggest window to encode at once.
+  static const size_t kWindowSize = 256 * 1024;
+
+  OptimalEngine();
+
+  // Write VCDIFF header. dict should outlive encoding.
+  bool start(const char* dict,
+             size_t len,
+             open_vcdiff::OutputStringInterface* out);
+
+  bool encode_chunk(const char* data,
+                    size_t len,
+                    open_vcdiff::OutputStringInterface* out);
+
+  bool finish(open_vcdiff::OutputStringInterface* out);
+
+  // COPY found for target position.
+  struct Match {
+    uint32_t len;
+    uint32_t addr;
+  };
+
+ private:
+  // Step of the shortest path.
+  struct Step {
+    uint32_t cost;
+    // Start of the instruction ending here.
+    uint32_t from;
+    // Address of COPY. kRun for RUN. Unused for ADD.
+    uint32_t addr;
+    // Address of last COPY on the path. For near cache estimation.
+    uint32_t last_addr;
+    // Whether previous step ended inside ADD.
+    bool from_add;
+  };
+
+  void encode_window(open_vcdiff::OutputStringInterface* out);
+  void build_suffix_array();
+  void find_matches(size_t pos, std::vector<Match>* matches) const;
+  void parse();
+  void emit();
+  static void relax(std::vector<Step>* steps,
+                    size_t to,
+                    Step s,
+                    uint32_t len);
+
+  // Estimated size of COPY address.
+  size_t address_cost(size_t addr, size_t here, uint32_t last_addr) const;
+
+  const uint8_t* dict_;
+  size_t dict_size_;
+
+  // Buffered window.
+  std::string window_;
+
+  // Dictionary, separator, window and terminator. Separators are unique
+  // symbols so no match crosses them.
+  std::vector<uint32_t> text_;
+  std::vector<uint32_t> sa_;
+  std::vector<uint32_t> rank_;
+  std::vector<uint32_t> lcp_;
+
+  // Shortest path. copy_[i] ends at i after COPY or RUN, add_[i] ends at i
+  // inside ADD.
+  std::vector<Step> copy_;
+  std::vector<Step> add_;
+
+  VcdiffWriter writer_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_OPTIMAL_ENGINE_H_
@@ -5,12 +5,13 @@
 
 #include <cassert>
 #include "sdch_config.h"
+#include "sdch_probes.h"
 #include "sdch_request_context.h"
 
 namespace sdch {
 
-OutputHandler::OutputHandler(RequestContext* ctx, ngx_http_output_body_filter_pt next_body)
-    : Handler(NULL), ctx_(ctx), next_body_(next_body) {
+OutputHandler::OutputHandler(RequestContext* ctx, const PipelineSpec& spec)
+    : ctx_(ctx), next_body_(spec.next_body) {
 }
 
 OutputHandler::~OutputHandler() {}
@@ -20,14 +21,6 @@ bool OutputHandler::init(RequestContext* ctx) {
   return true;
 }
 
-ngx_int_t OutputHandler::on_data(const uint8_t* buf, size_t len) {
-  Status res = write(buf, len);
-  if (res == STATUS_ERROR)
-    return NGX_ERROR;
-
-  return next_body();
-}
-
 ngx_int_t OutputHandler::on_finish() {
   out_buf_->last_buf = 1;
   if (flush_out_buf(false) == STATUS_ERROR)
@@ -109,6 +102,8 @@ Status OutputHandler::flush_out_buf(bool flush) {
 }
 
 ngx_int_t OutputHandler::next_body() {
+  ScopedTimer timer(&ctx_->phase_ns[PHASE_OUTPUT]);
+  SDCH_PROBE2(output_flush, ctx_->request, out_);
   ngx_int_t rc = next_body_(ctx_->request, out_);
   ngx_chain_update_chains(ctx_->request->pool,
                           &free_,
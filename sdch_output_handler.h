@@ -17,17 +17,23 @@ namespace sdch {
 
 class RequestContext;
 
-// nginx output handler. Will pass data to nginx.
-class OutputHandler : public Handler {
+// nginx output handler. Will pass data to nginx. Always the last stage.
+class OutputHandler {
  public:
-  OutputHandler(RequestContext* ctx, ngx_http_output_body_filter_pt next_body);
+  OutputHandler(RequestContext* ctx, const PipelineSpec& spec);
   ~OutputHandler();
 
-  virtual bool init(RequestContext* ctx);
+  bool init(RequestContext* ctx);
 
-  virtual ngx_int_t on_data(const uint8_t* buf, size_t len);
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    Status res = write(buf, len);
+    if (res == STATUS_ERROR)
+      return NGX_ERROR;
 
-  virtual ngx_int_t on_finish();
+    return next_body();
+  }
+
+  ngx_int_t on_finish();
 
  private:
   Status get_buf();
@@ -49,4 +55,3 @@ class OutputHandler : public Handler {
 }  // namespace sdch
 
 #endif  // SDCH_OUTPUT_HANDLER_H_
-
@@ -0,0 +1,267 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_parallel_handler.h"
+
+#if (NGX_THREADS)
+
+#include <algorithm>
+#include <memory>
+
+#include <google/vcencoder.h>
+
+#include "sdch_config.h"
+#include "sdch_dictionary.h"
+#include "sdch_encoder_pool.h"
+#include "sdch_optimal_engine.h"
+#include "sdch_request_context.h"
+#include "sdch_vcdiff_engine.h"
+#include "sdch_vcdiff_writer.h"
+
+namespace sdch {
+
+struct ParallelWindow {
+  ParallelEncoder* owner;
+
+  // Read-only parts of encoder. Shared between windows.
+  const Dictionary* dict;
+  const VcdiffIndex* index;
+  ngx_uint_t encoder;
+
+  std::string in;
+  std::string out;
+
+  bool done;
+  bool ok;
+};
+
+namespace {
+
+// Windows of one response in flight. More would only wait in thread pool
+// queue with their input in memory.
+const size_t kMaxWindows = 8;
+
+// Encode window as one or more VCDIFF windows without file header. Runs in
+// thread pool.
+bool encode_window(ParallelWindow* w) {
+  open_vcdiff::OutputString<std::string> out(&w->out);
+  size_t header;
+
+  switch (w->encoder) {
+    case ENCODER_SIMD: {
+      VcdiffEngine engine;
+      if (!engine.start(w->index, &out))
+        return false;
+      header = w->out.size();
+      if (!engine.encode_chunk(w->in.data(), w->in.size(), &out) ||
+          !engine.finish(&out))
+        return false;
+      break;
+    }
+
+    case ENCODER_OPTIMAL: {
+      OptimalEngine engine;
+      if (!engine.start(w->dict->payload(), w->dict->payload_size(), &out))
+        return false;
+      header = w->out.size();
+      if (!engine.encode_chunk(w->in.data(), w->in.size(), &out) ||
+          !engine.finish(&out))
+        return false;
+      break;
+    }
+
+    default: {
+      // EncoderPool isn't thread safe. Encoder is cheap compared to window.
+      std::auto_ptr<EncoderPool::Encoder> enc(EncoderPool::create(w->dict));
+      if (!enc->StartEncodingToInterface(&out))
+        return false;
+      header = w->out.size();
+      if (!enc->EncodeChunkToInterface(w->in.data(), w->in.size(), &out) ||
+          !enc->FinishEncodingToInterface(&out))
+        return false;
+      break;
+    }
+  }
+
+  w->out.erase(0, header);
+  return true;
+}
+
+}  // namespace
+
+ParallelEncoder::ParallelEncoder(RequestContext* ctx,
+                                 const PipelineSpec& spec)
+    : ctx_(ctx),
+      dict_(spec.dict),
+      quasidict_(spec.quasidict),
+      index_(NULL),
+      encoder_(spec.encoder),
+      thread_pool_(spec.thread_pool),
+      window_size_(spec.window_size),
+      posted_(false),
+      finishing_(false) {}
+
+ParallelEncoder::~ParallelEncoder() {
+  // Only aborted requests get here with windows. Threads are done with
+  // them: request is blocked until event_handler.
+  for (size_t i = 0; i < windows_.size(); ++i)
+    delete windows_[i];
+}
+
+bool ParallelEncoder::start() {
+  // Index and payload are built lazily. Do it here, threads only read them.
+  if (encoder_ == ENCODER_SIMD && (index_ = dict_->vcdiff_index()) == NULL)
+    return false;
+  if (encoder_ == ENCODER_OPTIMAL && !dict_->has_payload())
+    return false;
+
+  std::string header(reinterpret_cast<const char*>(dict_->server_id().data()),
+                     8);
+  header.push_back('\0');
+  open_vcdiff::OutputString<std::string> out(&header);
+  VcdiffWriter::write_header(&out);
+
+  pending_.reserve(window_size_);
+  return write(header) != NGX_ERROR;
+}
+
+bool ParallelEncoder::encode(const uint8_t* buf, size_t len) {
+  pending_.append(reinterpret_cast<const char*>(buf), len);
+  if (!post_ready())
+    return false;
+
+  update_buffered();
+  return true;
+}
+
+ngx_int_t ParallelEncoder::finish() {
+  finishing_ = true;
+
+  // Whole response fits into single window. Don't bother with threads.
+  if (!posted_) {
+    ParallelWindow w;
+    w.dict = dict_;
+    w.index = index_;
+    w.encoder = encoder_;
+    w.in.swap(pending_);
+    if (!encode_window(&w) || write(w.out) == NGX_ERROR)
+      return NGX_ERROR;
+    return complete();
+  }
+
+  ngx_int_t rc = drain();
+  update_buffered();
+  return rc;
+}
+
+bool ParallelEncoder::post_ready() {
+  while (!pending_.empty() && windows_.size() < kMaxWindows &&
+         (pending_.size() >= window_size_ || finishing_)) {
+    if (!post(std::min(pending_.size(), window_size_)))
+      return false;
+  }
+
+  ctx_->input_blocked = windows_.size() >= kMaxWindows;
+  return true;
+}
+
+bool ParallelEncoder::post(size_t n) {
+  ngx_http_request_t* r = ctx_->request;
+
+  ngx_thread_task_t* task = ngx_thread_task_alloc(r->pool, 0);
+  if (task == NULL)
+    return false;
+
+  std::auto_ptr<ParallelWindow> w(new ParallelWindow());
+  w->owner = this;
+  w->dict = dict_;
+  w->index = index_;
+  w->encoder = encoder_;
+  w->in.assign(pending_, 0, n);
+  w->done = false;
+  w->ok = false;
+
+  task->ctx = w.get();
+  task->handler = thread_handler;
+  task->event.handler = event_handler;
+  task->event.data = w.get();
+
+  if (ngx_thread_task_post(thread_pool_, task) != NGX_OK)
+    return false;
+
+  ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                 "sdch window of %uz bytes posted", w->in.size());
+
+  windows_.push_back(w.release());
+  posted_ = true;
+  r->main->blocked++;
+
+  pending_.erase(0, n);
+  return true;
+}
+
+void ParallelEncoder::thread_handler(void* data, ngx_log_t* log) {
+  ParallelWindow* w = static_cast<ParallelWindow*>(data);
+  w->ok = encode_window(w);
+}
+
+void ParallelEncoder::event_handler(ngx_event_t* ev) {
+  ParallelWindow* w = static_cast<ParallelWindow*>(ev->data);
+  ParallelEncoder* self = w->owner;
+  ngx_http_request_t* r = self->ctx_->request;
+  ngx_connection_t* c = r->connection;
+
+  ngx_http_set_log_request(c->log, r);
+
+  r->main->blocked--;
+  w->done = true;
+
+  if (self->drain() == NGX_ERROR) {
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0, "sdch parallel encoding failed");
+    ngx_http_finalize_request(r, NGX_ERROR);
+    return;
+  }
+
+  self->update_buffered();
+
+  // Feed input held while there was no room for windows.
+  if (self->ctx_->input_blocked)
+    ngx_post_event(c->write, &ngx_posted_events);
+  else
+    self->ctx_->resume();
+}
+
+ngx_int_t ParallelEncoder::drain() {
+  while (!windows_.empty() && windows_.front()->done) {
+    std::auto_ptr<ParallelWindow> w(windows_.front());
+    windows_.pop_front();
+
+    if (!w->ok || write(w->out) == NGX_ERROR)
+      return NGX_ERROR;
+  }
+
+  if (!post_ready())
+    return NGX_ERROR;
+
+  if (!windows_.empty())
+    return NGX_AGAIN;
+
+  if (finishing_)
+    return complete();
+
+  return NGX_OK;
+}
+
+void ParallelEncoder::update_buffered() {
+  ngx_http_request_t* r = ctx_->request;
+
+  // SDCH_BUFFERED is shared with sdch_slice_size.
+  if (!windows_.empty())
+    r->buffered |= SDCH_BUFFERED;
+  else if (ctx_->in == NULL)
+    r->buffered &= ~SDCH_BUFFERED;
+}
+
+}  // namespace sdch
+
+#endif  // NGX_THREADS
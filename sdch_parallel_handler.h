@@ -0,0 +1,125 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_PARALLEL_HANDLER_H_
+#define SDCH_PARALLEL_HANDLER_H_
+
+#include "sdch_handler.h"
+
+#if (NGX_THREADS)
+
+#include <deque>
+#include <string>
+
+namespace sdch {
+
+class Dictionary;
+class RequestContext;
+class VcdiffIndex;
+
+// Window of response encoded on thread pool.
+struct ParallelWindow;
+
+// Encodes response as independent VCDIFF windows of spec.window_size
+// bytes on spec.thread_pool. Every window is encoded by its own encoder
+// against the same read-only dictionary. Finished windows are written in
+// order, so output is a regular VCDIFF stream.
+//
+// Windows finish outside of body_filter. Request is kept alive with
+// r->main->blocked and output is flushed by posting write event. Only a few
+// windows are in flight at once: beyond that input is held the same way
+// sdch_slice_size does until a window is done.
+class ParallelEncoder {
+ public:
+  ParallelEncoder(RequestContext* ctx, const PipelineSpec& spec);
+  virtual ~ParallelEncoder();
+
+ protected:
+  // Write Dictionary server_id and VCDIFF header.
+  bool start();
+  // Buffer data. Full windows are posted to thread pool while there is
+  // room for them.
+  bool encode(const uint8_t* buf, size_t len);
+  // Post last window. NGX_AGAIN means complete() will be called later.
+  ngx_int_t finish();
+  // No windows in flight.
+  bool idle() const { return windows_.empty(); }
+
+  // Output of finished window. Called in order of windows.
+  virtual ngx_int_t write(const std::string& out) = 0;
+  // Called after finish() when all windows are written.
+  virtual ngx_int_t complete() = 0;
+
+ private:
+  static void thread_handler(void* data, ngx_log_t* log);
+  static void event_handler(ngx_event_t* ev);
+
+  // Post window of n bytes from pending_.
+  bool post(size_t n);
+  // Post what can be posted from pending_. Blocks input if no more room.
+  bool post_ready();
+  // Write finished windows from the front of queue and post the next ones.
+  ngx_int_t drain();
+  void update_buffered();
+
+  RequestContext* ctx_;
+  Dictionary* dict_;
+  // Keeps quasi, trained, composite or version dictionary alive while
+  // threads read it.
+  FastdictFactory::ValuePtr quasidict_;
+  const VcdiffIndex* index_;
+  ngx_uint_t encoder_;
+  ngx_thread_pool_t* thread_pool_;
+  size_t window_size_;
+
+  // Input not posted yet: window being filled and full windows waiting for
+  // room.
+  std::string pending_;
+  // Posted windows in order.
+  std::deque<ParallelWindow*> windows_;
+  bool posted_;
+  bool finishing_;
+};
+
+template <typename Next>
+class ParallelEncodingHandler : public ParallelEncoder {
+ public:
+  ParallelEncodingHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : ParallelEncoder(ctx, spec), next_(ctx, spec) {}
+
+  bool init(RequestContext* ctx) {
+    if (!next_.init(ctx))
+      return false;
+    return start();
+  }
+
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    if (len)
+      return encode(buf, len) ? NGX_OK : NGX_ERROR;
+
+    // No data was supplied. Pass it through unless it'll overtake windows.
+    if (idle())
+      return next_.on_data(buf, len);
+    return NGX_OK;
+  }
+
+  ngx_int_t on_finish() { return finish(); }
+
+ protected:
+  virtual ngx_int_t write(const std::string& out) {
+    return next_.on_data(reinterpret_cast<const uint8_t*>(out.data()),
+                         out.size());
+  }
+
+  virtual ngx_int_t complete() { return next_.on_finish(); }
+
+ private:
+  Next next_;
+};
+
+
+}  // namespace sdch
+
+#endif  // NGX_THREADS
+
+#endif  // SDCH_PARALLEL_HANDLER_H_
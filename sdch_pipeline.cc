@@ -0,0 +1,117 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_pipeline.h"
+
+#include "sdch_autoauto_handler.h"
+#include "sdch_cache_handler.h"
+#include "sdch_config.h"
+#include "sdch_deflate_handler.h"
+#include "sdch_dump_handler.h"
+#include "sdch_encoding_handler.h"
+#include "sdch_output_handler.h"
+#include "sdch_parallel_handler.h"
+#include "sdch_pool_alloc.h"
+#include "sdch_request_context.h"
+#include "sdch_zstd_handler.h"
+
+namespace sdch {
+
+namespace {
+
+// Stages are added starting from the output end. Each step either wraps
+// Tail into its stage or passes Tail as is, depending on spec. Steps follow
+// what header_filter can ask for, so only reachable combinations get their
+// own Pipeline instantiation: gzip and cache only with VCDIFF or cached
+// output, nothing but sampling and storing without dictionary.
+
+template <typename Chain>
+Handler* finish(RequestContext* ctx, const PipelineSpec& spec) {
+  return POOL_ALLOC(ctx->request, Pipeline<Chain>, ctx, spec);
+}
+
+template <typename Tail>
+Handler* add_autoauto(RequestContext* ctx, const PipelineSpec& spec) {
+  if (spec.store_as_quasi)
+    return finish<AutoautoHandler<Tail> >(ctx, spec);
+  return finish<Tail>(ctx, spec);
+}
+
+template <typename Tail>
+Handler* add_dump(RequestContext* ctx, const PipelineSpec& spec) {
+  if (spec.dump || spec.train_slot >= 0)
+    return add_autoauto<DumpHandler<Tail> >(ctx, spec);
+  return add_autoauto<Tail>(ctx, spec);
+}
+
+template <typename Tail>
+Handler* add_vcdiff(RequestContext* ctx, const PipelineSpec& spec) {
+#if (NGX_THREADS)
+  if (spec.thread_pool)
+    return add_dump<ParallelEncodingHandler<Tail> >(ctx, spec);
+#endif
+
+  // Optimal requires thread pool, so it never gets here.
+  if (spec.encoder == ENCODER_SIMD)
+    return add_dump<EncodingHandler<Tail, SimdEncoder> >(ctx, spec);
+  return add_dump<EncodingHandler<Tail, OpenVcdiffEncoder> >(ctx, spec);
+}
+
+template <typename Tail>
+Handler* add_cache_store(RequestContext* ctx, const PipelineSpec& spec) {
+  if (spec.cache)
+    return add_vcdiff<CacheStoreHandler<Tail> >(ctx, spec);
+  return add_vcdiff<Tail>(ctx, spec);
+}
+
+// Cache stores and replays plain SDCH. So gzip goes after it.
+template <typename Tail>
+Handler* add_deflate(RequestContext* ctx, const PipelineSpec& spec) {
+  if (spec.gzip)
+    return add_cache_store<DeflateHandler<Tail> >(ctx, spec);
+  return add_cache_store<Tail>(ctx, spec);
+}
+
+template <typename Tail>
+Handler* add_cached(RequestContext* ctx, const PipelineSpec& spec) {
+  if (spec.gzip)
+    return add_dump<CachedHandler<DeflateHandler<Tail> > >(ctx, spec);
+  return add_dump<CachedHandler<Tail> >(ctx, spec);
+}
+
+#if (NGX_HAVE_ZSTD)
+// No gzip on top of zstd.
+template <typename Tail>
+Handler* add_zstd(RequestContext* ctx, const PipelineSpec& spec) {
+  if (spec.cache)
+    return add_dump<ZstdEncodingHandler<CacheStoreHandler<Tail> > >(ctx, spec);
+  return add_dump<ZstdEncodingHandler<Tail> >(ctx, spec);
+}
+#endif
+
+// Response without dictionary is at least sampled or stored.
+template <typename Tail>
+Handler* add_plain(RequestContext* ctx, const PipelineSpec& spec) {
+  if (!spec.store_as_quasi)
+    return finish<DumpHandler<Tail> >(ctx, spec);
+  return add_dump<Tail>(ctx, spec);
+}
+
+}  // namespace
+
+Handler* create_pipeline(RequestContext* ctx, const PipelineSpec& spec) {
+  if (spec.dict == NULL)
+    return add_plain<OutputHandler>(ctx, spec);
+
+  if (spec.cached.data)
+    return add_cached<OutputHandler>(ctx, spec);
+
+#if (NGX_HAVE_ZSTD)
+  if (spec.encoder == ENCODER_ZSTD)
+    return add_zstd<OutputHandler>(ctx, spec);
+#endif
+
+  return add_deflate<OutputHandler>(ctx, spec);
+}
+
+}  // namespace sdch
@@ -0,0 +1,50 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_PIPELINE_H_
+#define SDCH_PIPELINE_H_
+
+#include "sdch_handler.h"
+#include "sdch_probes.h"
+#include "sdch_request_context.h"
+
+namespace sdch {
+
+// Fused Handler chain. Chain is the outermost stage which embeds the rest
+// of them by value. E.g.
+//   Pipeline<AutoautoHandler<EncodingHandler<OutputHandler> > >
+// Whole thing is a single allocation from request pool.
+template <typename Chain>
+class Pipeline : public Handler {
+ public:
+  Pipeline(RequestContext* ctx, const PipelineSpec& spec)
+      : chain_(ctx, spec), ctx_(ctx) {}
+
+  virtual bool init(RequestContext* ctx) {
+    SDCH_PROBE1(pipeline_init, ctx->request);
+    return chain_.init(ctx);
+  }
+
+  virtual ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    SDCH_PROBE2(pipeline_data, ctx_->request, len);
+    return chain_.on_data(buf, len);
+  }
+
+  virtual ngx_int_t on_finish() {
+    SDCH_PROBE1(pipeline_finish, ctx_->request);
+    return chain_.on_finish();
+  }
+
+ private:
+  Chain chain_;
+  RequestContext* ctx_;
+};
+
+// Instantiate Pipeline for the combination of stages described by spec.
+// Allocated from request pool. Returns NULL on failure.
+Handler* create_pipeline(RequestContext* ctx, const PipelineSpec& spec);
+
+
+}  // namespace sdch
+
+#endif  // SDCH_PIPELINE_H_
@@ -0,0 +1,52 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_PROBES_H_
+#define SDCH_PROBES_H_
+
+extern "C" {
+#include <ngx_config.h>
+}
+
+// USDT probes for bpftrace, perf and SystemTap. Built in with
+// "SDCH_USDT=YES ./configure ...". Probe is a single nop until attached,
+// arguments are already in registers mostly. Provider is "sdch":
+//
+//   request(r)                       client accepts sdch
+//   skip(r, reason)                  SkipReason
+//   select(r, dict_id, is_best, quasi)
+//                                    dict_id is NULL or 8 bytes
+//   encode(r, dict_id)               response will be encoded
+//   pipeline_init(r)
+//   pipeline_data(r, len)
+//   pipeline_finish(r)
+//   <stage>_data(r, buf, len)        stage is vcdiff, zstd, deflate,
+//   <stage>_finish(r)                autoauto, cache_store or dump
+//   output_flush(r, chain)           chain passed to the next body filter
+//   fastdict_find(id, found)
+//   fastdict_store(id, size)
+//   fastdict_evict(id, size)
+//
+//   bpftrace -e 'usdt:objs/nginx:sdch:pipeline_data { @[tid] = sum(arg1) }'
+
+#if (NGX_HAVE_SDCH_USDT)
+
+#include <sys/sdt.h>
+
+#define SDCH_PROBE(name) DTRACE_PROBE(sdch, name)
+#define SDCH_PROBE1(name, a) DTRACE_PROBE1(sdch, name, a)
+#define SDCH_PROBE2(name, a, b) DTRACE_PROBE2(sdch, name, a, b)
+#define SDCH_PROBE3(name, a, b, c) DTRACE_PROBE3(sdch, name, a, b, c)
+#define SDCH_PROBE4(name, a, b, c, d) DTRACE_PROBE4(sdch, name, a, b, c, d)
+
+#else
+
+#define SDCH_PROBE(name)
+#define SDCH_PROBE1(name, a)
+#define SDCH_PROBE2(name, a, b)
+#define SDCH_PROBE3(name, a, b, c)
+#define SDCH_PROBE4(name, a, b, c, d)
+
+#endif  // NGX_HAVE_SDCH_USDT
+
+#endif  // SDCH_PROBES_H_
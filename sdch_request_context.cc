@@ -11,8 +11,39 @@ RequestContext::RequestContext(ngx_http_request_t* r) : request(r) {
   ngx_http_set_ctx(r, this, sdch_module);
 }
 
+RequestContext::~RequestContext() {
+  if (resume_event_.posted)
+    ngx_delete_posted_event(&resume_event_);
+}
+
 RequestContext* RequestContext::get(ngx_http_request_t* r) {
   return static_cast<RequestContext*>(ngx_http_get_module_ctx(r, sdch_module));
 }
 
+void RequestContext::resume() {
+  if (resume_event_.posted)
+    return;
+  resume_event_.handler = resume_handler;
+  resume_event_.data = this;
+  resume_event_.log = request->connection->log;
+  ngx_post_event(&resume_event_, &ngx_posted_events);
+}
+
+void RequestContext::resume_handler(ngx_event_t* ev) {
+  RequestContext* ctx = static_cast<RequestContext*>(ev->data);
+  ngx_http_request_t* r = ctx->request;
+  ngx_connection_t* c = r->connection;
+
+  ngx_http_set_log_request(c->log, r);
+
+  if (ctx->in != NULL && ngx_http_output_filter(r, NULL) == NGX_ERROR) {
+    ngx_http_finalize_request(r, NGX_ERROR);
+  } else {
+    // Let finalized request finish once its output is written.
+    ngx_post_event(c->write, &ngx_posted_events);
+  }
+
+  ngx_http_run_posted_requests(c);
+}
+
 }  // namespace sdch
@@ -17,16 +17,24 @@ extern "C" {
 
 #include "sdch_dictionary.h"
 #include "sdch_fastdict_factory.h"
+#include "sdch_stats.h"
+#include "sdch_timer.h"
 
 namespace sdch {
 
 class Handler;
+struct PipelineSpec;
+
+// Bit in r->buffered. Set while we are holding unprocessed input after
+// yielding to event loop.
+#define SDCH_BUFFERED 0x08
 
 // Context used inside nginx to keep relevant data.
 struct RequestContext {
  public:
   // Create RequestContext.
   explicit RequestContext(ngx_http_request_t* r);
+  ~RequestContext();
 
   // Fetch RequestContext associated with nginx request
   static RequestContext* get(ngx_http_request_t* r);
@@ -36,11 +44,70 @@ struct RequestContext {
 
   bool need_flush;  // FIXME
 
+  // Input left unprocessed after slice_size exhausted.
+  ngx_chain_t* in;
+
+  // Feed input kept in "in" to body filter from posted event. Nothing else
+  // calls it without new data: buffered upstream doesn't.
+  void resume();
+
+  // Precompressed file to send instead of encoding. Set by "sdch_static".
+  ngx_buf_t* static_file;
+
+  // Look-ahead buffer and dictionary to trial-encode it with. Set by
+  // "sdch_lookahead" until headers are sent.
+  ngx_buf_t*  lookahead;
+  Dictionary* lookahead_dict;
+
+  // "sdch_trial_dicts" candidates and their memo key.
+  ngx_array_t*  trial_dicts;
+  ngx_str_t     trial_key;
+  // While looking ahead. Pipeline is created from it once trial shows that
+  // encoding pays off and with which dictionary.
+  PipelineSpec* spec;
+
+  // Client ids of dictionaries composite one is built from. Empty if
+  // composite dictionary is not used.
+  ngx_str_t composite_ids;
+
+  // Response is "Content-Encoding: sdch, gzip".
+  bool gzip;
+  // Response is "Content-Encoding: sdch-zstd".
+  bool zstd;
+
+  // CacheStatus for $sdch_cache_status.
+  unsigned cache_status : 2;
+
   bool started : 1;
   bool done : 1;
+  // Pipeline takes no more input until resume(). Set while too many
+  // windows of ParallelEncodingHandler are in flight.
+  bool input_blocked : 1;
+
+  // Dictionary was chosen (maybe none). For $sdch_is_best and friends.
+  bool selected : 1;
+  bool is_best : 1;
+  bool quasi_hit : 1;
+  bool has_dict : 1;
+
+  // Client id of Dictionary response is encoded with if has_dict.
+  Dictionary::id_t dict_id;
+  // Value of sdch_group.
+  ngx_str_t group;
+  // Why response isn't encoded. Requests skipped early get context just
+  // for this.
+  SkipReason skip_reason;
 
   size_t total_in;
   size_t total_out;
+
+  // Nanoseconds spent in every Phase. Zero if phase didn't happen.
+  uint64_t phase_ns[PHASES];
+
+ private:
+  static void resume_handler(ngx_event_t* ev);
+
+  ngx_event_t resume_event_;
 };
 
 
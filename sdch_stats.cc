@@ -0,0 +1,492 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_stats.h"
+
+#include <algorithm>
+
+#include "sdch_module.h"
+#include "sdch_pool_alloc.h"
+
+namespace sdch {
+
+namespace {
+
+const size_t kSlots = 1024;
+const size_t kMaxName = 62;
+const size_t kLocations = 32;
+
+// Log-linear histogram: every power of two is split into kSubBuckets
+// buckets, so error is within 25%. Values up to kSubBuckets nanoseconds
+// have own buckets, everything from 2^kMaxExp (about a minute) goes to
+// the last one.
+const size_t kSubBits = 2;
+const size_t kSubBuckets = 1 << kSubBits;
+const size_t kMaxExp = 36;
+const size_t kBuckets = (kMaxExp - kSubBits + 2) * kSubBuckets;
+
+size_t bucket_index(uint64_t ns) {
+  if (ns < kSubBuckets)
+    return size_t(ns);
+
+  size_t exp = 63 - __builtin_clzll(ns);
+  if (exp > kMaxExp)
+    return kBuckets - 1;
+
+  size_t sub = size_t(ns >> (exp - kSubBits)) & (kSubBuckets - 1);
+  return (exp - kSubBits + 1) * kSubBuckets + sub;
+}
+
+// The largest value in bucket.
+uint64_t bucket_upper(size_t index) {
+  if (index < kSubBuckets)
+    return index;
+
+  size_t exp = index / kSubBuckets + kSubBits - 1;
+  uint64_t sub = index % kSubBuckets;
+  return ((kSubBuckets + sub + 1) << (exp - kSubBits)) - 1;
+}
+
+enum SlotKind {
+  KIND_DICTIONARY = 1,
+  KIND_GROUP = 2
+};
+
+ngx_str_t skip_reason_names[] = {
+  ngx_null_string,
+  ngx_string("disabled"),
+  ngx_string("status"),
+  ngx_string("encoded"),
+  ngx_string("too_small"),
+  ngx_string("content_type"),
+  ngx_string("disable_cv"),
+  ngx_string("header_only"),
+  ngx_string("proxied"),
+  ngx_string("no_dictionary"),
+  ngx_string("lookahead"),
+};
+
+const char* phase_names[] = {
+  "select",
+  "init",
+  "encode",
+  "autoauto",
+  "output",
+};
+
+// Groups and locations come from configuration and variables. Keep them
+// safe for JSON and labels.
+size_t sanitize(const ngx_str_t& name, u_char* buf) {
+  size_t len = std::min(name.len, kMaxName);
+  for (size_t i = 0; i < len; ++i) {
+    u_char c = name.data[i];
+    buf[i] = (c < 0x20 || c > 0x7e || c == '"' || c == '\\') ? '_' : c;
+  }
+  return len;
+}
+
+// Nanoseconds as seconds for Prometheus.
+u_char* print_seconds(u_char* p, uint64_t ns) {
+  return ngx_sprintf(p, "%uL.%09uL", ns / 1000000000, ns % 1000000000);
+}
+
+const char* counter_names[] = {
+  "requests",
+  "encoded",
+  "bytes_in",
+  "bytes_out",
+  "get_dictionary",
+  "quasi_stores",
+  "quasi_hits",
+  "quasi_misses",
+  "quasi_evictions",
+  "dumps",
+  "dumps_dropped",
+};
+
+}  // namespace
+
+const ngx_str_t& skip_reason_name(SkipReason reason) {
+  return skip_reason_names[reason];
+}
+
+struct Stats::Slot {
+  // ngx_hash_key of kind and name. 0 if slot is free.
+  ngx_atomic_t hash;
+  // name is written. Slot can be counted before that.
+  ngx_atomic_t ready;
+  ngx_atomic_t count;
+  u_char kind;
+  u_char len;
+  u_char name[kMaxName];
+};
+
+struct Stats::Histogram {
+  ngx_atomic_t count;
+  ngx_atomic_t sum;
+  ngx_atomic_t buckets[kBuckets];
+};
+
+struct Stats::Location {
+  // 0 if free. Claimed in init_zone only.
+  u_char len;
+  u_char name[kMaxName];
+  Histogram phases[PHASES];
+};
+
+// Lives in shared memory.
+struct Stats::Shared {
+  ngx_atomic_t counters[COUNTERS];
+  ngx_atomic_t skipped[SKIP_REASONS];
+  // Selections which didn't fit into slots.
+  ngx_atomic_t overflow;
+  Slot slots[kSlots];
+  Location locations[kLocations];
+};
+
+Stats* Stats::create(ngx_conf_t* cf) {
+  static ngx_str_t name = ngx_string("sdch_status");
+  ngx_shm_zone_t* zone = ngx_shared_memory_add(
+      cf, &name, sizeof(Shared) + 8 * ngx_pagesize, &sdch_module);
+  if (zone == NULL)
+    return NULL;
+
+  if (zone->data)
+    return static_cast<Stats*>(zone->data);
+
+  Stats* stats = POOL_ALLOC(cf, Stats);
+  if (stats == NULL)
+    return NULL;
+
+  stats->locations_ = ngx_array_create(cf->pool, 4, sizeof(LocationName));
+  if (stats->locations_ == NULL)
+    return NULL;
+
+  zone->init = init_zone;
+  zone->data = stats;
+  return stats;
+}
+
+ngx_int_t Stats::init_zone(ngx_shm_zone_t* zone, void* data) {
+  Stats* stats = static_cast<Stats*>(zone->data);
+  Stats* old = static_cast<Stats*>(data);
+
+  ngx_slab_pool_t* shpool = reinterpret_cast<ngx_slab_pool_t*>(zone->shm.addr);
+
+  if (old) {
+    // Reload. Keep counting.
+    stats->sh_ = old->sh_;
+  } else if (zone->shm.exists) {
+    stats->sh_ = static_cast<Shared*>(shpool->data);
+  } else {
+    stats->sh_ = static_cast<Shared*>(ngx_slab_calloc(shpool, sizeof(Shared)));
+    if (stats->sh_ == NULL)
+      return NGX_ERROR;
+    shpool->data = stats->sh_;
+  }
+
+  stats->map_locations(zone->shm.log);
+  return NGX_OK;
+}
+
+void Stats::map_locations(ngx_log_t* log) {
+  LocationName* names = static_cast<LocationName*>(locations_->elts);
+  for (ngx_uint_t i = 0; i < locations_->nelts; ++i) {
+    LocationName& n = names[i];
+    Location* free = NULL;
+    for (size_t j = 0; j < kLocations && n.index < 0; ++j) {
+      Location& l = sh_->locations[j];
+      if (l.len == 0 && free == NULL)
+        free = &l;
+      if (l.len == n.name.len && ngx_memcmp(l.name, n.name.data, l.len) == 0)
+        n.index = j;
+    }
+
+    if (n.index >= 0)
+      continue;
+
+    // Locations of previous configurations are never freed.
+    if (free == NULL) {
+      ngx_log_error(NGX_LOG_WARN, log, 0,
+                    "sdch_status: no room for location \"%V\"", &n.name);
+      continue;
+    }
+
+    free->len = n.name.len;
+    ngx_memcpy(free->name, n.name.data, n.name.len);
+    n.index = free - sh_->locations;
+  }
+}
+
+ngx_int_t Stats::location(ngx_conf_t* cf, const ngx_str_t& name) {
+  u_char buf[kMaxName];
+  size_t len = sanitize(name, buf);
+
+  LocationName* names = static_cast<LocationName*>(locations_->elts);
+  for (ngx_uint_t i = 0; i < locations_->nelts; ++i) {
+    if (names[i].name.len == len &&
+        ngx_memcmp(names[i].name.data, buf, len) == 0)
+      return i;
+  }
+
+  if (locations_->nelts == kLocations) {
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "sdch_status: too many locations, \"%V\" is not timed",
+                       &name);
+    return -1;
+  }
+
+  LocationName* n = static_cast<LocationName*>(ngx_array_push(locations_));
+  if (n == NULL)
+    return -1;
+
+  n->name.data = static_cast<u_char*>(ngx_pnalloc(cf->pool, len));
+  if (n->name.data == NULL)
+    return -1;
+  ngx_memcpy(n->name.data, buf, len);
+  n->name.len = len;
+  n->index = -1;
+  return locations_->nelts - 1;
+}
+
+void Stats::observe(ngx_int_t location, Phase phase, uint64_t ns) {
+  if (location < 0)
+    return;
+
+  ngx_int_t index = static_cast<LocationName*>(locations_->elts)[location].index;
+  if (index < 0)
+    return;
+
+  Histogram& h = sh_->locations[index].phases[phase];
+  ngx_atomic_fetch_add(&h.buckets[bucket_index(ns)], 1);
+  ngx_atomic_fetch_add(&h.sum, ns);
+  ngx_atomic_fetch_add(&h.count, 1);
+}
+
+void Stats::add(Counter counter, ngx_atomic_int_t n) {
+  ngx_atomic_fetch_add(&sh_->counters[counter], n);
+}
+
+void Stats::skipped(SkipReason reason) {
+  ngx_atomic_fetch_add(&sh_->skipped[reason], 1);
+}
+
+void Stats::selected(const ngx_str_t& dict, const ngx_str_t& group) {
+  count(KIND_DICTIONARY, dict);
+  count(KIND_GROUP, group);
+}
+
+void Stats::count(u_char kind, const ngx_str_t& name) {
+  u_char buf[kMaxName];
+  size_t len = sanitize(name, buf);
+
+  ngx_atomic_uint_t hash = ngx_hash(ngx_hash_key(buf, len), kind);
+  if (hash == 0)
+    hash = 1;
+
+  for (size_t i = 0; i < kSlots; ++i) {
+    Slot* s = &sh_->slots[(hash + i) % kSlots];
+
+    if (s->hash == 0 && ngx_atomic_cmp_set(&s->hash, 0, hash)) {
+      s->kind = kind;
+      s->len = len;
+      ngx_memcpy(s->name, buf, len);
+      ngx_memory_barrier();
+      s->ready = 1;
+      ngx_atomic_fetch_add(&s->count, 1);
+      return;
+    }
+
+    if (s->hash != hash)
+      continue;
+
+    // Collision. Slot being filled right now is taken as ours.
+    if (s->ready && (s->kind != kind || s->len != len ||
+                     ngx_memcmp(s->name, buf, len) != 0))
+      continue;
+
+    ngx_atomic_fetch_add(&s->count, 1);
+    return;
+  }
+
+  ngx_atomic_fetch_add(&sh_->overflow, 1);
+}
+
+ngx_buf_t* Stats::render(ngx_pool_t* pool, Format format) const {
+  size_t used = 0;
+  for (size_t i = 0; i < kSlots; ++i) {
+    if (sh_->slots[i].ready)
+      ++used;
+  }
+
+  // Every histogram line is shorter than this.
+  const size_t line = kMaxName + 3 * NGX_ATOMIC_T_LEN +
+                      sizeof("sdch_phase_duration_seconds_bucket"
+                             "{location=\"\",phase=\"autoauto\",le=\"\"} \n");
+  size_t lines = 0;
+  for (size_t i = 0; i < kLocations; ++i) {
+    const Location& l = sh_->locations[i];
+    for (int ph = 0; ph < PHASES && l.len; ++ph) {
+      lines += 4;
+      for (size_t j = 0; j < kBuckets; ++j) {
+        if (l.phases[ph].buckets[j])
+          ++lines;
+      }
+    }
+  }
+
+  ngx_buf_t* b = ngx_create_temp_buf(
+      pool, 4096 + lines * line +
+                used * (kMaxName + sizeof("sdch_dictionary_selected_total"
+                                          "{id=\"\"} \n") + NGX_ATOMIC_T_LEN));
+  if (b == NULL)
+    return NULL;
+
+  u_char* p = b->last;
+
+  if (format == FORMAT_JSON) {
+    p = ngx_sprintf(p, "{");
+    for (int i = 0; i < COUNTERS; ++i) {
+      p = ngx_sprintf(p, "\"%s\":%uA,", counter_names[i], sh_->counters[i]);
+    }
+
+    p = ngx_sprintf(p, "\"skipped\":{");
+    for (int i = SKIP_NONE + 1; i < SKIP_REASONS; ++i) {
+      p = ngx_sprintf(p, "%s\"%V\":%uA", i == SKIP_NONE + 1 ? "" : ",",
+                      &skip_reason_names[i], sh_->skipped[i]);
+    }
+    p = ngx_sprintf(p, "},");
+
+    for (u_char kind = KIND_DICTIONARY; kind <= KIND_GROUP; ++kind) {
+      p = ngx_sprintf(p, kind == KIND_DICTIONARY ? "\"dictionaries\":{"
+                                                 : ",\"groups\":{");
+      bool first = true;
+      for (size_t i = 0; i < kSlots; ++i) {
+        const Slot& s = sh_->slots[i];
+        if (!s.ready || s.kind != kind)
+          continue;
+        p = ngx_sprintf(p, "%s\"%*s\":%uA", first ? "" : ",", size_t(s.len),
+                        s.name, s.count);
+        first = false;
+      }
+      p = ngx_sprintf(p, "}");
+    }
+
+    p = ngx_sprintf(p, ",\"locations\":{");
+    bool first = true;
+    for (size_t i = 0; i < kLocations; ++i) {
+      const Location& l = sh_->locations[i];
+      if (!l.len)
+        continue;
+      p = ngx_sprintf(p, "%s\"%*s\":{", first ? "" : ",", size_t(l.len),
+                      l.name);
+      first = false;
+
+      bool first_phase = true;
+      for (int ph = 0; ph < PHASES; ++ph) {
+        const Histogram& h = l.phases[ph];
+        if (!h.count)
+          continue;
+        p = ngx_sprintf(p, "%s\"%s\":{\"count\":%uA,\"sum_ns\":%uA,"
+                           "\"buckets\":{",
+                        first_phase ? "" : ",", phase_names[ph], h.count,
+                        h.sum);
+        first_phase = false;
+
+        // Upper bound in nanoseconds and count. The last one is unbounded.
+        bool first_bucket = true;
+        for (size_t j = 0; j < kBuckets; ++j) {
+          if (!h.buckets[j])
+            continue;
+          if (j == kBuckets - 1) {
+            p = ngx_sprintf(p, "%s\"inf\":%uA", first_bucket ? "" : ",",
+                            h.buckets[j]);
+          } else {
+            p = ngx_sprintf(p, "%s\"%uL\":%uA", first_bucket ? "" : ",",
+                            bucket_upper(j), h.buckets[j]);
+          }
+          first_bucket = false;
+        }
+        p = ngx_sprintf(p, "}}");
+      }
+      p = ngx_sprintf(p, "}");
+    }
+    p = ngx_sprintf(p, "}");
+
+    p = ngx_sprintf(p, ",\"overflow\":%uA}\n", sh_->overflow);
+  } else {
+    for (int i = 0; i < COUNTERS; ++i) {
+      p = ngx_sprintf(p, "# TYPE sdch_%s_total counter\n"
+                         "sdch_%s_total %uA\n",
+                      counter_names[i], counter_names[i], sh_->counters[i]);
+    }
+
+    p = ngx_sprintf(p, "# TYPE sdch_skipped_total counter\n");
+    for (int i = SKIP_NONE + 1; i < SKIP_REASONS; ++i) {
+      p = ngx_sprintf(p, "sdch_skipped_total{reason=\"%V\"} %uA\n",
+                      &skip_reason_names[i], sh_->skipped[i]);
+    }
+
+    for (u_char kind = KIND_DICTIONARY; kind <= KIND_GROUP; ++kind) {
+      const char* metric = kind == KIND_DICTIONARY
+                               ? "sdch_dictionary_selected_total{id"
+                               : "sdch_group_selected_total{group";
+      p = ngx_sprintf(p, "# TYPE %*s counter\n",
+                      ngx_strchr(metric, '{') - metric, metric);
+      for (size_t i = 0; i < kSlots; ++i) {
+        const Slot& s = sh_->slots[i];
+        if (!s.ready || s.kind != kind)
+          continue;
+        p = ngx_sprintf(p, "%s=\"%*s\"} %uA\n", metric, size_t(s.len),
+                        s.name, s.count);
+      }
+    }
+
+    p = ngx_sprintf(p, "# TYPE sdch_selected_overflow_total counter\n"
+                       "sdch_selected_overflow_total %uA\n", sh_->overflow);
+
+    // Only non-empty buckets are listed. Prometheus doesn't need the rest.
+    p = ngx_sprintf(p, "# TYPE sdch_phase_duration_seconds histogram\n");
+    for (size_t i = 0; i < kLocations; ++i) {
+      const Location& l = sh_->locations[i];
+      for (int ph = 0; ph < PHASES && l.len; ++ph) {
+        const Histogram& h = l.phases[ph];
+        if (!h.count)
+          continue;
+
+        ngx_atomic_uint_t total = 0;
+        for (size_t j = 0; j < kBuckets - 1; ++j) {
+          if (!h.buckets[j])
+            continue;
+          total += h.buckets[j];
+          p = ngx_sprintf(p, "sdch_phase_duration_seconds_bucket"
+                             "{location=\"%*s\",phase=\"%s\",le=\"",
+                          size_t(l.len), l.name, phase_names[ph]);
+          p = print_seconds(p, bucket_upper(j));
+          p = ngx_sprintf(p, "\"} %uA\n", total);
+        }
+
+        // Histogram is updated while we are reading it. Keep it consistent.
+        ngx_atomic_uint_t count = std::max(total + h.buckets[kBuckets - 1],
+                                           ngx_atomic_uint_t(h.count));
+        p = ngx_sprintf(p, "sdch_phase_duration_seconds_bucket"
+                           "{location=\"%*s\",phase=\"%s\",le=\"+Inf\"} %uA\n",
+                        size_t(l.len), l.name, phase_names[ph], count);
+        p = ngx_sprintf(p, "sdch_phase_duration_seconds_sum"
+                           "{location=\"%*s\",phase=\"%s\"} ",
+                        size_t(l.len), l.name, phase_names[ph]);
+        p = print_seconds(p, h.sum);
+        p = ngx_sprintf(p, "\nsdch_phase_duration_seconds_count"
+                           "{location=\"%*s\",phase=\"%s\"} %uA\n",
+                        size_t(l.len), l.name, phase_names[ph], count);
+      }
+    }
+  }
+
+  b->last = p;
+  b->last_buf = 1;
+  b->last_in_chain = 1;
+  return b;
+}
+
+}  // namespace sdch
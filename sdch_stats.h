@@ -0,0 +1,109 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_STATS_H_
+#define SDCH_STATS_H_
+
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+}
+
+#include "sdch_timer.h"
+
+namespace sdch {
+
+// Why response wasn't encoded.
+enum SkipReason {
+  SKIP_NONE,
+  SKIP_DISABLED,      // "sdch off"
+  SKIP_STATUS,        // Status other than 200, 403 or 404
+  SKIP_ENCODED,       // Content-Encoding is set already
+  SKIP_TOO_SMALL,     // sdch_min_length
+  SKIP_CONTENT_TYPE,  // sdch_types
+  SKIP_DISABLE_CV,    // sdch_disablecv
+  SKIP_HEADER_ONLY,   // HEAD and friends
+  SKIP_PROXIED,       // sdch_proxied
+  SKIP_NO_DICTIONARY, // Client has no usable dictionary
+  SKIP_LOOKAHEAD,     // sdch_lookahead decided it doesn't pay off
+  SKIP_REASONS
+};
+
+// Name of reason for logs and stats.
+const ngx_str_t& skip_reason_name(SkipReason reason);
+
+// Module-wide counters in shared memory zone. Enabled by "sdch_status".
+// Counters are updated with atomic adds, no locks on request path.
+// Selection counts are kept in open-addressing table of fixed size,
+// slots are claimed with CAS.
+//
+// Object itself lives in configuration pool of every worker and is
+// attached to ngx_shm_zone_t as data.
+class Stats {
+ public:
+  enum Counter {
+    REQUESTS,         // Responses to clients accepting sdch (or dcz)
+    ENCODED,
+    BYTES_IN,         // Of encoded responses
+    BYTES_OUT,
+    GET_DICTIONARY,   // Get-Dictionary headers sent
+    QUASI_STORES,
+    QUASI_HITS,
+    QUASI_MISSES,
+    QUASI_EVICTIONS,
+    DUMPS,            // Responses queued by sdch_dumpdir
+    DUMPS_DROPPED,    // Sampled, but didn't fit into sdch_dump_queue
+    COUNTERS
+  };
+
+  enum Format {
+    FORMAT_JSON,
+    FORMAT_PROMETHEUS
+  };
+
+  // Add zone. Repeated calls return the same Stats.
+  static Stats* create(ngx_conf_t* cf);
+
+  void add(Counter counter, ngx_atomic_int_t n = 1);
+  void skipped(SkipReason reason);
+  // Dictionary (by client id, "quasi" or "composite") and sdch_group used for response.
+  void selected(const ngx_str_t& dict, const ngx_str_t& group);
+
+  // Register location for phase histograms. Returns its index or -1 if
+  // there are too many of them. Called during configuration only.
+  ngx_int_t location(ngx_conf_t* cf, const ngx_str_t& name);
+  // Add phase time of request in location to histogram.
+  void observe(ngx_int_t location, Phase phase, uint64_t ns);
+
+  // Render all counters into buffer allocated from pool.
+  ngx_buf_t* render(ngx_pool_t* pool, Format format) const;
+
+ private:
+  struct Shared;
+  struct Slot;
+  struct Histogram;
+  struct Location;
+
+  static ngx_int_t init_zone(ngx_shm_zone_t* zone, void* data);
+  // Find or claim Location in sh_ for every registered name.
+  void map_locations(ngx_log_t* log);
+
+  // Count name in table. kind keeps dictionaries and groups apart.
+  void count(u_char kind, const ngx_str_t& name);
+
+  Shared* sh_;
+
+  // Names of registered locations and their Location in sh_. Mapped by
+  // name in init_zone, so reload may add and reorder locations.
+  struct LocationName {
+    ngx_str_t name;
+    ngx_int_t index;
+  };
+  ngx_array_t* locations_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_STATS_H_
@@ -0,0 +1,43 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_TIMER_H_
+#define SDCH_TIMER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+namespace sdch {
+
+// Stages of response processing timed per request.
+enum Phase {
+  PHASE_SELECT,    // select_dictionary
+  PHASE_INIT,      // Handler::init of whole pipeline
+  PHASE_ENCODE,    // Encoder, including stages after it
+  PHASE_AUTOAUTO,  // Hashing quasi-dictionary
+  PHASE_OUTPUT,    // Passing buffers to next body filter
+  PHASES
+};
+
+// Monotonic nanoseconds. On Linux it's vDSO reading TSC, no syscall.
+inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Adds time spent in scope to *total.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(uint64_t* total) : total_(total), start_(now_ns()) {}
+  ~ScopedTimer() { *total_ += now_ns() - start_; }
+
+ private:
+  uint64_t* total_;
+  uint64_t start_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_TIMER_H_
@@ -0,0 +1,607 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_trainer.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+
+#include <google/vcencoder.h>
+
+#include "sdch_encoder_pool.h"
+#include "sdch_module.h"
+#include "sdch_offline.h"
+
+namespace sdch {
+
+namespace {
+
+// Fewer fresh samples aren't worth training on.
+const size_t kMinSamples = 16;
+// Every kHoldOut-th slot is held out for evaluation.
+const size_t kHoldOut = 5;
+
+uint64_t encoded_size(const Dictionary* dict, const DictSamples& samples) {
+  uint64_t total = 0;
+  std::string out;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const std::string& s = samples[i];
+    out.clear();
+    open_vcdiff::OutputString<std::string> o(&out);
+    std::auto_ptr<EncoderPool::Encoder> enc(EncoderPool::create(dict));
+    if (enc->StartEncodingToInterface(&o) &&
+        enc->EncodeChunkToInterface(s.data(), s.size(), &o) &&
+        enc->FinishEncodingToInterface(&o))
+      total += out.size();
+    else
+      total += s.size();
+  }
+  return total;
+}
+
+// Dictionary of group as announced in shared memory.
+struct Published {
+  std::string group;
+  ngx_uint_t age;
+  u_char id[8];
+};
+
+bool same_group(const std::string& name, const ngx_str_t& group) {
+  return name.size() == std::min(group.len, Trainer::kMaxGroupName) &&
+         ngx_memcmp(name.data(), group.data, name.size()) == 0;
+}
+
+}  // namespace
+
+const size_t Trainer::kMaxGroups;
+const size_t Trainer::kMaxGroupName;
+const size_t Trainer::kMaxKeep;
+
+struct Trainer::Group {
+  // 0 if slot is free. Set once, after name.
+  size_t name_len;
+  u_char name[kMaxGroupName];
+  // Responses offered to reservoir since the last training.
+  ngx_atomic_t seen;
+  // Dictionaries published so far. The latest kMaxKeep client ids are in
+  // ids, the newest at (published - 1) % kMaxKeep.
+  ngx_uint_t published;
+  u_char ids[kMaxKeep][8];
+};
+
+struct Trainer::Shared {
+  // Bumped on every publication.
+  ngx_atomic_t generation;
+  Group groups[kMaxGroups];
+
+  // Layout of slots. groups * samples slots, every one is 4 bytes of length
+  // followed by sample_size bytes.
+  size_t layout_groups;
+  size_t layout_samples;
+  size_t layout_sample_size;
+  u_char* slots;
+};
+
+struct Trainer::Job {
+  Job() : group(0), baseline(NULL), ts(0), samples(0), raw(0),
+          baseline_size(0), candidate_size(0) {}
+
+  size_t group;
+  std::string name;
+  // Trained baseline is kept alive while job runs.
+  ValuePtr baseline_value;
+  const Dictionary* baseline;
+  time_t ts;
+
+  // Results.
+  size_t samples;
+  // Of held out samples: as is, encoded with baseline and with candidate.
+  uint64_t raw;
+  uint64_t baseline_size;
+  uint64_t candidate_size;
+  // Set if candidate is published.
+  ValuePtr value;
+  std::string error;
+};
+
+Trainer::Trainer()
+    :
+#if (NGX_THREADS)
+      thread_pool_(NULL),
+      task_(NULL),
+#endif
+      groups_(4),
+      samples_(256),
+      sample_size_(16 * 1024),
+      interval_(3600 * 1000),
+      keep_(2),
+      zone_(NULL),
+      shpool_(NULL),
+      sh_(NULL),
+      in_flight_(false),
+      generation_(0) {
+  ngx_str_null(&dir_);
+  ngx_str_null(&domain_);
+  ngx_memzero(&timer_, sizeof(timer_));
+}
+
+Trainer::~Trainer() {}
+
+bool Trainer::create_zone(ngx_conf_t* cf) {
+  static ngx_str_t name = ngx_string("sdch_train");
+  // Shared and reservoir take whole pages. Slab allocator keeps header for
+  // every page, and its own state and alignment take two more.
+  size_t reservoir = groups_ * samples_ * (sizeof(uint32_t) + sample_size_);
+  size_t pages = (sizeof(Shared) + ngx_pagesize - 1) / ngx_pagesize +
+                 (reservoir + ngx_pagesize - 1) / ngx_pagesize + 8;
+  size_t size = pages * (ngx_pagesize + sizeof(ngx_slab_page_t)) +
+                2 * ngx_pagesize;
+
+  zone_ = ngx_shared_memory_add(cf, &name, size, &sdch_module);
+  if (zone_ == NULL)
+    return false;
+
+  zone_->init = init_zone;
+  zone_->data = this;
+  return true;
+}
+
+ngx_int_t Trainer::init_zone(ngx_shm_zone_t* zone, void* data) {
+  Trainer* t = static_cast<Trainer*>(zone->data);
+  Trainer* old = static_cast<Trainer*>(data);
+
+  t->shpool_ = reinterpret_cast<ngx_slab_pool_t*>(zone->shm.addr);
+
+  if (old) {
+    // Reload. Keep reservoir and published dictionaries.
+    t->sh_ = old->sh_;
+  } else if (zone->shm.exists) {
+    t->sh_ = static_cast<Shared*>(t->shpool_->data);
+  } else {
+    t->sh_ = static_cast<Shared*>(
+        ngx_slab_calloc(t->shpool_, sizeof(Shared)));
+    if (t->sh_ == NULL)
+      return NGX_ERROR;
+    t->shpool_->data = t->sh_;
+  }
+
+  Shared* sh = t->sh_;
+  if (sh->slots != NULL && sh->layout_groups == t->groups_ &&
+      sh->layout_samples == t->samples_ &&
+      sh->layout_sample_size == t->sample_size_)
+    return NGX_OK;
+
+  // Zone of the same size with different layout. Start sampling over.
+  if (sh->slots != NULL)
+    ngx_slab_free(t->shpool_, sh->slots);
+  sh->slots = static_cast<u_char*>(ngx_slab_calloc(
+      t->shpool_,
+      t->groups_ * t->samples_ * (sizeof(uint32_t) + t->sample_size_)));
+  if (sh->slots == NULL)
+    return NGX_ERROR;
+  sh->layout_groups = t->groups_;
+  sh->layout_samples = t->samples_;
+  sh->layout_sample_size = t->sample_size_;
+  for (size_t i = 0; i < kMaxGroups; ++i)
+    sh->groups[i].seen = 0;
+  return NGX_OK;
+}
+
+void Trainer::add_baseline(const ngx_str_t& group, Dictionary* dict,
+                           ngx_int_t prio) {
+  std::string name(reinterpret_cast<const char*>(group.data),
+                   std::min(group.len, kMaxGroupName));
+  // Without explicit priority dictionaries go in order after the rest.
+  if (prio < 0)
+    prio = NGX_MAX_INT_T_VALUE;
+  for (size_t i = 0; i < baselines_.size(); ++i) {
+    Baseline& b = baselines_[i];
+    if (b.group != name)
+      continue;
+    if (prio < b.prio) {
+      b.prio = prio;
+      b.dict = dict;
+    }
+    return;
+  }
+
+  Baseline b;
+  b.group = name;
+  b.prio = prio;
+  b.dict = dict;
+  baselines_.push_back(b);
+}
+
+ngx_int_t Trainer::init_process(ngx_cycle_t* cycle) {
+  if (sh_ == NULL || ngx_worker != 0 ||
+      (ngx_process != NGX_PROCESS_WORKER && ngx_process != NGX_PROCESS_SINGLE))
+    return NGX_OK;
+
+  timer_.handler = timer_handler;
+  timer_.data = this;
+  timer_.log = cycle->log;
+  // Don't keep exiting worker alive.
+  timer_.cancelable = 1;
+  ngx_add_timer(&timer_, interval_);
+  return NGX_OK;
+}
+
+Trainer::Group* Trainer::find_group(const ngx_str_t& group) {
+  size_t len = std::min(group.len, kMaxGroupName);
+  Group* free = NULL;
+  for (size_t i = 0; i < groups_; ++i) {
+    Group& g = sh_->groups[i];
+    if (g.name_len == len && ngx_memcmp(g.name, group.data, len) == 0)
+      return &g;
+    if (g.name_len == 0 && free == NULL)
+      free = &g;
+  }
+  if (free == NULL || len == 0)
+    return NULL;
+
+  // Somebody could claim it meanwhile.
+  ngx_shmtx_lock(&shpool_->mutex);
+  Group* res = NULL;
+  for (size_t i = 0; i < groups_ && res == NULL; ++i) {
+    Group& g = sh_->groups[i];
+    if (g.name_len == len && ngx_memcmp(g.name, group.data, len) == 0) {
+      res = &g;
+    } else if (g.name_len == 0) {
+      ngx_memcpy(g.name, group.data, len);
+      ngx_memory_barrier();
+      g.name_len = len;
+      res = &g;
+    }
+  }
+  ngx_shmtx_unlock(&shpool_->mutex);
+  return res;
+}
+
+u_char* Trainer::slot(size_t index) const {
+  return sh_->slots + index * (sizeof(uint32_t) + sample_size_);
+}
+
+ngx_int_t Trainer::reserve(const ngx_str_t& group) {
+  if (sh_ == NULL)
+    return -1;
+
+  Group* g = find_group(group);
+  if (g == NULL)
+    return -1;
+
+  // Reservoir sampling: n-th response replaces random slot with
+  // probability samples / n.
+  ngx_uint_t n = ngx_atomic_fetch_add(&g->seen, 1) + 1;
+  ngx_uint_t i = n <= samples_ ? n - 1 : ngx_uint_t(ngx_random()) % n;
+  if (i >= samples_)
+    return -1;
+  return (g - sh_->groups) * samples_ + i;
+}
+
+void Trainer::fill(ngx_int_t index, const std::string& data) {
+  uint32_t len = std::min(data.size(), sample_size_);
+  u_char* p = slot(index);
+
+  ngx_shmtx_lock(&shpool_->mutex);
+  ngx_memcpy(p, &len, sizeof(len));
+  ngx_memcpy(p + sizeof(len), data.data(), len);
+  ngx_shmtx_unlock(&shpool_->mutex);
+}
+
+void Trainer::timer_handler(ngx_event_t* ev) {
+  static_cast<Trainer*>(ev->data)->start();
+}
+
+void Trainer::start() {
+  ngx_log_t* log = timer_.log;
+  if (in_flight_)
+    return;
+
+  // Compare with what is actually served.
+  refresh(log);
+
+  jobs_.clear();
+  for (size_t i = 0; i < groups_; ++i) {
+    const Group& g = sh_->groups[i];
+    if (g.name_len == 0 || g.seen < kMinSamples)
+      continue;
+
+    jobs_.push_back(Job());
+    Job& job = jobs_.back();
+    job.group = i;
+    job.name.assign(reinterpret_cast<const char*>(g.name), g.name_len);
+    job.ts = ngx_time();
+
+    for (size_t j = 0; j < trained_.size(); ++j) {
+      if (trained_[j].age == 0 && trained_[j].group == job.name) {
+        job.baseline_value = trained_[j].value;
+        job.baseline = &job.baseline_value->dict;
+      }
+    }
+    for (size_t j = 0; j < baselines_.size() && job.baseline == NULL; ++j) {
+      if (baselines_[j].group == job.name)
+        job.baseline = baselines_[j].dict;
+    }
+  }
+
+  if (jobs_.empty()) {
+    ngx_add_timer(&timer_, interval_);
+    return;
+  }
+
+#if (NGX_THREADS)
+  if (thread_pool_ != NULL) {
+    if (task_ == NULL) {
+      task_ = ngx_thread_task_alloc(ngx_cycle->pool, 0);
+      if (task_ == NULL) {
+        ngx_add_timer(&timer_, interval_);
+        return;
+      }
+      task_->ctx = this;
+      task_->handler = thread_handler;
+      task_->event.handler = event_handler;
+      task_->event.data = this;
+    }
+
+    // Retry next interval.
+    if (ngx_thread_task_post(thread_pool_, task_) != NGX_OK) {
+      jobs_.clear();
+      ngx_add_timer(&timer_, interval_);
+      return;
+    }
+    in_flight_ = true;
+    return;
+  }
+#endif
+
+  for (size_t i = 0; i < jobs_.size(); ++i)
+    train(&jobs_[i]);
+  publish(log);
+}
+
+void Trainer::train(Job* job) {
+  DictSamples samples;
+  DictSamples held;
+
+  // Only samples of the last interval, content drifts.
+  ngx_shmtx_lock(&shpool_->mutex);
+  Group& g = sh_->groups[job->group];
+  size_t seen = g.seen;
+  size_t n = std::min(seen, samples_);
+  for (size_t i = 0; i < n; ++i) {
+    const u_char* p = slot(job->group * samples_ + i);
+    uint32_t len;
+    ngx_memcpy(&len, p, sizeof(len));
+    if (len < sizeof(uint64_t))
+      continue;
+    DictSamples& to = (i % kHoldOut == kHoldOut - 1) ? held : samples;
+    to.push_back(std::string(reinterpret_cast<const char*>(p + sizeof(len)),
+                             len));
+  }
+  // Too few filled yet. Keep collecting into the same reservoir.
+  bool enough = samples.size() >= kMinSamples && !held.empty();
+  if (enough) {
+    // Slots reserved but never filled in the next interval must not show
+    // samples of this one.
+    for (size_t i = 0; i < samples_; ++i)
+      ngx_memzero(slot(job->group * samples_ + i), sizeof(uint32_t));
+    g.seen = 0;
+  }
+  ngx_shmtx_unlock(&shpool_->mutex);
+
+  job->samples = samples.size() + held.size();
+  if (!enough)
+    return;
+
+  std::string payload = build_dict_payload(samples, params_);
+  if (payload.empty())
+    return;
+
+  std::string content;
+  if (domain_.len) {
+    content.append("domain: ");
+    content.append(reinterpret_cast<const char*>(domain_.data), domain_.len);
+    content.append("\n");
+  }
+  content.append("\n");
+  size_t header_len = content.size();
+  content.append(payload);
+
+  ValuePtr value(new FastdictFactory::Value(job->ts));
+  value->group = job->name;
+  const char* begin = content.data();
+  // Payload is read from the file written below when needed.
+  if (!value->dict.init(begin, begin + header_len, begin + content.size(),
+                        false)) {
+    job->error = "can't create dictionary";
+    return;
+  }
+
+  for (size_t i = 0; i < held.size(); ++i)
+    job->raw += held[i].size();
+  job->baseline_size = job->baseline != NULL
+                           ? encoded_size(job->baseline, held)
+                           : job->raw;
+  job->candidate_size = encoded_size(&value->dict, held);
+  if (job->candidate_size * 100 >= job->baseline_size * 99)
+    return;
+
+  std::string fn(reinterpret_cast<const char*>(dir_.data), dir_.len);
+  fn += '/';
+  fn.append(reinterpret_cast<const char*>(value->dict.client_id().data()),
+            value->dict.client_id().size());
+  fn += ".dict";
+  if (!write_file(fn, content)) {
+    job->error = "write " + fn + ": " + strerror(errno);
+    return;
+  }
+  value->dict.filename_ = fn;
+
+  job->value = value;
+}
+
+void Trainer::publish(ngx_log_t* log) {
+  in_flight_ = false;
+
+  for (size_t i = 0; i < jobs_.size(); ++i) {
+    Job& job = jobs_[i];
+    if (!job.error.empty()) {
+      ngx_log_error(NGX_LOG_ERR, log, 0, "sdch_train: group \"%s\": %s",
+                    job.name.c_str(), job.error.c_str());
+      continue;
+    }
+    // Not enough samples yet.
+    if (job.value == NULL && job.candidate_size == 0)
+      continue;
+    if (job.value == NULL) {
+      ngx_log_error(NGX_LOG_INFO, log, 0,
+                    "sdch_train: group \"%s\": %uz samples, %uL bytes "
+                    "held out, candidate %uL, current %uL, kept current",
+                    job.name.c_str(), job.samples, job.raw,
+                    job.candidate_size, job.baseline_size);
+      continue;
+    }
+
+    const Dictionary::id_t& id = job.value->dict.client_id();
+    u_char retired[8];
+    bool retire = false;
+
+    ngx_shmtx_lock(&shpool_->mutex);
+    Group& g = sh_->groups[job.group];
+    // Generation falling out of the latest keep_ ones.
+    if (g.published >= keep_) {
+      ngx_memcpy(retired, g.ids[(g.published - keep_) % kMaxKeep], 8);
+      retire = true;
+    }
+    ngx_memcpy(g.ids[g.published % kMaxKeep], id.data(), 8);
+    g.published++;
+    ngx_shmtx_unlock(&shpool_->mutex);
+    ngx_atomic_fetch_add(&sh_->generation, 1);
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "sdch_train: group \"%s\": published %*s, %uz samples, "
+                  "%uL bytes held out, candidate %uL, current %uL",
+                  job.name.c_str(), id.size(), id.data(), job.samples,
+                  job.raw, job.candidate_size, job.baseline_size);
+
+    // Loaded already.
+    Trained t;
+    t.group = job.name;
+    t.age = 0;
+    t.value = job.value;
+    trained_.push_back(t);
+
+    if (retire) {
+      std::string fn(reinterpret_cast<const char*>(dir_.data), dir_.len);
+      fn += '/';
+      fn.append(reinterpret_cast<const char*>(retired), 8);
+      fn += ".dict";
+      if (unlink(fn.c_str()) != 0 && errno != ENOENT) {
+        ngx_log_error(NGX_LOG_WARN, log, ngx_errno,
+                      "sdch_train: unlink \"%s\" failed", fn.c_str());
+      }
+    }
+  }
+
+  jobs_.clear();
+  refresh(log);
+  ngx_add_timer(&timer_, interval_);
+}
+
+void Trainer::refresh(ngx_log_t* log) {
+  if (sh_ == NULL || sh_->generation == generation_)
+    return;
+
+  std::vector<Published> published;
+
+  ngx_shmtx_lock(&shpool_->mutex);
+  ngx_uint_t generation = sh_->generation;
+  for (size_t i = 0; i < groups_; ++i) {
+    const Group& g = sh_->groups[i];
+    size_t n = std::min<size_t>(g.published, keep_);
+    for (size_t age = 0; age < n; ++age) {
+      published.push_back(Published());
+      Published& p = published.back();
+      p.group.assign(reinterpret_cast<const char*>(g.name), g.name_len);
+      p.age = age;
+      ngx_memcpy(p.id, g.ids[(g.published - 1 - age) % kMaxKeep], 8);
+    }
+  }
+  ngx_shmtx_unlock(&shpool_->mutex);
+
+  TrainedList trained;
+  for (size_t i = 0; i < published.size(); ++i) {
+    const Published& p = published[i];
+    Trained t;
+    t.group = p.group;
+    t.age = p.age;
+    for (size_t j = 0; j < trained_.size() && t.value == NULL; ++j) {
+      if (ngx_memcmp(trained_[j].value->dict.client_id().data(), p.id, 8) ==
+          0)
+        t.value = trained_[j].value;
+    }
+
+    if (t.value == NULL) {
+      std::string fn(reinterpret_cast<const char*>(dir_.data), dir_.len);
+      fn += '/';
+      fn.append(reinterpret_cast<const char*>(p.id), 8);
+      fn += ".dict";
+
+      t.value.reset(new FastdictFactory::Value(ngx_time()));
+      t.value->group = p.group;
+      if (!t.value->dict.load(fn.c_str())) {
+        ngx_log_error(NGX_LOG_ERR, log, 0,
+                      "sdch_train: can't load \"%s\"", fn.c_str());
+        continue;
+      }
+    }
+    trained.push_back(t);
+  }
+
+  // Requests using dropped ones keep them alive.
+  trained_.swap(trained);
+  generation_ = generation;
+}
+
+Trainer::ValuePtr Trainer::find(const ngx_str_t& group, const u_char* id,
+                                ngx_uint_t* age) const {
+  for (size_t i = 0; i < trained_.size(); ++i) {
+    const Trained& t = trained_[i];
+    if (same_group(t.group, group) &&
+        ngx_memcmp(t.value->dict.client_id().data(), id, 8) == 0) {
+      *age = t.age;
+      return t.value;
+    }
+  }
+  return ValuePtr();
+}
+
+Trainer::ValuePtr Trainer::current(const ngx_str_t& group) const {
+  for (size_t i = 0; i < trained_.size(); ++i) {
+    const Trained& t = trained_[i];
+    if (t.age == 0 && same_group(t.group, group))
+      return t.value;
+  }
+  return ValuePtr();
+}
+
+#if (NGX_THREADS)
+
+void Trainer::thread_handler(void* data, ngx_log_t* log) {
+  Trainer* self = static_cast<Trainer*>(data);
+  for (size_t i = 0; i < self->jobs_.size(); ++i)
+    self->train(&self->jobs_[i]);
+}
+
+void Trainer::event_handler(ngx_event_t* ev) {
+  Trainer* self = static_cast<Trainer*>(ev->data);
+  self->publish(self->timer_.log);
+}
+
+#endif  // NGX_THREADS
+
+}  // namespace sdch
@@ -0,0 +1,162 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_TRAINER_H_
+#define SDCH_TRAINER_H_
+
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+}
+
+#include <string>
+#include <vector>
+
+#include "sdch_dict_builder.h"
+#include "sdch_fastdict_factory.h"
+
+namespace sdch {
+
+// Online dictionary training ("sdch_train_zone" and "sdch_train").
+//
+// Workers sample responses of every sdch_group into a reservoir in shared
+// memory. Every interval worker 0 trains new dictionary of each group on
+// its reservoir (see DictBuilder) in a thread pool task. Every fifth slot
+// of reservoir is held out: candidate is published only if it encodes
+// held out samples at least 1% smaller than the latest dictionary of group
+// (trained or the first configured one). Published dictionary is written
+// into directory as <client id>.dict and announced with generation counter
+// in shared memory. Workers load new dictionaries on the next request.
+//
+// The latest "keep" dictionaries of group stay selectable, the newest one
+// is the best. Retired ones are removed from directory. Dictionaries are
+// FastdictFactory::Values, so requests using retired one keep it alive.
+class Trainer {
+ public:
+  typedef FastdictFactory::ValuePtr ValuePtr;
+
+  // Limits of shared memory layout.
+  static const size_t kMaxGroups = 16;
+  static const size_t kMaxGroupName = 63;
+  static const size_t kMaxKeep = 4;
+
+  Trainer();
+  ~Trainer();
+
+  // Configured by "sdch_train_zone".
+  void set_dir(const ngx_str_t& dir) { dir_ = dir; }
+  void set_groups(size_t groups) { groups_ = groups; }
+  void set_samples(size_t samples) { samples_ = samples; }
+  void set_sample_size(size_t size) { sample_size_ = size; }
+  void set_dict_size(size_t size) { params_.size = size; }
+  void set_interval(ngx_msec_t interval) { interval_ = interval; }
+  void set_keep(size_t keep) { keep_ = keep; }
+  void set_domain(const ngx_str_t& domain) { domain_ = domain; }
+#if (NGX_THREADS)
+  // NULL means train in event loop.
+  void set_thread_pool(ngx_thread_pool_t* pool) { thread_pool_ = pool; }
+#endif
+
+  // Add "sdch_train" zone. Called after all parameters are set.
+  bool create_zone(ngx_conf_t* cf);
+
+  bool enabled() const { return zone_ != NULL; }
+
+  // Configured dictionary to compare the first trained one of group with.
+  // The one with the lowest priority wins.
+  void add_baseline(const ngx_str_t& group, Dictionary* dict,
+                    ngx_int_t prio);
+
+  // Start training timer in worker 0.
+  ngx_int_t init_process(ngx_cycle_t* cycle);
+
+  // Decide if response of group goes into reservoir. Returns slot to
+  // fill() or -1.
+  ngx_int_t reserve(const ngx_str_t& group);
+  // Longer responses are truncated.
+  size_t sample_size() const { return sample_size_; }
+  void fill(ngx_int_t slot, const std::string& data);
+
+  // Load dictionaries published since the last call. Cheap if there are
+  // none.
+  void refresh(ngx_log_t* log);
+
+  // Selectable dictionary of group with client id. Age is 0 for the newest
+  // one. Empty if there is none.
+  ValuePtr find(const ngx_str_t& group, const u_char* id,
+                ngx_uint_t* age) const;
+  // The newest dictionary of group. Empty if there is none yet.
+  ValuePtr current(const ngx_str_t& group) const;
+
+ private:
+  struct Group;
+  struct Shared;
+  struct Job;
+  typedef std::vector<Job> JobList;
+
+  struct Trained {
+    std::string group;
+    ngx_uint_t age;
+    ValuePtr value;
+  };
+  typedef std::vector<Trained> TrainedList;
+
+  struct Baseline {
+    std::string group;
+    ngx_int_t prio;
+    Dictionary* dict;
+  };
+
+  static ngx_int_t init_zone(ngx_shm_zone_t* zone, void* data);
+
+  Group* find_group(const ngx_str_t& group);
+  u_char* slot(size_t index) const;
+
+  static void timer_handler(ngx_event_t* ev);
+  void start();
+  void publish(ngx_log_t* log);
+
+  // Can run in thread pool.
+  void train(Job* job);
+
+#if (NGX_THREADS)
+  static void thread_handler(void* data, ngx_log_t* log);
+  static void event_handler(ngx_event_t* ev);
+
+  ngx_thread_pool_t* thread_pool_;
+  ngx_thread_task_t* task_;
+#endif
+
+  ngx_str_t dir_;
+  size_t groups_;
+  size_t samples_;
+  size_t sample_size_;
+  ngx_msec_t interval_;
+  size_t keep_;
+  ngx_str_t domain_;
+  DictBuilderParams params_;
+
+  ngx_shm_zone_t* zone_;
+  ngx_slab_pool_t* shpool_;
+  Shared* sh_;
+
+  std::vector<Baseline> baselines_;
+
+  // Worker 0 only.
+  ngx_event_t timer_;
+  JobList jobs_;
+  bool in_flight_;
+
+  // Loaded by refresh().
+  TrainedList trained_;
+  ngx_uint_t generation_;
+
+  Trainer(const Trainer&);
+  Trainer& operator=(const Trainer&);
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_TRAINER_H_
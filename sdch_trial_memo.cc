@@ -0,0 +1,38 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_trial_memo.h"
+
+namespace sdch {
+
+TrialMemo::TrialMemo() : valid_(60) {}
+
+Dictionary* TrialMemo::find(const std::string& key, time_t now) const {
+  StoreType::const_iterator i = memo_.find(key);
+  if (i == memo_.end() || now - i->second.ts > valid_)
+    return NULL;
+  return i->second.dict;
+}
+
+void TrialMemo::store(const std::string& key, Dictionary* dict, time_t now) {
+  if (memo_.size() >= kMaxSize && memo_.find(key) == memo_.end()) {
+    trim(now);
+    // Everything is fresh. Start over rather than keep LRU for it.
+    if (memo_.size() >= kMaxSize)
+      memo_.clear();
+  }
+
+  Entry e = { dict, now };
+  memo_[key] = e;
+}
+
+void TrialMemo::trim(time_t now) {
+  for (StoreType::iterator i = memo_.begin(); i != memo_.end();) {
+    if (now - i->second.ts > valid_)
+      memo_.erase(i++);
+    else
+      ++i;
+  }
+}
+
+}  // namespace sdch
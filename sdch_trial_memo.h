@@ -0,0 +1,51 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_TRIAL_MEMO_H_
+#define SDCH_TRIAL_MEMO_H_
+
+#include <time.h>
+#include <map>
+#include <string>
+
+namespace sdch {
+
+class Dictionary;
+
+// Per-worker memo of "sdch_trial_dicts" winners. Key is built by caller
+// from location, "sdch_trial_key" and candidate dictionaries. Only
+// Dictionaries living as long as config (not quasi ones) should be stored.
+class TrialMemo {
+ public:
+  TrialMemo();
+
+  // Winner of previous trial or NULL if there wasn't one or it's expired.
+  Dictionary* find(const std::string& key, time_t now) const;
+
+  void store(const std::string& key, Dictionary* dict, time_t now);
+
+  // Winners older than this will be tried again.
+  void set_valid(time_t valid) { valid_ = valid; }
+
+ private:
+  struct Entry {
+    Dictionary* dict;
+    time_t ts;
+  };
+  typedef std::map<std::string, Entry> StoreType;
+
+  // Upper bound of entries. URI patterns come from config, so it's mostly
+  // a guard against sdch_trial_key with too many values.
+  static const size_t kMaxSize = 4096;
+
+  // Remove expired entries.
+  void trim(time_t now);
+
+  StoreType memo_;
+  time_t valid_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_TRIAL_MEMO_H_
@@ -0,0 +1,183 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_vcdiff_engine.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <smmintrin.h>
+#define SDCH_HAVE_SSE41_DISPATCH 1
+#endif
+
+namespace sdch {
+
+const size_t VcdiffIndex::kHashBytes;
+const size_t VcdiffIndex::kBucketSize;
+const uint32_t VcdiffIndex::kEmpty;
+const size_t VcdiffEngine::kMinMatch;
+
+namespace {
+
+inline uint32_t load32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+// Hashes of 4 consecutive positions. Needs 7 readable bytes.
+typedef void (*HashGroupFn)(const uint8_t* p, unsigned bits, uint32_t* h);
+
+void hash_group_scalar(const uint8_t* p, unsigned bits, uint32_t* h) {
+  for (int k = 0; k < 4; ++k)
+    h[k] = VcdiffIndex::hash(load32(p + k), bits);
+}
+
+#if defined(SDCH_HAVE_SSE41_DISPATCH)
+__attribute__((target("sse4.1")))
+void hash_group_sse41(const uint8_t* p, unsigned bits, uint32_t* h) {
+  // 8 bytes are loaded. Only 7 of them used.
+  __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+  v = _mm_shuffle_epi8(
+      v, _mm_setr_epi8(0, 1, 2, 3, 1, 2, 3, 4, 2, 3, 4, 5, 3, 4, 5, 6));
+  v = _mm_mullo_epi32(v, _mm_set1_epi32(static_cast<int>(2654435761U)));
+  v = _mm_srl_epi32(v, _mm_cvtsi32_si128(32 - bits));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(h), v);
+}
+#endif
+
+HashGroupFn choose_hash_group() {
+#if defined(SDCH_HAVE_SSE41_DISPATCH)
+  if (__builtin_cpu_supports("sse4.1"))
+    return hash_group_sse41;
+#endif
+  return hash_group_scalar;
+}
+
+const HashGroupFn hash_group = choose_hash_group();
+
+size_t match_length(const uint8_t* a, const uint8_t* b, size_t max) {
+  size_t n = 0;
+#if defined(__SSE2__)
+  while (n + 16 <= max) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + n));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + n));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+    if (mask != 0xffff)
+      return n + __builtin_ctz(~mask);
+    n += 16;
+  }
+#endif
+  while (n < max && a[n] == b[n])
+    ++n;
+  return n;
+}
+
+}  // namespace
+
+VcdiffIndex::VcdiffIndex(const char* dict, size_t len)
+    : dict_(reinterpret_cast<const uint8_t*>(dict)),
+      size_(len),
+      hash_bits_(10) {
+  // Around 2 positions per bucket on average.
+  while ((size_t(1) << hash_bits_) < len / 2 && hash_bits_ < 24)
+    ++hash_bits_;
+
+  table_.assign((size_t(1) << hash_bits_) * kBucketSize, kEmpty);
+
+  // Keep most recent positions in front of bucket.
+  for (size_t i = 0; i + kHashBytes <= len; ++i) {
+    uint32_t* b = &table_[hash(load32(dict_ + i), hash_bits_) * kBucketSize];
+    memmove(b + 1, b, (kBucketSize - 1) * sizeof(*b));
+    b[0] = i;
+  }
+}
+
+VcdiffEngine::VcdiffEngine() : index_(NULL) {}
+
+bool VcdiffEngine::start(const VcdiffIndex* index,
+                         open_vcdiff::OutputStringInterface* out) {
+  index_ = index;
+  VcdiffWriter::write_header(out);
+  return true;
+}
+
+bool VcdiffEngine::encode_chunk(const char* data,
+                                size_t len,
+                                open_vcdiff::OutputStringInterface* out) {
+  // Same as open-vcdiff: no window for empty chunk.
+  if (len == 0)
+    return true;
+
+  const uint8_t* target = reinterpret_cast<const uint8_t*>(data);
+  writer_.start_window(index_->size());
+  find_matches(target, len);
+  writer_.finish_window(target, len, out);
+  return true;
+}
+
+bool VcdiffEngine::finish(open_vcdiff::OutputStringInterface* out) {
+  return true;
+}
+
+void VcdiffEngine::find_matches(const uint8_t* t, size_t len) {
+  const uint8_t* d = index_->dict();
+  const size_t dsize = index_->size();
+  const unsigned bits = index_->hash_bits();
+
+  // Start of pending literals.
+  size_t lit = 0;
+  size_t pos = 0;
+
+  if (dsize >= kMinMatch) {
+    while (pos + 8 <= len) {
+      uint32_t h[4];
+      hash_group(t + pos, bits, h);
+
+      size_t best_len = 0;
+      size_t best_addr = 0;
+      size_t best_pos = 0;
+      for (size_t k = 0; k < 4 && best_len < kMinMatch; ++k) {
+        const uint32_t* b = index_->bucket(h[k]);
+        for (size_t j = 0;
+             j < VcdiffIndex::kBucketSize && b[j] != VcdiffIndex::kEmpty;
+             ++j) {
+          size_t l = match_length(d + b[j], t + pos + k,
+                                  std::min(dsize - b[j], len - pos - k));
+          if (l > best_len) {
+            best_len = l;
+            best_addr = b[j];
+            best_pos = pos + k;
+          }
+        }
+      }
+
+      if (best_len < kMinMatch) {
+        pos += 4;
+        continue;
+      }
+
+      // Extend match backwards over pending literals.
+      while (best_pos > lit && best_addr > 0 &&
+             d[best_addr - 1] == t[best_pos - 1]) {
+        --best_pos;
+        --best_addr;
+        ++best_len;
+      }
+
+      writer_.add(t + lit, best_pos - lit);
+      writer_.copy(best_addr, best_len);
+      pos = lit = best_pos + best_len;
+    }
+  }
+
+  writer_.add(t + lit, len - lit);
+}
+
+}  // namespace sdch
@@ -0,0 +1,90 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_VCDIFF_ENGINE_H_
+#define SDCH_VCDIFF_ENGINE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <google/vcencoder.h>
+
+#include "sdch_vcdiff_writer.h"
+
+namespace sdch {
+
+// Read-only hash index over dictionary for VcdiffEngine. Built once per
+// Dictionary and shared between requests.
+//
+// Every dictionary position is hashed by its first kHashBytes bytes.
+// Table is an array of 16-byte buckets with kBucketSize most recent
+// positions each. So every lookup touches exactly one cache line.
+class VcdiffIndex {
+ public:
+  static const size_t kHashBytes = 4;
+  static const size_t kBucketSize = 4;
+  static const uint32_t kEmpty = 0xffffffff;
+
+  // dict should outlive index.
+  VcdiffIndex(const char* dict, size_t len);
+
+  const uint8_t* dict() const { return dict_; }
+  size_t size() const { return size_; }
+
+  // Hash table is 2^hash_bits buckets.
+  unsigned hash_bits() const { return hash_bits_; }
+  const uint32_t* bucket(uint32_t hash) const {
+    return &table_[hash * kBucketSize];
+  }
+
+  // Memory used by hash table.
+  size_t table_size() const { return table_.size() * sizeof(uint32_t); }
+
+  static uint32_t hash(uint32_t v, unsigned bits) {
+    return (v * 2654435761U) >> (32 - bits);
+  }
+
+ private:
+  const uint8_t* dict_;
+  size_t size_;
+  unsigned hash_bits_;
+  std::vector<uint32_t> table_;
+};
+
+// VCDIFF encoder producing the same format as open-vcdiff's
+// VCDiffStreamingEncoder with VCD_FORMAT_INTERLEAVED | VCD_FORMAT_CHECKSUM:
+// one window per chunk, whole dictionary as source segment, matches against
+// dictionary only.
+//
+// Hashes of four consecutive target positions are computed at once (SSE4.1
+// when CPU supports it) and matches are extended 16 bytes at a time (SSE2).
+class VcdiffEngine {
+ public:
+  VcdiffEngine();
+
+  // Write VCDIFF header. index should outlive encoding.
+  bool start(const VcdiffIndex* index,
+             open_vcdiff::OutputStringInterface* out);
+
+  // Encode chunk as separate window.
+  bool encode_chunk(const char* data,
+                    size_t len,
+                    open_vcdiff::OutputStringInterface* out);
+
+  bool finish(open_vcdiff::OutputStringInterface* out);
+
+  // Shortest match worth a COPY instruction.
+  static const size_t kMinMatch = 6;
+
+ private:
+  void find_matches(const uint8_t* data, size_t len);
+
+  const VcdiffIndex* index_;
+  VcdiffWriter writer_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_VCDIFF_ENGINE_H_
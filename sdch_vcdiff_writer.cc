@@ -0,0 +1,216 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_vcdiff_writer.h"
+
+#include <string.h>
+#include <zlib.h>
+
+namespace sdch {
+
+const size_t VcdiffWriter::kNearSize;
+const size_t VcdiffWriter::kSameSize;
+
+namespace {
+
+// RFC 3284 constants
+const char kHeader[] = { '\xD6', '\xC3', '\xC4', 'S', '\x00' };
+const uint8_t VCD_SOURCE = 0x01;
+const uint8_t VCD_CHECKSUM = 0x04;  // open-vcdiff extension
+
+// Default code table layout
+const uint8_t VCD_RUN = 0;         // RUN with separate size
+const uint8_t VCD_ADD = 1;         // ADD with separate size, then 1..17
+const uint8_t VCD_COPY = 19;       // COPY mode 0 with separate size
+const uint8_t VCD_ADD_COPY = 163;  // ADD 1..4 + COPY 4..6, modes 0..5
+const uint8_t VCD_ADD_COPY_SAME = 235;  // ADD 1..4 + COPY 4, modes 6..8
+const uint8_t VCD_COPY_ADD = 247;  // COPY 4 + ADD 1, modes 0..8
+
+const unsigned VCD_HERE = 1;
+const unsigned VCD_FIRST_NEAR = 2;
+const unsigned VCD_FIRST_SAME = 6;
+
+}  // namespace
+
+VcdiffWriter::VcdiffWriter() {
+  start_window(0);
+}
+
+void VcdiffWriter::write_header(open_vcdiff::OutputStringInterface* out) {
+  out->append(kHeader, sizeof(kHeader));
+}
+
+void VcdiffWriter::append_varint(std::string* s, uint64_t v) {
+  char buf[10];
+  char* p = buf + sizeof(buf);
+  *--p = v & 0x7f;
+  while (v >>= 7)
+    *--p = (v & 0x7f) | 0x80;
+  s->append(p, buf + sizeof(buf) - p);
+}
+
+size_t VcdiffWriter::varint_length(uint64_t v) {
+  size_t res = 1;
+  while (v >>= 7)
+    ++res;
+  return res;
+}
+
+void VcdiffWriter::start_window(size_t source_size) {
+  source_size_ = source_size;
+  target_size_ = 0;
+  memset(near_, 0, sizeof(near_));
+  memset(same_, 0, sizeof(same_));
+  next_near_ = 0;
+  last_inst_ = LAST_NONE;
+  inst_.clear();
+}
+
+void VcdiffWriter::add(const uint8_t* data, size_t len) {
+  if (len == 0)
+    return;
+
+  if (last_inst_ == LAST_COPY && last_size_ == 4 && len == 1) {
+    inst_[last_opcode_pos_] = VCD_COPY_ADD + last_mode_;
+    last_inst_ = LAST_NONE;
+  } else {
+    last_opcode_pos_ = inst_.size();
+    // Default code table has ADD opcodes with embedded size 1..17.
+    if (len <= 17) {
+      inst_.push_back(VCD_ADD + len);
+    } else {
+      inst_.push_back(VCD_ADD);
+      append_varint(&inst_, len);
+    }
+    last_inst_ = LAST_ADD;
+    last_size_ = len;
+  }
+
+  inst_.append(reinterpret_cast<const char*>(data), len);
+  target_size_ += len;
+}
+
+void VcdiffWriter::run(uint8_t byte, size_t len) {
+  if (len == 0)
+    return;
+
+  inst_.push_back(VCD_RUN);
+  append_varint(&inst_, len);
+  inst_.push_back(byte);
+  target_size_ += len;
+  last_inst_ = LAST_NONE;
+}
+
+void VcdiffWriter::copy(size_t addr, size_t len) {
+  unsigned mode;
+  size_t encoded;
+  encode_address(addr, &mode, &encoded);
+  update_cache(addr);
+
+  if (last_inst_ == LAST_ADD && last_size_ <= 4 && mode < VCD_FIRST_SAME &&
+      len >= 4 && len <= 6) {
+    inst_[last_opcode_pos_] =
+        VCD_ADD_COPY + mode * 12 + (last_size_ - 1) * 3 + (len - 4);
+    last_inst_ = LAST_NONE;
+  } else if (last_inst_ == LAST_ADD && last_size_ <= 4 &&
+             mode >= VCD_FIRST_SAME && len == 4) {
+    inst_[last_opcode_pos_] =
+        VCD_ADD_COPY_SAME + (mode - VCD_FIRST_SAME) * 4 + (last_size_ - 1);
+    last_inst_ = LAST_NONE;
+  } else {
+    last_opcode_pos_ = inst_.size();
+    // Default code table has COPY opcodes with embedded size 4..18.
+    uint8_t opcode = VCD_COPY + mode * 16;
+    if (len >= 4 && len <= 18) {
+      inst_.push_back(opcode + len - 3);
+    } else {
+      inst_.push_back(opcode);
+      append_varint(&inst_, len);
+    }
+    last_inst_ = LAST_COPY;
+    last_size_ = len;
+    last_mode_ = mode;
+  }
+
+  if (mode >= VCD_FIRST_SAME)
+    inst_.push_back(static_cast<char>(encoded));
+  else
+    append_varint(&inst_, encoded);
+
+  target_size_ += len;
+}
+
+size_t VcdiffWriter::address_cost(size_t addr) const {
+  unsigned mode;
+  size_t encoded;
+  encode_address(addr, &mode, &encoded);
+  return mode >= VCD_FIRST_SAME ? 1 : varint_length(encoded);
+}
+
+void VcdiffWriter::encode_address(size_t addr,
+                                  unsigned* mode,
+                                  size_t* encoded) const {
+  size_t here = source_size_ + target_size_;
+  size_t same = addr % (kSameSize * 256);
+  if (same_[same] == addr) {
+    // Single byte. Can't do better.
+    *mode = VCD_FIRST_SAME + same / 256;
+    *encoded = same % 256;
+    return;
+  }
+
+  // VCD_SELF
+  *mode = 0;
+  *encoded = addr;
+
+  if (here - addr < *encoded) {
+    *mode = VCD_HERE;
+    *encoded = here - addr;
+  }
+
+  for (size_t i = 0; i < kNearSize; ++i) {
+    if (addr >= near_[i] && addr - near_[i] < *encoded) {
+      *mode = VCD_FIRST_NEAR + i;
+      *encoded = addr - near_[i];
+    }
+  }
+}
+
+void VcdiffWriter::update_cache(size_t addr) {
+  near_[next_near_] = addr;
+  next_near_ = (next_near_ + 1) % kNearSize;
+  same_[addr % (kSameSize * 256)] = addr;
+}
+
+void VcdiffWriter::finish_window(const uint8_t* target,
+                                 size_t len,
+                                 open_vcdiff::OutputStringInterface* out) {
+  uLong checksum = adler32(adler32(0L, Z_NULL, 0), target, len);
+
+  // Data and addresses sections are empty because everything is
+  // interleaved into instructions section.
+  size_t delta_len = varint_length(len) + 1 + varint_length(0) +
+                     varint_length(inst_.size()) + varint_length(0) +
+                     varint_length(checksum) + inst_.size();
+
+  std::string& h = header_;
+  h.clear();
+  // Window header
+  h.push_back(VCD_SOURCE | VCD_CHECKSUM);
+  append_varint(&h, source_size_);
+  append_varint(&h, 0);
+  append_varint(&h, delta_len);
+  // Delta encoding header
+  append_varint(&h, len);
+  h.push_back(0x00);  // Delta_Indicator
+  append_varint(&h, 0);
+  append_varint(&h, inst_.size());
+  append_varint(&h, 0);
+  append_varint(&h, checksum);
+
+  out->ReserveAdditionalBytes(h.size() + inst_.size());
+  out->append(h.data(), h.size());
+  out->append(inst_.data(), inst_.size());
+}
+
+}  // namespace sdch
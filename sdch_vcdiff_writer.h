@@ -0,0 +1,82 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_VCDIFF_WRITER_H_
+#define SDCH_VCDIFF_WRITER_H_
+
+#include <stdint.h>
+#include <string>
+
+#include <google/vcencoder.h>
+
+namespace sdch {
+
+// Writes VCDIFF (RFC 3284) windows in open-vcdiff's interleaved format with
+// checksums, using default code table. Whole dictionary is the source
+// segment of every window.
+//
+// Address mode of every COPY is chosen to give the shortest encoding.
+// Adjacent instructions are merged into double opcodes when code table
+// allows it.
+class VcdiffWriter {
+ public:
+  // Address cache sizes. Defaults from RFC 3284.
+  static const size_t kNearSize = 4;
+  static const size_t kSameSize = 3;
+
+  VcdiffWriter();
+
+  // Write VCDIFF file header.
+  static void write_header(open_vcdiff::OutputStringInterface* out);
+
+  // Start new window with source segment of source_size bytes.
+  void start_window(size_t source_size);
+
+  void add(const uint8_t* data, size_t len);
+  void run(uint8_t byte, size_t len);
+  // Copy from address in source + target address space.
+  void copy(size_t addr, size_t len);
+
+  // Write window. target is the whole window's target for checksum.
+  void finish_window(const uint8_t* target,
+                     size_t len,
+                     open_vcdiff::OutputStringInterface* out);
+
+  // Size of address as encoded with best mode. Doesn't update caches.
+  size_t address_cost(size_t addr) const;
+
+  // Varint helpers
+  static void append_varint(std::string* s, uint64_t v);
+  static size_t varint_length(uint64_t v);
+
+ private:
+  enum LastInst { LAST_NONE, LAST_ADD, LAST_COPY };
+
+  void encode_address(size_t addr, unsigned* mode, size_t* encoded) const;
+  void update_cache(size_t addr);
+
+  size_t source_size_;
+  // Bytes of target produced by instructions so far.
+  size_t target_size_;
+
+  // RFC 3284 5.1 address caches.
+  size_t near_[kNearSize];
+  size_t next_near_;
+  size_t same_[kSameSize * 256];
+
+  // Last instruction written, for merging into double opcode.
+  LastInst last_inst_;
+  size_t last_size_;
+  unsigned last_mode_;
+  size_t last_opcode_pos_;
+
+  // Interleaved instructions, sizes, data and addresses of current window.
+  std::string inst_;
+  // Window and delta encoding headers.
+  std::string header_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_VCDIFF_WRITER_H_
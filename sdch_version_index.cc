@@ -0,0 +1,70 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_version_index.h"
+
+#include <algorithm>
+
+#include "sdch_fastdict_factory.h"
+
+namespace sdch {
+
+namespace {
+
+bool same_id(const Dictionary::id_t& a, const Dictionary::id_t& b) {
+  return !(a < b) && !(b < a);
+}
+
+}  // namespace
+
+VersionIndex::VersionIndex() {}
+
+void VersionIndex::add(const std::string& url,
+                       const Dictionary::id_t& id,
+                       size_t max_versions,
+                       FastdictFactory* factory) {
+  StoreType::iterator i = urls_.find(url);
+  if (i == urls_.end()) {
+    if (urls_.size() >= kMaxUrls) {
+      urls_.erase(lru_.back());
+      lru_.pop_back();
+    }
+    lru_.push_front(url);
+    Entry e;
+    e.lru = lru_.begin();
+    i = urls_.insert(std::make_pair(url, e)).first;
+  } else {
+    lru_.splice(lru_.begin(), lru_, i->second.lru);
+  }
+
+  std::deque<Dictionary::id_t>& v = i->second.versions;
+  for (std::deque<Dictionary::id_t>::iterator d = v.begin(); d != v.end();
+       ++d) {
+    if (same_id(*d, id)) {
+      v.erase(d);
+      break;
+    }
+  }
+  v.push_front(id);
+
+  while (v.size() > std::max(max_versions, size_t(1))) {
+    factory->erase(v.back());
+    v.pop_back();
+  }
+}
+
+bool VersionIndex::has(const std::string& url,
+                       const Dictionary::id_t& id) const {
+  StoreType::const_iterator i = urls_.find(url);
+  if (i == urls_.end())
+    return false;
+
+  const std::deque<Dictionary::id_t>& v = i->second.versions;
+  for (size_t n = 0; n < v.size(); ++n) {
+    if (same_id(v[n], id))
+      return true;
+  }
+  return false;
+}
+
+}  // namespace sdch
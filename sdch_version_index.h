@@ -0,0 +1,59 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_VERSION_INDEX_H_
+#define SDCH_VERSION_INDEX_H_
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+
+#include "sdch_dictionary.h"
+
+namespace sdch {
+
+class FastdictFactory;
+
+// Per-worker index of recent versions of URLs for "sdch_delta". Versions
+// themselves are quasi-dictionaries in FastdictFactory keyed by content
+// hash. Index keeps only their ids and removes old versions from the
+// factory, so one busy URL doesn't push everything else out.
+class VersionIndex {
+ public:
+  VersionIndex();
+
+  // Remember dictionary with id as the latest version of url. Versions
+  // beyond max_versions are removed from factory.
+  void add(const std::string& url,
+           const Dictionary::id_t& id,
+           size_t max_versions,
+           FastdictFactory* factory);
+
+  // Is id one of recent versions of url.
+  bool has(const std::string& url, const Dictionary::id_t& id) const;
+
+  size_t size() const { return urls_.size(); }
+
+ private:
+  typedef std::list<std::string> LRUType;
+  struct Entry {
+    // Most recent first.
+    std::deque<Dictionary::id_t> versions;
+    LRUType::iterator lru;
+  };
+  typedef std::map<std::string, Entry> StoreType;
+
+  // Upper bound of URLs. Least recently updated ones are forgotten. Their
+  // versions stay in FastdictFactory until LRU there drops them.
+  static const size_t kMaxUrls = 16384;
+
+  StoreType urls_;
+  // Most recently updated in front.
+  LRUType lru_;
+};
+
+
+}  // namespace sdch
+
+#endif  // SDCH_VERSION_INDEX_H_
@@ -0,0 +1,153 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_ZSTD_HANDLER_H_
+#define SDCH_ZSTD_HANDLER_H_
+
+#include "sdch_handler.h"
+
+#if (NGX_HAVE_ZSTD)
+
+#include <zstd.h>
+
+#include "sdch_dictionary.h"
+#include "sdch_main_config.h"
+#include "sdch_probes.h"
+#include "sdch_request_context.h"
+#include "sdch_zstd_pool.h"
+
+namespace sdch {
+
+// zstd counterpart of EncodingHandler for "Content-Encoding: sdch-zstd".
+// Output is framed the same way: server_id, '\0' and single zstd frame
+// compressed with Dictionary payload. For "dcz" server_id is replaced by
+// skippable frame header and SHA-256 of Dictionary.
+template <typename Next>
+class ZstdEncodingHandler {
+ public:
+  ZstdEncodingHandler(RequestContext* ctx, const PipelineSpec& spec)
+      : next_(ctx, spec),
+        ctx_(ctx),
+        dict_(spec.dict),
+        quasidict_(spec.quasidict),
+        level_(spec.zstd_level),
+        dcz_(spec.dcz),
+        pool_(NULL),
+        cctx_(NULL) {}
+
+  ~ZstdEncodingHandler() {
+    // Request was aborted in the middle. Context state is unknown.
+    if (cctx_)
+      ZSTD_freeCCtx(cctx_);
+  }
+
+  bool init(RequestContext* ctx) {
+    if (!next_.init(ctx))
+      return false;
+
+    if (dcz_) {
+      static const uint8_t magic[8] = {
+        0x5e, 0x2a, 0x4d, 0x18, 0x20, 0x00, 0x00, 0x00
+      };
+      next_.on_data(magic, sizeof(magic));
+      next_.on_data(dict_->sha256(), 32);
+    } else {
+      // Output Dictionary server_id first
+      next_.on_data(dict_->server_id().data(), 8);
+
+      static const uint8_t terminator[1] = { 0x0 };
+      next_.on_data(terminator, 1);
+    }
+
+    pool_ = &MainConfig::get(ctx->request)->zstd_pool;
+    cctx_ = pool_->borrow();
+    if (cctx_ == NULL)
+      return false;
+
+    // Quasi-dictionaries are used once. Compiling them into CDict isn't
+    // worth it, prefix is valid for exactly one frame.
+    if (quasidict_ != NULL && dict_ == &quasidict_->dict) {
+      return dict_->has_payload() &&
+             !ZSTD_isError(ZSTD_CCtx_setParameter(
+                 cctx_, ZSTD_c_compressionLevel, level_)) &&
+             !ZSTD_isError(ZSTD_CCtx_refPrefix(
+                 cctx_, dict_->payload(), dict_->payload_size()));
+    }
+
+    const ZSTD_CDict* cdict = pool_->cdict(dict_, level_);
+    return cdict != NULL && !ZSTD_isError(ZSTD_CCtx_refCDict(cctx_, cdict));
+  }
+
+  ngx_int_t on_data(const uint8_t* buf, size_t len) {
+    SDCH_PROBE3(zstd_data, ctx_->request, buf, len);
+    if (len) {
+      ScopedTimer timer(&ctx_->phase_ns[PHASE_ENCODE]);
+      return compress(buf, len, ZSTD_e_continue);
+    }
+
+    // Flush requested. Push out everything zstd holds.
+    if (ctx_->need_flush)
+      return compress(buf, 0, ZSTD_e_flush);
+
+    return next_.on_data(buf, len);
+  }
+
+  ngx_int_t on_finish() {
+    SDCH_PROBE1(zstd_finish, ctx_->request);
+    {
+      ScopedTimer timer(&ctx_->phase_ns[PHASE_ENCODE]);
+      if (compress(NULL, 0, ZSTD_e_end) == NGX_ERROR)
+        return NGX_ERROR;
+    }
+
+    pool_->release(cctx_);
+    cctx_ = NULL;
+    return next_.on_finish();
+  }
+
+ private:
+  // Feed buf into zstd and pass its output to next_ chunk by chunk.
+  ngx_int_t compress(const uint8_t* buf, size_t len, ZSTD_EndDirective mode) {
+    uint8_t out[4096];
+    ngx_int_t rc = NGX_OK;
+
+    ZSTD_inBuffer in = { buf, len, 0 };
+    for (;;) {
+      ZSTD_outBuffer o = { out, sizeof(out), 0 };
+      size_t left = ZSTD_compressStream2(cctx_, &o, &in, mode);
+      if (ZSTD_isError(left))
+        return NGX_ERROR;
+
+      if (o.pos) {
+        rc = next_.on_data(out, o.pos);
+        if (rc == NGX_ERROR)
+          return rc;
+      }
+
+      // Input consumed. And for flush/end everything is written out.
+      if (in.pos == in.size && (mode == ZSTD_e_continue || left == 0))
+        break;
+    }
+
+    return rc;
+  }
+
+  Next next_;
+  RequestContext* ctx_;
+
+  Dictionary* dict_;
+  FastdictFactory::ValuePtr quasidict_;
+  int level_;
+  bool dcz_;
+
+  ZstdPool* pool_;
+  // Borrowed in init(). NULL after successful on_finish().
+  ZSTD_CCtx* cctx_;
+};
+
+
+}  // namespace sdch
+
+#endif  // NGX_HAVE_ZSTD
+
+#endif  // SDCH_ZSTD_HANDLER_H_
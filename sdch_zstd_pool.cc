@@ -0,0 +1,63 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#include "sdch_zstd_pool.h"
+
+#if (NGX_HAVE_ZSTD)
+
+#include "sdch_dictionary.h"
+
+namespace sdch {
+
+ZstdPool::ZstdPool() : max_size_(8) {}
+
+ZstdPool::~ZstdPool() {
+  for (CDicts::iterator i = cdicts_.begin(); i != cdicts_.end(); ++i)
+    ZSTD_freeCDict(i->second);
+  for (size_t i = 0; i < free_.size(); ++i)
+    ZSTD_freeCCtx(free_[i]);
+}
+
+const ZSTD_CDict* ZstdPool::cdict(const Dictionary* dict, int level) {
+  Key key(dict, level);
+  CDicts::iterator i = cdicts_.find(key);
+  if (i != cdicts_.end())
+    return i->second;
+
+  if (!dict->has_payload())
+    return NULL;
+
+  // Stable API only. It copies payload, but once per worker. Plain SDCH
+  // dictionaries are taken as raw content.
+  ZSTD_CDict* res =
+      ZSTD_createCDict(dict->payload(), dict->payload_size(), level);
+  if (res == NULL)
+    return NULL;
+
+  cdicts_.insert(std::make_pair(key, res));
+  return res;
+}
+
+ZSTD_CCtx* ZstdPool::borrow() {
+  if (free_.empty())
+    return ZSTD_createCCtx();
+
+  // Most recently used one. It's more likely to be in cache.
+  ZSTD_CCtx* res = free_.back();
+  free_.pop_back();
+  return res;
+}
+
+void ZstdPool::release(ZSTD_CCtx* cctx) {
+  if (free_.size() >= max_size_) {
+    ZSTD_freeCCtx(cctx);
+    return;
+  }
+  // Drop dictionary and parameters of previous request.
+  ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+  free_.push_back(cctx);
+}
+
+}  // namespace sdch
+
+#endif  // NGX_HAVE_ZSTD
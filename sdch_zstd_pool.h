@@ -0,0 +1,60 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+
+#ifndef SDCH_ZSTD_POOL_H_
+#define SDCH_ZSTD_POOL_H_
+
+extern "C" {
+#include <ngx_config.h>
+#include <ngx_core.h>
+}
+
+#if (NGX_HAVE_ZSTD)
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include <zstd.h>
+
+namespace sdch {
+
+class Dictionary;
+
+// Per-worker zstd state for ZstdEncodingHandler. Dictionaries are compiled
+// into ZSTD_CDict once and kept as long as config. Compression contexts
+// are reused between requests. Only Dictionaries living as long as config
+// (not quasi ones) should be passed to cdict().
+class ZstdPool {
+ public:
+  ZstdPool();
+  ~ZstdPool();
+
+  // Compiled dictionary for level. Owned by pool. NULL on failure.
+  const ZSTD_CDict* cdict(const Dictionary* dict, int level);
+
+  // Get fresh compression context. Caller owns it until release().
+  ZSTD_CCtx* borrow();
+
+  // Return context to the pool. Should be called only after frame is
+  // finished. Otherwise just ZSTD_freeCCtx() it.
+  void release(ZSTD_CCtx* cctx);
+
+  // Maximum number of idle contexts. 0 disables pooling.
+  void set_max_size(size_t max_size) { max_size_ = max_size; }
+
+ private:
+  typedef std::pair<const Dictionary*, int> Key;
+  typedef std::map<Key, ZSTD_CDict*> CDicts;
+
+  CDicts cdicts_;
+  std::vector<ZSTD_CCtx*> free_;
+  size_t max_size_;
+};
+
+
+}  // namespace sdch
+
+#endif  // NGX_HAVE_ZSTD
+
+#endif  // SDCH_ZSTD_POOL_H_
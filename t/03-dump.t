@@ -46,7 +46,61 @@ GET /sdch HTTP/1.1
 Accept-Encoding: gzip, deflate, sdch
 Avail-Dictionary: WSsxLmBh
 
---- grep_error_log chop
-dump open file
+--- grep_error_log eval
+qr/dump queued \d+ bytes/
 --- grep_error_log_out
-dump open file
+dump queued 3 bytes
+
+=== TEST 2: Sampled out
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  sdch_dumpdir $TEST_NGINX_SERVROOT/client_temp sample=0;
+  return 200 "FOO";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- no_error_log
+dump queued
+
+=== TEST 3: Dumps are counted
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  sdch_dumpdir $TEST_NGINX_SERVROOT/client_temp sample=1;
+  return 200 "FOO";
+}
+location /status {
+  sdch_status;
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- pipelined_requests eval
+["GET /sdch", "GET /status"]
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+--- response_body_like eval
+[qr/^hueGONof\x00/, qr/"dumps":[1-9]\d*,"dumps_dropped":0/]
+--- no_error_log
+[alert]
@@ -0,0 +1,117 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Sdch;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value(http_config => "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+
+        sdch on;
+        sdch_dict $servroot/html/sdch/css.dict css 1;
+        sdch_types text/css;
+      ");
+
+    # Ids are:
+    # user lHudK8d3 server iNm9gxBj
+    $block->set_value(user_files => '
+        >>> sdch/css.dict
+        Path: /sdch
+
+        THE CSS DICTIONARY
+
+        >>> sdch/foo.css
+        ' . 'CSS ' x 65536 . '
+      ');
+
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Sliced encoding of large response
+--- config
+location /sdch/foo.css {
+  sdch_group css;
+  sdch_slice_size 4k;
+  default_type text/css;
+}
+--- request
+GET /sdch/foo.css HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: lHudK8d3
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_filters eval
+Sdch::check_body("$ENV{TEST_NGINX_SERVROOT}/html/sdch/foo.css",
+                 "$ENV{TEST_NGINX_SERVROOT}/html/sdch/css.dict")
+--- response_body
+same
+--- no_error_log
+[alert]
+
+=== TEST 2: Slicing disabled
+--- config
+location /sdch/foo.css {
+  sdch_group css;
+  sdch_slice_size 0;
+  default_type text/css;
+}
+--- request
+GET /sdch/foo.css HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: lHudK8d3
+
+--- response_headers
+Content-Encoding: sdch
+--- no_error_log
+[alert]
+
+=== TEST 3: Sliced encoding of buffered upstream
+Upstream calls body filter only with new data. The rest of slices shouldn't
+wait for it.
+--- config
+location /sdch/foo.css {
+  sdch off;
+  default_type text/css;
+}
+location /sdch/proxied.css {
+  sdch_group css;
+  sdch_slice_size 4k;
+  proxy_buffering on;
+  proxy_buffers 4 64k;
+  proxy_pass http://127.0.0.1:$TEST_NGINX_SERVER_PORT/sdch/foo.css;
+}
+--- request
+GET /sdch/proxied.css HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: lHudK8d3
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_filters eval
+Sdch::check_body("$ENV{TEST_NGINX_SERVROOT}/html/sdch/foo.css",
+                 "$ENV{TEST_NGINX_SERVROOT}/html/sdch/css.dict")
+--- response_body
+same
+--- timeout: 5
+--- no_error_log
+[alert]
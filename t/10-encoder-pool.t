@@ -0,0 +1,80 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      " . ($block->pool_config // ''));
+    return $block;
+  });
+
+
+# Same encoder should be reused by subsequent requests.
+repeat_each(3);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Pooled encoders
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- no_error_log
+[alert]
+
+=== TEST 2: Pooling disabled
+--- pool_config
+sdch_encoder_pool_size 0;
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- no_error_log
+[alert]
@@ -0,0 +1,128 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Sdch;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Built-in encoder
+--- config
+location /sdch {
+  sdch on;
+  sdch_encoder simd;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- no_error_log
+[alert]
+
+=== TEST 2: Built-in encoder with quasi dictionary
+--- config
+location /sdch {
+  sdch on;
+  sdch_encoder simd;
+  sdch_fastdict on;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Sdch-Features: fastdict
+
+--- response_headers
+X-Sdch-Use-As-Dictionary: 1
+--- no_error_log
+[alert]
+
+=== TEST 3: Unknown encoder
+--- config
+location /sdch {
+  sdch on;
+  sdch_encoder foo;
+  return 200 "FOO";
+}
+--- must_die
+
+=== TEST 4: Optimal encoder
+--- main_config
+thread_pool sdch threads=2;
+--- config
+location /sdch {
+  sdch on;
+  sdch_encoder optimal;
+  sdch_thread_pool sdch;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY FOO FOO FOO";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_filters eval
+Sdch::check_body(\"THE DICTIONARY FOO THE DICTIONARY FOO FOO FOO",
+                 "$ENV{TEST_NGINX_SERVROOT}/html/sdch/dict1.dict")
+--- response_body
+same
+--- no_error_log
+[alert]
+
+=== TEST 5: Optimal encoder without thread pool
+--- config
+location /sdch {
+  sdch on;
+  sdch_encoder optimal;
+  return 200 "FOO";
+}
+--- must_die
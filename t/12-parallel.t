@@ -0,0 +1,99 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Sdch;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('main_config', "thread_pool sdch threads=4;");
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    $block->set_value(user_files => '>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+>>> sdch/foo.html
+' . 'THE DICTIONARY FOO ' x 65536 . '
+');
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Windows encoded on thread pool
+--- config
+location /sdch {
+  sdch on;
+  sdch_thread_pool sdch;
+  sdch_window_size 64k;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+}
+--- request
+GET /sdch/foo.html HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_filters eval
+Sdch::check_body("$ENV{TEST_NGINX_SERVROOT}/html/sdch/foo.html",
+                 "$ENV{TEST_NGINX_SERVROOT}/html/sdch/dict1.dict")
+--- response_body
+same
+--- no_error_log
+[alert]
+
+=== TEST 2: Windows encoded on thread pool by built-in encoder
+--- config
+location /sdch {
+  sdch on;
+  sdch_encoder simd;
+  sdch_thread_pool sdch;
+  sdch_window_size 64k;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+}
+--- request
+GET /sdch/foo.html HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_filters eval
+Sdch::check_body("$ENV{TEST_NGINX_SERVROOT}/html/sdch/foo.html",
+                 "$ENV{TEST_NGINX_SERVROOT}/html/sdch/dict1.dict")
+--- response_body
+same
+--- no_error_log
+[alert]
+
+=== TEST 3: Zero window
+--- config
+location /sdch {
+  sdch on;
+  sdch_thread_pool sdch;
+  sdch_window_size 0;
+}
+--- must_die
@@ -0,0 +1,134 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    my $http_config = $block->http_config // '';
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+
+        sdch_cache_zone sdch 1m;
+      " . $http_config);
+    $block->set_value(user_files => '>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+>>> sdch/foo.html
+THE DICTIONARY FOO THE DICTIONARY
+
+>>> a/sdch/bar.html 201501011200.00
+THE DICTIONARY BAR A
+
+>>> b/sdch/bar.html 201501011200.00
+THE DICTIONARY BAR B
+');
+    return $block;
+  });
+
+
+# Cache survives between repetitions.
+repeat_each(1);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Miss then hit
+--- config
+location /sdch {
+  sdch on;
+  sdch_cache zone=sdch;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  add_header X-Sdch-Cache $sdch_cache_status;
+}
+--- request eval
+["GET /sdch/foo.html", "GET /sdch/foo.html"]
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers eval
+["Content-Encoding: sdch\nX-Sdch-Cache: MISS", "Content-Encoding: sdch\nX-Sdch-Cache: HIT"]
+--- no_error_log
+[alert]
+
+=== TEST 2: No ETag
+--- config
+location /sdch {
+  sdch on;
+  sdch_cache zone=sdch;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  add_header X-Sdch-Cache $sdch_cache_status;
+  return 200 "THE DICTIONARY FOO";
+}
+--- request
+GET /sdch
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+X-Sdch-Cache: BYPASS
+
+=== TEST 3: Servers sharing zone
+Same URI and ETag (mtime and size) on two servers.
+--- http_config
+server {
+  listen $TEST_NGINX_SERVER_PORT;
+  server_name other.example;
+  root $TEST_NGINX_SERVROOT/html/b;
+
+  location /sdch {
+    sdch on;
+    sdch_cache zone=sdch;
+    sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+    sdch_url /sdch/dict1.dict;
+    default_type text/html;
+    add_header X-Sdch-Cache $sdch_cache_status;
+  }
+}
+--- config
+location /sdch {
+  root $TEST_NGINX_SERVROOT/html/a;
+  sdch on;
+  sdch_cache zone=sdch;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  add_header X-Sdch-Cache $sdch_cache_status;
+}
+--- request eval
+["GET /sdch/bar.html", "GET http://other.example/sdch/bar.html",
+ "GET http://other.example/sdch/bar.html"]
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers eval
+["Content-Encoding: sdch\nX-Sdch-Cache: MISS",
+ "Content-Encoding: sdch\nX-Sdch-Cache: MISS",
+ "Content-Encoding: sdch\nX-Sdch-Cache: HIT"]
+--- no_error_log
+[alert]
+
+=== TEST 4: Unknown zone
+--- config
+location /sdch {
+  sdch on;
+  sdch_cache zone=foo;
+}
+--- must_die
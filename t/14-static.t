@@ -0,0 +1,119 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Precompressed file is sent as is
+--- config
+location /sdch {
+  sdch on;
+  sdch_static on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  sdch_types text/css;
+  types { text/css css; }
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+>>> sdch/style.css
+THE DICTIONARY FOO THE DICTIONARY
+>>> sdch/style.css.hueGONof.sdch
+PRECOMPRESSED
+--- request
+GET /sdch/style.css HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+Content-Length: 14
+--- response_body
+PRECOMPRESSED
+--- no_error_log
+[alert]
+
+=== TEST 2: No precompressed file, encode as usual
+--- config
+location /sdch {
+  sdch on;
+  sdch_static on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  sdch_types text/css;
+  types { text/css css; }
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+>>> sdch/style.css
+THE DICTIONARY FOO THE DICTIONARY
+--- request
+GET /sdch/style.css HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+!Content-Length
+--- no_error_log
+[alert]
+
+=== TEST 3: Precompressed file without Avail-Dictionary
+--- config
+location /sdch {
+  sdch on;
+  sdch_static on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  sdch_types text/css;
+  types { text/css css; }
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+>>> sdch/style.css
+THE DICTIONARY FOO THE DICTIONARY
+>>> sdch/style.css.hueGONof.sdch
+PRECOMPRESSED
+--- request
+GET /sdch/style.css HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+
+--- response_headers
+!Content-Encoding
+Get-Dictionary: /sdch/dict1.dict
+--- response_body
+THE DICTIONARY FOO THE DICTIONARY
+--- no_error_log
+[alert]
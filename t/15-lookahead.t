@@ -0,0 +1,112 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Encode when trial pays off
+--- config
+location /sdch {
+  sdch on;
+  sdch_lookahead 4k;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+!X-Sdch-Encode
+--- no_error_log
+[alert]
+
+=== TEST 2: Send original when dictionary doesn't help
+--- config
+location /sdch {
+  sdch on;
+  sdch_lookahead 4k;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "qwertyuiopasdfghjklzxcvbnm1234567890";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+!Content-Encoding
+X-Sdch-Encode: 0
+Content-Length: 36
+--- response_body: qwertyuiopasdfghjklzxcvbnm1234567890
+--- no_error_log
+[alert]
+
+=== TEST 3: Decide on first bytes and pass the rest through
+--- config
+location /sdch {
+  sdch on;
+  sdch_lookahead 16;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+!Content-Encoding
+X-Sdch-Encode: 0
+--- response_body: THE DICTIONARY FOO THE DICTIONARY
+--- no_error_log
+[alert]
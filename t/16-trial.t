@@ -0,0 +1,99 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Trial picks dictionary with smaller output
+--- config
+location /sdch {
+  sdch on;
+  sdch_lookahead 4k;
+  sdch_trial_dicts 2;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/other.dict default 0;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict default 1;
+  sdch_url /sdch/other.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/other.dict
+Host: example.com
+
+zzzzzzzzzzzzzz
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: 7AKh_4MB, WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_like: ^hueGONof\0
+--- no_error_log
+[alert]
+
+=== TEST 2: Without trial the best by priority is used
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/other.dict default 0;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict default 1;
+  sdch_url /sdch/other.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/other.dict
+Host: example.com
+
+zzzzzzzzzzzzzz
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: 7AKh_4MB, WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_like: ^5mZNunYL\0
+--- no_error_log
+[alert]
+
+=== TEST 3: sdch_trial_dicts requires sdch_lookahead
+--- config
+location /sdch {
+  sdch on;
+  sdch_trial_dicts 2;
+}
+--- must_die
@@ -0,0 +1,129 @@
+# Keep nginx running between tests. We have to preserve quasi dictionaries on
+# server. We have to set it before loading Test::Nginx
+BEGIN {
+$ENV{TEST_NGINX_FORCE_RESTART_ON_TEST} = '0';
+}
+
+use Test::Nginx::Socket no_plan;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Sdch;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+# Quasi-dictionary stored by the first test is used by the next ones.
+repeat_each(1);
+no_shuffle();
+run_tests();
+
+
+__DATA__
+
+=== TEST 1: Store quasi-dictionary
+--- config
+location /sdch {
+  sdch on;
+  sdch_composite on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+Sdch-Features: fastdict
+
+--- response_headers
+Content-Encoding: sdch
+! X-Sdch-Composite
+--- grep_error_log chop
+storing quasidict
+--- grep_error_log_out
+storing quasidict
+
+=== TEST 2: Encode against composite dictionary
+--- config
+location /sdch {
+  sdch on;
+  sdch_composite on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh, Gjf-0-92
+Sdch-Features: composite
+
+--- response_headers
+Content-Encoding: sdch
+X-Sdch-Composite: WSsxLmBh Gjf-0-92
+--- response_body_filters eval
+Sdch::check_body(\"THE DICTIONARY FOO",
+                 ["$ENV{TEST_NGINX_SERVROOT}/html/sdch/dict1.dict",
+                  "THE DICTIONARY FOO"])
+--- response_body
+same
+--- no_error_log
+[alert]
+
+=== TEST 3: Composite is not declared
+--- config
+location /sdch {
+  sdch on;
+  sdch_composite on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh, Gjf-0-92
+
+--- response_headers
+Content-Encoding: sdch
+! X-Sdch-Composite
+--- response_body_like: ^hueGONof\0
@@ -0,0 +1,94 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+
+__DATA__
+
+=== TEST 1: Gzip on top of sdch
+--- config
+location /sdch {
+  sdch on;
+  sdch_gzip on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch, gzip
+--- response_body_like: ^\x1f\x8b
+--- no_error_log
+[alert]
+
+=== TEST 2: Client doesn't accept gzip
+--- config
+location /sdch {
+  sdch on;
+  sdch_gzip on;
+  sdch_gzip_comp_level 9;
+  sdch_gzip_window 4k;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_like: ^hueGONof\0
+--- no_error_log
+[alert]
+
+=== TEST 3: Bad window
+--- config
+location /sdch {
+  sdch on;
+  sdch_gzip on;
+  sdch_gzip_window 3k;
+  return 200 "FOO";
+}
+--- must_die
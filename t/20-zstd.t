@@ -0,0 +1,149 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Sdch;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+
+__DATA__
+
+=== TEST 1: zstd with configured dictionary
+--- config
+location /sdch {
+  sdch on;
+  sdch_zstd on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, sdch, sdch-zstd
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch-zstd
+--- response_body_filters eval
+Sdch::check_body(\"THE DICTIONARY FOO THE DICTIONARY",
+                 "$ENV{TEST_NGINX_SERVROOT}/html/sdch/dict1.dict")
+--- response_body
+same
+--- no_error_log
+[alert]
+
+=== TEST 2: sdch-zstd is not accepted
+--- config
+location /sdch {
+  sdch on;
+  sdch_zstd on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, sdch, sdch-zstd;q=0
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- response_body_like: ^hueGONof\0\xd6\xc3\xc4
+--- no_error_log
+[alert]
+
+=== TEST 3: FastDict client accepting sdch-zstd
+--- config
+location /sdch {
+  sdch on;
+  sdch_zstd on;
+  sdch_fastdict on;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: sdch, sdch-zstd
+Sdch-Features: fastdict
+
+--- response_headers
+X-Sdch-Use-As-Dictionary: 1
+--- no_error_log
+[alert]
+
+=== TEST 4: Lookahead trial with zstd
+--- config
+location /sdch {
+  sdch on;
+  sdch_zstd on;
+  sdch_lookahead 4k;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX FOO BAR BAZ QUX";
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, sdch, sdch-zstd
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch-zstd
+!X-Sdch-Encode
+--- response_body_like: ^hueGONof\0\x28\xb5\x2f\xfd
+--- no_error_log
+[alert]
+
+=== TEST 5: Bad level
+--- config
+location /sdch {
+  sdch on;
+  sdch_zstd on;
+  sdch_zstd_level 23;
+  return 200 "FOO";
+}
+--- must_die
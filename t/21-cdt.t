@@ -0,0 +1,131 @@
+# Keep nginx running between tests. We have to preserve quasi dictionaries on
+# server. We have to set it before loading Test::Nginx
+BEGIN {
+$ENV{TEST_NGINX_FORCE_RESTART_ON_TEST} = '0';
+}
+
+use Test::Nginx::Socket no_plan;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Sdch;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+# Dictionary stored by the first test is used by the next ones.
+repeat_each(1);
+no_shuffle();
+run_tests();
+
+
+__DATA__
+
+=== TEST 1: Mark and store response
+--- config
+location /cdt {
+  sdch on;
+  sdch_cdt on;
+  sdch_cdt_match "/cdt*";
+  default_type text/html;
+  return 200 "THE DICTIONARY VERSION ONE";
+}
+--- request
+GET /cdt HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, br, zstd, dcb, dcz
+
+--- response_headers
+Use-As-Dictionary: match="/cdt*"
+! Content-Encoding
+--- response_body: THE DICTIONARY VERSION ONE
+--- grep_error_log chop
+storing quasidict
+--- grep_error_log_out
+storing quasidict
+
+=== TEST 2: dcz against stored response
+--- config
+location /cdt {
+  sdch on;
+  sdch_cdt on;
+  sdch_cdt_match "/cdt*";
+  default_type text/html;
+  return 200 "THE DICTIONARY VERSION ONE";
+}
+--- request
+GET /cdt HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, br, zstd, dcb, dcz
+Available-Dictionary: :cUeCksDqV/wzpdYSRZ60mJj8paNodBM8ctu5Y0Zg/CM=:
+
+--- response_headers
+Content-Encoding: dcz
+Use-As-Dictionary: match="/cdt*"
+--- response_body_filters eval
+Sdch::check_body(\"THE DICTIONARY VERSION ONE", \"THE DICTIONARY VERSION ONE")
+--- response_body
+same
+--- no_error_log
+[alert]
+
+=== TEST 3: Unknown dictionary
+--- config
+location /cdt {
+  sdch on;
+  sdch_cdt on;
+  default_type text/html;
+  return 200 "THE DICTIONARY VERSION TWO";
+}
+--- request
+GET /cdt HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, br, zstd, dcb, dcz
+Available-Dictionary: :AAAAksDqV/wzpdYSRZ60mJj8paNodBM8ctu5Y0Zg/CM=:
+
+--- response_headers
+! Content-Encoding
+--- response_body: THE DICTIONARY VERSION TWO
+
+=== TEST 4: No store for client without dictionary support
+--- config
+location /cdt {
+  sdch on;
+  sdch_cdt on;
+  sdch_cdt_match "/cdt*";
+  default_type text/html;
+  return 200 "THE DICTIONARY VERSION ONE";
+}
+--- request
+GET /cdt HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, br, zstd
+
+--- response_headers
+! Use-As-Dictionary
+! Content-Encoding
+--- response_body: THE DICTIONARY VERSION ONE
+--- no_error_log
+storing quasidict
+
+=== TEST 5: Bad match pattern
+--- config
+location /cdt {
+  sdch on;
+  sdch_cdt_match 'a"b';
+  return 200 "FOO";
+}
+--- must_die
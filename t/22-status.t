@@ -0,0 +1,119 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+
+__DATA__
+
+=== TEST 1: JSON status
+--- config
+location /status {
+  sdch_status;
+}
+--- request
+GET /status
+--- response_headers
+Content-Type: application/json
+--- response_body_like: ^\{"requests":\d+,"encoded":\d+,.*"skipped":\{"disabled":\d+,.*"overflow":\d+\}$
+--- no_error_log
+[alert]
+
+=== TEST 2: Prometheus status
+--- config
+location /status {
+  sdch_status prometheus;
+}
+--- request
+GET /status
+--- response_headers
+Content-Type: text/plain; version=0.0.4
+--- response_body_like
+# TYPE sdch_requests_total counter
+sdch_requests_total \d+
+--- no_error_log
+[alert]
+
+=== TEST 3: Encoded request is counted
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+location /status {
+  sdch_status;
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- pipelined_requests eval
+["GET /sdch", "GET /status"]
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+--- response_body_like eval
+[qr/^hueGONof\x00/, qr/"encoded":[1-9].*"dictionaries":\{"WSsxLmBh":[1-9]/]
+--- no_error_log
+[alert]
+
+=== TEST 4: Phase histograms
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "THE DICTIONARY FOO THE DICTIONARY";
+}
+location /status {
+  sdch_status prometheus;
+}
+--- user_files
+>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+--- pipelined_requests eval
+["GET /sdch", "GET /status"]
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+--- response_body_like eval
+[qr/^hueGONof\x00/, qr/sdch_phase_duration_seconds_count\{location="\/sdch",phase="encode"\} [1-9]/]
+--- no_error_log
+[alert]
+
+=== TEST 5: Bad format
+--- config
+location /status {
+  sdch_status xml;
+}
+--- must_die
+--- error_log
+expects json or prometheus
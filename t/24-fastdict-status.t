@@ -0,0 +1,61 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+      ");
+    return $block;
+  });
+
+
+repeat_each(1);
+no_shuffle();
+run_tests();
+
+
+__DATA__
+
+=== TEST 1: Empty store
+--- config
+location /fastdict {
+  sdch_fastdict_status;
+}
+--- request
+GET /fastdict
+--- response_headers
+Content-Type: application/json
+--- response_body_like: ^\{"pid":\d+,"total_size":\d+,"max_size":\d+,"evictions":0,"blocked_evictions":0,"dictionaries":\[\]\}$
+--- no_error_log
+[alert]
+
+=== TEST 2: Stored quasi-dictionary
+--- config
+location /sdch {
+  sdch on;
+  sdch_fastdict on;
+  sdch_group main;
+  default_type text/html;
+  return 200 "FOO";
+}
+location /fastdict {
+  sdch_fastdict_status;
+}
+--- pipelined_requests eval
+["GET /sdch", "GET /fastdict"]
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Sdch-Features: fastdict
+--- response_body_like eval
+[qr/^FOO$/, qr/"dictionaries":\[\{"id":"lSBDfOiQ","size":3,"index_size":\d+,"age":\d+,"hits":0,"in_use":0,"group":"main"\}\]/]
+--- no_error_log
+[alert]
@@ -0,0 +1,207 @@
+use Test::Nginx::Socket no_plan;
+use Test::More;
+use FindBin;
+use lib "$FindBin::Bin/lib";
+use Sdch;
+
+my $servroot = $Test::Nginx::Socket::ServRoot;
+$ENV{TEST_NGINX_SERVROOT} = $servroot;
+
+add_block_preprocessor(sub {
+    my $block = shift;
+    # Block's own http_config replaces sdch_train_zone.
+    my $zone = $block->http_config
+        // "sdch_train_zone $servroot/html/train thread_pool=off interval=100ms;";
+    $block->set_value('http_config',
+      "
+        client_body_temp_path $servroot/client_temp;
+        proxy_temp_path $servroot/proxy_temp;
+        fastcgi_temp_path $servroot/fastcgi_temp;
+        uwsgi_temp_path $servroot/uwsgi_temp;
+        scgi_temp_path $servroot/scgi_temp;
+
+        $zone
+      ");
+    $block->set_value(user_files => '>>> sdch/dict1.dict
+Host: example.com
+
+THE DICTIONARY
+
+>>> train/keep
+
+>>> wait.txt
+' . ('x' x 3000) . '
+');
+    return $block;
+  });
+
+
+repeat_each(2);
+no_shuffle();
+run_tests();
+
+__DATA__
+
+=== TEST 1: Encoded response is sampled
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  sdch_train on;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- grep_error_log eval
+qr/train sample \d+ bytes/
+--- grep_error_log_out
+train sample 3 bytes
+
+=== TEST 2: Response without dictionary is sampled
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  sdch_train on;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+
+--- response_headers
+Content-Encoding:
+Content-Length: 3
+--- grep_error_log eval
+qr/train sample \d+ bytes/
+--- grep_error_log_out
+train sample 3 bytes
+
+=== TEST 3: Off by default
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- no_error_log
+train sample
+
+=== TEST 4: Nothing trained yet
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_train on;
+  sdch_url /sdch/$sdch_train_dict;
+  default_type text/html;
+  add_header X-Train-Dict "[$sdch_train_dict]";
+  return 200 "FOO";
+}
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+
+--- response_headers
+X-Train-Dict: []
+
+=== TEST 5: Dictionary is trained, written and announced
+Enough distinct responses, then a slow one lets timer train. Client
+announcing trained dictionary gets response encoded with it.
+--- http_config
+sdch_train_zone $TEST_NGINX_SERVROOT/html/train thread_pool=off interval=100ms;
+map $sdch_train_dict $train_id {
+  ~^(?<id>[\w-]{8})\.dict$ $id;
+}
+--- config
+location /train {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_train on;
+  sdch_url /dicts/$sdch_train_dict;
+  default_type text/html;
+  return 200 "<html><head><title>Common page title of the site</title><link rel=\"stylesheet\" href=\"/static/site.css\"></head><body><div class=\"header\">Common header of every page of the site</div><div class=\"content\">$uri</div><div class=\"footer\">Common footer of every page, copyright and contacts</div></body></html>";
+}
+location /wait.txt {
+  limit_rate 1k;
+}
+location /name {
+  return 200 "$sdch_train_dict";
+}
+location /exists {
+  root $TEST_NGINX_SERVROOT/html/train;
+  default_type text/plain;
+  try_files /$sdch_train_dict =404;
+}
+location /encoded {
+  proxy_set_header Accept-Encoding sdch;
+  proxy_set_header Avail-Dictionary $train_id;
+  proxy_pass http://127.0.0.1:$TEST_NGINX_SERVER_PORT/train/encoded;
+}
+--- request eval
+[(map { "GET /train/$_" } 1..40), "GET /wait.txt", "GET /name",
+ "GET /exists", "GET /train/last", "GET /encoded"]
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+
+--- response_body_filters eval
+my $check = Sdch::check_body(
+    \'<html><head><title>Common page title of the site</title><link rel="stylesheet" href="/static/site.css"></head><body><div class="header">Common header of every page of the site</div><div class="content">/train/encoded</div><div class="footer">Common footer of every page, copyright and contacts</div></body></html>',
+    "$ENV{TEST_NGINX_SERVROOT}/html/train/*.dict");
+sub { $_[0] =~ /^[\w-]{8}\0/ ? $check->($_[0]) : $_[0] }
+--- response_body_like eval
+[(map { qr/Common header/ } 1..40), qr/^x+$/, qr/^[\w-]{8}\.dict$/,
+ qr/^\n.*Common footer of every page/s, qr/Common header/, qr/^same$/]
+--- response_headers_like eval
+[(map { "" } 1..43), "Get-Dictionary: /dicts/[\\w-]{8}\\.dict",
+ "Content-Encoding: sdch"]
+--- error_log eval
+qr/sdch_train: group "default": published/
+--- timeout: 10
+
+=== TEST 6: Default zone fits reservoir
+--- http_config
+sdch_train_zone $TEST_NGINX_SERVROOT/html/train;
+--- config
+location /sdch {
+  sdch on;
+  sdch_dict $TEST_NGINX_SERVROOT/html/sdch/dict1.dict;
+  sdch_url /sdch/dict1.dict;
+  sdch_train on;
+  default_type text/html;
+  return 200 "FOO";
+}
+--- request
+GET /sdch HTTP/1.1
+--- more_headers
+Accept-Encoding: gzip, deflate, sdch
+Avail-Dictionary: WSsxLmBh
+
+--- response_headers
+Content-Encoding: sdch
+--- grep_error_log eval
+qr/train sample \d+ bytes/
+--- grep_error_log_out
+train sample 3 bytes
+--- no_error_log
+[emerg]
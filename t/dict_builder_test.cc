@@ -0,0 +1,183 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+//
+// Test of DictBuilder on synthetic responses: random noise with known
+// segments repeated in some of them. Frequent segments should be selected,
+// each once and the best last, rare ones not at all, and payload should fit
+// in size. Noise fills the rest: its k-mers share counters with others.
+// Results shouldn't depend on threads or on batches of the first pass.
+//
+// Doesn't need nginx:
+//
+//   g++ -O2 -I. -o dict_builder_test t/dict_builder_test.cc
+//       sdch_dict_builder.cc -lpthread
+//   ./dict_builder_test
+
+#include <stdio.h>
+#include <string.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "sdch_dict_builder.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+  if (!ok)
+    ++failures;
+  printf("%s %s\n", ok ? "ok" : "FAIL", what);
+}
+
+// Deterministic on every platform, unlike random().
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  // xorshift64*. Low bits of LCG repeat too soon for noise.
+  uint32_t next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return static_cast<uint32_t>((state_ * 2685821657736338717ULL) >> 32);
+  }
+
+  std::string bytes(size_t len) {
+    std::string res(len, '\0');
+    for (size_t i = 0; i < len; ++i)
+      res[i] = static_cast<char>(next());
+    return res;
+  }
+
+ private:
+  uint64_t state_;
+};
+
+size_t count(const std::string& s, const std::string& what) {
+  size_t n = 0;
+  for (size_t pos = s.find(what); pos != std::string::npos;
+       pos = s.find(what, pos + 1))
+    ++n;
+  return n;
+}
+
+// No k bytes long substring of payload occurs in it twice.
+bool distinct_kmers(const std::string& payload, size_t k) {
+  std::set<std::string> seen;
+  for (size_t p = 0; p + k <= payload.size(); ++p) {
+    if (!seen.insert(payload.substr(p, k)).second)
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  Random rnd(1);
+
+  // In every response, in every other, in every tenth and in one.
+  std::string common = rnd.bytes(300);
+  std::string half = rnd.bytes(200);
+  std::string tenth = rnd.bytes(100);
+  std::string single = rnd.bytes(100);
+
+  const size_t kSamples = 200;
+  sdch::DictSamples samples;
+  for (size_t i = 0; i < kSamples; ++i) {
+    std::string s = rnd.bytes(200 + rnd.next() % 1000);
+    s += common;
+    s += rnd.bytes(200 + rnd.next() % 1000);
+    if (i % 2 == 0)
+      s += half + rnd.bytes(200 + rnd.next() % 1000);
+    if (i % 10 == 5)
+      s += tenth + rnd.bytes(200 + rnd.next() % 1000);
+    if (i == 77)
+      s += single + rnd.bytes(200);
+    samples.push_back(s);
+  }
+
+  // Four epochs: the first three take known segments.
+  sdch::DictBuilderParams params;
+  params.size = 1200;
+  params.length = 300;
+  std::string payload = sdch::build_dict_payload(samples, params);
+  printf("payload %zu bytes\n", payload.size());
+
+  check(count(payload, common) == 1, "segment of every response once");
+  check(count(payload, half) == 1, "segment of every other response once");
+  check(count(payload, tenth) == 1, "segment of every tenth response once");
+  check(count(payload, single) == 0, "segment of one response skipped");
+  check(payload.find(tenth) < payload.find(half) &&
+            payload.find(half) < payload.find(common),
+        "the best segments last");
+  check(payload.size() <= params.size, "size is respected");
+  check(distinct_kmers(payload, params.k), "no duplicate k-mers");
+
+  // Big one is filled with noise, but still without duplicates.
+  sdch::DictBuilderParams big;
+  std::string full = sdch::build_dict_payload(samples, big);
+  printf("full payload %zu bytes\n", full.size());
+  check(count(full, common) == 1 && count(full, half) == 1 &&
+            count(full, tenth) == 1,
+        "segments once in full payload");
+  check(full.size() <= big.size, "size of full payload is respected");
+  check(distinct_kmers(full, big.k), "no duplicate k-mers in full payload");
+
+  // Smaller than all segments together.
+  sdch::DictBuilderParams small = params;
+  small.size = 256;
+  small.length = 128;
+  std::string limited = sdch::build_dict_payload(samples, small);
+  printf("limited payload %zu bytes\n", limited.size());
+  check(!limited.empty() && limited.size() <= small.size,
+        "size is respected when segments don't fit");
+  check(distinct_kmers(limited, small.k), "no duplicate k-mers in limited");
+
+  sdch::DictBuilderParams threaded = params;
+  threaded.threads = 4;
+  check(sdch::build_dict_payload(samples, threaded) == payload,
+        "same payload on 4 threads");
+
+  // First pass in batches, second one in epochs, like sdch_dictgen.
+  sdch::DictBuilder builder(params);
+  sdch::DictSamples batch;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    batch.push_back(samples[i]);
+    if (batch.size() == 64 || i + 1 == samples.size()) {
+      builder.count(batch);
+      batch.clear();
+    }
+  }
+  check(builder.samples() == kSamples, "all samples counted");
+
+  sdch::DictSamples epoch;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < samples.size() && !builder.full(); ++i) {
+    epoch.push_back(samples[i]);
+    bytes += samples[i].size();
+    if (bytes >= builder.epoch_bytes() || i + 1 == samples.size()) {
+      builder.select(epoch);
+      epoch.clear();
+      bytes = 0;
+    }
+  }
+  check(builder.payload() == payload, "same payload with batches");
+  check(builder.segments() >= 3, "segment per frequent substring");
+
+  // Nothing repeats: nothing is worth taking. Pairs of colliding k-mers
+  // are likely even here, three of them aren't.
+  sdch::DictSamples noise;
+  for (size_t i = 0; i < 3; ++i)
+    noise.push_back(rnd.bytes(1000));
+  sdch::DictBuilderParams strict = params;
+  strict.min_freq = 3;
+  check(sdch::build_dict_payload(noise, strict).empty(),
+        "nothing from noise");
+
+  printf("%s: %d failures\n", failures ? "FAIL" : "ok", failures);
+  return failures ? 1 : 0;
+}
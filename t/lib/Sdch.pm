@@ -0,0 +1,271 @@
+package Sdch;
+
+# Decoders for response bodies in tests. Use them as response body filters
+# to compare decoded body with the original one, given as file or string:
+#
+#   use FindBin;
+#   use lib "$FindBin::Bin/lib";
+#   use Sdch;
+#   ...
+#   --- response_body_filters eval
+#   Sdch::check_body("$ENV{TEST_NGINX_SERVROOT}/html/sdch/foo.html",
+#                    "$ENV{TEST_NGINX_SERVROOT}/html/sdch/dict1.dict")
+#   --- response_body
+#   same
+#
+# Dictionaries are looked up by server id of response. Every argument is
+# one of:
+#   "path"            glob of sdch_dict files, read when response is decoded
+#   \"blob"           dictionary without headers (quasi-dictionary)
+#   ["path", "blob"]  composite of payload of the file and blob
+#
+# VCDIFF is decoded here, "sdch-zstd" and "dcz" need zstd command.
+
+use strict;
+use warnings;
+
+use Digest::SHA qw(sha256);
+use File::Temp qw(tempdir);
+use MIME::Base64 qw(encode_base64url);
+
+# Default code table of RFC 3284: [type, size, mode] pairs.
+# Types: 0 is NOOP, 1 is ADD, 2 is RUN, 3 is COPY.
+my @code_table;
+{
+    push @code_table, [[2, 0, 0], [0, 0, 0]];
+    push @code_table, [[1, $_, 0], [0, 0, 0]] for 0 .. 17;
+    for my $mode (0 .. 8) {
+        push @code_table, [[3, $_, $mode], [0, 0, 0]] for 0, 4 .. 18;
+    }
+    for my $mode (0 .. 5) {
+        for my $add (1 .. 4) {
+            push @code_table, [[1, $add, 0], [3, $_, $mode]] for 4 .. 6;
+        }
+    }
+    for my $mode (6 .. 8) {
+        push @code_table, [[1, $_, 0], [3, 4, $mode]] for 1 .. 4;
+    }
+    push @code_table, [[3, 4, $_], [1, 1, 0]] for 0 .. 8;
+    die "bad code table" unless @code_table == 256;
+}
+
+sub read_byte {
+    my $s = shift;
+    die "vcdiff: truncated\n" if $s->{p} >= length $s->{s};
+    return ord substr($s->{s}, $s->{p}++, 1);
+}
+
+sub read_varint {
+    my $s = shift;
+    my $v = 0;
+    for (;;) {
+        my $b = read_byte($s);
+        $v = ($v << 7) | ($b & 0x7f);
+        return $v unless $b & 0x80;
+    }
+}
+
+sub read_bytes {
+    my ($s, $len) = @_;
+    die "vcdiff: truncated\n" if $s->{p} + $len > length $s->{s};
+    my $res = substr($s->{s}, $s->{p}, $len);
+    $s->{p} += $len;
+    return $res;
+}
+
+# Decode VCDIFF delta against source. Both standard and interleaved
+# (open-vcdiff "S" version) formats.
+sub vcdiff_decode {
+    my ($source, $delta) = @_;
+
+    my $f = { s => $delta, p => 0 };
+    my $magic = read_bytes($f, 4);
+    die "vcdiff: bad magic\n" unless $magic =~ /^\xd6\xc3\xc4[\x00S]$/;
+    die "vcdiff: unsupported header\n" if read_byte($f) != 0;
+
+    my $target = '';
+    while ($f->{p} < length $delta) {
+        my $win = read_byte($f);
+        my ($src, $src_len) = ('', 0);
+        if ($win & 0x03) {
+            $src_len = read_varint($f);
+            my $src_pos = read_varint($f);
+            $src = substr($win & 0x01 ? $source : $target, $src_pos, $src_len);
+            die "vcdiff: bad source segment\n" if length $src != $src_len;
+        }
+
+        my $w = { s => read_bytes($f, read_varint($f)), p => 0 };
+        my $win_len = read_varint($w);
+        die "vcdiff: compressed sections\n" if read_byte($w) != 0;
+        my $data_len = read_varint($w);
+        my $inst_len = read_varint($w);
+        my $addr_len = read_varint($w);
+        read_varint($w) if $win & 0x04;  # Adler32 of open-vcdiff
+
+        my $data = { s => read_bytes($w, $data_len), p => 0 };
+        my $inst = { s => read_bytes($w, $inst_len), p => 0 };
+        my $addr = { s => read_bytes($w, $addr_len), p => 0 };
+        # Interleaved: everything is in instructions section.
+        if ($data_len == 0 && $addr_len == 0) {
+            $data = $addr = $inst;
+        }
+
+        my $out = '';
+        my @near = (0) x 4;
+        my $next_near = 0;
+        my @same = (0) x (3 * 256);
+        while ($inst->{p} < length $inst->{s}) {
+            for my $i (@{ $code_table[read_byte($inst)] }) {
+                my ($type, $size, $mode) = @$i;
+                next if $type == 0;
+                $size = read_varint($inst) if $size == 0;
+
+                if ($type == 1) {
+                    $out .= read_bytes($data, $size);
+                    next;
+                }
+                if ($type == 2) {
+                    $out .= chr(read_byte($data)) x $size;
+                    next;
+                }
+
+                my $here = $src_len + length $out;
+                my $a;
+                if ($mode == 0) {
+                    $a = read_varint($addr);
+                } elsif ($mode == 1) {
+                    $a = $here - read_varint($addr);
+                } elsif ($mode < 6) {
+                    $a = $near[$mode - 2] + read_varint($addr);
+                } else {
+                    $a = $same[($mode - 6) * 256 + read_byte($addr)];
+                }
+                $near[$next_near] = $a;
+                $next_near = ($next_near + 1) % 4;
+                $same[$a % (3 * 256)] = $a;
+                die "vcdiff: bad address\n" if $a >= $here;
+
+                for (; $size > 0 && $a < $src_len; ++$a, --$size) {
+                    $out .= substr($src, $a, 1);
+                }
+                # From target. Can overlap with what it produces.
+                while ($size > 0) {
+                    my $n = length($out) - ($a - $src_len);
+                    $n = $size if $n > $size;
+                    $out .= substr($out, $a - $src_len, $n);
+                    $a += $n;
+                    $size -= $n;
+                }
+            }
+        }
+
+        die "vcdiff: window size mismatch\n" if length $out != $win_len;
+        $target .= $out;
+    }
+
+    return $target;
+}
+
+sub read_file {
+    my $name = shift;
+    open my $fh, '<:raw', $name or die "$name: $!\n";
+    local $/;
+    return scalar <$fh>;
+}
+
+# Payload of sdch_dict file: everything after headers and empty line.
+sub payload {
+    my $blob = shift;
+    return substr($blob, 1) if $blob =~ /^\n/;
+    my $i = index($blob, "\n\n");
+    return $i < 0 ? '' : substr($blob, $i + 2);
+}
+
+# [client id, server id, SHA-256] of dictionary blob.
+sub ids {
+    my $sha = sha256(shift);
+    return (encode_base64url(substr($sha, 0, 6)),
+            encode_base64url(substr($sha, 6, 6)), $sha);
+}
+
+# All dictionaries as [blob, payload].
+sub dictionaries {
+    my @res;
+    for my $d (@_) {
+        if (ref $d eq 'SCALAR') {
+            push @res, [$$d, $$d];
+        } elsif (ref $d eq 'ARRAY') {
+            my ($file, @rest) = @$d;
+            my $blob = join '', payload(read_file($file)), @rest;
+            push @res, [$blob, $blob];
+        } else {
+            for my $file (glob $d) {
+                my $blob = read_file($file);
+                push @res, [$blob, payload($blob)];
+            }
+        }
+    }
+    return @res;
+}
+
+# Payload of dictionary with this server id (or SHA-256).
+sub find_payload {
+    my ($id, @dicts) = @_;
+    for my $d (dictionaries(@dicts)) {
+        my ($client, $server, $sha) = ids($d->[0]);
+        return $d->[1] if $id eq $server || $id eq $sha;
+    }
+    die "no dictionary " . ($id =~ /^[\w-]{8}$/ ? $id : unpack('H*', $id))
+        . "\n";
+}
+
+sub zstd_decode {
+    my ($payload, $frame) = @_;
+    my $dir = tempdir(CLEANUP => 1);
+    for (['dict', $payload], ['in.zst', $frame]) {
+        open my $fh, '>:raw', "$dir/$_->[0]" or die "$dir/$_->[0]: $!\n";
+        print $fh $_->[1];
+        close $fh;
+    }
+    system("zstd -q -d -f -D '$dir/dict' -o '$dir/out' '$dir/in.zst'") == 0
+        or die "zstd failed\n";
+    return read_file("$dir/out");
+}
+
+# Body filter decoding "sdch", "sdch-zstd" and "dcz" responses. Errors are
+# returned as body so test fails with them.
+sub decoder {
+    my @dicts = @_;
+    return sub {
+        my $body = shift;
+        my $res = eval {
+            if ($body =~ /^\x5e\x2a\x4d\x18\x20\x00\x00\x00/) {
+                return zstd_decode(find_payload(substr($body, 8, 32), @dicts),
+                                   substr($body, 40));
+            }
+            die "no server id\n" unless $body =~ /^([\w-]{8})\0/;
+            my $payload = find_payload($1, @dicts);
+            my $delta = substr($body, 9);
+            return zstd_decode($payload, $delta)
+                if $delta =~ /^\x28\xb5\x2f\xfd/;
+            return vcdiff_decode($payload, $delta);
+        };
+        return defined $res ? $res : "decoding failed: $@";
+    };
+}
+
+# Body filter returning "same\n" if decoded body is the original one.
+# Original is file name or reference to string.
+sub check_body {
+    my ($original, @dicts) = @_;
+    my $decode = decoder(@dicts);
+    return sub {
+        my $body = $decode->(shift);
+        my $expected = ref $original ? $$original : read_file($original);
+        return "same\n" if $body eq $expected;
+        return "differs: " . length($body) . " bytes instead of "
+            . length($expected) . ": " . substr($body, 0, 64) . "\n";
+    };
+}
+
+1;
@@ -0,0 +1,222 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+//
+// Differential test of VcdiffEngine and OptimalEngine against open-vcdiff:
+// everything encoded by them should decode with open-vcdiff's decoder to
+// the original. Also reports throughput and output size of all encoders.
+//
+// Doesn't need nginx:
+//
+//   g++ -O2 -I. -o vcdiff_engine_test t/vcdiff_engine_test.cc
+//       sdch_optimal_engine.cc sdch_vcdiff_engine.cc sdch_vcdiff_writer.cc
+//       -lvcddec -lvcdenc -lvcdcom -lz
+//   ./vcdiff_engine_test examples/fotki.yandex.ru [corpus files...]
+//
+// Dictionary file is expected in sdch_dict format (headers, empty line,
+// payload). Corpus files default to the dictionary itself.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <google/vcdecoder.h>
+#include <google/vcencoder.h>
+
+#include "sdch_optimal_engine.h"
+#include "sdch_vcdiff_engine.h"
+
+namespace {
+
+typedef open_vcdiff::OutputString<std::string> Output;
+
+int failures = 0;
+
+std::string read_file(const char* fn) {
+  std::ifstream in(fn, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+std::string encode_engine(const sdch::VcdiffIndex& index,
+                          const std::string& target,
+                          size_t chunk) {
+  std::string res;
+  Output out(&res);
+  sdch::VcdiffEngine engine;
+  engine.start(&index, &out);
+  for (size_t pos = 0; pos < target.size(); pos += chunk)
+    engine.encode_chunk(target.data() + pos,
+                        std::min(chunk, target.size() - pos), &out);
+  engine.finish(&out);
+  return res;
+}
+
+std::string encode_optimal(const std::string& dict,
+                           const std::string& target,
+                           size_t chunk) {
+  std::string res;
+  Output out(&res);
+  sdch::OptimalEngine engine;
+  engine.start(dict.data(), dict.size(), &out);
+  for (size_t pos = 0; pos < target.size(); pos += chunk)
+    engine.encode_chunk(target.data() + pos,
+                        std::min(chunk, target.size() - pos), &out);
+  engine.finish(&out);
+  return res;
+}
+
+std::string encode_open_vcdiff(const open_vcdiff::HashedDictionary& dict,
+                               const std::string& target,
+                               size_t chunk) {
+  std::string res;
+  open_vcdiff::VCDiffStreamingEncoder enc(
+      &dict,
+      open_vcdiff::VCD_FORMAT_INTERLEAVED | open_vcdiff::VCD_FORMAT_CHECKSUM,
+      false);
+  enc.StartEncoding(&res);
+  for (size_t pos = 0; pos < target.size(); pos += chunk)
+    enc.EncodeChunk(target.data() + pos,
+                    std::min(chunk, target.size() - pos), &res);
+  enc.FinishEncoding(&res);
+  return res;
+}
+
+void check(const std::string& dict,
+           const char* engine,
+           const std::string& encoded,
+           const std::string& name,
+           const std::string& target,
+           size_t chunk) {
+  std::string decoded;
+  open_vcdiff::VCDiffDecoder decoder;
+  bool ok = decoder.Decode(dict.data(), dict.size(), encoded, &decoded) &&
+            decoded == target;
+  if (!ok)
+    ++failures;
+  printf("%s %s %s chunk %zu: %zu -> %zu\n",
+         ok ? "ok" : "FAIL", engine, name.c_str(), chunk, target.size(),
+         encoded.size());
+}
+
+// Random splices of dictionary with some noise. Looks like pages
+// generated from the same templates.
+std::string mutate(const std::string& dict, size_t len, unsigned seed) {
+  srandom(seed);
+  std::string res;
+  while (res.size() < len && !dict.empty()) {
+    size_t pos = random() % dict.size();
+    res.append(dict, pos, 20 + random() % 400);
+    for (size_t n = random() % 40; n > 0; --n)
+      res.push_back("abcdefgh <>/=\"\n"[random() % 15]);
+  }
+  return res;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <dictionary> [corpus files...]\n", argv[0]);
+    return 2;
+  }
+
+  std::string file = read_file(argv[1]);
+  size_t header_end = file.find("\n\n");
+  std::string dict =
+      header_end == std::string::npos ? file : file.substr(header_end + 2);
+
+  sdch::VcdiffIndex index(dict.data(), dict.size());
+  open_vcdiff::HashedDictionary hashed(dict.data(), dict.size());
+  hashed.Init();
+
+  std::vector<std::pair<std::string, std::string> > corpus;
+  corpus.push_back(std::make_pair(std::string("empty"), std::string()));
+  corpus.push_back(std::make_pair(std::string("tiny"), std::string("<a>")));
+  corpus.push_back(std::make_pair(std::string("dict"), dict));
+  corpus.push_back(std::make_pair(std::string("mutated"),
+                                  mutate(dict, 1 << 20, 1)));
+  for (int i = 2; i < argc; ++i)
+    corpus.push_back(std::make_pair(std::string(argv[i]),
+                                    read_file(argv[i])));
+
+  static const size_t chunks[] = { 1, 7, 4096, 65536, size_t(1) << 30 };
+  for (size_t c = 0; c < corpus.size(); ++c) {
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+      // Byte-sized chunks are way too slow on big inputs.
+      if (chunks[i] < 64 && corpus[c].second.size() > 65536)
+        continue;
+      const std::string& target = corpus[c].second;
+      check(dict, "simd", encode_engine(index, target, chunks[i]),
+            corpus[c].first, target, chunks[i]);
+      check(dict, "optimal", encode_optimal(dict, target, chunks[i]),
+            corpus[c].first, target, chunks[i]);
+    }
+  }
+
+  // Throughput on 4k chunks, typical for proxied responses.
+  size_t total = 0;
+  size_t engine_out = 0;
+  size_t vcdiff_out = 0;
+  double engine_time = 0;
+  double vcdiff_time = 0;
+  for (int round = 0; round < 10; ++round) {
+    for (size_t c = 0; c < corpus.size(); ++c) {
+      const std::string& target = corpus[c].second;
+      total += target.size();
+
+      double start = now();
+      engine_out += encode_engine(index, target, 4096).size();
+      engine_time += now() - start;
+
+      start = now();
+      vcdiff_out += encode_open_vcdiff(hashed, target, 4096).size();
+      vcdiff_time += now() - start;
+    }
+  }
+
+  printf("VcdiffEngine: %.1f MB/s, %zu bytes\n",
+         total / engine_time / 1e6, engine_out);
+  printf("open-vcdiff:  %.1f MB/s, %zu bytes\n",
+         total / vcdiff_time / 1e6, vcdiff_out);
+
+  // OptimalEngine is too slow for rounds. Whole responses, as encoded
+  // offline.
+  total = 0;
+  size_t optimal_out = 0;
+  vcdiff_out = 0;
+  double optimal_time = 0;
+  vcdiff_time = 0;
+  for (size_t c = 0; c < corpus.size(); ++c) {
+    const std::string& target = corpus[c].second;
+    total += target.size();
+
+    double start = now();
+    optimal_out += encode_optimal(dict, target, target.size() + 1).size();
+    optimal_time += now() - start;
+
+    start = now();
+    vcdiff_out += encode_open_vcdiff(hashed, target, target.size() + 1).size();
+    vcdiff_time += now() - start;
+  }
+
+  printf("OptimalEngine: %.2f MB/s, ratio %.2f, %zu bytes\n",
+         total / optimal_time / 1e6, double(total) / optimal_out,
+         optimal_out);
+  printf("open-vcdiff:   %.2f MB/s, ratio %.2f, %zu bytes\n",
+         total / vcdiff_time / 1e6, double(total) / vcdiff_out, vcdiff_out);
+
+  return failures ? 1 : 0;
+}
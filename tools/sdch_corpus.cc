@@ -0,0 +1,177 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+//
+// Reads corpus written by "sdch_dumpdir" (see sdch_corpus.h).
+//
+//   sdch_corpus [-g GROUP] [-t TYPE] [-u URI] COMMAND PATH...
+//
+// PATH is corpus directory or segment. Commands:
+//
+//   list   one line per response: time, URI hash, group, content type and
+//          size
+//   cat    bodies of responses one after another
+//   stats  responses and bytes by group and content type
+//   index  entries of segment indexes without reading segments: segment,
+//          offset, size, time, URI hash and body size
+//
+// -g, -t and -u select responses of group, content type or request URI
+// (with arguments, as client sent it). Index has no group and type.
+//
+//   g++ -O2 -I. -o sdch_corpus tools/sdch_corpus.cc sdch_corpus.cc -lz
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sdch_corpus.h"
+
+namespace {
+
+struct Filter {
+  Filter() : has_uri(false), uri_hash(0) {}
+
+  bool match(const sdch::CorpusRecord& rec) const {
+    return (group.empty() || rec.group == group) &&
+           (type.empty() || rec.content_type == type) &&
+           (!has_uri || rec.uri_hash == uri_hash);
+  }
+
+  std::string group;
+  std::string type;
+  bool has_uri;
+  uint64_t uri_hash;
+};
+
+struct Totals {
+  Totals() : count(0), bytes(0) {}
+  uint64_t count;
+  uint64_t bytes;
+};
+
+void usage() {
+  fprintf(stderr,
+          "usage: sdch_corpus [-g GROUP] [-t TYPE] [-u URI] "
+          "list|cat|stats|index PATH...\n");
+  exit(2);
+}
+
+void print_record(const sdch::CorpusRecord& rec) {
+  printf("%" PRIu64 ".%03u %016" PRIx64 " %s %s %zu\n",
+         rec.timestamp / 1000, unsigned(rec.timestamp % 1000), rec.uri_hash,
+         rec.group.c_str(),
+         rec.content_type.empty() ? "-" : rec.content_type.c_str(),
+         rec.body.size());
+}
+
+int print_index(const Filter& filter, const sdch::CorpusReader& reader) {
+  const std::vector<std::string>& segments = reader.segments();
+  std::vector<sdch::CorpusIndexEntry> entries;
+  int rc = 0;
+
+  for (size_t s = 0; s < segments.size(); ++s) {
+    entries.clear();
+    if (!sdch::read_corpus_index(segments[s], &entries)) {
+      fprintf(stderr, "sdch_corpus: no index for %s\n", segments[s].c_str());
+      rc = 1;
+      continue;
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const sdch::CorpusIndexEntry& e = entries[i];
+      if (filter.has_uri && e.uri_hash != filter.uri_hash)
+        continue;
+      printf("%s %" PRIu64 " %u %" PRIu64 ".%03u %016" PRIx64 " %u\n",
+             segments[s].c_str(), e.offset, e.size, e.timestamp / 1000,
+             unsigned(e.timestamp % 1000), e.uri_hash, e.body_size);
+    }
+  }
+  return rc;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Filter filter;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "g:t:u:")) != -1) {
+    switch (opt) {
+      case 'g':
+        filter.group = optarg;
+        break;
+      case 't':
+        filter.type = optarg;
+        break;
+      case 'u':
+        filter.has_uri = true;
+        filter.uri_hash = sdch::corpus_uri_hash(optarg, strlen(optarg));
+        break;
+      default:
+        usage();
+    }
+  }
+  if (argc - optind < 2)
+    usage();
+
+  std::string cmd(argv[optind]);
+  char** paths = argv + optind + 1;
+  int npaths = argc - optind - 1;
+
+  if (cmd != "list" && cmd != "cat" && cmd != "stats" && cmd != "index")
+    usage();
+
+  sdch::CorpusReader reader;
+  for (int i = 0; i < npaths; ++i) {
+    if (!reader.add(paths[i])) {
+      fprintf(stderr, "sdch_corpus: %s\n", reader.error().c_str());
+      return 1;
+    }
+  }
+
+  if (cmd == "index")
+    return print_index(filter, reader);
+
+  typedef std::map<std::pair<std::string, std::string>, Totals> StatsMap;
+  StatsMap stats;
+  Totals total;
+
+  sdch::CorpusRecord rec;
+  while (reader.next(&rec)) {
+    if (!filter.match(rec))
+      continue;
+
+    if (cmd == "list") {
+      print_record(rec);
+    } else if (cmd == "cat") {
+      fwrite(rec.body.data(), 1, rec.body.size(), stdout);
+    } else {
+      Totals& t = stats[std::make_pair(rec.group, rec.content_type)];
+      t.count++;
+      t.bytes += rec.body.size();
+      total.count++;
+      total.bytes += rec.body.size();
+    }
+  }
+
+  if (cmd == "stats") {
+    for (StatsMap::iterator i = stats.begin(); i != stats.end(); ++i) {
+      printf("%s %s %" PRIu64 " %" PRIu64 "\n", i->first.first.c_str(),
+             i->first.second.empty() ? "-" : i->first.second.c_str(),
+             i->second.count, i->second.bytes);
+    }
+    printf("total %" PRIu64 " %" PRIu64 "\n", total.count, total.bytes);
+  }
+
+  if (!reader.error().empty()) {
+    fprintf(stderr, "sdch_corpus: %s\n", reader.error().c_str());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,207 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+//
+// Builds dictionary for "sdch_dict" from corpus written by "sdch_dumpdir"
+// (see sdch_corpus.h).
+//
+//   sdch_dictgen [-g GROUP] [-t TYPE] [-s SIZE] [-k K] [-l LENGTH]
+//                [-f MINFREQ] [-j THREADS] [-d DOMAIN] [-p PATH]
+//                -o OUT CORPUS...
+//
+// Uses DictBuilder (see sdch_dict_builder.h). Corpus is read twice and
+// only one epoch is kept in memory, so it can be much bigger than RAM.
+// OUT is written with "domain" and "path" headers, if given.
+//
+// Defaults: -s 128k -k 8 -l 1024 -f 2 -j <cpus>.
+//
+//   g++ -O2 -I. -o sdch_dictgen tools/sdch_dictgen.cc sdch_corpus.cc
+//       sdch_dict_builder.cc -lz -lpthread
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "sdch_corpus.h"
+#include "sdch_dict_builder.h"
+
+namespace {
+
+// Responses read per batch of the first pass.
+const size_t kBatchBytes = 256 * 1024 * 1024;
+
+struct Options {
+  std::string group;
+  std::string type;
+  sdch::DictBuilderParams params;
+  std::string domain;
+  std::string path;
+  std::string out;
+};
+
+// Responses of corpus matching options.
+class Source {
+ public:
+  Source(const std::vector<std::string>& segments, const Options& opt)
+      : opt_(opt) {
+    for (size_t i = 0; i < segments.size(); ++i)
+      reader_.add(segments[i]);
+  }
+
+  // Read responses until batch has at least bytes. Returns false if there
+  // is nothing more.
+  bool read(sdch::DictSamples* batch, uint64_t bytes) {
+    batch->clear();
+    uint64_t total = 0;
+    sdch::CorpusRecord rec;
+    while (total < bytes && reader_.next(&rec)) {
+      if ((!opt_.group.empty() && rec.group != opt_.group) ||
+          (!opt_.type.empty() && rec.content_type != opt_.type) ||
+          rec.body.size() < sizeof(uint64_t))
+        continue;
+      total += rec.body.size();
+      batch->push_back(std::string());
+      batch->back().swap(rec.body);
+    }
+    return !batch->empty();
+  }
+
+  const std::string& error() const { return reader_.error(); }
+
+ private:
+  const Options& opt_;
+  sdch::CorpusReader reader_;
+};
+
+bool parse_size(const char* s, size_t* res) {
+  char* end;
+  unsigned long long v = strtoull(s, &end, 10);
+  if (end == s)
+    return false;
+  switch (*end) {
+    case 'k': case 'K': v <<= 10; ++end; break;
+    case 'm': case 'M': v <<= 20; ++end; break;
+  }
+  if (*end != '\0' || v == 0)
+    return false;
+  *res = v;
+  return true;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: sdch_dictgen [-g GROUP] [-t TYPE] [-s SIZE] [-k K] "
+          "[-l LENGTH]\n"
+          "                    [-f MINFREQ] [-j THREADS] [-d DOMAIN] "
+          "[-p PATH]\n"
+          "                    -o OUT CORPUS...\n");
+  exit(2);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  sdch::DictBuilderParams& params = opt.params;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  params.threads = cpus > 0 ? cpus : 1;
+
+  int c;
+  size_t n;
+  while ((c = getopt(argc, argv, "g:t:s:k:l:f:j:d:p:o:")) != -1) {
+    switch (c) {
+      case 'g': opt.group = optarg; break;
+      case 't': opt.type = optarg; break;
+      case 'd': opt.domain = optarg; break;
+      case 'p': opt.path = optarg; break;
+      case 'o': opt.out = optarg; break;
+      case 's':
+        if (!parse_size(optarg, &params.size))
+          usage();
+        break;
+      case 'l':
+        if (!parse_size(optarg, &params.length))
+          usage();
+        break;
+      case 'k':
+        if (!parse_size(optarg, &params.k) || params.k < 4 || params.k > 8)
+          usage();
+        break;
+      case 'f':
+        if (!parse_size(optarg, &n))
+          usage();
+        params.min_freq = n;
+        break;
+      case 'j':
+        if (!parse_size(optarg, &params.threads))
+          usage();
+        break;
+      default:
+        usage();
+    }
+  }
+  if (opt.out.empty() || optind == argc || params.length < params.k)
+    usage();
+
+  // The same segments for both passes even if workers add new ones.
+  sdch::CorpusReader corpus;
+  for (int i = optind; i < argc; ++i) {
+    if (!corpus.add(argv[i])) {
+      fprintf(stderr, "sdch_dictgen: %s\n", corpus.error().c_str());
+      return 1;
+    }
+  }
+
+  sdch::DictBuilder builder(params);
+  {
+    Source src(corpus.segments(), opt);
+    sdch::DictSamples batch;
+    while (src.read(&batch, kBatchBytes))
+      builder.count(batch);
+    if (!src.error().empty()) {
+      fprintf(stderr, "sdch_dictgen: %s\n", src.error().c_str());
+      return 1;
+    }
+  }
+  if (builder.samples() == 0) {
+    fprintf(stderr, "sdch_dictgen: no responses in corpus\n");
+    return 1;
+  }
+  fprintf(stderr, "sdch_dictgen: %zu responses, %" PRIu64 " bytes\n",
+          builder.samples(), builder.bytes());
+
+  {
+    Source src(corpus.segments(), opt);
+    sdch::DictSamples epoch;
+    while (!builder.full() && src.read(&epoch, builder.epoch_bytes()))
+      builder.select(epoch);
+    if (!src.error().empty()) {
+      fprintf(stderr, "sdch_dictgen: %s\n", src.error().c_str());
+      return 1;
+    }
+  }
+
+  std::string payload = builder.payload();
+  std::string dict;
+  if (!opt.domain.empty())
+    dict += "domain: " + opt.domain + "\n";
+  if (!opt.path.empty())
+    dict += "path: " + opt.path + "\n";
+  dict += "\n";
+  dict += payload;
+
+  FILE* f = fopen(opt.out.c_str(), "wb");
+  if (f == NULL || fwrite(dict.data(), 1, dict.size(), f) != dict.size() ||
+      fclose(f) != 0) {
+    fprintf(stderr, "sdch_dictgen: can't write %s\n", opt.out.c_str());
+    return 1;
+  }
+
+  fprintf(stderr, "sdch_dictgen: %s: %zu segments, %zu bytes\n",
+          opt.out.c_str(), builder.segments(), payload.size());
+  return 0;
+}
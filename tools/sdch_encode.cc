@@ -0,0 +1,112 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+//
+// Build time encoder for "sdch_static". For every FILE writes
+// FILE.<server_id>.sdch next to it: server_id, '\0' and VCDIFF of FILE
+// against dictionary. Exactly what module sends for Content-Encoding: sdch.
+//
+//   sdch_encode [-e vcdiff|simd|optimal] DICTIONARY FILE...
+//
+// Default encoder is "optimal": it's slow, but it doesn't matter at build
+// time. Uses the same Dictionary and engines as the module, so it needs
+// headers of configured nginx tree but doesn't link with it:
+//
+//   g++ -O2 -I. -I$NGX/objs -I$NGX/src/core -I$NGX/src/event
+//       -I$NGX/src/event/modules -I$NGX/src/os/unix -I$NGX/src/http
+//       -I$NGX/src/http/modules -o sdch_encode tools/sdch_encode.cc
+//       sdch_dictionary.cc sdch_offline.cc sdch_optimal_engine.cc
+//       sdch_vcdiff_engine.cc sdch_vcdiff_writer.cc -lvcdenc -lvcdcom
+//       -lcrypto -lz
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <google/vcencoder.h>
+
+#include "sdch_dictionary.h"
+#include "sdch_offline.h"
+
+namespace {
+
+typedef open_vcdiff::OutputString<std::string> Output;
+
+bool read_file(const char* fn, std::string* res) {
+  std::ifstream in(fn, std::ios::binary);
+  if (!in)
+    return false;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  *res = ss.str();
+  return true;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: sdch_encode [-e vcdiff|simd|optimal] DICTIONARY FILE...\n");
+  exit(2);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  sdch::EncoderType encoder = sdch::ENCODER_OPTIMAL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "e:")) != -1) {
+    if (opt != 'e')
+      usage();
+    if (strcmp(optarg, "vcdiff") == 0)
+      encoder = sdch::ENCODER_VCDIFF;
+    else if (strcmp(optarg, "simd") == 0)
+      encoder = sdch::ENCODER_SIMD;
+    else if (strcmp(optarg, "optimal") == 0)
+      encoder = sdch::ENCODER_OPTIMAL;
+    else
+      usage();
+  }
+  if (argc - optind < 2)
+    usage();
+
+  sdch::Dictionary dict;
+  if (!dict.load(argv[optind])) {
+    fprintf(stderr, "sdch_encode: can't load dictionary %s\n", argv[optind]);
+    return 1;
+  }
+  std::string server_id(reinterpret_cast<const char*>(dict.server_id().data()),
+                        dict.server_id().size());
+
+  int rc = 0;
+  for (int i = optind + 1; i < argc; ++i) {
+    std::string src;
+    if (!read_file(argv[i], &src)) {
+      fprintf(stderr, "sdch_encode: can't read %s\n", argv[i]);
+      rc = 1;
+      continue;
+    }
+
+    std::string res = server_id;
+    res.push_back('\0');
+    Output out(&res);
+    if (!sdch::encode_buffer(encoder, &dict, src.data(), src.size(), &out)) {
+      fprintf(stderr, "sdch_encode: can't encode %s\n", argv[i]);
+      rc = 1;
+      continue;
+    }
+
+    std::string fn = std::string(argv[i]) + "." + server_id + ".sdch";
+    if (!sdch::write_file(fn, res)) {
+      fprintf(stderr, "sdch_encode: can't write %s\n", fn.c_str());
+      rc = 1;
+      continue;
+    }
+    printf("%s: %zu -> %zu\n", fn.c_str(), src.size(), res.size());
+  }
+
+  return rc;
+}
@@ -0,0 +1,559 @@
+// Copyright (c) 2015 Yandex LLC. All rights reserved.
+// Author: Vasily Chekalkin <bacek@yandex-team.ru>
+//
+// Replays corpus written by "sdch_dumpdir" (see sdch_corpus.h) against
+// candidate dictionaries, to decide whether one is worth deploying.
+//
+//   sdch_eval [-e vcdiff|simd|optimal] [-g GROUP] [-t TYPE] [-n COUNT]
+//             [-j THREADS] -c CORPUS [-c CORPUS...] DICTIONARY...
+//
+// Every response is encoded with every DICTIONARY exactly as the module
+// sends it for Content-Encoding: sdch: server_id, '\0' and VCDIFF. For
+// every dictionary and every content type prints:
+//
+//   - ratio: bytes in / bytes out, as $sdch_ratio, over all responses, and
+//     its 10th, 50th and 90th percentiles over single responses;
+//   - copy: share of response bytes produced by COPY instructions, and
+//     dict: share copied from dictionary (the rest is copied from response
+//     itself);
+//   - MB/s: encoding speed, CPU time of encoding threads only.
+//
+// Size and estimated memory of encoder hash tables ("index", the
+// same as in sdch_fastdict_status) are printed for every dictionary.
+// Responses are split between threads and the corpus is read in batches,
+// so it can be bigger than RAM. -n stops after COUNT responses.
+//
+// Default encoder is "vcdiff", the module default. Uses the same
+// Dictionary and engines as the module, with the same settings as
+// EncoderPool, so it needs headers of configured nginx tree but doesn't
+// link with it:
+//
+//   g++ -O2 -I. -I$NGX/objs -I$NGX/src/core -I$NGX/src/event
+//       -I$NGX/src/event/modules -I$NGX/src/os/unix -I$NGX/src/http
+//       -I$NGX/src/http/modules -o sdch_eval tools/sdch_eval.cc
+//       sdch_corpus.cc sdch_dictionary.cc sdch_offline.cc
+//       sdch_optimal_engine.cc sdch_vcdiff_engine.cc sdch_vcdiff_writer.cc
+//       -lvcdenc -lvcdcom -lcrypto -lz -lpthread
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <google/vcencoder.h>
+
+#include "sdch_corpus.h"
+#include "sdch_dictionary.h"
+#include "sdch_offline.h"
+
+namespace {
+
+typedef open_vcdiff::OutputString<std::string> Output;
+
+// Responses read per batch.
+const size_t kBatchBytes = 64 * 1024 * 1024;
+
+// RFC 3284 default code table, 5.6.
+enum { INST_NOOP, INST_ADD, INST_RUN, INST_COPY };
+
+struct Code {
+  uint8_t inst[2];
+  uint8_t size[2];
+  uint8_t mode[2];
+};
+
+class CodeTable {
+ public:
+  CodeTable() {
+    memset(codes_, 0, sizeof(codes_));
+    size_t i = 0;
+    set(i++, INST_RUN, 0, 0);
+    for (size_t size = 0; size <= 17; ++size)
+      set(i++, INST_ADD, size, 0);
+    for (size_t mode = 0; mode <= 8; ++mode) {
+      set(i++, INST_COPY, 0, mode);
+      for (size_t size = 4; size <= 18; ++size)
+        set(i++, INST_COPY, size, mode);
+    }
+    for (size_t mode = 0; mode <= 5; ++mode) {
+      for (size_t add = 1; add <= 4; ++add) {
+        for (size_t copy = 4; copy <= 6; ++copy) {
+          set(i, INST_ADD, add, 0);
+          set2(i++, INST_COPY, copy, mode);
+        }
+      }
+    }
+    for (size_t mode = 6; mode <= 8; ++mode) {
+      for (size_t add = 1; add <= 4; ++add) {
+        set(i, INST_ADD, add, 0);
+        set2(i++, INST_COPY, 4, mode);
+      }
+    }
+    for (size_t mode = 0; mode <= 8; ++mode) {
+      set(i, INST_COPY, 4, mode);
+      set2(i++, INST_ADD, 1, 0);
+    }
+  }
+
+  const Code& operator[](uint8_t opcode) const { return codes_[opcode]; }
+
+ private:
+  void set(size_t i, uint8_t inst, size_t size, size_t mode) {
+    codes_[i].inst[0] = inst;
+    codes_[i].size[0] = size;
+    codes_[i].mode[0] = mode;
+  }
+  void set2(size_t i, uint8_t inst, size_t size, size_t mode) {
+    codes_[i].inst[1] = inst;
+    codes_[i].size[1] = size;
+    codes_[i].mode[1] = mode;
+  }
+
+  Code codes_[256];
+};
+
+const CodeTable kCodeTable;
+
+struct Cursor {
+  Cursor(const uint8_t* b, const uint8_t* e) : p(b), end(e) {}
+
+  bool byte(uint8_t* v) {
+    if (p == end)
+      return false;
+    *v = *p++;
+    return true;
+  }
+
+  bool varint(uint64_t* v) {
+    *v = 0;
+    for (size_t i = 0; i < 10 && p != end; ++i) {
+      uint8_t b = *p++;
+      *v = (*v << 7) | (b & 0x7f);
+      if ((b & 0x80) == 0)
+        return true;
+    }
+    return false;
+  }
+
+  bool skip(uint64_t n) {
+    if (uint64_t(end - p) < n)
+      return false;
+    p += n;
+    return true;
+  }
+
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+// Target bytes produced by COPY instructions of delta, and the part of
+// them copied from dictionary. Only default code table and address caches
+// are supported, which is what all engines write.
+bool scan_copies(const std::string& delta, uint64_t* copied,
+                 uint64_t* from_dict) {
+  const size_t kNear = 4;
+  const size_t kSame = 3;
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(delta.data());
+  Cursor file(begin, begin + delta.size());
+
+  uint8_t hdr;
+  if (!file.skip(4) || !file.byte(&hdr) || (hdr & 0x02) != 0)
+    return false;
+  if ((hdr & 0x01) != 0 && !file.skip(1))
+    return false;
+
+  while (file.p != file.end) {
+    uint8_t win;
+    uint64_t source_size = 0, pos, delta_len;
+    if (!file.byte(&win))
+      return false;
+    if ((win & 0x03) != 0 &&
+        (!file.varint(&source_size) || !file.varint(&pos)))
+      return false;
+    if (!file.varint(&delta_len) || uint64_t(file.end - file.p) < delta_len)
+      return false;
+
+    Cursor w(file.p, file.p + delta_len);
+    file.p += delta_len;
+
+    uint64_t target_len, data_len, inst_len, addr_len, checksum;
+    uint8_t delta_ind;
+    if (!w.varint(&target_len) || !w.byte(&delta_ind) ||
+        !w.varint(&data_len) || !w.varint(&inst_len) ||
+        !w.varint(&addr_len) ||
+        ((win & 0x04) != 0 && !w.varint(&checksum)) ||
+        uint64_t(w.end - w.p) != data_len + inst_len + addr_len)
+      return false;
+
+    // Interleaved format has data and addresses in instructions section.
+    Cursor data(w.p, w.p + data_len);
+    Cursor inst(data.end, data.end + inst_len);
+    Cursor addrs(inst.end, inst.end + addr_len);
+    Cursor* data_src = data_len == 0 ? &inst : &data;
+    Cursor* addr_src = addr_len == 0 ? &inst : &addrs;
+
+    uint64_t near[kNear] = {0};
+    uint64_t same[kSame * 256] = {0};
+    size_t next_near = 0;
+    uint64_t here = 0;
+
+    while (inst.p != inst.end) {
+      uint8_t opcode;
+      if (!inst.byte(&opcode))
+        return false;
+      const Code& code = kCodeTable[opcode];
+      for (size_t h = 0; h < 2; ++h) {
+        if (code.inst[h] == INST_NOOP)
+          continue;
+        uint64_t size = code.size[h];
+        if (size == 0 && !inst.varint(&size))
+          return false;
+
+        if (code.inst[h] == INST_ADD) {
+          if (!data_src->skip(size))
+            return false;
+        } else if (code.inst[h] == INST_RUN) {
+          if (!data_src->skip(1))
+            return false;
+        } else {
+          // RFC 3284 5.3
+          uint64_t cur = source_size + here;
+          uint64_t addr;
+          unsigned mode = code.mode[h];
+          if (mode >= 2 + kNear) {
+            uint8_t b;
+            if (!addr_src->byte(&b))
+              return false;
+            addr = same[(mode - 2 - kNear) * 256 + b];
+          } else {
+            uint64_t v;
+            if (!addr_src->varint(&v))
+              return false;
+            if (mode == 0)
+              addr = v;
+            else if (mode == 1)
+              addr = cur - v;
+            else
+              addr = near[mode - 2] + v;
+          }
+          near[next_near] = addr;
+          next_near = (next_near + 1) % kNear;
+          same[addr % (kSame * 256)] = addr;
+
+          *copied += size;
+          if (addr < source_size)
+            *from_dict += std::min(size, source_size - addr);
+        }
+        here += size;
+      }
+    }
+    if (here != target_len)
+      return false;
+  }
+  return true;
+}
+
+uint64_t thread_cpu_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Results of one dictionary over some responses.
+struct Acc {
+  Acc()
+      : responses(0), errors(0), in(0), out(0), copied(0), from_dict(0),
+        ns(0) {}
+
+  void add(const Acc& o) {
+    responses += o.responses;
+    errors += o.errors;
+    in += o.in;
+    out += o.out;
+    copied += o.copied;
+    from_dict += o.from_dict;
+    ns += o.ns;
+    ratios.insert(ratios.end(), o.ratios.begin(), o.ratios.end());
+  }
+
+  uint64_t responses;
+  uint64_t errors;
+  uint64_t in;
+  uint64_t out;
+  uint64_t copied;
+  uint64_t from_dict;
+  uint64_t ns;
+  // Of every response.
+  std::vector<float> ratios;
+};
+
+typedef std::map<std::string, Acc> TypeMap;
+
+struct Sample {
+  std::string content_type;
+  std::string body;
+};
+
+struct Options {
+  Options() : encoder(sdch::ENCODER_VCDIFF), limit(0), threads(1) {}
+
+  sdch::EncoderType encoder;
+  std::string group;
+  std::string type;
+  uint64_t limit;
+  size_t threads;
+  std::vector<std::string> corpus;
+};
+
+// Shared by threads encoding one batch. Thread t takes every threads-th
+// response and accumulates into its own slot.
+struct Replay {
+  Replay(const Options& o, const std::vector<sdch::Dictionary*>& d)
+      : opt(o), dicts(d), batch(NULL),
+        results(o.threads, std::vector<TypeMap>(d.size())) {}
+
+  const Options& opt;
+  const std::vector<sdch::Dictionary*>& dicts;
+  const std::vector<Sample>* batch;
+  // [thread][dictionary]
+  std::vector<std::vector<TypeMap> > results;
+};
+
+struct Worker {
+  Replay* replay;
+  size_t thread;
+};
+
+void* run(void* data) {
+  Worker* w = static_cast<Worker*>(data);
+  Replay& r = *w->replay;
+  std::string delta;
+
+  for (size_t i = w->thread; i < r.batch->size(); i += r.opt.threads) {
+    const Sample& s = (*r.batch)[i];
+    for (size_t d = 0; d < r.dicts.size(); ++d) {
+      Acc& acc = r.results[w->thread][d][s.content_type];
+      sdch::Dictionary* dict = r.dicts[d];
+
+      delta.clear();
+      Output out(&delta);
+      uint64_t start = thread_cpu_ns();
+      bool ok = sdch::encode_buffer(r.opt.encoder, dict, s.body.data(),
+                                    s.body.size(), &out);
+      acc.ns += thread_cpu_ns() - start;
+
+      uint64_t copied = 0, from_dict = 0;
+      if (!ok || !scan_copies(delta, &copied, &from_dict)) {
+        ++acc.errors;
+        continue;
+      }
+      // What is sent: server_id, '\0' and VCDIFF.
+      uint64_t sent = dict->server_id().size() + 1 + delta.size();
+      ++acc.responses;
+      acc.in += s.body.size();
+      acc.out += sent;
+      acc.copied += copied;
+      acc.from_dict += from_dict;
+      acc.ratios.push_back(float(s.body.size()) / sent);
+    }
+  }
+  return NULL;
+}
+
+void replay_batch(Replay* r, const std::vector<Sample>& batch) {
+  r->batch = &batch;
+  std::vector<Worker> workers(r->opt.threads);
+  std::vector<pthread_t> tids(r->opt.threads);
+  std::vector<bool> started(r->opt.threads);
+  for (size_t t = 0; t < workers.size(); ++t) {
+    workers[t].replay = r;
+    workers[t].thread = t;
+    started[t] = workers.size() > 1 &&
+                 pthread_create(&tids[t], NULL, run, &workers[t]) == 0;
+  }
+  for (size_t t = 0; t < workers.size(); ++t) {
+    if (started[t])
+      pthread_join(tids[t], NULL);
+    else
+      run(&workers[t]);
+  }
+  r->batch = NULL;
+}
+
+// Reads responses matching options. Returns false if there is nothing more.
+bool read_batch(sdch::CorpusReader* reader, const Options& opt,
+                uint64_t* seen, std::vector<Sample>* batch) {
+  batch->clear();
+  uint64_t total = 0;
+  sdch::CorpusRecord rec;
+  while (total < kBatchBytes && (opt.limit == 0 || *seen < opt.limit) &&
+         reader->next(&rec)) {
+    if ((!opt.group.empty() && rec.group != opt.group) ||
+        (!opt.type.empty() && rec.content_type != opt.type) ||
+        rec.body.empty())
+      continue;
+    ++*seen;
+    total += rec.body.size();
+    batch->push_back(Sample());
+    batch->back().content_type.swap(rec.content_type);
+    batch->back().body.swap(rec.body);
+  }
+  return !batch->empty();
+}
+
+double percentile(const std::vector<float>& sorted, double q) {
+  if (sorted.empty())
+    return 0;
+  return sorted[size_t(q * (sorted.size() - 1))];
+}
+
+double share(uint64_t part, uint64_t whole) {
+  return whole == 0 ? 0 : 100.0 * part / whole;
+}
+
+void print_row(const std::string& name, Acc* acc) {
+  std::sort(acc->ratios.begin(), acc->ratios.end());
+  double secs = acc->ns / 1e9;
+  printf("  %-30s %9" PRIu64 " %12" PRIu64 " %12" PRIu64
+         " %6.2f %6.2f %6.2f %6.2f %6.1f %6.1f %8.1f\n",
+         name.c_str(), acc->responses, acc->in, acc->out,
+         acc->out == 0 ? 0 : double(acc->in) / acc->out,
+         percentile(acc->ratios, 0.1), percentile(acc->ratios, 0.5),
+         percentile(acc->ratios, 0.9), share(acc->copied, acc->in),
+         share(acc->from_dict, acc->in),
+         secs == 0 ? 0 : acc->in / secs / (1024 * 1024));
+  if (acc->errors > 0)
+    printf("  %-30s %9" PRIu64 " failed to encode\n", "", acc->errors);
+}
+
+bool parse_number(const char* s, uint64_t* res) {
+  char* end;
+  unsigned long long v = strtoull(s, &end, 10);
+  if (end == s || *end != '\0' || v == 0)
+    return false;
+  *res = v;
+  return true;
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: sdch_eval [-e vcdiff|simd|optimal] [-g GROUP] [-t TYPE] "
+          "[-n COUNT]\n"
+          "                 [-j THREADS] -c CORPUS [-c CORPUS...] "
+          "DICTIONARY...\n");
+  exit(2);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options opt;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  opt.threads = cpus > 0 ? cpus : 1;
+
+  int c;
+  uint64_t n;
+  while ((c = getopt(argc, argv, "e:g:t:n:j:c:")) != -1) {
+    switch (c) {
+      case 'e':
+        if (strcmp(optarg, "vcdiff") == 0)
+          opt.encoder = sdch::ENCODER_VCDIFF;
+        else if (strcmp(optarg, "simd") == 0)
+          opt.encoder = sdch::ENCODER_SIMD;
+        else if (strcmp(optarg, "optimal") == 0)
+          opt.encoder = sdch::ENCODER_OPTIMAL;
+        else
+          usage();
+        break;
+      case 'g': opt.group = optarg; break;
+      case 't': opt.type = optarg; break;
+      case 'c': opt.corpus.push_back(optarg); break;
+      case 'n':
+        if (!parse_number(optarg, &opt.limit))
+          usage();
+        break;
+      case 'j':
+        if (!parse_number(optarg, &n))
+          usage();
+        opt.threads = n;
+        break;
+      default:
+        usage();
+    }
+  }
+  if (opt.corpus.empty() || optind == argc)
+    usage();
+
+  std::vector<sdch::Dictionary*> dicts;
+  for (int i = optind; i < argc; ++i) {
+    sdch::Dictionary* dict = new sdch::Dictionary;
+    if (!dict->load(argv[i])) {
+      fprintf(stderr, "sdch_eval: can't load dictionary %s\n", argv[i]);
+      return 1;
+    }
+    // Built on first use, which isn't thread safe.
+    if (opt.encoder == sdch::ENCODER_SIMD)
+      dict->vcdiff_index();
+    if (opt.encoder != sdch::ENCODER_VCDIFF)
+      dict->has_payload();
+    dicts.push_back(dict);
+  }
+
+  sdch::CorpusReader reader;
+  for (size_t i = 0; i < opt.corpus.size(); ++i) {
+    if (!reader.add(opt.corpus[i])) {
+      fprintf(stderr, "sdch_eval: %s\n", reader.error().c_str());
+      return 1;
+    }
+  }
+
+  Replay replay(opt, dicts);
+  std::vector<Sample> batch;
+  uint64_t seen = 0;
+  while (read_batch(&reader, opt, &seen, &batch))
+    replay_batch(&replay, batch);
+  if (!reader.error().empty()) {
+    fprintf(stderr, "sdch_eval: %s\n", reader.error().c_str());
+    return 1;
+  }
+  if (seen == 0) {
+    fprintf(stderr, "sdch_eval: no responses in corpus\n");
+    return 1;
+  }
+
+  for (size_t d = 0; d < dicts.size(); ++d) {
+    const sdch::Dictionary& dict = *dicts[d];
+    TypeMap types;
+    for (size_t t = 0; t < opt.threads; ++t) {
+      TypeMap& m = replay.results[t][d];
+      for (TypeMap::iterator i = m.begin(); i != m.end(); ++i)
+        types[i->first].add(i->second);
+    }
+    Acc all;
+    for (TypeMap::iterator i = types.begin(); i != types.end(); ++i)
+      all.add(i->second);
+
+    printf("%s: id %.8s, %zu bytes, index %zu bytes\n", argv[optind + d],
+           reinterpret_cast<const char*>(dict.client_id().data()),
+           dict.size(), dict.index_size());
+    printf("  %-30s %9s %12s %12s %6s %6s %6s %6s %6s %6s %8s\n",
+           "content type", "responses", "in", "out", "ratio", "p10", "p50",
+           "p90", "copy%", "dict%", "MB/s");
+    print_row("all", &all);
+    for (TypeMap::iterator i = types.begin(); i != types.end(); ++i)
+      print_row(i->first.empty() ? "-" : i->first, &i->second);
+    printf("\n");
+  }
+
+  for (size_t d = 0; d < dicts.size(); ++d)
+    delete dicts[d];
+  return 0;
+}